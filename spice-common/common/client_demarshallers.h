@@ -25,9 +25,14 @@ SPICE_BEGIN_DECLS
 typedef void (*message_destructor_t)(uint8_t *message);
 typedef uint8_t * (*spice_parse_channel_func_t)(uint8_t *message_start, uint8_t *message_end, uint16_t message_type, int minor,
 						size_t *size_out, message_destructor_t *free_message);
+/* parses the @view messages into @view, returns NULL if the message has
+ * no view parser, is invalid or doesn't fit in @view_size */
+typedef uint8_t * (*spice_parse_channel_view_func_t)(uint8_t *message_start, uint8_t *message_end, uint16_t message_type, int minor,
+						     uint8_t *view, size_t view_size);
 
 spice_parse_channel_func_t spice_get_server_channel_parser(uint32_t channel, unsigned int *max_message_type);
 spice_parse_channel_func_t spice_get_server_channel_parser1(uint32_t channel, unsigned int *max_message_type);
+spice_parse_channel_view_func_t spice_get_server_channel_view_parser(uint32_t channel);
 
 SPICE_END_DECLS
 
@@ -143,6 +143,7 @@ typedef void (*message_destructor_t)(uint8_t *message);
 typedef uint8_t * (*parse_func_t)(uint8_t *message_start, uint8_t *message_end, uint8_t *struct_data, PointerInfo *ptr_info, int minor);
 typedef uint8_t * (*parse_msg_func_t)(uint8_t *message_start, uint8_t *message_end, int minor, size_t *size_out, message_destructor_t *free_message);
 typedef uint8_t * (*spice_parse_channel_func_t)(uint8_t *message_start, uint8_t *message_end, uint16_t message_type, int minor, size_t *size_out, message_destructor_t *free_message);
+typedef uint8_t * (*spice_parse_channel_view_func_t)(uint8_t *message_start, uint8_t *message_end, uint16_t message_type, int minor, uint8_t *view, size_t view_size);
 
 struct PointerInfo {
     uint64_t offset;
@@ -7207,6 +7208,114 @@ static uint8_t * parse_PlaybackChannel_msg(uint8_t *message_start, uint8_t *mess
 }
 
 
+static uint8_t * view_msg_playback_data(uint8_t *message_start, uint8_t *message_end, SPICE_GNUC_UNUSED int minor, uint8_t *view, size_t view_size)
+{
+    SPICE_GNUC_UNUSED uint8_t *pos;
+    uint8_t *start = message_start;
+    uint8_t *data = NULL;
+    size_t nw_size;
+    size_t mem_size;
+    uint8_t *in, *end;
+    size_t data__nw_size;
+    uint32_t data__nelements;
+    SpiceMsgPlaybackPacket *out;
+
+    { /* data */
+        data__nelements = message_end - (start + 4);
+
+        data__nw_size = data__nelements;
+    }
+
+    nw_size = 4 + data__nw_size;
+    mem_size = sizeof(SpiceMsgPlaybackPacket);
+
+    /* Check if message fits in reported side */
+    if (start + nw_size > message_end) {
+        return NULL;
+    }
+
+    /* Validated extents and calculated size */
+    if (view_size < mem_size) {
+        return NULL;
+    }
+    data = view;
+    end = data + sizeof(SpiceMsgPlaybackPacket);
+    in = start;
+
+    out = (SpiceMsgPlaybackPacket *)data;
+
+    out->time = consume_uint32(&in);
+    /* use array as pointer */
+    out->data = (uint8_t *)in;
+    out->data_size = data__nelements;
+    in += data__nelements;
+
+    assert(in <= message_end);
+    assert(end <= data + mem_size);
+    return data;
+
+}
+
+static uint8_t * view_msg_playback_mode(uint8_t *message_start, uint8_t *message_end, SPICE_GNUC_UNUSED int minor, uint8_t *view, size_t view_size)
+{
+    SPICE_GNUC_UNUSED uint8_t *pos;
+    uint8_t *start = message_start;
+    uint8_t *data = NULL;
+    size_t nw_size;
+    size_t mem_size;
+    uint8_t *in, *end;
+    size_t data__nw_size;
+    uint32_t data__nelements;
+    SpiceMsgPlaybackMode *out;
+
+    { /* data */
+        data__nelements = message_end - (start + 6);
+
+        data__nw_size = data__nelements;
+    }
+
+    nw_size = 6 + data__nw_size;
+    mem_size = sizeof(SpiceMsgPlaybackMode);
+
+    /* Check if message fits in reported side */
+    if (start + nw_size > message_end) {
+        return NULL;
+    }
+
+    /* Validated extents and calculated size */
+    if (view_size < mem_size) {
+        return NULL;
+    }
+    data = view;
+    end = data + sizeof(SpiceMsgPlaybackMode);
+    in = start;
+
+    out = (SpiceMsgPlaybackMode *)data;
+
+    out->time = consume_uint32(&in);
+    out->mode = consume_uint16(&in);
+    /* use array as pointer */
+    out->data = (uint8_t *)in;
+    out->data_size = data__nelements;
+    in += data__nelements;
+
+    assert(in <= message_end);
+    assert(end <= data + mem_size);
+    return data;
+
+}
+
+static uint8_t * view_PlaybackChannel_msg(uint8_t *message_start, uint8_t *message_end, uint16_t message_type, SPICE_GNUC_UNUSED int minor, uint8_t *view, size_t view_size)
+{
+    if (message_type == 101) {
+        return view_msg_playback_data(message_start, message_end, minor, view, view_size);
+    } else if (message_type == 102) {
+        return view_msg_playback_mode(message_start, message_end, minor, view, view_size);
+    }
+    return NULL;
+}
+
+
 
 static uint8_t * parse_msg_record_start(uint8_t *message_start, uint8_t *message_end, SPICE_GNUC_UNUSED int minor, size_t *size, message_destructor_t *free_message)
 {
@@ -7893,6 +8002,88 @@ static uint8_t * parse_UsbredirChannel_msg(uint8_t *message_start, uint8_t *mess
 }
 
 
+static uint8_t * view_SpiceMsgCompressedData(uint8_t *message_start, uint8_t *message_end, SPICE_GNUC_UNUSED int minor, uint8_t *view, size_t view_size)
+{
+    SPICE_GNUC_UNUSED uint8_t *pos;
+    uint8_t *start = message_start;
+    uint8_t *data = NULL;
+    size_t nw_size;
+    size_t mem_size;
+    uint8_t *in, *end;
+    size_t u__nw_size;
+    uint8_t type__value;
+    size_t compressed_data__nw_size;
+    uint32_t compressed_data__nelements;
+    SpiceMsgCompressedData *out;
+
+    { /* u */
+        pos = start + 0;
+        if (SPICE_UNLIKELY(pos + 1 > message_end)) {
+            goto error;
+        }
+        type__value = read_uint8(pos);
+        if (type__value == SPICE_DATA_COMPRESSION_TYPE_NONE) {
+            SPICE_GNUC_UNUSED uint8_t *start2 = (start + 1);
+            u__nw_size = 0;
+        } else if (1) {
+            u__nw_size = 4;
+        } else {
+            u__nw_size = 0;
+        }
+
+    }
+
+    { /* compressed_data */
+        compressed_data__nelements = message_end - (start + 1 + u__nw_size);
+
+        compressed_data__nw_size = compressed_data__nelements;
+    }
+
+    nw_size = 1 + u__nw_size + compressed_data__nw_size;
+    mem_size = sizeof(SpiceMsgCompressedData);
+
+    /* Check if message fits in reported side */
+    if (start + nw_size > message_end) {
+        return NULL;
+    }
+
+    /* Validated extents and calculated size */
+    if (view_size < mem_size) {
+        return NULL;
+    }
+    data = view;
+    end = data + sizeof(SpiceMsgCompressedData);
+    in = start;
+
+    out = (SpiceMsgCompressedData *)data;
+
+    out->type = consume_uint8(&in);
+    if (out->type == SPICE_DATA_COMPRESSION_TYPE_NONE) {
+    } else if (1) {
+        out->uncompressed_size = consume_uint32(&in);
+    }
+    /* use array as pointer */
+    out->compressed_data = (uint8_t *)in;
+    out->compressed_size = compressed_data__nelements;
+    in += compressed_data__nelements;
+
+    assert(in <= message_end);
+    assert(end <= data + mem_size);
+    return data;
+
+   error:
+    return NULL;
+}
+
+static uint8_t * view_UsbredirChannel_msg(uint8_t *message_start, uint8_t *message_end, uint16_t message_type, SPICE_GNUC_UNUSED int minor, uint8_t *view, size_t view_size)
+{
+    if (message_type == 102) {
+        return view_SpiceMsgCompressedData(message_start, message_end, minor, view, view_size);
+    }
+    return NULL;
+}
+
+
 
 static uint8_t * parse_msg_port_init(uint8_t *message_start, uint8_t *message_end, SPICE_GNUC_UNUSED int minor, size_t *size, message_destructor_t *free_message)
 {
@@ -8068,6 +8259,15 @@ static uint8_t * parse_PortChannel_msg(uint8_t *message_start, uint8_t *message_
 }
 
 
+static uint8_t * view_PortChannel_msg(uint8_t *message_start, uint8_t *message_end, uint16_t message_type, SPICE_GNUC_UNUSED int minor, uint8_t *view, size_t view_size)
+{
+    if (message_type == 102) {
+        return view_SpiceMsgCompressedData(message_start, message_end, minor, view, view_size);
+    }
+    return NULL;
+}
+
+
 
 static uint8_t * parse_WebDAVChannel_msg(uint8_t *message_start, uint8_t *message_end, uint16_t message_type, SPICE_GNUC_UNUSED int minor, size_t *size_out, message_destructor_t *free_message)
 {
@@ -8100,6 +8300,15 @@ static uint8_t * parse_WebDAVChannel_msg(uint8_t *message_start, uint8_t *messag
     return NULL;
 }
 
+
+static uint8_t * view_WebDAVChannel_msg(uint8_t *message_start, uint8_t *message_end, uint16_t message_type, SPICE_GNUC_UNUSED int minor, uint8_t *view, size_t view_size)
+{
+    if (message_type == 102) {
+        return view_SpiceMsgCompressedData(message_start, message_end, minor, view, view_size);
+    }
+    return NULL;
+}
+
 spice_parse_channel_func_t spice_get_server_channel_parser(uint32_t channel, unsigned int *max_message_type)
 {
     static struct {spice_parse_channel_func_t func; unsigned int max_messages; } channels[12] =  {
@@ -8138,3 +8347,25 @@ uint8_t * spice_parse_msg(uint8_t *message_start, uint8_t *message_end, uint32_t
     }
     return NULL;
 }
+
+spice_parse_channel_view_func_t spice_get_server_channel_view_parser(uint32_t channel)
+{
+    static spice_parse_channel_view_func_t channels[12] =  {
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        view_PlaybackChannel_msg,
+        NULL,
+        NULL,
+        NULL,
+        view_UsbredirChannel_msg,
+        view_PortChannel_msg,
+        view_WebDAVChannel_msg
+    };
+    if (channel < 12) {
+        return channels[channel];
+    }
+    return NULL;
+}
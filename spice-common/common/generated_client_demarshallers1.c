@@ -143,6 +143,7 @@ typedef void (*message_destructor_t)(uint8_t *message);
 typedef uint8_t * (*parse_func_t)(uint8_t *message_start, uint8_t *message_end, uint8_t *struct_data, PointerInfo *ptr_info, int minor);
 typedef uint8_t * (*parse_msg_func_t)(uint8_t *message_start, uint8_t *message_end, int minor, size_t *size_out, message_destructor_t *free_message);
 typedef uint8_t * (*spice_parse_channel_func_t)(uint8_t *message_start, uint8_t *message_end, uint16_t message_type, int minor, size_t *size_out, message_destructor_t *free_message);
+typedef uint8_t * (*spice_parse_channel_view_func_t)(uint8_t *message_start, uint8_t *message_end, uint16_t message_type, int minor, uint8_t *view, size_t view_size);
 
 struct PointerInfo {
     uint64_t offset;
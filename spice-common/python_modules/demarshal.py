@@ -82,6 +82,7 @@ def write_parser_helpers(writer):
     writer.statement("typedef uint8_t * (*parse_func_t)(uint8_t *message_start, uint8_t *message_end, uint8_t *struct_data, PointerInfo *ptr_info, int minor)")
     writer.statement("typedef uint8_t * (*parse_msg_func_t)(uint8_t *message_start, uint8_t *message_end, int minor, size_t *size_out, message_destructor_t *free_message)")
     writer.statement("typedef uint8_t * (*spice_parse_channel_func_t)(uint8_t *message_start, uint8_t *message_end, uint16_t message_type, int minor, size_t *size_out, message_destructor_t *free_message)")
+    writer.statement("typedef uint8_t * (*spice_parse_channel_view_func_t)(uint8_t *message_start, uint8_t *message_end, uint16_t message_type, int minor, uint8_t *view, size_t view_size)")
 
     writer.newline()
     writer.begin_block("struct PointerInfo")
@@ -1018,15 +1019,29 @@ def write_nofree(writer):
     scope = writer.function("nofree", "static void", "SPICE_GNUC_UNUSED uint8_t *data")
     writer.end_block()
 
-def write_msg_parser(writer, message):
+def check_view_message(message):
+    if message.has_attr("nocopy"):
+        raise Exception("@view and @nocopy are exclusive in message %s" % message.name)
+    if message.get_num_pointers() != 0:
+        raise Exception("@view message %s has pointers" % message.name)
+    for m in message.members:
+        if m.has_attr("end") or m.has_attr("to_ptr") or m.has_attr("chunk"):
+            raise Exception("@view message %s needs extra memory for %s" % (message.name, m.name))
+
+def write_msg_parser(writer, message, view=False):
     msg_name = message.c_name()
-    function_name = "parse_%s" % msg_name
+    if view:
+        function_name = "view_%s" % msg_name
+    else:
+        function_name = "parse_%s" % msg_name
     if writer.is_generated("demarshaller", function_name):
         return function_name
     writer.set_is_generated("demarshaller", function_name)
 
     msg_type = message.c_type()
     msg_sizeof = message.sizeof()
+    if view:
+        check_view_message(message)
 
     want_mem_size = (len(message.members) != 1 or message.members[0].is_fixed_nw_size()
                          or not message.members[0].is_array())
@@ -1034,9 +1049,11 @@ def write_msg_parser(writer, message):
     writer.newline()
     if message.has_attr("ifdef"):
         writer.ifdef(message.attributes["ifdef"][0])
-    parent_scope = writer.function(function_name,
-                                   "uint8_t *",
-                                   "uint8_t *message_start, uint8_t *message_end, SPICE_GNUC_UNUSED int minor, size_t *size, message_destructor_t *free_message", True)
+    if view:
+        args = "uint8_t *message_start, uint8_t *message_end, SPICE_GNUC_UNUSED int minor, uint8_t *view, size_t view_size"
+    else:
+        args = "uint8_t *message_start, uint8_t *message_end, SPICE_GNUC_UNUSED int minor, size_t *size, message_destructor_t *free_message"
+    parent_scope = writer.function(function_name, "uint8_t *", args, True)
     parent_scope.variable_def("SPICE_GNUC_UNUSED uint8_t *", "pos")
     parent_scope.variable_def("uint8_t *", "start = message_start")
     parent_scope.variable_def("uint8_t *", "data = NULL")
@@ -1071,8 +1088,13 @@ def write_msg_parser(writer, message):
         writer.assign("*size", "message_end - message_start")
         writer.assign("*free_message", "nofree")
     else:
-        writer.assign("data", "(uint8_t *)malloc(mem_size)")
-        writer.error_check("data == NULL")
+        if view:
+            with writer.block("if (view_size < mem_size)"):
+                writer.statement("return NULL")
+            writer.assign("data", "view")
+        else:
+            writer.assign("data", "(uint8_t *)malloc(mem_size)")
+            writer.error_check("data == NULL")
         writer.assign("end", "data + %s" % (msg_sizeof))
         writer.assign("in", "start").newline()
 
@@ -1090,15 +1112,17 @@ def write_msg_parser(writer, message):
 
         writer.statement("assert(end <= data + mem_size)")
 
-        writer.newline()
-        writer.assign("*size", "end - data")
-        writer.assign("*free_message", "(message_destructor_t) free")
+        if not view:
+            writer.newline()
+            writer.assign("*size", "end - data")
+            writer.assign("*free_message", "(message_destructor_t) free")
 
     writer.statement("return data")
     writer.newline()
     if writer.has_error_check:
         writer.label("error")
-        writer.statement("free(data)")
+        if not view:
+            writer.statement("free(data)")
         writer.statement("return NULL")
     writer.end_block()
 
@@ -1169,6 +1193,74 @@ def write_channel_parser(writer, channel, server):
 
     return function_name
 
+def write_channel_view_parser(writer, channel):
+    messages = [m for m in channel.server_messages if m.message_type.has_attr("view")]
+    if len(messages) == 0:
+        return None
+
+    function_name = "view_%s_msg" % channel.name
+    writer.newline()
+    if channel.has_attr("ifdef"):
+        writer.ifdef(channel.attributes["ifdef"][0])
+    scope = writer.function(function_name,
+                            "static uint8_t *",
+                            "uint8_t *message_start, uint8_t *message_end, uint16_t message_type, SPICE_GNUC_UNUSED int minor, uint8_t *view, size_t view_size")
+
+    helpers = writer.function_helper()
+
+    first = True
+    for m in messages:
+        func = write_msg_parser(helpers, m.message_type, view=True)
+        with writer.if_block("message_type == %d" % m.value, not first, False):
+            writer.statement("return %s(message_start, message_end, minor, view, view_size)" % func)
+        first = False
+    writer.newline()
+
+    writer.statement("return NULL")
+    writer.end_block()
+    if channel.has_attr("ifdef"):
+        writer.endif(channel.attributes["ifdef"][0])
+
+    return function_name
+
+def write_get_channel_view_parser(writer, view_parsers, max_channel):
+    writer.newline()
+    function_name = "spice_get_server_channel_view_parser" + writer.public_prefix
+
+    scope = writer.function(function_name,
+                            "spice_parse_channel_view_func_t",
+                            "uint32_t channel")
+
+    writer.write("static spice_parse_channel_view_func_t channels[%d] = " % (max_channel+1))
+    writer.begin_block()
+    for i in range(0, max_channel + 1):
+        channel = None
+        if i in view_parsers:
+            channel = view_parsers[i][0]
+            if channel.has_attr("ifdef"):
+                writer.ifdef(channel.attributes["ifdef"][0])
+            writer.write(view_parsers[i][1])
+        else:
+            writer.write("NULL")
+
+        if i != max_channel:
+            writer.write(",")
+        writer.newline()
+        if channel and channel.has_attr("ifdef"):
+            writer.ifdef_else(channel.attributes["ifdef"][0])
+            writer.write("NULL")
+            if i != max_channel:
+                writer.write(",")
+            writer.newline()
+            writer.endif(channel.attributes["ifdef"][0])
+    writer.end_block(semicolon = True)
+
+    with writer.if_block("channel < %d" % (max_channel + 1)):
+        writer.statement("return channels[channel]")
+
+    writer.statement("return NULL")
+    writer.end_block()
+
 def write_get_channel_parser(writer, channel_parsers, max_channel, is_server):
     writer.newline()
     if is_server:
@@ -1251,13 +1343,21 @@ def write_protocol_parser(writer, proto, is_server):
     max_channel = 0
     parsers = {}
 
+    view_parsers = {}
+
     for channel in proto.channels:
         max_channel = max(max_channel, channel.value)
 
         parsers[channel.value] = (channel.channel_type, write_channel_parser(writer, channel.channel_type, is_server))
+        if is_server:
+            view_parser = write_channel_view_parser(writer, channel.channel_type)
+            if view_parser is not None:
+                view_parsers[channel.value] = (channel.channel_type, view_parser)
 
     write_get_channel_parser(writer, parsers, max_channel, is_server)
     write_full_protocol_parser(writer, is_server)
+    if len(view_parsers) > 0:
+        write_get_channel_view_parser(writer, view_parsers, max_channel)
 
 def write_includes(writer):
     writer.writeln("#include <string.h>")
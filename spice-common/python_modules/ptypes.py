@@ -74,6 +74,9 @@ valid_attributes=set([
     'prefix',
     # used in demarshaller to use directly data from message without a copy
     'nocopy',
+    # the demarshaller also gets a view parser for this message, filling a
+    # caller provided structure instead of allocating one
+    'view',
     # store member array in a pointer
     # similar to to_ptr but has an additional argument which is the name of a C
     # field which will store the array length
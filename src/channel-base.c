@@ -34,7 +34,7 @@ spice_channel_handle_set_ack(SpiceChannel *channel, SpiceMsgIn *in)
         .generation = ack->generation,
     };
 
-    c->message_ack_window = c->message_ack_count = ack->window;
+    spice_channel_set_ack_window(channel, ack->window);
     c->marshallers->msgc_ack_sync(out->marshaller, &sync);
     spice_msg_out_send_internal(out);
 }
@@ -237,6 +237,15 @@ void spice_channel_set_handlers(SpiceChannelClass *klass,
     set_handlers(klass->priv, handlers, n);
 }
 
+G_GNUC_INTERNAL
+void spice_channel_set_link_capabilities(SpiceChannelClass *klass,
+                                         void (*link_capabilities)(SpiceChannel *channel))
+{
+    g_return_if_fail(klass->priv != NULL);
+
+    klass->priv->link_capabilities = link_capabilities;
+}
+
 static void
 vmc_write_free_cb(uint8_t *data, void *user_data)
 {
@@ -259,6 +268,12 @@ void spice_vmc_write_async(SpiceChannel *self,
     GTask *task;
 
     task = g_task_new(self, cancellable, callback, user_data);
+    if (count == 0) {
+        /* the marshaller would drop the buffer without telling */
+        g_task_return_int(task, 0);
+        g_object_unref(task);
+        return;
+    }
     g_task_set_task_data(task, GSIZE_TO_POINTER(count), NULL);
 
     msg = spice_msg_out_new(SPICE_CHANNEL(self), SPICE_MSGC_SPICEVMC_DATA);
@@ -108,6 +108,7 @@ static void clear_streams(SpiceChannel *channel);
 static display_surface *find_surface(SpiceDisplayChannelPrivate *c, guint32 surface_id);
 static void spice_display_channel_reset(SpiceChannel *channel, gboolean migrating);
 static void spice_display_channel_reset_capabilities(SpiceChannel *channel);
+static void spice_display_channel_link_capabilities(SpiceChannel *channel);
 static void destroy_canvas(display_surface *surface);
 static void destroy_display_stream(display_stream *st, int id);
 static void display_session_mm_time_reset_cb(SpiceSession *session, gpointer data);
@@ -763,8 +764,6 @@ static HDC create_compatible_dc(void)
 
 static void spice_display_channel_reset_capabilities(SpiceChannel *channel)
 {
-    guint i;
-
     spice_channel_set_capability(SPICE_CHANNEL(channel), SPICE_DISPLAY_CAP_SIZED_STREAM);
     spice_channel_set_capability(SPICE_CHANNEL(channel), SPICE_DISPLAY_CAP_MONITORS_CONFIG);
     spice_channel_set_capability(SPICE_CHANNEL(channel), SPICE_DISPLAY_CAP_COMPOSITE);
@@ -782,6 +781,14 @@ static void spice_display_channel_reset_capabilities(SpiceChannel *channel)
 #ifdef HAVE_BUILTIN_MJPEG
     spice_channel_set_capability(SPICE_CHANNEL(channel), SPICE_DISPLAY_CAP_CODEC_MJPEG);
 #endif
+}
+
+/* Probing the codecs initializes GStreamer, so it is left until the
+ * channel connects rather than done for every display channel created */
+static void spice_display_channel_link_capabilities(SpiceChannel *channel)
+{
+    guint i;
+
     for (i = 1; i < G_N_ELEMENTS(gst_opts); i++) {
         if (gstvideo_has_codec(i)) {
             spice_channel_set_capability(SPICE_CHANNEL(channel), gst_opts[i].cap);
@@ -1955,4 +1962,5 @@ static void channel_set_handlers(SpiceChannelClass *klass)
     };
 
     spice_channel_set_handlers(klass, handlers, G_N_ELEMENTS(handlers));
+    spice_channel_set_link_capabilities(klass, spice_display_channel_link_capabilities);
 }
@@ -0,0 +1,40 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_CLIENT_MAIN_CHANNEL_PRIV_H__
+#define __SPICE_CLIENT_MAIN_CHANNEL_PRIV_H__
+
+void spice_main_channel_sync_audio(SpiceMainChannel *channel);
+
+void spice_main_channel_handle_agent_data_msg(SpiceChannel *channel, SpiceMsgIn *in,
+                                              int *msg_size, guchar **msg_pos);
+guint64 spice_main_channel_get_agent_msg_copied(SpiceMainChannel *channel);
+
+/* The payload of an agent message from SPICE_MSG_MAIN_AGENT_DATA messages:
+ * a payload in one fragment is kept by reference, one spread over several
+ * is copied as it arrives into a buffer reused from message to message. */
+typedef struct _SpiceAgentMsgReassembly SpiceAgentMsgReassembly;
+
+SpiceAgentMsgReassembly *spice_agent_msg_reassembly_new(GDestroyNotify release);
+void spice_agent_msg_reassembly_free(SpiceAgentMsgReassembly *reassembly);
+void spice_agent_msg_reassembly_add(SpiceAgentMsgReassembly *reassembly,
+                                    guint8 *data, gsize size, gsize total,
+                                    gpointer owner);
+guint8 *spice_agent_msg_reassembly_finish(SpiceAgentMsgReassembly *reassembly);
+void spice_agent_msg_reassembly_clear(SpiceAgentMsgReassembly *reassembly);
+guint64 spice_agent_msg_reassembly_get_copied(SpiceAgentMsgReassembly *reassembly);
+#endif
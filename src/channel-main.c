@@ -27,10 +27,12 @@
 #include "spice-marshal.h"
 
 #include "spice-util-priv.h"
+#include "spice-log-priv.h"
 #include "spice-channel-priv.h"
 #include "spice-session-priv.h"
 #include "spice-audio-priv.h"
 #include "spice-file-transfer-task-priv.h"
+#include "channel-main-priv.h"
 
 /**
  * SECTION:channel-main
@@ -85,6 +87,14 @@ typedef struct {
     } stats;
 } FileTransferOperation;
 
+/* how the payload of the incoming agent message is dealt with */
+typedef enum {
+    AGENT_MSG_BUFFER,    /* reassembled in agent_msg_reassembly */
+    AGENT_MSG_CLIPBOARD, /* the same, until the clipboard header is read */
+    AGENT_MSG_STREAM,    /* clipboard data handed out as it arrives */
+    AGENT_MSG_DISCARD,   /* clipboard data over max-clipboard */
+} AgentMsgMode;
+
 struct _SpiceMainChannelPrivate  {
     enum SpiceMouseMode         mouse_mode;
     enum SpiceMouseMode         requested_mouse_mode;
@@ -101,13 +111,19 @@ struct _SpiceMainChannelPrivate  {
 
     int                         agent_tokens;
     VDAgentMessage              agent_msg; /* partial msg reconstruction */
-    guint8                      *agent_msg_data;
+    SpiceAgentMsgReassembly     *agent_msg_reassembly;
     guint                       agent_msg_pos;
     uint8_t                     agent_msg_size;
+    AgentMsgMode                agent_msg_mode;
+    guint8                      clipboard_in_header[4 + sizeof(VDAgentClipboard)];
+    guint                       clipboard_in_header_size;
+    guint8                      clipboard_in_stream; /* selections to stream, one bit each */
     uint32_t                    agent_caps[VD_AGENT_CAPS_SIZE];
     SpiceDisplayConfig          display[MAX_DISPLAY];
     gint                        timer_id;
     GQueue                      *agent_msg_queue;
+    GQueue                      agent_msg_deferred; /* held back during clipboard_stream */
+    GTask                       *clipboard_stream;
     GHashTable                  *file_xfer_tasks;
     GHashTable                  *flushing;
 
@@ -165,6 +181,7 @@ enum {
     SPICE_MAIN_CLIPBOARD_SELECTION_GRAB,
     SPICE_MAIN_CLIPBOARD_SELECTION_REQUEST,
     SPICE_MAIN_CLIPBOARD_SELECTION_RELEASE,
+    SPICE_MAIN_CLIPBOARD_SELECTION_DATA,
     SPICE_MIGRATION_STARTED,
     SPICE_MAIN_NEW_FILE_TRANSFER,
     SPICE_MAIN_LAST_SIGNAL,
@@ -186,6 +203,7 @@ static void file_xfer_read_async_cb(GObject *source_object,
                                     gpointer user_data);
 static void spice_main_set_max_clipboard(SpiceMainChannel *self, gint max);
 static void set_agent_connected(SpiceMainChannel *channel, gboolean connected);
+static void clipboard_stream_abort(SpiceMainChannel *channel);
 
 static void file_transfer_operation_free(FileTransferOperation *xfer_op);
 static void spice_main_channel_reset_all_xfer_operations(SpiceMainChannel *channel);
@@ -255,6 +273,8 @@ static void spice_main_channel_init(SpiceMainChannel *channel)
 
     c = channel->priv = SPICE_MAIN_CHANNEL_GET_PRIVATE(channel);
     c->agent_msg_queue = g_queue_new();
+    g_queue_init(&c->agent_msg_deferred);
+    c->agent_msg_reassembly = spice_agent_msg_reassembly_new((GDestroyNotify)spice_msg_in_unref);
     c->file_xfer_tasks = g_hash_table_new(g_direct_hash, g_direct_equal);
     c->flushing = g_hash_table_new(g_direct_hash, g_direct_equal);
     c->cancellable_volume_info = g_cancellable_new();
@@ -388,7 +408,7 @@ static void spice_main_channel_finalize(GObject *obj)
 {
     SpiceMainChannelPrivate *c = SPICE_MAIN_CHANNEL(obj)->priv;
 
-    g_free(c->agent_msg_data);
+    spice_agent_msg_reassembly_free(c->agent_msg_reassembly);
     agent_free_msg_queue(SPICE_MAIN_CHANNEL(obj));
 
     if (G_OBJECT_CLASS(spice_main_channel_parent_class)->finalize)
@@ -413,8 +433,10 @@ static void spice_main_channel_reset_agent(SpiceMainChannel *channel)
     c->agent_caps_received = FALSE;
     c->agent_display_config_sent = FALSE;
     c->agent_msg_pos = 0;
-    g_clear_pointer(&c->agent_msg_data, g_free);
+    spice_agent_msg_reassembly_clear(c->agent_msg_reassembly);
     c->agent_msg_size = 0;
+    c->agent_msg_mode = AGENT_MSG_BUFFER;
+    c->clipboard_in_stream = 0;
 
     spice_main_channel_reset_all_xfer_operations(channel);
     file_xfer_flushed(channel, FALSE);
@@ -432,6 +454,7 @@ static void spice_main_channel_reset(SpiceChannel *channel, gboolean migrating)
     c->agent_tokens = 0;
     agent_free_msg_queue(SPICE_MAIN_CHANNEL(channel));
     c->agent_msg_queue = g_queue_new();
+    clipboard_stream_abort(SPICE_MAIN_CHANNEL(channel));
 
     c->agent_volume_playback_sync = FALSE;
     c->agent_volume_record_sync = FALSE;
@@ -586,6 +609,10 @@ static void spice_main_channel_class_init(SpiceMainChannelClass *klass)
      * Maximum size of clipboard operations in bytes (default 100MB,
      * -1 for unlimited size);
      *
+     * Guest clipboard data over it is discarded, the requester gets an
+     * empty clipboard instead, unless it was requested with
+     * spice_main_clipboard_selection_request_stream().
+     *
      * Since: 0.22
      **/
     g_object_class_install_property
@@ -807,6 +834,39 @@ static void spice_main_channel_class_init(SpiceMainChannelClass *klass)
                      1,
                      G_TYPE_UINT);
 
+    /**
+     * SpiceMainChannel::main-clipboard-selection-data:
+     * @main: the #SpiceMainChannel that emitted the signal
+     * @selection: a VD_AGENT_CLIPBOARD_SELECTION clipboard
+     * @type: the VD_AGENT_CLIPBOARD data type
+     * @data: a chunk of the clipboard data
+     * @size: size of @data in bytes
+     * @offset: position of @data in the clipboard data
+     * @total: size of the whole clipboard data in bytes
+     *
+     * Provides the guest clipboard data requested with
+     * spice_main_clipboard_selection_request_stream() piece by piece as
+     * it arrives, so that it never has to be held whole in memory. The
+     * channel doesn't read any further until the handlers return. The
+     * last chunk is the one for which @offset + @size equals @total.
+     *
+     * #SpiceMainChannel::main-clipboard-selection is not emitted for
+     * these requests, and #SpiceMainChannel:max-clipboard doesn't apply.
+     *
+     * Since: 0.35
+     **/
+    signals[SPICE_MAIN_CLIPBOARD_SELECTION_DATA] =
+        g_signal_new("main-clipboard-selection-data",
+                     G_OBJECT_CLASS_TYPE(gobject_class),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     g_cclosure_user_marshal_VOID__UINT_UINT_POINTER_UINT_UINT_UINT,
+                     G_TYPE_NONE,
+                     6,
+                     G_TYPE_UINT, G_TYPE_UINT, G_TYPE_POINTER,
+                     G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT);
+
     /**
      * SpiceMainChannel::migration-started:
      * @main: the #SpiceMainChannel that emitted the signal
@@ -817,6 +877,14 @@ static void spice_main_channel_class_init(SpiceMainChannelClass *klass)
      * to @TRUE, then follow #SpiceSession::channel-new creation, and
      * use spice_channel_open_fd() once the socket is created.
      *
+     * If the session was itself opened with client provided sockets,
+     * @session inherits #SpiceSession:client-sockets: the application
+     * must then connect to #SpiceChannel::open-fd on the channels of
+     * @session and connect them to the destination
+     * #SpiceSession:host and #SpiceSession:port, otherwise the
+     * migration is cancelled and the server falls back to switching
+     * host.
+     *
      **/
     signals[SPICE_MIGRATION_STARTED] =
         g_signal_new("migration-started",
@@ -870,6 +938,10 @@ static void agent_free_msg_queue(SpiceMainChannel *channel)
         out = g_queue_pop_head(c->agent_msg_queue);
         spice_msg_out_unref(out);
     }
+    while (!g_queue_is_empty(&c->agent_msg_deferred)) {
+        out = g_queue_pop_head(&c->agent_msg_deferred);
+        spice_msg_out_unref(out);
+    }
 
     g_clear_pointer(&c->agent_msg_queue, g_queue_free);
 }
@@ -907,7 +979,7 @@ static void file_xfer_flush_async(SpiceFileTransferTask *xfer_task,
                       user_data);
 
     c = channel->priv;
-    was_empty = g_queue_is_empty(c->agent_msg_queue);
+    was_empty = g_queue_is_empty(c->agent_msg_queue) && g_queue_is_empty(&c->agent_msg_deferred);
     if (was_empty) {
         g_task_return_boolean(task, TRUE);
         g_object_unref(task);
@@ -915,7 +987,11 @@ static void file_xfer_flush_async(SpiceFileTransferTask *xfer_task,
     }
 
     /* wait until the last message currently in the queue has been sent */
-    g_hash_table_insert(c->flushing, g_queue_peek_tail(c->agent_msg_queue), task);
+    g_hash_table_insert(c->flushing,
+                        g_queue_is_empty(&c->agent_msg_deferred) ?
+                        g_queue_peek_tail(c->agent_msg_queue) :
+                        g_queue_peek_tail(&c->agent_msg_deferred),
+                        task);
 }
 
 static gboolean file_xfer_flush_finish(SpiceFileTransferTask *xfer_task,
@@ -951,12 +1027,77 @@ static void agent_send_msg_queue(SpiceMainChannel *channel)
         }
     }
     if (g_queue_is_empty(c->agent_msg_queue) &&
+        g_queue_is_empty(&c->agent_msg_deferred) &&
         g_hash_table_size(c->flushing) != 0) {
         g_warning("unexpected flush task in list, clearing");
         file_xfer_flushed(channel, TRUE);
     }
 }
 
+/* An agent message cut into SPICE_MSGC_MAIN_AGENT_DATA messages of at most
+ * VD_AGENT_MAX_DATA_SIZE as its payload is appended */
+typedef struct AgentMsgWriter {
+    GQueue *queue;
+    SpiceMsgOut *out;
+    guint8 *payload;
+    gsize paysize;
+    gsize remaining; /* payload bytes still to be appended */
+} AgentMsgWriter;
+
+static void agent_msg_writer_begin(SpiceMainChannel *channel, AgentMsgWriter *w,
+                                   GQueue *queue, int type, gsize size)
+{
+    VDAgentMessage msg;
+
+    G_STATIC_ASSERT(VD_AGENT_MAX_DATA_SIZE > sizeof(VDAgentMessage));
+
+    msg.protocol = VD_AGENT_PROTOCOL;
+    msg.type = type;
+    msg.opaque = 0;
+    msg.size = size;
+
+    w->queue = queue;
+    w->remaining = size;
+    w->paysize = MIN(VD_AGENT_MAX_DATA_SIZE, size + sizeof(VDAgentMessage));
+    w->out = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_MAIN_AGENT_DATA);
+    w->payload = spice_marshaller_reserve_space(w->out->marshaller, w->paysize);
+    memcpy(w->payload, &msg, sizeof(VDAgentMessage));
+    w->payload += sizeof(VDAgentMessage);
+    w->paysize -= sizeof(VDAgentMessage);
+    if (w->paysize == 0) {
+        g_queue_push_tail(w->queue, w->out);
+        w->out = NULL;
+    }
+}
+
+static void agent_msg_writer_append(SpiceMainChannel *channel, AgentMsgWriter *w,
+                                    const void *data, gsize size)
+{
+    const guint8 *d = data;
+    gsize mins;
+
+    g_return_if_fail(size <= w->remaining);
+
+    while (size > 0) {
+        if (w->out == NULL) {
+            w->paysize = MIN(VD_AGENT_MAX_DATA_SIZE, w->remaining);
+            w->out = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_MAIN_AGENT_DATA);
+            w->payload = spice_marshaller_reserve_space(w->out->marshaller, w->paysize);
+        }
+        mins = MIN(w->paysize, size);
+        memcpy(w->payload, d, mins);
+        d += mins;
+        w->payload += mins;
+        w->paysize -= mins;
+        w->remaining -= mins;
+        size -= mins;
+        if (w->paysize == 0) {
+            g_queue_push_tail(w->queue, w->out);
+            w->out = NULL;
+        }
+    }
+}
+
 /* any context: the message is not flushed immediately,
    you can wakeup() the channel coroutine or send_msg_queue()
 
@@ -964,66 +1105,36 @@ static void agent_send_msg_queue(SpiceMainChannel *channel)
    agent_msg_queue_many(main, VD_AGENT_...,
                         &foo, sizeof(Foo),
                         data, data_size, NULL);
+
+   while a clipboard is streamed to the agent, the message waits for the
+   end of it, the agent can't tell fragments of interleaved messages apart
 */
 G_GNUC_NULL_TERMINATED
 static void agent_msg_queue_many(SpiceMainChannel *channel, int type, const void *data, ...)
 {
     va_list args;
     SpiceMainChannelPrivate *c = channel->priv;
-    SpiceMsgOut *out;
-    VDAgentMessage msg;
-    guint8 *payload;
-    gsize paysize, s, mins, size = 0;
+    AgentMsgWriter w;
+    gsize s, size = 0;
     const guint8 *d;
 
-    G_STATIC_ASSERT(VD_AGENT_MAX_DATA_SIZE > sizeof(VDAgentMessage));
-
     va_start(args, data);
     for (d = data; d != NULL; d = va_arg(args, void*)) {
         size += va_arg(args, gsize);
     }
     va_end(args);
 
-    msg.protocol = VD_AGENT_PROTOCOL;
-    msg.type = type;
-    msg.opaque = 0;
-    msg.size = size;
-
-    paysize = MIN(VD_AGENT_MAX_DATA_SIZE, size + sizeof(VDAgentMessage));
-    out = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_MAIN_AGENT_DATA);
-    payload = spice_marshaller_reserve_space(out->marshaller, paysize);
-    memcpy(payload, &msg, sizeof(VDAgentMessage));
-    payload += sizeof(VDAgentMessage);
-    paysize -= sizeof(VDAgentMessage);
-    if (paysize == 0) {
-        g_queue_push_tail(c->agent_msg_queue, out);
-        out = NULL;
-    }
+    agent_msg_writer_begin(channel, &w,
+                           c->clipboard_stream ? &c->agent_msg_deferred : c->agent_msg_queue,
+                           type, size);
 
     va_start(args, data);
-    for (d = data; size > 0; d = va_arg(args, void*)) {
+    for (d = data; d != NULL; d = va_arg(args, void*)) {
         s = va_arg(args, gsize);
-        while (s > 0) {
-            if (out == NULL) {
-                paysize = MIN(VD_AGENT_MAX_DATA_SIZE, size);
-                out = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_MAIN_AGENT_DATA);
-                payload = spice_marshaller_reserve_space(out->marshaller, paysize);
-            }
-            mins = MIN(paysize, s);
-            memcpy(payload, d, mins);
-            d += mins;
-            payload += mins;
-            s -= mins;
-            size -= mins;
-            paysize -= mins;
-            if (paysize == 0) {
-                g_queue_push_tail(c->agent_msg_queue, out);
-                out = NULL;
-            }
-        }
+        agent_msg_writer_append(channel, &w, d, s);
     }
     va_end(args);
-    g_warn_if_fail(out == NULL);
+    g_warn_if_fail(w.out == NULL);
 }
 
 static int monitors_cmp(const void *p1, const void *p2, gpointer user_data)
@@ -1152,9 +1263,10 @@ gboolean spice_main_send_monitor_config(SpiceMainChannel *channel)
     return TRUE;
 }
 
+/* NULL until a playback or record channel brought the audio backend up */
 static SpiceAudio *spice_main_get_audio(const SpiceMainChannel *channel)
 {
-    return spice_audio_get(spice_channel_get_session(SPICE_CHANNEL(channel)), NULL);
+    return spice_session_get_audio_manager(spice_channel_get_session(SPICE_CHANNEL(channel)));
 }
 
 static void audio_playback_volume_info_cb(GObject *object, GAsyncResult *res, gpointer user_data)
@@ -1270,6 +1382,19 @@ static void agent_sync_audio_record(SpiceMainChannel *main_channel)
                                              audio_record_volume_info_cb, main_channel);
 }
 
+/* main context: the audio backend came up after the agent capabilities */
+G_GNUC_INTERNAL
+void spice_main_channel_sync_audio(SpiceMainChannel *channel)
+{
+    g_return_if_fail(SPICE_IS_MAIN_CHANNEL(channel));
+
+    if (!channel->priv->agent_caps_received)
+        return;
+
+    agent_sync_audio_playback(channel);
+    agent_sync_audio_record(channel);
+}
+
 /* any context: the message is not flushed immediately,
    you can wakeup() the channel coroutine or send_msg_queue() */
 static void agent_display_config(SpiceMainChannel *channel)
@@ -1368,14 +1493,41 @@ static void agent_clipboard_grab(SpiceMainChannel *channel, guint selection,
     agent_msg_queue(channel, VD_AGENT_CLIPBOARD_GRAB, size, msg);
 }
 
+/* fills @msg with what precedes the data in a VD_AGENT_CLIPBOARD message,
+ * returns its size, or 0 if the agent can't take @selection */
+static gsize agent_clipboard_header(SpiceMainChannel *self, guint selection,
+                                    guint32 type, guint8 *msg)
+{
+    VDAgentClipboard *cb;
+    gsize msgsize;
+
+    msgsize = sizeof(VDAgentClipboard);
+    if (test_agent_cap(self, VD_AGENT_CAP_CLIPBOARD_SELECTION)) {
+        msgsize += 4;
+    } else if (selection != VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD) {
+        return 0;
+    }
+
+    memset(msg, 0, msgsize);
+
+    cb = (VDAgentClipboard *)msg;
+
+    if (test_agent_cap(self, VD_AGENT_CAP_CLIPBOARD_SELECTION)) {
+        msg[0] = selection;
+        cb = (VDAgentClipboard *)(msg + 4);
+    }
+
+    cb->type = type;
+    return msgsize;
+}
+
 /* any context: the message is not flushed immediately,
    you can wakeup() the channel coroutine or send_msg_queue() */
 static void agent_clipboard_notify(SpiceMainChannel *self, guint selection,
                                    guint32 type, const guchar *data, size_t size)
 {
     SpiceMainChannelPrivate *c = self->priv;
-    VDAgentClipboard *cb;
-    guint8 *msg;
+    guint8 msg[4 + sizeof(VDAgentClipboard)];
     size_t msgsize;
     gint max_clipboard = spice_main_get_max_clipboard(self);
 
@@ -1383,26 +1535,180 @@ static void agent_clipboard_notify(SpiceMainChannel *self, guint selection,
     g_return_if_fail(test_agent_cap(self, VD_AGENT_CAP_CLIPBOARD_BY_DEMAND));
     g_return_if_fail(max_clipboard == -1 || size < max_clipboard);
 
-    msgsize = sizeof(VDAgentClipboard);
-    if (test_agent_cap(self, VD_AGENT_CAP_CLIPBOARD_SELECTION)) {
-        msgsize += 4;
-    } else if (selection != VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD) {
+    msgsize = agent_clipboard_header(self, selection, type, msg);
+    if (msgsize == 0) {
         CHANNEL_DEBUG(self, "Ignoring clipboard notify");
         return;
     }
 
-    msg = g_alloca(msgsize);
-    memset(msg, 0, msgsize);
+    agent_msg_queue_many(self, VD_AGENT_CLIPBOARD, msg, msgsize, data, size, NULL);
+}
 
-    cb = (VDAgentClipboard *)msg;
+/* ------------------------------------------------------------------ */
+/* clipboard data streamed to the agent, see
+ * spice_main_clipboard_selection_notify_async() */
 
-    if (test_agent_cap(self, VD_AGENT_CAP_CLIPBOARD_SELECTION)) {
-        msg[0] = selection;
-        cb = (VDAgentClipboard *)(msg + 4);
+/* read from the stream and queued at once, the memory a transfer takes
+ * whatever the size of the clipboard */
+#define CLIPBOARD_STREAM_BLOCK (64 * 1024)
+
+/* Once its VD_AGENT_CLIPBOARD message is started, the agent must get all
+ * of the clipboard data: when the stream fails or is cancelled, the rest
+ * of the message is padded */
+typedef struct ClipboardStream {
+    GInputStream *stream;
+    AgentMsgWriter writer;
+    guint8 *buffer;
+    gboolean pad; /* the stream can't be read, the agent gets zeroes */
+    GError *error;
+} ClipboardStream;
+
+static void clipboard_stream_next(GTask *task);
+
+static void clipboard_stream_free(ClipboardStream *cs)
+{
+    g_clear_object(&cs->stream);
+    if (cs->writer.out != NULL)
+        spice_msg_out_unref(cs->writer.out);
+    g_free(cs->buffer);
+    g_clear_error(&cs->error);
+    g_free(cs);
+}
+
+/* main context: the agent message is complete, the ones held back
+ * meanwhile can follow */
+static void clipboard_stream_done(SpiceMainChannel *channel)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    GTask *task = c->clipboard_stream;
+    ClipboardStream *cs = g_task_get_task_data(task);
+
+    c->clipboard_stream = NULL;
+    while (!g_queue_is_empty(&c->agent_msg_deferred))
+        g_queue_push_tail(c->agent_msg_queue, g_queue_pop_head(&c->agent_msg_deferred));
+    spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
+
+    if (cs->error != NULL) {
+        GError *error = cs->error;
+
+        cs->error = NULL;
+        g_task_return_error(task, error);
+    } else {
+        g_task_return_boolean(task, TRUE);
     }
+    g_object_unref(task);
+}
 
-    cb->type = type;
-    agent_msg_queue_many(self, VD_AGENT_CLIPBOARD, msg, msgsize, data, size, NULL);
+/* main or coroutine context: the connection is gone, and so are the queued
+ * fragments of the message */
+static void clipboard_stream_abort(SpiceMainChannel *channel)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    GTask *task = c->clipboard_stream;
+
+    if (task == NULL)
+        return;
+
+    c->clipboard_stream = NULL;
+    g_task_return_new_error(task, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
+                            _("The clipboard transfer was interrupted"));
+    g_object_unref(task);
+}
+
+static void clipboard_stream_flushed(GObject *source_object,
+                                     GAsyncResult *res,
+                                     gpointer user_data)
+{
+    SpiceMainChannel *channel = SPICE_MAIN_CHANNEL(source_object);
+    GTask *task = user_data;
+    ClipboardStream *cs = g_task_get_task_data(task);
+    gboolean sent = g_task_propagate_boolean(G_TASK(res), NULL);
+
+    if (channel->priv->clipboard_stream == task) {
+        /* the server still expects the rest of the message, see
+         * spice_main_channel_reset() */
+        if (!sent && cs->error == NULL)
+            cs->error = g_error_new_literal(SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
+                                            _("The agent disconnected"));
+        clipboard_stream_next(task);
+    }
+    g_object_unref(task);
+}
+
+/* main context: the next block is only read once the previous one is sent */
+static void clipboard_stream_flush(SpiceMainChannel *channel, GTask *task)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    GTask *flush;
+
+    /* the tail may be awaited already when the last read was short */
+    if (g_queue_is_empty(c->agent_msg_queue) ||
+        g_hash_table_contains(c->flushing, g_queue_peek_tail(c->agent_msg_queue))) {
+        clipboard_stream_next(task);
+        return;
+    }
+
+    spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
+    flush = g_task_new(channel, NULL, clipboard_stream_flushed, g_object_ref(task));
+    g_hash_table_insert(c->flushing, g_queue_peek_tail(c->agent_msg_queue), flush);
+}
+
+static void clipboard_stream_read_cb(GObject *source_object,
+                                     GAsyncResult *res,
+                                     gpointer user_data)
+{
+    GTask *task = user_data;
+    SpiceMainChannel *channel = g_task_get_source_object(task);
+    ClipboardStream *cs = g_task_get_task_data(task);
+    GError *error = NULL;
+    gssize count;
+
+    count = g_input_stream_read_finish(G_INPUT_STREAM(source_object), res, &error);
+    if (channel->priv->clipboard_stream != task) {
+        g_clear_error(&error);
+        g_object_unref(task);
+        return;
+    }
+
+    if (count > 0) {
+        agent_msg_writer_append(channel, &cs->writer, cs->buffer, count);
+    } else {
+        if (count == 0)
+            error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                                        _("The clipboard data is truncated"));
+        g_clear_error(&cs->error);
+        cs->error = error;
+        cs->pad = TRUE;
+    }
+    clipboard_stream_flush(channel, task);
+    g_object_unref(task);
+}
+
+/* main context: a block is read from the stream once the previous one is
+ * sent. Even when the agent disconnects meanwhile, the server still
+ * forwards the end of the message */
+static void clipboard_stream_next(GTask *task)
+{
+    SpiceMainChannel *channel = g_task_get_source_object(task);
+    ClipboardStream *cs = g_task_get_task_data(task);
+    gsize count = MIN(CLIPBOARD_STREAM_BLOCK, cs->writer.remaining);
+
+    if (count == 0) {
+        clipboard_stream_done(channel);
+        return;
+    }
+
+    if (cs->pad) {
+        /* a message can't be cut short */
+        memset(cs->buffer, 0, count);
+        agent_msg_writer_append(channel, &cs->writer, cs->buffer, count);
+        clipboard_stream_flush(channel, task);
+        return;
+    }
+
+    g_input_stream_read_async(cs->stream, cs->buffer, count, G_PRIORITY_DEFAULT,
+                              g_task_get_cancellable(task),
+                              clipboard_stream_read_cb, g_object_ref(task));
 }
 
 /* any context: the message is not flushed immediately,
@@ -1688,18 +1994,24 @@ static void main_handle_mm_time(SpiceChannel *channel, SpiceMsgIn *in)
     spice_session_set_mm_time(session, msg->time);
 }
 
-typedef struct channel_new {
+typedef struct channels_new {
     SpiceSession *session;
-    int type;
-    int id;
-} channel_new_t;
+    int num_of_channels;
+    SpiceChannelId channels[];
+} channels_new_t;
 
 /* main context */
-static gboolean _channel_new(channel_new_t *c)
+static gboolean _channels_new(channels_new_t *c)
 {
+    int i;
+
     g_return_val_if_fail(c != NULL, FALSE);
 
-    spice_channel_new(c->session, c->type, c->id);
+    /* create all the channels in one go, so that their coroutines start
+     * connecting during the same main loop iteration and share a single
+     * host lookup */
+    for (i = 0; i < c->num_of_channels; i++)
+        spice_channel_new(c->session, c->channels[i].type, c->channels[i].id);
 
     g_object_unref(c->session);
     g_free(c);
@@ -1715,7 +2027,7 @@ static void usb_connect_failed(GObject *object,SpiceUsbDevice *device,GError *er
 
 static void audio_connect_failed(GObject *object,SpiceUsbDevice *device,GError *error,gpointer   data)
 {
-	g_print("audio failed\n");           
+	SPICE_LOG_WARNING("audio failed");
 	return;
 }
 
@@ -1724,44 +2036,32 @@ static void main_handle_channels_list(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceMsgChannels *msg = spice_msg_in_parsed(in);
     SpiceSession *session;
+    channels_new_t *c;
     int i;
     
     session = spice_channel_get_session(channel);
     //zhangzhiyong add
     	SpiceUsbDeviceManager *manager;
-	SpiceAudio        *audiomanager;
-	//SpicePlaybackChannel *playback_channel;
     /* guarantee that uuid is notified before setting up the channels, even if
      * the server is older and doesn't actually send the uuid */
     g_coroutine_object_notify(G_OBJECT(session), "uuid");
 
-    for (i = 0; i < msg->num_of_channels; i++) {
-        channel_new_t *c;
-
-        c = g_new(channel_new_t, 1);
-        c->session = g_object_ref(session);
-        c->type = msg->channels[i].type;
-        c->id = msg->channels[i].id;
-        /* no need to explicitely switch to main context, since
-           synchronous call is not needed. */
-        /* no need to track idle, session is refed */
-        g_idle_add((GSourceFunc)_channel_new, c);
-    }
+    c = g_malloc(sizeof(channels_new_t) +
+                 msg->num_of_channels * sizeof(SpiceChannelId));
+    c->session = g_object_ref(session);
+    c->num_of_channels = msg->num_of_channels;
+    for (i = 0; i < msg->num_of_channels; i++)
+        c->channels[i] = msg->channels[i];
+    /* no need to explicitely switch to main context, since
+       synchronous call is not needed. */
+    /* no need to track idle, session is refed */
+    g_idle_add((GSourceFunc)_channels_new, c);
 
     manager = spice_usb_device_manager_get(session, NULL);
     if (manager) {
         g_signal_connect(manager, "auto-connect-failed",G_CALLBACK(usb_connect_failed), NULL);
         g_signal_connect(manager, "device-error",G_CALLBACK(usb_connect_failed), NULL);
 														                                                }
-    audiomanager = spice_audio_get(session, NULL);
-
-	/*if (audiomanager) {
-	       g_signal_connect(audiomanager, "auto-connect-failed",G_CALLBACK(audio_connect_failed), NULL);
-		   g_signal_connect(audiomanager, "device-error",G_CALLBACK(audio_connect_failed), NULL);
-
-	}*/
-
-
 }
 
 /* coroutine context */
@@ -1966,6 +2266,21 @@ static void spice_main_set_max_clipboard(SpiceMainChannel *self, gint max)
     spice_channel_wakeup(SPICE_CHANNEL(self), FALSE);
 }
 
+/* coroutine context: whether the reply on @selection is for
+ * spice_main_clipboard_selection_request_stream() */
+static gboolean agent_clipboard_in_take_stream(SpiceMainChannel *self, guint selection)
+{
+    SpiceMainChannelPrivate *c = self->priv;
+    gboolean stream;
+
+    if (selection >= 8)
+        return FALSE;
+
+    stream = (c->clipboard_in_stream & (1 << selection)) != 0;
+    c->clipboard_in_stream &= ~(1 << selection);
+    return stream;
+}
+
 /* coroutine context */
 static void main_agent_handle_msg(SpiceChannel *channel,
                                   VDAgentMessage *msg, gpointer payload)
@@ -2033,6 +2348,13 @@ static void main_agent_handle_msg(SpiceChannel *channel,
     case VD_AGENT_CLIPBOARD:
     {
         VDAgentClipboard *cb = payload;
+        if (agent_clipboard_in_take_stream(self, selection)) {
+            guint size = msg->size - sizeof(VDAgentClipboard);
+
+            g_coroutine_signal_emit(self, signals[SPICE_MAIN_CLIPBOARD_SELECTION_DATA], 0,
+                                    selection, cb->type, cb->data, size, 0, size);
+            break;
+        }
         g_coroutine_signal_emit(self, signals[SPICE_MAIN_CLIPBOARD_SELECTION], 0, selection,
                                 cb->type, cb->data, msg->size - sizeof(VDAgentClipboard));
 
@@ -2087,8 +2409,224 @@ static void main_agent_handle_msg(SpiceChannel *channel,
     }
 }
 
-/* coroutine context */
-static void main_handle_agent_data_msg(SpiceChannel* channel, int* msg_size, guchar** msg_pos)
+/* coroutine context: decides what becomes of the payload of the agent
+ * message whose header was just read */
+static void agent_msg_in_start(SpiceMainChannel *self)
+{
+    SpiceMainChannelPrivate *c = self->priv;
+
+    c->agent_msg_mode = AGENT_MSG_BUFFER;
+    if (c->agent_msg.type != VD_AGENT_CLIPBOARD)
+        return;
+
+    c->clipboard_in_header_size = sizeof(VDAgentClipboard);
+    if (test_agent_cap(self, VD_AGENT_CAP_CLIPBOARD_SELECTION))
+        c->clipboard_in_header_size += 4;
+    if (c->agent_msg.size < c->clipboard_in_header_size)
+        return;
+
+    c->agent_msg_mode = AGENT_MSG_CLIPBOARD;
+}
+
+static VDAgentClipboard *agent_clipboard_in_get_header(SpiceMainChannel *self,
+                                                       guint8 *selection)
+{
+    SpiceMainChannelPrivate *c = self->priv;
+
+    if (c->clipboard_in_header_size > sizeof(VDAgentClipboard)) {
+        *selection = c->clipboard_in_header[0];
+        return (VDAgentClipboard *)(c->clipboard_in_header + 4);
+    }
+
+    *selection = VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD;
+    return (VDAgentClipboard *)c->clipboard_in_header;
+}
+
+/* coroutine context: @n bytes of the clipboard message payload at @pos,
+ * once the clipboard header is in, what becomes of the data is known */
+static void agent_clipboard_in_header(SpiceMainChannel *self, guint pos,
+                                      const guint8 *data, guint n)
+{
+    SpiceMainChannelPrivate *c = self->priv;
+    guint hsize = c->clipboard_in_header_size;
+    guint size = c->agent_msg.size - hsize;
+    gint max_clipboard = spice_main_get_max_clipboard(self);
+    guint8 selection;
+
+    g_return_if_fail(pos < hsize);
+
+    memcpy(c->clipboard_in_header + pos, data, MIN(hsize - pos, n));
+    if (pos + n < hsize)
+        return;
+
+    agent_clipboard_in_get_header(self, &selection);
+    if (agent_clipboard_in_take_stream(self, selection)) {
+        c->agent_msg_mode = AGENT_MSG_STREAM;
+    } else if (max_clipboard != -1 && size > (guint)max_clipboard) {
+        g_warning("discarding %u bytes of clipboard data over the %d bytes limit",
+                  size, max_clipboard);
+        c->agent_msg_mode = AGENT_MSG_DISCARD;
+    } else {
+        c->agent_msg_mode = AGENT_MSG_BUFFER;
+        return;
+    }
+    /* what was buffered so far is the header, kept aside already */
+    spice_agent_msg_reassembly_clear(c->agent_msg_reassembly);
+}
+
+/* coroutine context: @n bytes of the clipboard message payload at @pos */
+static void agent_clipboard_in_data(SpiceMainChannel *self, guint pos,
+                                    const guint8 *data, guint n)
+{
+    SpiceMainChannelPrivate *c = self->priv;
+    guint hsize = c->clipboard_in_header_size;
+    guint total = c->agent_msg.size - hsize;
+    guint8 selection;
+    VDAgentClipboard *cb;
+
+    if (pos < hsize) {
+        guint m = MIN(hsize - pos, n);
+
+        pos += m;
+        data += m;
+        n -= m;
+        if (pos < hsize)
+            return;
+    }
+    /* empty clipboard data still gets its signal */
+    if (n == 0 && total != 0)
+        return;
+
+    cb = agent_clipboard_in_get_header(self, &selection);
+    g_coroutine_signal_emit(self, signals[SPICE_MAIN_CLIPBOARD_SELECTION_DATA], 0,
+                            selection, cb->type, data, n, pos - hsize, total);
+}
+
+/* coroutine context: the requester still waits for a reply, it gets an
+ * empty clipboard */
+static void agent_clipboard_in_discarded(SpiceMainChannel *self)
+{
+    guint8 selection;
+    VDAgentClipboard *cb = agent_clipboard_in_get_header(self, &selection);
+
+    g_coroutine_signal_emit(self, signals[SPICE_MAIN_CLIPBOARD_SELECTION], 0, selection,
+                            cb->type, "", 0);
+    if (selection == VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD)
+        g_coroutine_signal_emit(self, signals[SPICE_MAIN_CLIPBOARD], 0,
+                                cb->type, "", 0);
+}
+
+/* ------------------------------------------------------------------ */
+
+/* the buffer joining fragments is kept for the next message up to this
+ * size, bigger messages are rare, clipboard data mostly */
+#define AGENT_MSG_REASSEMBLY_KEEP (64 * 1024)
+
+struct _SpiceAgentMsgReassembly {
+    GDestroyNotify release;
+    /* a whole payload in one fragment, by reference */
+    guint8 *data;
+    gpointer owner;
+    /* or the fragments copied so far */
+    guint8 *buffer;
+    gsize buffer_size;
+    gsize len;
+    guint64 copied;
+};
+
+G_GNUC_INTERNAL
+SpiceAgentMsgReassembly *spice_agent_msg_reassembly_new(GDestroyNotify release)
+{
+    SpiceAgentMsgReassembly *reassembly = g_new0(SpiceAgentMsgReassembly, 1);
+
+    reassembly->release = release;
+
+    return reassembly;
+}
+
+G_GNUC_INTERNAL
+void spice_agent_msg_reassembly_free(SpiceAgentMsgReassembly *reassembly)
+{
+    spice_agent_msg_reassembly_clear(reassembly);
+    g_free(reassembly->buffer);
+    g_free(reassembly);
+}
+
+/* Appends @size bytes at @data to a payload of @total bytes, the reference
+ * on @owner is taken over. @data is only kept, until @owner is released,
+ * if it is the whole payload, otherwise it is copied and @owner released
+ * right away. */
+G_GNUC_INTERNAL
+void spice_agent_msg_reassembly_add(SpiceAgentMsgReassembly *reassembly,
+                                    guint8 *data, gsize size, gsize total,
+                                    gpointer owner)
+{
+    g_return_if_fail(reassembly->owner == NULL);
+    g_return_if_fail(reassembly->len + size <= total);
+
+    if (size == total) {
+        reassembly->data = data;
+        reassembly->owner = owner;
+        return;
+    }
+
+    if (total > reassembly->buffer_size) {
+        g_free(reassembly->buffer);
+        reassembly->buffer = g_malloc(total);
+        reassembly->buffer_size = total;
+    }
+    memcpy(reassembly->buffer + reassembly->len, data, size);
+    reassembly->len += size;
+    reassembly->copied += size;
+    reassembly->release(owner);
+}
+
+/* Returns the whole payload, valid until spice_agent_msg_reassembly_clear() */
+G_GNUC_INTERNAL
+guint8 *spice_agent_msg_reassembly_finish(SpiceAgentMsgReassembly *reassembly)
+{
+    if (reassembly->owner != NULL)
+        return reassembly->data;
+    if (reassembly->len == 0)
+        return NULL;
+
+    return reassembly->buffer;
+}
+
+G_GNUC_INTERNAL
+void spice_agent_msg_reassembly_clear(SpiceAgentMsgReassembly *reassembly)
+{
+    if (reassembly->owner != NULL) {
+        reassembly->release(reassembly->owner);
+        reassembly->owner = NULL;
+        reassembly->data = NULL;
+    }
+    reassembly->len = 0;
+
+    if (reassembly->buffer_size > AGENT_MSG_REASSEMBLY_KEEP) {
+        g_clear_pointer(&reassembly->buffer, g_free);
+        reassembly->buffer_size = 0;
+    }
+}
+
+/* Returns how many payload bytes were copied so far */
+G_GNUC_INTERNAL
+guint64 spice_agent_msg_reassembly_get_copied(SpiceAgentMsgReassembly *reassembly)
+{
+    return reassembly->copied;
+}
+
+G_GNUC_INTERNAL
+guint64 spice_main_channel_get_agent_msg_copied(SpiceMainChannel *channel)
+{
+    return spice_agent_msg_reassembly_get_copied(channel->priv->agent_msg_reassembly);
+}
+
+/* coroutine context: takes the agent data at *@msg_pos, up to the end of
+ * the agent message it belongs to, and moves *@msg_pos past it */
+G_GNUC_INTERNAL
+void spice_main_channel_handle_agent_data_msg(SpiceChannel *channel, SpiceMsgIn *in,
+                                              int *msg_size, guchar **msg_pos)
 {
     SpiceMainChannelPrivate *c = SPICE_MAIN_CHANNEL(channel)->priv;
     int n;
@@ -2102,24 +2640,45 @@ static void main_handle_agent_data_msg(SpiceChannel* channel, int* msg_size, guc
         if (c->agent_msg_pos == sizeof(VDAgentMessage)) {
             SPICE_DEBUG("agent msg start: msg_size=%u, protocol=%u, type=%u",
                         c->agent_msg.size, c->agent_msg.protocol, c->agent_msg.type);
-            g_return_if_fail(c->agent_msg_data == NULL);
-            c->agent_msg_data = g_malloc0(c->agent_msg.size);
+            agent_msg_in_start(SPICE_MAIN_CHANNEL(channel));
         }
     }
 
     if (c->agent_msg_pos >= sizeof(VDAgentMessage)) {
-        n = MIN(sizeof(VDAgentMessage) + c->agent_msg.size - c->agent_msg_pos, *msg_size);
-        memcpy(c->agent_msg_data + c->agent_msg_pos - sizeof(VDAgentMessage), *msg_pos, n);
+        guint pos = c->agent_msg_pos - sizeof(VDAgentMessage);
+
+        n = MIN(c->agent_msg.size - pos, *msg_size);
+        if (c->agent_msg_mode == AGENT_MSG_CLIPBOARD && n > 0)
+            agent_clipboard_in_header(SPICE_MAIN_CHANNEL(channel), pos, *msg_pos, n);
+        switch (c->agent_msg_mode) {
+        case AGENT_MSG_STREAM:
+            agent_clipboard_in_data(SPICE_MAIN_CHANNEL(channel), pos, *msg_pos, n);
+            break;
+        case AGENT_MSG_DISCARD:
+            break;
+        case AGENT_MSG_BUFFER:
+        case AGENT_MSG_CLIPBOARD:
+            if (n > 0) {
+                spice_msg_in_ref(in);
+                spice_agent_msg_reassembly_add(c->agent_msg_reassembly, *msg_pos, n,
+                                               c->agent_msg.size, in);
+            }
+            break;
+        }
         c->agent_msg_pos += n;
         *msg_size -= n;
         *msg_pos += n;
     }
 
     if (c->agent_msg_pos == sizeof(VDAgentMessage) + c->agent_msg.size) {
-        main_agent_handle_msg(channel, &c->agent_msg, c->agent_msg_data);
-        g_free(c->agent_msg_data);
-        c->agent_msg_data = NULL;
+        if (c->agent_msg_mode == AGENT_MSG_BUFFER)
+            main_agent_handle_msg(channel, &c->agent_msg,
+                                  spice_agent_msg_reassembly_finish(c->agent_msg_reassembly));
+        else if (c->agent_msg_mode == AGENT_MSG_DISCARD)
+            agent_clipboard_in_discarded(SPICE_MAIN_CHANNEL(channel));
+        spice_agent_msg_reassembly_clear(c->agent_msg_reassembly);
         c->agent_msg_pos = 0;
+        c->agent_msg_mode = AGENT_MSG_BUFFER;
     }
 }
 
@@ -2148,7 +2707,7 @@ static void main_handle_agent_data(SpiceChannel *channel, SpiceMsgIn *in)
 
     data = spice_msg_in_raw(in, &len);
     while (len > 0) {
-        main_handle_agent_data_msg(channel, &len, &data);
+        spice_main_channel_handle_agent_data_msg(channel, in, &len, &data);
     }
 }
 
@@ -2170,17 +2729,57 @@ static void migrate_channel_new_cb(SpiceSession *s, SpiceChannel *channel, gpoin
                      G_CALLBACK(migrate_channel_event_cb), data);
 }
 
-static SpiceChannel* migrate_channel_connect(spice_migrate *mig, int type, int id)
+static SpiceChannel* migrate_channel_new(spice_migrate *mig, int type, int id)
 {
-    SPICE_DEBUG("migrate_channel_connect %d:%d", type, id);
+    SPICE_DEBUG("migrate_channel_new %d:%d", type, id);
 
     SpiceChannel *newc = spice_channel_new(mig->session, type, id);
-    spice_channel_connect(newc);
     mig->nchannels++;
 
     return newc;
 }
 
+/* main context */
+static gboolean migrate_channel_can_connect(spice_migrate *mig, SpiceChannel *channel)
+{
+    if (!spice_session_get_client_provided_socket(mig->session))
+        return TRUE;
+
+    /* nobody would answer the fd request, and the migration would
+     * hang until the server gives up on it */
+    if (!g_signal_has_handler_pending(channel, g_signal_lookup("open-fd", SPICE_TYPE_CHANNEL),
+                                      0, FALSE)) {
+        CHANNEL_DEBUG(channel, "no handler for open-fd, can't connect to destination");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* main context: connects all of @channels, or none of them if one of
+ * them can't be connected. In the latter case, they will never report
+ * to @mig, which lives on the stack of main_migrate_connect() */
+static gboolean migrate_channels_connect(spice_migrate *mig, GList *channels)
+{
+    GList *l;
+
+    for (l = channels; l != NULL; l = l->next) {
+        if (!migrate_channel_can_connect(mig, l->data))
+            break;
+    }
+
+    if (l != NULL) {
+        for (l = channels; l != NULL; l = l->next)
+            g_signal_handlers_disconnect_by_func(l->data, migrate_channel_event_cb, mig);
+        return FALSE;
+    }
+
+    for (l = channels; l != NULL; l = l->next)
+        spice_channel_connect(l->data);
+
+    return TRUE;
+}
+
 /* coroutine context */
 static void spice_main_channel_send_migration_handshake(SpiceChannel *channel)
 {
@@ -2226,16 +2825,24 @@ static void migrate_channel_event_cb(SpiceChannel *channel, SpiceChannelEvent ev
                 mig->nchannels--;
             }
             /* now connect the rest of the channels */
-            GList *channels, *l;
+            GList *channels, *l, *newcs = NULL;
+            gboolean connected;
             l = channels = spice_session_get_channels(session);
             while (l != NULL) {
                 SpiceChannelPrivate  *curc = SPICE_CHANNEL(l->data)->priv;
                 l = l->next;
                 if (curc->channel_type == SPICE_CHANNEL_MAIN)
                     continue;
-                migrate_channel_connect(mig, curc->channel_type, curc->channel_id);
+                newcs = g_list_prepend(newcs,
+                    migrate_channel_new(mig, curc->channel_type, curc->channel_id));
             }
             g_list_free(channels);
+            connected = migrate_channels_connect(mig, newcs);
+            g_list_free(newcs);
+            if (!connected) {
+                coroutine_yieldto(mig->from, NULL);
+                break;
+            }
         } else {
             c->state = SPICE_CHANNEL_STATE_MIGRATING;
             mig->nchannels--;
@@ -2283,6 +2890,7 @@ static gboolean migrate_connect(gpointer data)
 {
     spice_migrate *mig = data;
     SpiceChannelPrivate  *c;
+    GList *mainc;
     int port, sport;
     const char *host;
 
@@ -2352,7 +2960,12 @@ static gboolean migrate_connect(gpointer data)
 
     /* the migration process is in 2 steps, first the main channel and
        then the rest of the channels */
-    migrate_channel_connect(mig, SPICE_CHANNEL_MAIN, 0);
+    mainc = g_list_prepend(NULL, migrate_channel_new(mig, SPICE_CHANNEL_MAIN, 0));
+    if (!migrate_channels_connect(mig, mainc)) {
+        /* go back to main channel to report error */
+        coroutine_yieldto(mig->from, NULL);
+    }
+    g_list_free(mainc);
 
     return FALSE;
 }
@@ -2785,6 +3398,126 @@ void spice_main_clipboard_selection_notify(SpiceMainChannel *channel, guint sele
     spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
 }
 
+/**
+ * spice_main_clipboard_selection_notify_async:
+ * @channel: a #SpiceMainChannel
+ * @selection: one of the clipboard #VD_AGENT_CLIPBOARD_SELECTION_*
+ * @type: a #VD_AGENT_CLIPBOARD type
+ * @stream: a #GInputStream with the clipboard data
+ * @size: number of bytes to read from @stream
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore
+ * @callback: (scope async): a #GAsyncReadyCallback to call when the data is sent
+ * @user_data: (closure): the data to pass to callback function
+ *
+ * Send @size bytes of clipboard data read from @stream to the guest, like
+ * spice_main_clipboard_selection_notify() does with a buffer, without
+ * holding more than a block of it in memory at a time. Each block is
+ * read from @stream once the previous one is sent to the agent.
+ *
+ * The agent is told @size before the data. If @stream fails, ends
+ * before @size bytes or @cancellable is cancelled, the operation fails,
+ * and the guest gets zeroes for the rest of the data. Other messages to
+ * the agent wait while the data is sent, only one transfer may be in
+ * progress at a time.
+ *
+ * When the operation is finished, @callback will be called. You can then
+ * call spice_main_clipboard_selection_notify_finish() to get the result of
+ * the operation.
+ *
+ * Since: 0.35
+ **/
+void spice_main_clipboard_selection_notify_async(SpiceMainChannel *channel,
+                                                 guint selection,
+                                                 guint32 type,
+                                                 GInputStream *stream,
+                                                 gsize size,
+                                                 GCancellable *cancellable,
+                                                 GAsyncReadyCallback callback,
+                                                 gpointer user_data)
+{
+    SpiceMainChannelPrivate *c;
+    ClipboardStream *cs;
+    GTask *task;
+    guint8 msg[4 + sizeof(VDAgentClipboard)];
+    gsize msgsize;
+    gint max_clipboard;
+
+    g_return_if_fail(SPICE_IS_MAIN_CHANNEL(channel));
+    g_return_if_fail(G_IS_INPUT_STREAM(stream));
+
+    c = channel->priv;
+    task = g_task_new(channel, cancellable, callback, user_data);
+    max_clipboard = spice_main_get_max_clipboard(channel);
+
+    if (!c->agent_connected ||
+        !test_agent_cap(channel, VD_AGENT_CAP_CLIPBOARD_BY_DEMAND)) {
+        g_task_return_new_error(task, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
+                                _("The agent is not connected"));
+        g_object_unref(task);
+        return;
+    }
+    if (max_clipboard != -1 && size >= (gsize)max_clipboard) {
+        g_task_return_new_error(task, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
+                                _("The clipboard data is over the %d bytes limit"),
+                                max_clipboard);
+        g_object_unref(task);
+        return;
+    }
+    if (c->clipboard_stream != NULL) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_PENDING,
+                                _("A clipboard transfer is already in progress"));
+        g_object_unref(task);
+        return;
+    }
+    msgsize = agent_clipboard_header(channel, selection, type, msg);
+    if (msgsize == 0) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                _("The agent doesn't support this clipboard selection"));
+        g_object_unref(task);
+        return;
+    }
+
+    cs = g_new0(ClipboardStream, 1);
+    cs->stream = g_object_ref(stream);
+    cs->buffer = g_malloc(MIN(CLIPBOARD_STREAM_BLOCK, MAX(size, 1)));
+    g_task_set_task_data(task, cs, (GDestroyNotify)clipboard_stream_free);
+    /* a cancellation fails the read of the next block, a transfer
+     * complete meanwhile still succeeds */
+    g_task_set_check_cancellable(task, FALSE);
+
+    /* the reference is dropped by clipboard_stream_done() or _abort() */
+    c->clipboard_stream = task;
+    agent_msg_writer_begin(channel, &cs->writer, c->agent_msg_queue,
+                           VD_AGENT_CLIPBOARD, msgsize + size);
+    agent_msg_writer_append(channel, &cs->writer, msg, msgsize);
+    clipboard_stream_next(task);
+}
+
+/**
+ * spice_main_clipboard_selection_notify_finish:
+ * @channel: a #SpiceMainChannel
+ * @result: a #GAsyncResult
+ * @error: a #GError, or %NULL
+ *
+ * Finishes sending the clipboard data started with
+ * spice_main_clipboard_selection_notify_async().
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ *
+ * Since: 0.35
+ **/
+gboolean spice_main_clipboard_selection_notify_finish(SpiceMainChannel *channel,
+                                                      GAsyncResult *result,
+                                                      GError **error)
+{
+    GTask *task = G_TASK(result);
+
+    g_return_val_if_fail(SPICE_IS_MAIN_CHANNEL(channel), FALSE);
+    g_return_val_if_fail(g_task_is_valid(task, channel), FALSE);
+
+    return g_task_propagate_boolean(task, error);
+}
+
 /**
  * spice_main_clipboard_request:
  * @channel: a #SpiceMainChannel
@@ -2816,6 +3549,34 @@ void spice_main_clipboard_selection_request(SpiceMainChannel *channel, guint sel
     g_return_if_fail(channel != NULL);
     g_return_if_fail(SPICE_IS_MAIN_CHANNEL(channel));
 
+    if (selection < 8)
+        channel->priv->clipboard_in_stream &= ~(1 << selection);
+    agent_clipboard_request(channel, selection, type);
+    spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
+}
+
+/**
+ * spice_main_clipboard_selection_request_stream:
+ * @channel: a #SpiceMainChannel
+ * @selection: one of the clipboard #VD_AGENT_CLIPBOARD_SELECTION_*
+ * @type: a #VD_AGENT_CLIPBOARD type
+ *
+ * Request clipboard data of @type from the guest, like
+ * spice_main_clipboard_selection_request(). The reply is sent piece by
+ * piece through the #SpiceMainChannel::main-clipboard-selection-data
+ * signal instead, whatever its size.
+ *
+ * The reply on @selection is taken for the most recent request on it.
+ *
+ * Since: 0.35
+ **/
+void spice_main_clipboard_selection_request_stream(SpiceMainChannel *channel,
+                                                   guint selection, guint32 type)
+{
+    g_return_if_fail(SPICE_IS_MAIN_CHANNEL(channel));
+    g_return_if_fail(selection < 8);
+
+    channel->priv->clipboard_in_stream |= 1 << selection;
     agent_clipboard_request(channel, selection, type);
     spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
 }
@@ -82,7 +82,20 @@ gboolean spice_main_send_monitor_config(SpiceMainChannel *channel);
 void spice_main_clipboard_selection_grab(SpiceMainChannel *channel, guint selection, guint32 *types, int ntypes);
 void spice_main_clipboard_selection_release(SpiceMainChannel *channel, guint selection);
 void spice_main_clipboard_selection_notify(SpiceMainChannel *channel, guint selection, guint32 type, const guchar *data, size_t size);
+void spice_main_clipboard_selection_notify_async(SpiceMainChannel *channel,
+                                                 guint selection,
+                                                 guint32 type,
+                                                 GInputStream *stream,
+                                                 gsize size,
+                                                 GCancellable *cancellable,
+                                                 GAsyncReadyCallback callback,
+                                                 gpointer user_data);
+gboolean spice_main_clipboard_selection_notify_finish(SpiceMainChannel *channel,
+                                                      GAsyncResult *result,
+                                                      GError **error);
 void spice_main_clipboard_selection_request(SpiceMainChannel *channel, guint selection, guint32 type);
+void spice_main_clipboard_selection_request_stream(SpiceMainChannel *channel,
+                                                   guint selection, guint32 type);
 
 gboolean spice_main_agent_test_capability(SpiceMainChannel *channel, guint32 cap);
 void spice_main_file_copy_async(SpiceMainChannel *channel,
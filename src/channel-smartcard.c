@@ -78,7 +78,9 @@ struct _SpiceSmartcardChannelPrivate {
     GHashTable *pending_card_insertions;
 
     /* next commands to be sent to the spice server. This is needed since
-     * we have to wait for a command answer before sending the next one
+     * we have to wait for a command answer before sending the next one.
+     * The answers to the server APDUs are not acknowledged, they don't
+     * go through the queue
      */
     GQueue *message_queue;
 
@@ -51,6 +51,14 @@ void spice_usbredir_channel_connect_device_async(
                                         GCancellable         *cancellable,
                                         GAsyncReadyCallback   callback,
                                         gpointer              user_data);
+/* Same for a device already open, takes ownership of @handle */
+void spice_usbredir_channel_connect_handle_async(
+                                        SpiceUsbredirChannel *channel,
+                                        libusb_device_handle *handle,
+                                        SpiceUsbDevice       *spice_device,
+                                        GCancellable         *cancellable,
+                                        GAsyncReadyCallback   callback,
+                                        gpointer              user_data);
 gboolean spice_usbredir_channel_connect_device_finish(
                                         SpiceUsbredirChannel *channel,
                                         GAsyncResult         *res,
@@ -40,6 +40,7 @@
 #include "spice-common.h"
 
 #include "spice-channel-priv.h"
+#include "spice-trace-priv.h"
 
 /**
  * SECTION:channel-usbredir
@@ -56,9 +57,20 @@
 #ifdef USE_USBREDIR
 
 #define COMPRESS_THRESHOLD 1000
+/* default ceiling of the channel output queue, see usbredir_pacer_hold() */
+#define MAX_QUEUED_BYTES (256 * 1024)
+/* buckets of the queue delay histogram, bucket i counts the delays up to
+ * 125 << i us, the last one the longer ones */
+#define QUEUE_DELAY_BUCKETS 16
 #define SPICE_USBREDIR_CHANNEL_GET_PRIVATE(obj)                                  \
     (G_TYPE_INSTANCE_GET_PRIVATE((obj), SPICE_TYPE_USBREDIR_CHANNEL, SpiceUsbredirChannelPrivate))
 
+/* a message of device data in the channel output queue */
+typedef struct {
+    gint64 time; /* when it was queued */
+    gsize size;
+} QueuedData;
+
 enum SpiceUsbredirChannelState {
     STATE_DISCONNECTED,
 #ifdef USE_POLKIT
@@ -70,6 +82,8 @@ enum SpiceUsbredirChannelState {
 
 struct _SpiceUsbredirChannelPrivate {
     libusb_device *device;
+    libusb_device_handle *parked_handle; /* set by connect_handle_async */
+    guint device_id; /* bus << 8 | address, for the trace probes */
     SpiceUsbDevice *spice_device;
     libusb_context *context;
     struct usbredirhost *host;
@@ -85,6 +99,31 @@ struct _SpiceUsbredirChannelPrivate {
 #endif
     GMutex device_connect_mutex;
     SpiceUsbDeviceManager *usb_device_manager;
+    /* output pacing, protected by pacer_mutex, which is never held
+     * while calling into the channel */
+    GMutex pacer_mutex;
+    guint64 max_queued_bytes;
+    gboolean paced;
+    GArray *queued;       /* QueuedData, in the order they are freed */
+    guint queued_head;
+    guint64 queued_bytes;
+    gint64 queue_delay;   /* smoothed, in us */
+    gint64 max_queue_delay;
+    guint64 queue_delay_hist[QUEUE_DELAY_BUCKETS];
+    gint64 queue_delay_sum;
+    guint64 lz4_uncompressed_bytes;
+    guint64 lz4_compressed_bytes;
+};
+
+enum {
+    PROP_0,
+    PROP_MAX_QUEUED_BYTES,
+    PROP_QUEUE_DELAY,
+    PROP_MAX_QUEUE_DELAY,
+    PROP_QUEUE_DELAY_HISTOGRAM,
+    PROP_QUEUE_DELAY_SUM,
+    PROP_LZ4_UNCOMPRESSED_BYTES,
+    PROP_LZ4_COMPRESSED_BYTES,
 };
 
 static void channel_set_handlers(SpiceChannelClass *klass);
@@ -117,6 +156,9 @@ static void spice_usbredir_channel_init(SpiceUsbredirChannel *channel)
 #ifdef USE_USBREDIR
     channel->priv = SPICE_USBREDIR_CHANNEL_GET_PRIVATE(channel);
     g_mutex_init(&channel->priv->device_connect_mutex);
+    g_mutex_init(&channel->priv->pacer_mutex);
+    channel->priv->max_queued_bytes = MAX_QUEUED_BYTES;
+    channel->priv->queued = g_array_new(FALSE, FALSE, sizeof(QueuedData));
 #endif
 }
 
@@ -159,8 +201,25 @@ static void spice_usbredir_channel_reset(SpiceChannel *c, gboolean migrating)
     SpiceUsbredirChannel *channel = SPICE_USBREDIR_CHANNEL(c);
     SpiceUsbredirChannelPrivate *priv = channel->priv;
 
+    g_mutex_lock(&priv->pacer_mutex);
+    /* the queue is dropped along with the connection */
+    priv->paced = FALSE;
+    g_array_set_size(priv->queued, 0);
+    priv->queued_head = 0;
+    priv->queued_bytes = 0;
+    g_mutex_unlock(&priv->pacer_mutex);
+
     if (priv->host) {
         if (priv->state == STATE_CONNECTED) {
+            /* the channel dropped under the device, or is being moved
+             * to the destination of a semi-seamless migration, which
+             * starts a new usbredir stream: give it a chance to be
+             * redirected again once the channel is back. A seamless
+             * migration swaps the channel without resetting it, the
+             * device stays attached through it */
+            if (priv->usb_device_manager != NULL)
+                spice_usb_device_manager_park_device(priv->usb_device_manager,
+                                                     priv->spice_device, migrating);
             spice_usbredir_channel_disconnect_device_async(channel, NULL,
                 _channel_reset_cb, GUINT_TO_POINTER(migrating));
         } else {
@@ -170,6 +229,67 @@ static void spice_usbredir_channel_reset(SpiceChannel *c, gboolean migrating)
         SPICE_CHANNEL_CLASS(spice_usbredir_channel_parent_class)->channel_reset(c, migrating);
     }
 }
+
+static void spice_usbredir_channel_get_property(GObject    *gobject,
+                                                guint       prop_id,
+                                                GValue     *value,
+                                                GParamSpec *pspec)
+{
+    SpiceUsbredirChannelPrivate *priv = SPICE_USBREDIR_CHANNEL(gobject)->priv;
+
+    g_mutex_lock(&priv->pacer_mutex);
+    switch (prop_id) {
+    case PROP_MAX_QUEUED_BYTES:
+        g_value_set_uint64(value, priv->max_queued_bytes);
+        break;
+    case PROP_QUEUE_DELAY:
+        g_value_set_int64(value, priv->queue_delay);
+        break;
+    case PROP_MAX_QUEUE_DELAY:
+        g_value_set_int64(value, priv->max_queue_delay);
+        break;
+    case PROP_QUEUE_DELAY_HISTOGRAM: {
+        GArray *hist = g_array_sized_new(FALSE, FALSE, sizeof(guint64),
+                                         QUEUE_DELAY_BUCKETS);
+
+        g_array_append_vals(hist, priv->queue_delay_hist, QUEUE_DELAY_BUCKETS);
+        g_value_take_boxed(value, hist);
+        break;
+    }
+    case PROP_QUEUE_DELAY_SUM:
+        g_value_set_int64(value, priv->queue_delay_sum);
+        break;
+    case PROP_LZ4_UNCOMPRESSED_BYTES:
+        g_value_set_uint64(value, priv->lz4_uncompressed_bytes);
+        break;
+    case PROP_LZ4_COMPRESSED_BYTES:
+        g_value_set_uint64(value, priv->lz4_compressed_bytes);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
+        break;
+    }
+    g_mutex_unlock(&priv->pacer_mutex);
+}
+
+static void spice_usbredir_channel_set_property(GObject      *gobject,
+                                                guint         prop_id,
+                                                const GValue *value,
+                                                GParamSpec   *pspec)
+{
+    SpiceUsbredirChannelPrivate *priv = SPICE_USBREDIR_CHANNEL(gobject)->priv;
+
+    switch (prop_id) {
+    case PROP_MAX_QUEUED_BYTES:
+        g_mutex_lock(&priv->pacer_mutex);
+        priv->max_queued_bytes = g_value_get_uint64(value);
+        g_mutex_unlock(&priv->pacer_mutex);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
+        break;
+    }
+}
 #endif
 
 static void spice_usbredir_channel_class_init(SpiceUsbredirChannelClass *klass)
@@ -180,9 +300,135 @@ static void spice_usbredir_channel_class_init(SpiceUsbredirChannelClass *klass)
 
     gobject_class->dispose       = spice_usbredir_channel_dispose;
     gobject_class->finalize      = spice_usbredir_channel_finalize;
+    gobject_class->get_property  = spice_usbredir_channel_get_property;
+    gobject_class->set_property  = spice_usbredir_channel_set_property;
     channel_class->channel_up    = spice_usbredir_channel_up;
     channel_class->channel_reset = spice_usbredir_channel_reset;
 
+    /**
+     * SpiceUsbredirChannel:max-queued-bytes:
+     *
+     * Once this many bytes of device data are waiting to be sent on the
+     * channel, the data from the redirected device is held back until
+     * the queue drops below it again, so that bulk transfers don't delay
+     * the interrupt and control traffic behind them. 0 disables the
+     * limit.
+     *
+     * Since: 0.35
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_MAX_QUEUED_BYTES,
+         g_param_spec_uint64("max-queued-bytes",
+                             "Maximum queued bytes",
+                             "Output queue ceiling in bytes, 0 for no limit",
+                             0, G_MAXUINT64, MAX_QUEUED_BYTES,
+                             G_PARAM_READWRITE |
+                             G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceUsbredirChannel:queue-delay:
+     *
+     * Smoothed time, in microseconds, the device data spent in the
+     * channel output queue before reaching the socket.
+     *
+     * Since: 0.35
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_QUEUE_DELAY,
+         g_param_spec_int64("queue-delay",
+                            "Queue delay",
+                            "Smoothed output queue delay, in us",
+                            0, G_MAXINT64, 0,
+                            G_PARAM_READABLE |
+                            G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceUsbredirChannel:max-queue-delay:
+     *
+     * Longest time, in microseconds, device data spent in the channel
+     * output queue.
+     *
+     * Since: 0.35
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_MAX_QUEUE_DELAY,
+         g_param_spec_int64("max-queue-delay",
+                            "Maximum queue delay",
+                            "Longest output queue delay, in us",
+                            0, G_MAXINT64, 0,
+                            G_PARAM_READABLE |
+                            G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceUsbredirChannel:queue-delay-histogram:
+     *
+     * A #GArray of 16 #guint64 counting the device data by the time it
+     * spent in the channel output queue. Element i counts the delays up
+     * to 125 << i microseconds and above the previous bound, the last
+     * element the delays longer than 125 << 14 microseconds.
+     *
+     * Since: 0.35
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_QUEUE_DELAY_HISTOGRAM,
+         g_param_spec_boxed("queue-delay-histogram",
+                            "Queue delay histogram",
+                            "Output queue delay counts, by power of two buckets",
+                            G_TYPE_ARRAY,
+                            G_PARAM_READABLE |
+                            G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceUsbredirChannel:queue-delay-sum:
+     *
+     * Total time, in microseconds, the device data spent in the channel
+     * output queue.
+     *
+     * Since: 0.35
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_QUEUE_DELAY_SUM,
+         g_param_spec_int64("queue-delay-sum",
+                            "Queue delay sum",
+                            "Total output queue delay, in us",
+                            0, G_MAXINT64, 0,
+                            G_PARAM_READABLE |
+                            G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceUsbredirChannel:lz4-uncompressed-bytes:
+     *
+     * Size of the device data exchanged LZ4 compressed, in either
+     * direction, before compression.
+     *
+     * Since: 0.35
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_LZ4_UNCOMPRESSED_BYTES,
+         g_param_spec_uint64("lz4-uncompressed-bytes",
+                             "LZ4 uncompressed bytes",
+                             "Size of the LZ4 compressed data before compression",
+                             0, G_MAXUINT64, 0,
+                             G_PARAM_READABLE |
+                             G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceUsbredirChannel:lz4-compressed-bytes:
+     *
+     * Size of the device data exchanged LZ4 compressed, in either
+     * direction, after compression.
+     *
+     * Since: 0.35
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_LZ4_COMPRESSED_BYTES,
+         g_param_spec_uint64("lz4-compressed-bytes",
+                             "LZ4 compressed bytes",
+                             "Size of the LZ4 compressed data",
+                             0, G_MAXUINT64, 0,
+                             G_PARAM_READABLE |
+                             G_PARAM_STATIC_STRINGS));
+
     g_type_class_add_private(klass, sizeof(SpiceUsbredirChannelPrivate));
     channel_set_handlers(SPICE_CHANNEL_CLASS(klass));
 #endif
@@ -233,6 +479,8 @@ static void spice_usbredir_channel_finalize(GObject *obj)
         usbredirhost_close(channel->priv->host);
 #ifdef USE_USBREDIR
     g_mutex_clear(&channel->priv->device_connect_mutex);
+    g_mutex_clear(&channel->priv->pacer_mutex);
+    g_array_unref(channel->priv->queued);
 #endif
 
     /* Chain up to the parent class */
@@ -286,7 +534,7 @@ static gboolean spice_usbredir_channel_open_device(
     SpiceUsbredirChannelPrivate *priv = channel->priv;
     SpiceSession *session;
     libusb_device_handle *handle = NULL;
-    int rc, status;
+    int rc = 0, status;
     SpiceUsbDeviceManager *manager;
 
     g_return_val_if_fail(priv->state == STATE_DISCONNECTED
@@ -295,7 +543,12 @@ static gboolean spice_usbredir_channel_open_device(
 #endif
                          , FALSE);
 
-    rc = libusb_open(priv->device, &handle);
+    if (priv->parked_handle != NULL) {
+        handle = priv->parked_handle;
+        priv->parked_handle = NULL;
+    } else {
+        rc = libusb_open(priv->device, &handle);
+    }
     if (rc != 0) {
         g_set_error(err, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
                     "Could not open usb device: %s [%i]",
@@ -349,6 +602,7 @@ static void spice_usbredir_channel_open_acl_cb(
     }
     if (err) {
         g_clear_pointer(&priv->device, libusb_unref_device);
+        priv->device_id = 0;
         g_boxed_free(spice_usb_device_get_type(), priv->spice_device);
         priv->spice_device = NULL;
         priv->state  = STATE_DISCONNECTED;
@@ -365,7 +619,6 @@ static void spice_usbredir_channel_open_acl_cb(
 }
 #endif
 
-#ifndef USE_POLKIT
 static void
 _open_device_async_cb(GTask *task,
                       gpointer object,
@@ -380,6 +633,7 @@ _open_device_async_cb(GTask *task,
 
     if (!spice_usbredir_channel_open_device(channel, &err)) {
         g_clear_pointer(&priv->device, libusb_unref_device);
+        priv->device_id = 0;
         g_boxed_free(spice_usb_device_get_type(), priv->spice_device);
         priv->spice_device = NULL;
     }
@@ -392,23 +646,18 @@ _open_device_async_cb(GTask *task,
         g_task_return_boolean(task, TRUE);
     }
 }
-#endif
 
-G_GNUC_INTERNAL
-void spice_usbredir_channel_connect_device_async(
-                                          SpiceUsbredirChannel *channel,
-                                          libusb_device        *device,
-                                          SpiceUsbDevice       *spice_device,
-                                          GCancellable         *cancellable,
-                                          GAsyncReadyCallback   callback,
-                                          gpointer              user_data)
+static void spice_usbredir_channel_connect_async(SpiceUsbredirChannel *channel,
+                                                 libusb_device        *device,
+                                                 libusb_device_handle *handle,
+                                                 SpiceUsbDevice       *spice_device,
+                                                 GCancellable         *cancellable,
+                                                 GAsyncReadyCallback   callback,
+                                                 gpointer              user_data)
 {
     SpiceUsbredirChannelPrivate *priv = channel->priv;
     GTask *task;
 
-    g_return_if_fail(SPICE_IS_USBREDIR_CHANNEL(channel));
-    g_return_if_fail(device != NULL);
-
     CHANNEL_DEBUG(channel, "connecting device %04x:%04x (%p) to channel %p",
                   spice_usb_device_get_vid(spice_device),
                   spice_usb_device_get_pid(spice_device),
@@ -431,9 +680,18 @@ void spice_usbredir_channel_connect_device_async(
     }
 
     priv->device = libusb_ref_device(device);
+    priv->device_id = libusb_get_bus_number(device) << 8 |
+                      libusb_get_device_address(device);
     priv->spice_device = g_boxed_copy(spice_usb_device_get_type(),
                                       spice_device);
+    priv->parked_handle = handle;
+    handle = NULL;
 #ifdef USE_POLKIT
+    if (priv->parked_handle != NULL) {
+        /* the device node is already open, no ACL to grant */
+        g_task_run_in_thread(task, _open_device_async_cb);
+        goto done;
+    }
     priv->task = task;
     priv->state  = STATE_WAITING_FOR_ACL_HELPER;
     priv->acl_helper = spice_usb_acl_helper_new();
@@ -451,9 +709,46 @@ void spice_usbredir_channel_connect_device_async(
 #endif
 
 done:
+    if (handle != NULL)
+        libusb_close(handle);
     g_object_unref(task);
 }
 
+G_GNUC_INTERNAL
+void spice_usbredir_channel_connect_device_async(
+                                          SpiceUsbredirChannel *channel,
+                                          libusb_device        *device,
+                                          SpiceUsbDevice       *spice_device,
+                                          GCancellable         *cancellable,
+                                          GAsyncReadyCallback   callback,
+                                          gpointer              user_data)
+{
+    g_return_if_fail(SPICE_IS_USBREDIR_CHANNEL(channel));
+    g_return_if_fail(device != NULL);
+
+    spice_usbredir_channel_connect_async(channel, device, NULL, spice_device,
+                                         cancellable, callback, user_data);
+}
+
+/* Like spice_usbredir_channel_connect_device_async(), for a device the
+ * usb device manager kept open while it was parked. The channel takes
+ * ownership of @handle. */
+G_GNUC_INTERNAL
+void spice_usbredir_channel_connect_handle_async(
+                                          SpiceUsbredirChannel *channel,
+                                          libusb_device_handle *handle,
+                                          SpiceUsbDevice       *spice_device,
+                                          GCancellable         *cancellable,
+                                          GAsyncReadyCallback   callback,
+                                          gpointer              user_data)
+{
+    g_return_if_fail(SPICE_IS_USBREDIR_CHANNEL(channel));
+    g_return_if_fail(handle != NULL);
+
+    spice_usbredir_channel_connect_async(channel, libusb_get_device(handle), handle,
+                                         spice_device, cancellable, callback, user_data);
+}
+
 G_GNUC_INTERNAL
 gboolean spice_usbredir_channel_connect_device_finish(
                                                SpiceUsbredirChannel *channel,
@@ -501,6 +796,7 @@ void spice_usbredir_channel_disconnect_device(SpiceUsbredirChannel *channel)
         /* This also closes the libusb handle we passed from open_device */
         usbredirhost_set_device(priv->host, NULL);
         g_clear_pointer(&priv->device, libusb_unref_device);
+        priv->device_id = 0;
         g_boxed_free(spice_usb_device_get_type(), priv->spice_device);
         priv->spice_device = NULL;
         priv->state  = STATE_DISCONNECTED;
@@ -575,8 +871,21 @@ void spice_usbredir_channel_get_guest_filter(
 #if USBREDIR_VERSION >= 0x000701
 static uint64_t usbredir_buffered_output_size_callback(void *user_data)
 {
+    SpiceUsbredirChannelPrivate *priv;
+    guint64 size;
+
     g_return_val_if_fail(SPICE_IS_USBREDIR_CHANNEL(user_data), 0);
-    return spice_channel_get_queue_size(SPICE_CHANNEL(user_data));
+    priv = SPICE_USBREDIR_CHANNEL(user_data)->priv;
+
+    g_mutex_lock(&priv->pacer_mutex);
+    size = priv->queued_bytes;
+    /* while paced, more data piles up in usbredirhost: have it drop
+     * isochronous packets rather than queue them */
+    if (priv->paced)
+        size = MAX(size, priv->max_queued_bytes);
+    g_mutex_unlock(&priv->pacer_mutex);
+
+    return size;
 }
 #endif
 
@@ -646,14 +955,117 @@ static int usbredir_read_callback(void *user_data, uint8_t *data, int count)
     return count;
 }
 
+/* main context */
+static gboolean usbredir_pacer_resume(gpointer user_data)
+{
+    SpiceUsbredirChannel *channel = user_data;
+
+    /* hand over what usbredirhost held back meanwhile */
+    usbredir_write_flush_callback(channel);
+    g_object_unref(channel);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Any context. Returns TRUE if the device data must stay in usbredirhost
+ * for now: once max_queued_bytes are queued on the channel, nothing more
+ * is taken until the queue drops back below it, see usbredir_pacer_sent().
+ * Data then waits in usbredirhost, which drops isochronous packets, and
+ * the guest doesn't get its bulk transfers completed ahead of the link.
+ */
+static gboolean usbredir_pacer_hold(SpiceUsbredirChannel *channel)
+{
+    SpiceUsbredirChannelPrivate *priv = channel->priv;
+    gboolean hold;
+
+    g_mutex_lock(&priv->pacer_mutex);
+    if (!priv->paced && priv->max_queued_bytes != 0 &&
+        priv->queued_bytes >= priv->max_queued_bytes)
+        priv->paced = TRUE;
+    hold = priv->paced;
+    g_mutex_unlock(&priv->pacer_mutex);
+
+    return hold;
+}
+
+/* any context, called before the message of @size bytes is sent */
+static void usbredir_pacer_queued(SpiceUsbredirChannel *channel, gsize size)
+{
+    SpiceUsbredirChannelPrivate *priv = channel->priv;
+    QueuedData data = {
+        .time = g_get_monotonic_time(),
+        .size = size,
+    };
+
+    g_mutex_lock(&priv->pacer_mutex);
+    g_array_append_val(priv->queued, data);
+    priv->queued_bytes += size;
+    g_mutex_unlock(&priv->pacer_mutex);
+}
+
+/* any context, called as the queued messages are freed, in order. This
+ * may run with the channel xmit queue locked, see channel_reset(). */
+static void usbredir_pacer_sent(SpiceUsbredirChannel *channel)
+{
+    SpiceUsbredirChannelPrivate *priv = channel->priv;
+    QueuedData *data;
+    gint64 delay;
+    guint bucket = 0;
+
+    g_mutex_lock(&priv->pacer_mutex);
+    if (priv->queued_head < priv->queued->len) {
+        data = &g_array_index(priv->queued, QueuedData, priv->queued_head);
+        delay = g_get_monotonic_time() - data->time;
+        priv->queue_delay += (delay - priv->queue_delay) / 8;
+        priv->max_queue_delay = MAX(priv->max_queue_delay, delay);
+        while (bucket < QUEUE_DELAY_BUCKETS - 1 && delay > (125 << bucket))
+            bucket++;
+        priv->queue_delay_hist[bucket]++;
+        priv->queue_delay_sum += delay;
+        priv->queued_bytes -= MIN(priv->queued_bytes, data->size);
+        if (++priv->queued_head == priv->queued->len) {
+            g_array_set_size(priv->queued, 0);
+            priv->queued_head = 0;
+        }
+    }
+    if (priv->paced && (priv->max_queued_bytes == 0 ||
+        priv->queued_bytes < priv->max_queued_bytes)) {
+        priv->paced = FALSE;
+        g_idle_add(usbredir_pacer_resume, g_object_ref(channel));
+    }
+    g_mutex_unlock(&priv->pacer_mutex);
+}
+
 static void usbredir_free_write_cb_data(uint8_t *data, void *user_data)
 {
     SpiceUsbredirChannel *channel = user_data;
     SpiceUsbredirChannelPrivate *priv = channel->priv;
 
+    usbredir_pacer_sent(channel);
     usbredirhost_free_write_buffer(priv->host, data);
 }
 
+#ifdef USE_LZ4
+static void usbredir_free_compressed_data(uint8_t *data, void *user_data)
+{
+    usbredir_pacer_sent(user_data);
+    g_free(data);
+}
+
+/* any context */
+static void usbredir_count_lz4(SpiceUsbredirChannel *channel,
+                               guint uncompressed, guint compressed)
+{
+    SpiceUsbredirChannelPrivate *priv = channel->priv;
+
+    g_mutex_lock(&priv->pacer_mutex);
+    priv->lz4_uncompressed_bytes += uncompressed;
+    priv->lz4_compressed_bytes += compressed;
+    g_mutex_unlock(&priv->pacer_mutex);
+}
+#endif
+
 #ifdef USE_LZ4
 static int try_write_compress_LZ4(SpiceUsbredirChannel *channel, uint8_t *data, int count)
 {
@@ -704,9 +1116,11 @@ static int try_write_compress_LZ4(SpiceUsbredirChannel *channel, uint8_t *data,
         spice_marshaller_add_by_ref_full(msg_out_compressed->marshaller,
                                          compressed_data_msg.compressed_data,
                                          compressed_data_count,
-                                         (spice_marshaller_item_free_func)g_free,
+                                         usbredir_free_compressed_data,
                                          channel);
+        usbredir_pacer_queued(channel, compressed_data_count);
         spice_msg_out_send(msg_out_compressed);
+        usbredir_count_lz4(channel, count, compressed_data_count);
         return TRUE;
     }
 
@@ -721,6 +1135,12 @@ static int usbredir_write_callback(void *user_data, uint8_t *data, int count)
     SpiceUsbredirChannel *channel = user_data;
     SpiceMsgOut *msg_out;
 
+    /* usbredirhost keeps the buffer, and retries on the next flush */
+    if (usbredir_pacer_hold(channel))
+        return 0;
+
+    SPICE_TRACE3(usbredir_write, channel->parent.priv->channel_id,
+                 channel->priv->device_id, count);
 #ifdef USE_LZ4
     if (try_write_compress_LZ4(channel, data, count)) {
         usbredirhost_free_write_buffer(channel->priv->host, data);
@@ -731,6 +1151,7 @@ static int usbredir_write_callback(void *user_data, uint8_t *data, int count)
                                 SPICE_MSGC_SPICEVMC_DATA);
     spice_marshaller_add_by_ref_full(msg_out->marshaller, data, count,
                                      usbredir_free_write_cb_data, channel);
+    usbredir_pacer_queued(channel, count);
     spice_msg_out_send(msg_out);
 
     return count;
@@ -868,6 +1289,9 @@ static void usbredir_handle_msg(SpiceChannel *c, SpiceMsgIn *in)
         if (try_handle_compressed_msg(compressed_data_msg, &buf, &size)) {
             priv->read_buf_size = size;
             priv->read_buf = buf;
+#ifdef USE_LZ4
+            usbredir_count_lz4(channel, size, compressed_data_msg->compressed_size);
+#endif
         } else {
             r = usbredirhost_read_parse_error;
         }
@@ -878,8 +1302,13 @@ static void usbredir_handle_msg(SpiceChannel *c, SpiceMsgIn *in)
     }
 
     spice_usbredir_channel_lock(channel);
-    if (r == 0)
+    if (r == 0) {
+        SPICE_TRACE3(usbredir_parse_begin, c->priv->channel_id,
+                     priv->device_id, priv->read_buf_size);
         r = usbredirhost_read_guest_data(priv->host);
+        SPICE_TRACE3(usbredir_parse_end, c->priv->channel_id,
+                     priv->device_id, r);
+    }
     if (r != 0) {
         SpiceUsbDevice *spice_device = priv->spice_device;
         device_error_data err_data;
@@ -0,0 +1,46 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_CLIENT_WEBDAV_CHANNEL_PRIV_H__
+#define __SPICE_CLIENT_WEBDAV_CHANNEL_PRIV_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* a mux frame is the client id (gint64), the payload size (guint16),
+ * both little endian, then the payload */
+#define MUX_HEADER_SIZE (sizeof(gint64) + sizeof(guint16))
+
+typedef struct _SpiceWebdavDemux SpiceWebdavDemux;
+
+/* a frame header was parsed */
+typedef void (*SpiceWebdavDemuxFrameFunc)(gint64 client, guint16 size, gpointer user_data);
+/* a piece of the payload of the current frame, @payload references the
+ * data passed to spice_webdav_demux_data() */
+typedef void (*SpiceWebdavDemuxPayloadFunc)(gint64 client, GBytes *payload, gpointer user_data);
+
+SpiceWebdavDemux *spice_webdav_demux_new(SpiceWebdavDemuxFrameFunc frame,
+                                         SpiceWebdavDemuxPayloadFunc payload,
+                                         gpointer user_data);
+void spice_webdav_demux_free(SpiceWebdavDemux *demux);
+void spice_webdav_demux_reset(SpiceWebdavDemux *demux);
+void spice_webdav_demux_data(SpiceWebdavDemux *demux, GBytes *bytes);
+
+G_END_DECLS
+
+#endif /* __SPICE_CLIENT_WEBDAV_CHANNEL_PRIV_H__ */
@@ -17,9 +17,13 @@
 */
 #include "config.h"
 
+#include <string.h>
+
 #include "spice-client.h"
 #include "spice-common.h"
 #include "spice-channel-priv.h"
+#include "channel-webdav-priv.h"
+#include "spice-log-priv.h"
 #include "spice-session-priv.h"
 #include "spice-marshal.h"
 #include "vmcstream.h"
@@ -48,6 +52,22 @@
 #define SPICE_WEBDAV_CHANNEL_GET_PRIVATE(obj)                                  \
     (G_TYPE_INSTANCE_GET_PRIVATE((obj), SPICE_TYPE_WEBDAV_CHANNEL, SpiceWebdavChannelPrivate))
 
+#define MAX_MUX_SIZE G_MAXUINT16
+/* client id and payload size, little endian */
+
+/* frames read ahead from a client, while the previous ones are on their
+ * way to the guest */
+#define CLIENT_MAX_FRAMES 4
+/* frames are sent together, in messages of up to this size */
+#define OUTPUT_QUEUE_MAX_BATCH (64 * 1024)
+/* bytes handed to the channel and not written to the socket yet, the
+ * next frames wait in the queue meanwhile */
+#define OUTPUT_QUEUE_MAX_PENDING (1024 * 1024)
+/* bytes from the guest not written to the clients yet, the channel isn't
+ * read meanwhile */
+#define DEMUX_MAX_PENDING (1024 * 1024)
+
+typedef struct Client Client;
 typedef struct _OutputQueue OutputQueue;
 
 struct _SpiceWebdavChannelPrivate {
@@ -56,11 +76,11 @@ struct _SpiceWebdavChannelPrivate {
     GHashTable *clients;
     OutputQueue *queue;
 
+    /* frames from the guest, parsed as the messages come */
     gboolean demuxing;
     struct _demux {
-        gint64 client;
-        guint16 size;
-        guint8 *buf;
+        SpiceWebdavDemux *parser;
+        gsize pending;
     } demux;
 };
 
@@ -68,142 +88,171 @@ G_DEFINE_TYPE(SpiceWebdavChannel, spice_webdav_channel, SPICE_TYPE_PORT_CHANNEL)
 
 static void spice_webdav_handle_msg(SpiceChannel *channel, SpiceMsgIn *msg);
 
+struct Client
+{
+    guint refs;
+    SpiceWebdavChannel *self;
+    GIOStream *pipe;
+    gint64 id;
+    GCancellable *cancellable;
+
+    /* to the guest: frames read and not written to the socket yet */
+    guint frames;
+    gboolean reading;
+    gboolean eof;
+
+    /* from the guest: payloads to write to the pipe */
+    GQueue output;
+    gsize output_size;
+    gboolean writing;
+
+    gint64 start_time;
+    guint64 bytes_to_guest;
+    guint64 bytes_from_guest;
+};
+
+typedef struct _MuxFrame {
+    OutputQueue *queue;
+    Client *client;
+    gsize size; /* header included */
+    guint8 data[MUX_HEADER_SIZE + MAX_MUX_SIZE];
+} MuxFrame;
+
+/* Frames of all the clients, sent in batches. The frames are referenced
+ * until they reach the socket. */
 struct _OutputQueue {
-    GOutputStream *output;
-    gboolean flushing;
+    SpiceChannel *channel; /* weak, NULL once the channel is gone */
+    gboolean opened; /* frames are only sent while the port is opened */
+    GQueue frames;
+    gsize pending;
+    guint in_flight;
     guint idle_id;
-    GQueue *queue;
 };
 
-typedef struct _OutputQueueElem {
-    OutputQueue *queue;
-    const guint8 *buf;
-    gsize size;
-    GFunc pushed_cb;
-    gpointer user_data;
-} OutputQueueElem;
+static void client_unref(Client *client);
+static void client_start_read(Client *client);
+static void remove_client(Client *client);
+
+static void mux_frame_free(MuxFrame *frame)
+{
+    client_unref(frame->client);
+    g_free(frame);
+}
 
-static OutputQueue* output_queue_new(GOutputStream *output)
+static OutputQueue* output_queue_new(SpiceChannel *channel)
 {
     OutputQueue *queue = g_new0(OutputQueue, 1);
 
-    queue->output = g_object_ref(output);
-    queue->queue = g_queue_new();
+    queue->channel = channel;
+    g_queue_init(&queue->frames);
 
     return queue;
 }
 
-static void output_queue_free(OutputQueue *queue)
+/* drops the frames not handed to the channel yet */
+static void output_queue_drop(OutputQueue *queue)
 {
-    g_warn_if_fail(g_queue_get_length(queue->queue) == 0);
-    g_warn_if_fail(!queue->flushing);
-
-    g_queue_free_full(queue->queue, g_free);
-    g_clear_object(&queue->output);
+    g_queue_foreach(&queue->frames, (GFunc)mux_frame_free, NULL);
+    g_queue_clear(&queue->frames);
     if (queue->idle_id)
         g_source_remove(queue->idle_id);
-    g_free(queue);
+    queue->idle_id = 0;
 }
 
-static gboolean output_queue_idle(gpointer user_data);
-
-static void output_queue_flush_cb(GObject *source_object,
-                                  GAsyncResult *res,
-                                  gpointer user_data)
+/* the frames in flight free the queue once they are done */
+static void output_queue_free(OutputQueue *queue)
 {
-    GError *error = NULL;
-    OutputQueueElem *e = user_data;
-    OutputQueue *q = e->queue;
+    output_queue_drop(queue);
+    queue->channel = NULL;
 
-    q->flushing = FALSE;
-    g_output_stream_flush_finish(G_OUTPUT_STREAM(source_object),
-                                 res, &error);
-    if (error)
-        g_warning("error: %s", error->message);
+    if (queue->in_flight == 0)
+        g_free(queue);
+}
 
-    g_clear_error(&error);
+static gboolean output_queue_idle(gpointer user_data);
 
-    if (!q->idle_id)
+static void output_queue_schedule(OutputQueue *q)
+{
+    if (q->opened && !q->idle_id && !g_queue_is_empty(&q->frames) &&
+        q->pending < OUTPUT_QUEUE_MAX_PENDING)
         q->idle_id = g_idle_add(output_queue_idle, q);
-
-    g_free(e);
 }
 
-static gboolean output_queue_idle(gpointer user_data)
+/* the frame was written to the socket, or dropped with the channel */
+static void output_queue_frame_sent(uint8_t *data, void *opaque)
 {
-    OutputQueue *q = user_data;
-    OutputQueueElem *e;
-    GError *error = NULL;
-
-    if (q->flushing) {
-        q->idle_id = 0;
-        return FALSE;
+    MuxFrame *frame = opaque;
+    OutputQueue *q = frame->queue;
+    Client *client = frame->client;
+
+    q->pending -= frame->size;
+    q->in_flight--;
+    if (q->channel == NULL) {
+        mux_frame_free(frame);
+        if (q->in_flight == 0)
+            g_free(q);
+        return;
     }
 
-    e = g_queue_pop_head(q->queue);
-    if (!e) {
-        q->idle_id = 0;
-        return FALSE;
+    client->frames--;
+    if (g_cancellable_is_cancelled(client->cancellable)) {
+        /* the client was removed */
+    } else if (client->eof) {
+        if (client->frames == 0)
+            remove_client(client);
+    } else {
+        client_start_read(client);
     }
+    mux_frame_free(frame);
 
-    if (!g_output_stream_write_all(q->output, e->buf, e->size, NULL, NULL, &error))
-        goto err;
-    else if (e->pushed_cb)
-        e->pushed_cb(q, e->user_data);
+    output_queue_schedule(q);
+}
 
-    q->flushing = TRUE;
-    g_output_stream_flush_async(q->output, G_PRIORITY_DEFAULT, NULL, output_queue_flush_cb, e);
+static gboolean output_queue_idle(gpointer user_data)
+{
+    OutputQueue *q = user_data;
+    SpiceMsgOut *msg_out = NULL;
+    gsize batch = 0;
 
-    return TRUE;
+    q->idle_id = 0;
+    while (q->pending < OUTPUT_QUEUE_MAX_PENDING && batch < OUTPUT_QUEUE_MAX_BATCH) {
+        MuxFrame *frame = g_queue_pop_head(&q->frames);
+
+        if (frame == NULL)
+            break;
+
+        if (msg_out == NULL)
+            msg_out = spice_msg_out_new(q->channel, SPICE_MSGC_SPICEVMC_DATA);
+        q->pending += frame->size;
+        q->in_flight++;
+        batch += frame->size;
+        spice_marshaller_add_by_ref_full(msg_out->marshaller, frame->data, frame->size,
+                                         output_queue_frame_sent, frame);
+    }
 
-err:
-    g_warning("failed to write to output stream");
-    if (error)
-        g_warning("error: %s", error->message);
-    g_clear_error(&error);
+    if (msg_out != NULL)
+        spice_msg_out_send(msg_out);
 
-    q->idle_id = 0;
+    output_queue_schedule(q);
     return FALSE;
 }
 
-static void output_queue_push(OutputQueue *q, const guint8 *buf, gsize size,
-                              GFunc pushed_cb, gpointer user_data)
+static void output_queue_push(OutputQueue *q, MuxFrame *frame)
 {
-    OutputQueueElem *e = g_new(OutputQueueElem, 1);
-
-    e->buf = buf;
-    e->size = size;
-    e->pushed_cb = pushed_cb;
-    e->user_data = user_data;
-    e->queue = q;
-    g_queue_push_tail(q->queue, e);
-
-    if (!q->idle_id && !q->flushing)
-        q->idle_id = g_idle_add(output_queue_idle, q);
+    frame->queue = q;
+    g_queue_push_tail(&q->frames, frame);
+    /* frames read meanwhile join the batch */
+    output_queue_schedule(q);
 }
 
-typedef struct Client
-{
-    guint refs;
-    SpiceWebdavChannel *self;
-    GIOStream *pipe;
-    gint64 id;
-    GCancellable *cancellable;
-
-    struct _mux {
-        gint64 id;
-        guint16 size;
-        guint8 *buf;
-    } mux;
-} Client;
-
 static void
 client_unref(Client *client)
 {
     if (--client->refs > 0)
         return;
 
-    g_free(client->mux.buf);
+    g_queue_foreach(&client->output, (GFunc)g_bytes_unref, NULL);
+    g_queue_clear(&client->output);
 
     g_object_unref(client->pipe);
     g_object_unref(client->cancellable);
@@ -218,54 +267,48 @@ client_ref(Client *client)
     return client;
 }
 
-static void client_start_read(Client *client);
-
 static void remove_client(Client *client)
 {
     if (g_cancellable_is_cancelled(client->cancellable))
         return;
 
-    g_cancellable_cancel(client->cancellable);
-
     g_hash_table_remove(client->self->priv->clients, &client->id);
 }
 
-static void mux_pushed_cb(OutputQueue *q, gpointer user_data)
-{
-    Client *client = user_data;
-
-    if (client->mux.size == 0) {
-        remove_client(client);
-    } else {
-        client_start_read(client);
-    }
-
-    client_unref(client);
-}
-
-#define MAX_MUX_SIZE G_MAXUINT16
-
 static void server_reply_cb(GObject *source_object,
                             GAsyncResult *res,
                             gpointer user_data)
 {
-    Client *client = user_data;
-    SpiceWebdavChannelPrivate *c = client->self->priv;
+    MuxFrame *frame = user_data;
+    Client *client = frame->client;
+    SpiceWebdavChannelPrivate *c;
     GError *err = NULL;
     gssize size;
+    gint64 id;
+    guint16 len;
 
     size = g_input_stream_read_finish(G_INPUT_STREAM(source_object), res, &err);
     if (err || g_cancellable_is_cancelled(client->cancellable))
         goto end;
 
+    client->reading = FALSE;
     g_return_if_fail(size <= MAX_MUX_SIZE);
     g_return_if_fail(size >= 0);
-    client->mux.size = size;
 
-    output_queue_push(c->queue, (guint8 *)&client->mux.id, sizeof(gint64), NULL, NULL);
-    client->mux.size = GUINT16_TO_LE(client->mux.size);
-    output_queue_push(c->queue, (guint8 *)&client->mux.size, sizeof(guint16), NULL, NULL);
-    output_queue_push(c->queue, (guint8 *)client->mux.buf, size, (GFunc)mux_pushed_cb, client);
+    id = GINT64_TO_LE(client->id);
+    len = GUINT16_TO_LE(size);
+    memcpy(frame->data, &id, sizeof(id));
+    memcpy(frame->data + sizeof(id), &len, sizeof(len));
+    frame->size = MUX_HEADER_SIZE + size;
+
+    /* an empty frame tells the guest the client is done */
+    client->eof = (size == 0);
+    client->frames++;
+    client->bytes_to_guest += size;
+
+    c = client->self->priv;
+    output_queue_push(c->queue, frame);
+    client_start_read(client);
 
     return;
 
@@ -277,81 +320,107 @@ end:
         g_clear_error(&err);
     }
 
-    client_unref(client);
+    mux_frame_free(frame);
 }
 
 static void client_start_read(Client *client)
 {
     GInputStream *input;
+    MuxFrame *frame;
+
+    if (client->reading || client->eof || client->frames >= CLIENT_MAX_FRAMES)
+        return;
+
+    frame = g_new(MuxFrame, 1);
+    frame->client = client_ref(client);
+    client->reading = TRUE;
 
     input = g_io_stream_get_input_stream(G_IO_STREAM(client->pipe));
-    g_input_stream_read_async(input, client->mux.buf, MAX_MUX_SIZE,
+    g_input_stream_read_async(input, frame->data + MUX_HEADER_SIZE, MAX_MUX_SIZE,
                               G_PRIORITY_DEFAULT, client->cancellable, server_reply_cb,
-                              client_ref(client));
+                              frame);
 }
 
 static void start_demux(SpiceWebdavChannel *self);
 
 #ifdef USE_PHODAV
-static void demux_to_client_finish(Client *client, gboolean fail)
-{
-    SpiceWebdavChannel *self = client->self;
-    SpiceWebdavChannelPrivate *c = self->priv;
-
-    if (fail) {
-        remove_client(client);
-    }
-
-    c->demuxing = FALSE;
-    start_demux(self);
-}
+static void client_write_next(Client *client);
 
-static void demux_to_client_cb(GObject *source, GAsyncResult *result, gpointer user_data)
+static void client_write_cb(GObject *source, GAsyncResult *result, gpointer user_data)
 {
     Client *client = user_data;
-    SpiceWebdavChannelPrivate *c = client->self->priv;
+    GBytes *bytes = g_queue_pop_head(&client->output);
+    SpiceWebdavChannelPrivate *c;
     GError *error = NULL;
-    gboolean fail;
     gsize size;
 
 G_GNUC_BEGIN_IGNORE_DEPRECATIONS
     g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), result, &size, &error);
 G_GNUC_END_IGNORE_DEPRECATIONS
 
+    client->writing = FALSE;
+    if (g_cancellable_is_cancelled(client->cancellable)) {
+        /* the pending bytes were accounted for on removal */
+        goto end;
+    }
+
+    c = client->self->priv;
+    client->output_size -= g_bytes_get_size(bytes);
+    c->demux.pending -= g_bytes_get_size(bytes);
+    client->bytes_from_guest += size;
+
     if (error) {
         CHANNEL_DEBUG(client->self, "write failed: %s", error->message);
-        g_clear_error(&error);
+        remove_client(client);
+    } else {
+        g_warn_if_fail(size == g_bytes_get_size(bytes));
+        client_write_next(client);
     }
+    start_demux(client->self);
 
-    fail = (size != c->demux.size);
-    g_warn_if_fail(size == c->demux.size);
-    demux_to_client_finish(client, fail);
+end:
+    g_clear_error(&error);
+    g_bytes_unref(bytes);
+    client_unref(client);
+}
+
+static void client_write_next(Client *client)
+{
+    GBytes *bytes = g_queue_peek_head(&client->output);
+    gsize size;
+    gconstpointer data;
+
+    if (client->writing || bytes == NULL)
+        return;
+
+    client->writing = TRUE;
+    data = g_bytes_get_data(bytes, &size);
+G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+    g_output_stream_write_all_async(g_io_stream_get_output_stream(client->pipe),
+                                    data, size, G_PRIORITY_DEFAULT,
+                                    client->cancellable, client_write_cb,
+                                    client_ref(client));
+G_GNUC_END_IGNORE_DEPRECATIONS
 }
 #endif
 
-static void demux_to_client(Client *client)
+/* @bytes references a part of a message */
+static void demux_to_client(Client *client, GBytes *bytes)
 {
 #ifdef USE_PHODAV
     SpiceWebdavChannelPrivate *c = client->self->priv;
-    gsize size = c->demux.size;
+    gsize size = g_bytes_get_size(bytes);
 
     CHANNEL_DEBUG(client->self, "pushing %"G_GSIZE_FORMAT" to client %p", size, client);
 
-    if (size > 0) {
-G_GNUC_BEGIN_IGNORE_DEPRECATIONS
-        g_output_stream_write_all_async(g_io_stream_get_output_stream(client->pipe),
-                                        c->demux.buf, size, G_PRIORITY_DEFAULT,
-                                        c->cancellable, demux_to_client_cb, client);
-G_GNUC_END_IGNORE_DEPRECATIONS
-        return;
-    } else {
-        /* Nothing to write */
-        demux_to_client_finish(client, FALSE);
-    }
+    g_queue_push_tail(&client->output, g_bytes_ref(bytes));
+    client->output_size += size;
+    c->demux.pending += size;
+    client_write_next(client);
 #endif
 }
 
-static void start_client(SpiceWebdavChannel *self)
+static Client *start_client(SpiceWebdavChannel *self, gint64 id)
 {
 #ifdef USE_PHODAV
     SpiceWebdavChannelPrivate *c = self->priv;
@@ -365,15 +434,15 @@ static void start_client(SpiceWebdavChannel *self)
     session = spice_channel_get_session(SPICE_CHANNEL(self));
     server = phodav_server_get_soup_server(spice_session_get_webdav_server(session));
 
-    CHANNEL_DEBUG(self, "starting client %" G_GINT64_FORMAT, c->demux.client);
+    CHANNEL_DEBUG(self, "starting client %" G_GINT64_FORMAT, id);
 
     client = g_new0(Client, 1);
     client->refs = 1;
-    client->id = c->demux.client;
+    client->id = id;
     client->self = self;
-    client->mux.id = GINT64_TO_LE(client->id);
-    client->mux.buf = g_malloc0(MAX_MUX_SIZE);
     client->cancellable = g_cancellable_new();
+    client->start_time = g_get_monotonic_time();
+    g_queue_init(&client->output);
     spice_make_pipe(&client->pipe, &peer);
 
 G_GNUC_BEGIN_IGNORE_DEPRECATIONS
@@ -385,10 +454,9 @@ G_GNUC_END_IGNORE_DEPRECATIONS
     g_hash_table_insert(c->clients, &client->id, client);
 
     client_start_read(client);
-    demux_to_client(client);
 
     g_clear_object(&addr);
-    return;
+    return client;
 
 fail:
     if (error)
@@ -399,106 +467,146 @@ fail:
     g_clear_error(&error);
     client_unref(client);
 #endif
+    return NULL;
 }
 
-static void data_read_cb(GObject *source_object,
-                         GAsyncResult *res,
-                         gpointer user_data)
+struct _SpiceWebdavDemux {
+    SpiceWebdavDemuxFrameFunc frame;
+    SpiceWebdavDemuxPayloadFunc payload;
+    gpointer user_data;
+
+    guint8 header[MUX_HEADER_SIZE];
+    gsize header_len;
+    gint64 client;
+    guint16 size; /* of the payload still to come */
+};
+
+SpiceWebdavDemux *spice_webdav_demux_new(SpiceWebdavDemuxFrameFunc frame,
+                                         SpiceWebdavDemuxPayloadFunc payload,
+                                         gpointer user_data)
 {
-    SpiceWebdavChannel *self = user_data;
-    SpiceWebdavChannelPrivate *c;
-    Client *client;
-    GError *error = NULL;
-    gssize size;
+    SpiceWebdavDemux *demux = g_new0(SpiceWebdavDemux, 1);
 
-    size = spice_vmc_input_stream_read_all_finish(G_INPUT_STREAM(source_object), res, &error);
-    if (error) {
-        g_warning("error: %s", error->message);
-        g_clear_error(&error);
-        return;
-    }
+    demux->frame = frame;
+    demux->payload = payload;
+    demux->user_data = user_data;
 
-    c = self->priv;
-    g_return_if_fail(size == c->demux.size);
+    return demux;
+}
 
-    client = g_hash_table_lookup(c->clients, &c->demux.client);
+void spice_webdav_demux_free(SpiceWebdavDemux *demux)
+{
+    g_free(demux);
+}
 
-    if (client)
-        demux_to_client(client);
-    else
-        start_client(self);
+/* drops the frame being parsed */
+void spice_webdav_demux_reset(SpiceWebdavDemux *demux)
+{
+    demux->header_len = 0;
+    demux->size = 0;
 }
 
+/* Splits the data of a message into the frames of the clients, a frame
+ * may span several messages */
+void spice_webdav_demux_data(SpiceWebdavDemux *demux, GBytes *bytes)
+{
+    const guint8 *data;
+    gsize size, offset = 0;
+
+    data = g_bytes_get_data(bytes, &size);
+    while (offset < size) {
+        GBytes *payload;
+        gsize n;
+
+        if (demux->header_len < MUX_HEADER_SIZE) {
+            gint64 id;
+            guint16 len;
+
+            n = MIN(MUX_HEADER_SIZE - demux->header_len, size - offset);
+            memcpy(demux->header + demux->header_len, data + offset, n);
+            demux->header_len += n;
+            offset += n;
+            if (demux->header_len < MUX_HEADER_SIZE)
+                break;
+
+            memcpy(&id, demux->header, sizeof(id));
+            memcpy(&len, demux->header + sizeof(id), sizeof(len));
+            demux->client = GINT64_FROM_LE(id);
+            demux->size = GUINT16_FROM_LE(len);
+
+            demux->frame(demux->client, demux->size, demux->user_data);
+            if (demux->size == 0)
+                demux->header_len = 0;
+            continue;
+        }
+
+        n = MIN(demux->size, size - offset);
+        payload = g_bytes_new_from_bytes(bytes, offset, n);
+        demux->payload(demux->client, payload, demux->user_data);
+        g_bytes_unref(payload);
+        offset += n;
+        demux->size -= n;
+        if (demux->size == 0)
+            demux->header_len = 0;
+    }
+}
 
-static void size_read_cb(GObject *source_object,
-                         GAsyncResult *res,
-                         gpointer user_data)
+static void demux_frame(gint64 id, guint16 size G_GNUC_UNUSED, gpointer user_data)
 {
     SpiceWebdavChannel *self = user_data;
-    SpiceWebdavChannelPrivate *c;
-    GInputStream *istream = G_INPUT_STREAM(source_object);
-    GError *error = NULL;
-    gssize size;
 
-    size = spice_vmc_input_stream_read_all_finish(G_INPUT_STREAM(source_object), res, &error);
-    if (error || size != sizeof(guint16))
-        goto end;
+    if (g_hash_table_lookup(self->priv->clients, &id) == NULL)
+        start_client(self, id);
+}
 
-    c = self->priv;
-    c->demux.size = GUINT16_FROM_LE(c->demux.size);
-    spice_vmc_input_stream_read_all_async(istream,
-        c->demux.buf, c->demux.size,
-        G_PRIORITY_DEFAULT, c->cancellable, data_read_cb, self);
-    return;
+static void demux_payload(gint64 id, GBytes *payload, gpointer user_data)
+{
+    SpiceWebdavChannel *self = user_data;
+    Client *client = g_hash_table_lookup(self->priv->clients, &id);
 
-end:
-    if (error) {
-        g_warning("error: %s", error->message);
-        g_clear_error(&error);
-    }
+    if (client != NULL)
+        demux_to_client(client, payload);
 }
 
-static void client_read_cb(GObject *source_object,
-                               GAsyncResult *res,
-                               gpointer user_data)
+static void demux_read_cb(GObject *source_object,
+                          GAsyncResult *res,
+                          gpointer user_data)
 {
     SpiceWebdavChannel *self = user_data;
-    SpiceWebdavChannelPrivate *c = self->priv;
-    GInputStream *istream = G_INPUT_STREAM(source_object);
     GError *error = NULL;
-    gssize size;
-
-    size = spice_vmc_input_stream_read_all_finish(G_INPUT_STREAM(source_object), res, &error);
-    if (error || size != sizeof(gint64))
-        goto end;
-
-    c->demux.client = GINT64_FROM_LE(c->demux.client);
-    spice_vmc_input_stream_read_all_async(istream,
-        &c->demux.size, sizeof(guint16),
-        G_PRIORITY_DEFAULT, c->cancellable, size_read_cb, self);
-    return;
+    GBytes *bytes;
 
-end:
+    bytes = spice_vmc_input_stream_read_bytes_finish(G_INPUT_STREAM(source_object), res, &error);
     if (error) {
-        g_warning("error: %s", error->message);
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning("error: %s", error->message);
         g_clear_error(&error);
+        return;
     }
+
+    self->priv->demuxing = FALSE;
+    spice_webdav_demux_data(self->priv->demux.parser, bytes);
+    g_bytes_unref(bytes);
+
+    start_demux(self);
 }
 
+/* reads what the current message has left, unless the clients are
+ * behind */
 static void start_demux(SpiceWebdavChannel *self)
 {
     SpiceWebdavChannelPrivate *c = self->priv;
     GInputStream *istream = g_io_stream_get_input_stream(G_IO_STREAM(c->stream));
 
-    if (c->demuxing)
+    if (c->demuxing || c->cancellable == NULL ||
+        g_cancellable_is_cancelled(c->cancellable) ||
+        c->demux.pending >= DEMUX_MAX_PENDING)
         return;
 
     c->demuxing = TRUE;
 
-    CHANNEL_DEBUG(self, "start demux");
-    spice_vmc_input_stream_read_all_async(istream, &c->demux.client, sizeof(gint64),
-        G_PRIORITY_DEFAULT, c->cancellable, client_read_cb, self);
-
+    spice_vmc_input_stream_read_bytes_async(istream, G_MAXSSIZE,
+        G_PRIORITY_DEFAULT, c->cancellable, demux_read_cb, self);
 }
 
 static void port_event(SpiceWebdavChannel *self, gint event)
@@ -509,17 +617,38 @@ static void port_event(SpiceWebdavChannel *self, gint event)
     if (event == SPICE_PORT_EVENT_OPENED) {
         g_clear_object(&c->cancellable);
         c->cancellable = g_cancellable_new();
+        c->queue->opened = TRUE;
         start_demux(self);
     } else {
         g_cancellable_cancel(c->cancellable);
         c->demuxing = FALSE;
         g_hash_table_remove_all(c->clients);
+        /* the frames of the removed clients */
+        c->queue->opened = FALSE;
+        output_queue_drop(c->queue);
+        spice_webdav_demux_reset(c->demux.parser);
+        g_warn_if_fail(c->demux.pending == 0);
     }
 }
 
 static void client_remove_unref(gpointer data)
 {
     Client *client = data;
+    SpiceWebdavChannelPrivate *c = client->self->priv;
+    gint64 elapsed = g_get_monotonic_time() - client->start_time;
+
+    SPICE_LOG_INFO("webdav client %" G_GINT64_FORMAT " done in %.3fs: "
+                   "%" G_GUINT64_FORMAT " bytes to the guest (%.0f KB/s), "
+                   "%" G_GUINT64_FORMAT " from the guest (%.0f KB/s)",
+                   client->id, elapsed / (double)G_USEC_PER_SEC,
+                   client->bytes_to_guest,
+                   client->bytes_to_guest * 1000. / MAX(elapsed, 1) / 1.024,
+                   client->bytes_from_guest,
+                   client->bytes_from_guest * 1000. / MAX(elapsed, 1) / 1.024);
+
+    /* what is left to write is dropped */
+    c->demux.pending -= client->output_size;
+    client->output_size = 0;
 
     g_cancellable_cancel(client->cancellable);
     client_unref(client);
@@ -533,19 +662,9 @@ static void spice_webdav_channel_init(SpiceWebdavChannel *channel)
     c->stream = spice_vmc_stream_new(SPICE_CHANNEL(channel));
     c->clients = g_hash_table_new_full(g_int64_hash, g_int64_equal,
                                        NULL, client_remove_unref);
-    c->demux.buf = g_malloc0(MAX_MUX_SIZE);
 
-    GOutputStream *ostream = g_io_stream_get_output_stream(G_IO_STREAM(c->stream));
-    c->queue = output_queue_new(ostream);
-}
-
-static void spice_webdav_channel_finalize(GObject *object)
-{
-    SpiceWebdavChannelPrivate *c = SPICE_WEBDAV_CHANNEL(object)->priv;
-
-    g_free(c->demux.buf);
-
-    G_OBJECT_CLASS(spice_webdav_channel_parent_class)->finalize(object);
+    c->queue = output_queue_new(SPICE_CHANNEL(channel));
+    c->demux.parser = spice_webdav_demux_new(demux_frame, demux_payload, channel);
 }
 
 static void spice_webdav_channel_dispose(GObject *object)
@@ -557,6 +676,7 @@ static void spice_webdav_channel_dispose(GObject *object)
     g_clear_pointer(&c->queue, output_queue_free);
     g_clear_object(&c->stream);
     g_hash_table_unref(c->clients);
+    g_clear_pointer(&c->demux.parser, spice_webdav_demux_free);
 
     G_OBJECT_CLASS(spice_webdav_channel_parent_class)->dispose(object);
 }
@@ -566,15 +686,30 @@ static void spice_webdav_channel_up(SpiceChannel *channel)
     CHANNEL_DEBUG(channel, "up");
 }
 
+static void spice_webdav_channel_reset(SpiceChannel *channel, gboolean migrating)
+{
+    SpiceWebdavChannel *self = SPICE_WEBDAV_CHANNEL(channel);
+    SpiceWebdavChannelPrivate *c = self->priv;
+
+    /* the port closes with the connection, without an event */
+    port_event(self, SPICE_PORT_EVENT_CLOSED);
+    /* the frames handed to the previous connection free their queue as
+     * the channel drops them, the next connection starts from scratch */
+    output_queue_free(c->queue);
+    c->queue = output_queue_new(channel);
+
+    SPICE_CHANNEL_CLASS(spice_webdav_channel_parent_class)->channel_reset(channel, migrating);
+}
+
 static void spice_webdav_channel_class_init(SpiceWebdavChannelClass *klass)
 {
     GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
     SpiceChannelClass *channel_class = SPICE_CHANNEL_CLASS(klass);
 
     gobject_class->dispose      = spice_webdav_channel_dispose;
-    gobject_class->finalize     = spice_webdav_channel_finalize;
     channel_class->handle_msg   = spice_webdav_handle_msg;
     channel_class->channel_up   = spice_webdav_channel_up;
+    channel_class->channel_reset = spice_webdav_channel_reset;
 
     g_signal_override_class_handler("port-event",
                                     SPICE_TYPE_WEBDAV_CHANNEL,
@@ -588,15 +723,21 @@ static void webdav_handle_data_msg(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceWebdavChannel *self = SPICE_WEBDAV_CHANNEL(channel);
     SpiceWebdavChannelPrivate *c = self->priv;
+    GBytes *bytes;
     int size;
     uint8_t *buf;
 
     buf = spice_msg_in_raw(in, &size);
     CHANNEL_DEBUG(channel, "len:%d buf:%p", size, buf);
 
+    /* the demuxer may keep parts of the message until they are written
+     * to the client */
+    spice_msg_in_ref(in);
+    bytes = g_bytes_new_with_free_func(buf, size, (GDestroyNotify)spice_msg_in_unref, in);
     spice_vmc_input_stream_co_data(
         SPICE_VMC_INPUT_STREAM(g_io_stream_get_input_stream(G_IO_STREAM(c->stream))),
-        buf, size);
+        bytes);
+    g_bytes_unref(bytes);
 }
 
 
@@ -25,10 +25,196 @@
 #endif
 
 #include <errno.h>
+#include <stdint.h>
+#include <string.h>
 #include <glib.h>
 
 #include "continuation.h"
 
+#if WITH_ASM_SWITCH
+#if defined(__CET__) && (__CET__ & 2)
+/* cc_switch() returns to a frame the shadow stack doesn't know about */
+#error "the asm context switch doesn't support CET shadow stacks"
+#endif
+
+/*
+ * cc_switch() saves the callee-saved registers on the current stack,
+ * stores the stack pointer in *from_sp and resumes the context saved at
+ * to_sp. Unlike getcontext(), it doesn't save the signal mask, so a
+ * switch costs no syscall.
+ *
+ * A new continuation starts in cc_start, with the continuation in a
+ * callee-saved register, see cc_init().
+ */
+void cc_switch(void **from_sp, void *to_sp) G_GNUC_INTERNAL;
+void cc_start(void) G_GNUC_INTERNAL;
+/* only called from cc_start, keep it through LTO */
+void cc_run(struct continuation *cc) G_GNUC_INTERNAL __attribute__((used));
+
+#if defined(__x86_64__)
+/* rbp, rbx, r12-r15, then mxcsr and the x87 control word */
+#define CC_FRAME_SIZE (8 * 8)
+#define CC_FRAME_ARG 4		/* r12 */
+#define CC_FRAME_START 7	/* return address */
+
+__asm__(
+	".pushsection .text\n"
+	".globl cc_switch\n"
+	".hidden cc_switch\n"
+	".type cc_switch, @function\n"
+	"cc_switch:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $8, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	ldmxcsr (%rsp)\n"
+	"	fldcw 4(%rsp)\n"
+	"	addq $8, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size cc_switch, .-cc_switch\n"
+	"\n"
+	".globl cc_start\n"
+	".hidden cc_start\n"
+	".type cc_start, @function\n"
+	"cc_start:\n"
+	"	.cfi_startproc\n"
+	"	.cfi_undefined rip\n"
+	"	movq %r12, %rdi\n"
+	"	call cc_run\n"
+	"	ud2\n"
+	"	.cfi_endproc\n"
+	".size cc_start, .-cc_start\n"
+	".popsection\n"
+);
+
+static void cc_frame_init(void **frame)
+{
+	guint32 *fpu = (guint32 *)frame;
+
+	/* the default control words, as set at process startup */
+	fpu[0] = 0x1f80;
+	fpu[1] = 0x037f;
+}
+#elif defined(__aarch64__)
+/* x19-x28, x29, x30, d8-d15, then fpcr and padding */
+#define CC_FRAME_SIZE (22 * 8)
+#define CC_FRAME_ARG 0		/* x19 */
+#define CC_FRAME_START 11	/* x30 */
+
+__asm__(
+	".pushsection .text\n"
+	".globl cc_switch\n"
+	".hidden cc_switch\n"
+	".type cc_switch, %function\n"
+	"cc_switch:\n"
+	"	sub sp, sp, #176\n"
+	"	stp x19, x20, [sp, #0]\n"
+	"	stp x21, x22, [sp, #16]\n"
+	"	stp x23, x24, [sp, #32]\n"
+	"	stp x25, x26, [sp, #48]\n"
+	"	stp x27, x28, [sp, #64]\n"
+	"	stp x29, x30, [sp, #80]\n"
+	"	stp d8, d9, [sp, #96]\n"
+	"	stp d10, d11, [sp, #112]\n"
+	"	stp d12, d13, [sp, #128]\n"
+	"	stp d14, d15, [sp, #144]\n"
+	"	mrs x2, fpcr\n"
+	"	str x2, [sp, #160]\n"
+	"	mov x2, sp\n"
+	"	str x2, [x0]\n"
+	"	mov sp, x1\n"
+	"	ldr x2, [sp, #160]\n"
+	"	msr fpcr, x2\n"
+	"	ldp x19, x20, [sp, #0]\n"
+	"	ldp x21, x22, [sp, #16]\n"
+	"	ldp x23, x24, [sp, #32]\n"
+	"	ldp x25, x26, [sp, #48]\n"
+	"	ldp x27, x28, [sp, #64]\n"
+	"	ldp x29, x30, [sp, #80]\n"
+	"	ldp d8, d9, [sp, #96]\n"
+	"	ldp d10, d11, [sp, #112]\n"
+	"	ldp d12, d13, [sp, #128]\n"
+	"	ldp d14, d15, [sp, #144]\n"
+	"	add sp, sp, #176\n"
+	"	ret\n"
+	".size cc_switch, .-cc_switch\n"
+	"\n"
+	".globl cc_start\n"
+	".hidden cc_start\n"
+	".type cc_start, %function\n"
+	"cc_start:\n"
+	"	.cfi_startproc\n"
+	"	.cfi_undefined x30\n"
+	"	mov x0, x19\n"
+	"	bl cc_run\n"
+	"	brk #0\n"
+	"	.cfi_endproc\n"
+	".size cc_start, .-cc_start\n"
+	".popsection\n"
+);
+
+static void cc_frame_init(void **frame G_GNUC_UNUSED)
+{
+	/* fpcr 0: round to nearest, no traps, as at process startup */
+}
+#else
+#error "no asm context switch for this architecture"
+#endif
+
+void cc_run(struct continuation *cc)
+{
+	cc->entry(cc);
+
+	/* back to whoever switched to us last, for good */
+	cc->exited = 1;
+	cc_switch(&cc->sp, cc->last->sp);
+}
+
+void cc_init(struct continuation *cc)
+{
+	uintptr_t top = ((uintptr_t)cc->stack + cc->stack_size) & ~(uintptr_t)15;
+	void **frame = (void **)(top - CC_FRAME_SIZE);
+
+	memset(frame, 0, CC_FRAME_SIZE);
+	cc_frame_init(frame);
+	frame[CC_FRAME_ARG] = cc;
+	frame[CC_FRAME_START] = (void *)cc_start;
+	cc->sp = frame;
+	cc->last = NULL;
+	cc->exited = 0;
+}
+
+int cc_release(struct continuation *cc)
+{
+	if (cc->release)
+		return cc->release(cc);
+
+	return 0;
+}
+
+int cc_swap(struct continuation *from, struct continuation *to)
+{
+	to->exited = 0;
+	to->last = from;
+	cc_switch(&from->sp, to->sp);
+
+	/* 1 when resumed because to finished */
+	return to->exited;
+}
+#else
 /*
  * va_args to makecontext() must be type 'int', so passing
  * the pointer we need may require several int args. This
@@ -93,6 +279,7 @@ int cc_swap(struct continuation *from, struct continuation *to)
 
 	return 0;
 }
+#endif
 /*
  * Local variables:
  *  c-indent-level: 8
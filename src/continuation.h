@@ -23,8 +23,10 @@
 
 #include "spice-common.h"
 #include <stddef.h>
+#if !WITH_ASM_SWITCH
 #include <ucontext.h>
 #include <setjmp.h>
+#endif
 
 struct continuation
 {
@@ -34,10 +36,15 @@ struct continuation
 	int (*release)(struct continuation *cc);
 
 	/* private */
+#if WITH_ASM_SWITCH
+	void *sp;
+	struct continuation *last;
+#else
 	ucontext_t uc;
 	ucontext_t last;
-	int exited;
 	jmp_buf jmp;
+#endif
+	int exited;
 };
 
 void cc_init(struct continuation *cc);
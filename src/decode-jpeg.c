@@ -33,6 +33,9 @@
 #include <stdio.h>
 #include <jpeglib.h>
 
+/* scanlines handed to libjpeg per jpeg_read_scanlines() call */
+#define DECODE_MAX_LINES 16
+
 typedef struct GlibJpegDecoder
 {
     SpiceJpegDecoder              base;
@@ -44,6 +47,7 @@ typedef struct GlibJpegDecoder
     int      _data_size;
     int      _width;
     int      _height;
+    gboolean _fast;
 } GlibJpegDecoder;
 
 static void begin_decode(SpiceJpegDecoder *decoder,
@@ -67,6 +71,10 @@ static void begin_decode(SpiceJpegDecoder *decoder,
     jpeg_read_header(&d->_cinfo, TRUE);
 
     d->_cinfo.out_color_space = JCS_RGB;
+    if (d->_fast) {
+        d->_cinfo.dct_method = JDCT_IFAST;
+        d->_cinfo.do_fancy_upsampling = FALSE;
+    }
     d->_width = d->_cinfo.image_width;
     d->_height = d->_cinfo.image_height;
 
@@ -77,6 +85,7 @@ static void begin_decode(SpiceJpegDecoder *decoder,
 /* TODO: move it elsewhere and reuse it in get_pixbuf(), optimize? */
 typedef void (*converter_rgb_t)(uint8_t* src, uint8_t* dest, int width);
 
+#ifndef JCS_EXTENSIONS
 static void convert_rgb_to_bgr(uint8_t* src, uint8_t* dest, int width)
 {
     int x;
@@ -101,37 +110,62 @@ static void convert_rgb_to_bgrx(uint8_t* src, uint8_t* dest, int width)
         src += 3;
     }
 }
+#endif
 
 static void decode(SpiceJpegDecoder *decoder,
                    uint8_t* dest, int stride, int format)
 {
     GlibJpegDecoder *d = SPICE_CONTAINEROF(decoder, GlibJpegDecoder, base);
-    uint8_t* scan_line = g_alloca(d->_width * 3);
+    JSAMPROW lines[DECODE_MAX_LINES];
     converter_rgb_t converter = NULL;
-    int row;
+    uint8_t *scan_lines = NULL;
+    int i, n;
 
     switch (format) {
     case SPICE_BITMAP_FMT_24BIT:
+#ifdef JCS_EXTENSIONS
+        d->_cinfo.out_color_space = JCS_EXT_BGR;
+#else
         converter = convert_rgb_to_bgr;
+#endif
         break;
     case SPICE_BITMAP_FMT_32BIT:
+#ifdef JCS_EXTENSIONS
+        d->_cinfo.out_color_space = JCS_EXT_BGRX;
+#else
         converter = convert_rgb_to_bgrx;
+#endif
         break;
     default:
         g_warning("bad bitmap format, %d", format);
         return;
     }
 
-    g_return_if_fail(converter != NULL);
-
     jpeg_start_decompress(&d->_cinfo);
 
-    for (row = 0; row < d->_height; row++) {
-        jpeg_read_scanlines(&d->_cinfo, &scan_line, 1);
-        converter(scan_line, dest, d->_width);
-        dest += stride;
+    /* with libjpeg-turbo the rows are decoded straight into @dest,
+     * otherwise they go through an RGB scratch buffer first */
+    if (converter != NULL)
+        scan_lines = g_malloc(DECODE_MAX_LINES * d->_width * 3);
+
+    while (d->_cinfo.output_scanline < d->_cinfo.output_height) {
+        n = MIN(DECODE_MAX_LINES, d->_cinfo.output_height - d->_cinfo.output_scanline);
+        for (i = 0; i < n; i++)
+            lines[i] = converter ? scan_lines + i * d->_width * 3 : dest + i * stride;
+
+        n = jpeg_read_scanlines(&d->_cinfo, lines, n);
+        if (n == 0) {
+            /* truncated data, jpeg_finish_decompress() would bail out */
+            jpeg_abort_decompress(&d->_cinfo);
+            g_free(scan_lines);
+            return;
+        }
+        for (i = 0; converter && i < n; i++)
+            converter(lines[i], dest + i * stride, d->_width);
+        dest += n * stride;
     }
 
+    g_free(scan_lines);
     jpeg_finish_decompress(&d->_cinfo);
 }
 
@@ -179,6 +213,10 @@ SpiceJpegDecoder *jpeg_decoder_new(void)
 
     d->base.ops = &jpeg_decoder_ops;
 
+    /* trade some image quality for decoding speed */
+    if (g_getenv("SPICE_JPEG_FAST_DECODE"))
+        d->_fast = TRUE;
+
     return &d->base;
 }
 
@@ -19,18 +19,45 @@
 
 #include "decode.h"
 
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#else
 #ifndef __GNUC__
 #define ZLIB_WINAPI
 #endif
 
 #include <zlib.h>
+#endif
 
 typedef struct GlibZlibDecoder
 {
     SpiceZlibDecoder         base;
+#ifdef HAVE_LIBDEFLATE
+    struct libdeflate_decompressor *_decompressor;
+#else
     z_stream                 _z_strm;
+#endif
 } GlibZlibDecoder;
 
+#ifdef HAVE_LIBDEFLATE
+/* the output size is known upfront, so the whole image is inflated in one
+ * go without zlib's streaming state machine and window copies */
+static void decode(SpiceZlibDecoder *decoder,
+                   uint8_t *data, int data_size,
+                   uint8_t *dest, int dest_size)
+{
+    GlibZlibDecoder *d = SPICE_CONTAINEROF(decoder, GlibZlibDecoder, base);
+    enum libdeflate_result ret;
+    size_t out_size;
+
+    ret = libdeflate_zlib_decompress(d->_decompressor, data, data_size,
+                                     dest, dest_size, &out_size);
+
+    if (ret != LIBDEFLATE_SUCCESS) {
+        g_warning("libdeflate inflate failed, error %d", ret);
+    }
+}
+#else
 static void decode(SpiceZlibDecoder *decoder,
                    uint8_t *data, int data_size,
                    uint8_t *dest, int dest_size)
@@ -50,6 +77,7 @@ static void decode(SpiceZlibDecoder *decoder,
         g_warning("zlib inflate failed, error %d", z_ret);
     }
 }
+#endif
 
 static SpiceZlibDecoderOps zlib_decoder_ops = {
     .decode = decode,
@@ -58,6 +86,13 @@ static SpiceZlibDecoderOps zlib_decoder_ops = {
 SpiceZlibDecoder *zlib_decoder_new(void)
 {
     GlibZlibDecoder *d = g_new0(GlibZlibDecoder, 1);
+#ifdef HAVE_LIBDEFLATE
+    d->_decompressor = libdeflate_alloc_decompressor();
+    if (d->_decompressor == NULL) {
+        g_warning("libdeflate decoder init failed");
+        goto fail;
+    }
+#else
     int z_ret;
 
     d->_z_strm.zalloc = Z_NULL;
@@ -70,6 +105,7 @@ SpiceZlibDecoder *zlib_decoder_new(void)
         g_warning("zlib decoder init failed, error %d", z_ret);
         goto fail;
     }
+#endif
 
     d->base.ops = &zlib_decoder_ops;
 
@@ -84,6 +120,10 @@ void zlib_decoder_destroy(SpiceZlibDecoder *decoder)
 {
     GlibZlibDecoder *d = SPICE_CONTAINEROF(decoder, GlibZlibDecoder, base);
 
+#ifdef HAVE_LIBDEFLATE
+    libdeflate_free_decompressor(d->_decompressor);
+#else
     inflateEnd(&d->_z_strm);
+#endif
     free(d);
 }
@@ -22,6 +22,10 @@
 
 #include "gio-coroutine.h"
 
+#ifdef G_OS_UNIX
+#include <glib-unix.h>
+#endif
+
 typedef struct _GConditionWaitSource
 {
     GCoroutine *self;
@@ -71,6 +75,45 @@ GIOCondition g_coroutine_socket_wait(GCoroutine *self,
     return val;
 }
 
+#ifdef G_OS_UNIX
+static gboolean g_fd_wait_helper(gint fd G_GNUC_UNUSED,
+                                 GIOCondition cond,
+                                 gpointer data)
+{
+    struct coroutine *to = data;
+    coroutine_yieldto(to, &cond);
+    return FALSE;
+}
+
+/* same as g_coroutine_socket_wait(), for a file descriptor that isn't
+ * a socket, such as an io_uring instance */
+GIOCondition g_coroutine_fd_wait(GCoroutine *self,
+                                 gint fd,
+                                 GIOCondition cond)
+{
+    GIOCondition *ret, val = 0;
+    GSource *src;
+
+    g_return_val_if_fail(self != NULL, 0);
+    g_return_val_if_fail(self->wait_id == 0, 0);
+    g_return_val_if_fail(fd >= 0, 0);
+
+    src = g_unix_fd_source_new(fd, cond | G_IO_HUP | G_IO_ERR | G_IO_NVAL);
+    g_source_set_callback(src, (GSourceFunc)g_fd_wait_helper, self, NULL);
+    self->wait_id = g_source_attach(src, NULL);
+    ret = coroutine_yield(NULL);
+    g_source_unref(src);
+
+    if (ret != NULL)
+        val = *ret;
+    else
+        g_source_remove(self->wait_id);
+
+    self->wait_id = 0;
+    return val;
+}
+#endif
+
 void g_coroutine_condition_cancel(GCoroutine *coroutine)
 {
     g_return_if_fail(coroutine != NULL);
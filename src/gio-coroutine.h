@@ -52,6 +52,10 @@ GCoroutine*  g_coroutine_self           (void);
 void         g_coroutine_wakeup         (GCoroutine *coroutine);
 GIOCondition g_coroutine_socket_wait    (GCoroutine *coroutine,
                                          GSocket *sock, GIOCondition cond);
+#ifdef G_OS_UNIX
+GIOCondition g_coroutine_fd_wait        (GCoroutine *coroutine,
+                                         gint fd, GIOCondition cond);
+#endif
 gboolean     g_coroutine_condition_wait (GCoroutine *coroutine,
                                          GConditionWaitFunc func, gpointer data);
 void         g_coroutine_condition_cancel(GCoroutine *coroutine);
@@ -27,6 +27,7 @@ G_BEGIN_DECLS
 struct _SpiceAudioPrivate {
     SpiceSession            *session;
     GMainContext            *main_context;
+    guint                   underruns;
 };
 
 SpiceAudio *spice_audio_new_priv(SpiceSession *session, GMainContext *context,
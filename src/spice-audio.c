@@ -58,6 +58,7 @@ enum {
     PROP_0,
     PROP_SESSION,
     PROP_MAIN_CONTEXT,
+    PROP_UNDERRUNS,
 };
 
 static void spice_audio_finalize(GObject *gobject)
@@ -86,6 +87,9 @@ static void spice_audio_get_property(GObject *gobject,
     case PROP_MAIN_CONTEXT:
         g_value_set_boxed(value, priv->main_context);
         break;
+    case PROP_UNDERRUNS:
+        g_value_set_uint(value, priv->underruns);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
         break;
@@ -142,6 +146,20 @@ static void spice_audio_class_init(SpiceAudioClass *klass)
                                G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
     g_object_class_install_property(gobject_class, PROP_MAIN_CONTEXT, pspec);
 
+    /**
+     * SpiceAudio:underruns:
+     *
+     * Number of times the playback stream ran out of data, as reported
+     * by the audio backend. Only the PulseAudio backend reports them.
+     *
+     * Since: 0.35
+     **/
+    pspec = g_param_spec_uint("underruns", "Underruns",
+                              "Number of playback underruns",
+                              0, G_MAXUINT, 0,
+                              G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(gobject_class, PROP_UNDERRUNS, pspec);
+
     g_type_class_add_private(klass, sizeof(SpiceAudioPrivate));
 }
 
@@ -31,6 +31,9 @@
 #include "spice-util-priv.h"
 #include "coroutine.h"
 #include "gio-coroutine.h"
+#ifdef HAVE_IO_URING
+#include "uring-socket.h"
+#endif
 
 #include "common/client_marshallers.h"
 #include "common/client_demarshallers.h"
@@ -40,6 +43,9 @@ G_BEGIN_DECLS
 
 #define MAX_SPICE_DATA_HEADER_SIZE sizeof(SpiceDataHeader)
 
+/* send times of the last ACKs, to tell which ones the server has seen */
+#define SPICE_CHANNEL_ACK_HISTORY 8
+
 #define CHANNEL_DEBUG(channel, fmt, ...) \
     SPICE_DEBUG("%s: " fmt, SPICE_CHANNEL(channel)->priv->name, ## __VA_ARGS__)
 
@@ -54,6 +60,13 @@ struct _SpiceMsgOut {
     gboolean              ro_check;
 };
 
+/* the messages of spice.proto marked @view, parsed without allocation */
+typedef union {
+    SpiceMsgPlaybackPacket  playback_packet;
+    SpiceMsgPlaybackMode    playback_mode;
+    SpiceMsgCompressedData  compressed_data;
+} SpiceMsgView;
+
 struct _SpiceMsgIn {
     int                   refcount;
     SpiceChannel          *channel;
@@ -61,6 +74,7 @@ struct _SpiceMsgIn {
     uint8_t               *data;
     int                   dpos;
     uint8_t               *parsed;
+    SpiceMsgView          view;
     size_t                psize;
     message_destructor_t  pfree;
     SpiceMsgIn            *parent;
@@ -79,6 +93,8 @@ enum spice_channel_state {
 struct _SpiceChannelClassPrivate
 {
     GArray *handlers;
+    /* capabilities that are costly to probe, only set when connecting */
+    void (*link_capabilities)(SpiceChannel *channel);
 };
 
 struct _SpiceChannelPrivate {
@@ -120,9 +136,17 @@ struct _SpiceChannelPrivate {
     SpiceChannelEvent           event;
 
     spice_parse_channel_func_t  parser;
+    spice_parse_channel_view_func_t view_parser;
     SpiceMessageMarshallers     *marshallers;
     guint                       channel_watch;
     int                         tls;
+    gint64                      tls_handshake_time; /* in us */
+    gboolean                    tls_session_reused;
+    gboolean                    ktls_send;
+    gboolean                    ktls_recv;
+#ifdef HAVE_IO_URING
+    SpiceUringSocket            *uring;
+#endif
 
     int                         channel_id;
     int                         channel_type;
@@ -133,6 +157,18 @@ struct _SpiceChannelPrivate {
 
     int                         message_ack_window;
     int                         message_ack_count;
+    int                         message_ack_pending; /* due, held back */
+    guint64                     message_ack_sent;     /* since SET_ACK */
+    guint64                     message_ack_received; /* since SET_ACK */
+    gint64                      message_ack_times[SPICE_CHANNEL_ACK_HISTORY];
+    gint64                      message_ack_blocked;  /* server window exhausted */
+    guint64                     message_ack_blocked_on;
+    gint64                      last_message_time;
+    gint64                      message_interval;     /* smoothed, in us */
+    gint64                      rtt;                  /* in us, -1 if unknown */
+    gint64                      rtt_time;
+    guint64                     acks_sent;
+    gint64                      ack_stall_time;       /* in us */
 
     GArray                      *caps;
     GArray                      *common_caps;
@@ -140,6 +176,10 @@ struct _SpiceChannelPrivate {
     GArray                      *remote_common_caps;
 
     gsize                       total_read_bytes;
+    guint64                     total_write_bytes;
+    guint64                     msgs_read;
+    guint64                     msgs_written;
+    guint                       connects;
     uint64_t                    last_message_serial;
     GSList                      *flushing;
 
@@ -175,14 +215,18 @@ void spice_channel_wakeup(SpiceChannel *channel, gboolean cancel);
 SpiceSession* spice_channel_get_session(SpiceChannel *channel);
 enum spice_channel_state spice_channel_get_state(SpiceChannel *channel);
 guint64 spice_channel_get_queue_size (SpiceChannel *channel);
+gint64 spice_channel_get_tls_handshake_time(SpiceChannel *channel, gboolean *resumed);
 
 /* coroutine context */
 typedef void (*handler_msg_in)(SpiceChannel *channel, SpiceMsgIn *msg, gpointer data);
 void spice_channel_recv_msg(SpiceChannel *channel, handler_msg_in handler, gpointer data);
+void spice_channel_set_ack_window(SpiceChannel *channel, int window);
 
 /* channel-base.c */
 void spice_channel_set_handlers(SpiceChannelClass *klass,
                                 const spice_msg_handler* handlers, const int n);
+void spice_channel_set_link_capabilities(SpiceChannelClass *klass,
+                                         void (*link_capabilities)(SpiceChannel *channel));
 void spice_channel_handle_wait_for_channels(SpiceChannel *channel, SpiceMsgIn *in);
 
 gint spice_channel_get_channel_id(SpiceChannel *channel);
@@ -22,6 +22,8 @@
 
 #include "spice-channel-priv.h"
 #include "spice-session-priv.h"
+#include "spice-log-priv.h"
+#include "spice-trace-priv.h"
 #include "spice-marshal.h"
 #include "bio-gio.h"
 
@@ -95,6 +97,14 @@ enum {
     PROP_CHANNEL_ID,
     PROP_TOTAL_READ_BYTES,
     PROP_SOCKET,
+    PROP_TLS_OFFLOAD,
+    PROP_ACKS_SENT,
+    PROP_ACK_STALL_TIME,
+    PROP_TOTAL_WRITE_BYTES,
+    PROP_MESSAGES_READ,
+    PROP_MESSAGES_WRITTEN,
+    PROP_QUEUE_SIZE,
+    PROP_RECONNECTS,
 };
 
 /* Signals */
@@ -119,6 +129,7 @@ static void spice_channel_init(SpiceChannel *channel)
     c->out_serial = 1;
     c->in_serial = 1;
     c->fd = -1;
+    c->rtt = -1;
     c->auth_needs_username = FALSE;
     c->auth_needs_password = FALSE;
     strcpy(c->name, "?");
@@ -228,6 +239,30 @@ static void spice_channel_get_property(GObject    *gobject,
     case PROP_SOCKET:
         g_value_set_object(value, c->sock);
         break;
+    case PROP_TLS_OFFLOAD:
+        g_value_set_boolean(value, c->ktls_send || c->ktls_recv);
+        break;
+    case PROP_ACKS_SENT:
+        g_value_set_uint64(value, c->acks_sent);
+        break;
+    case PROP_ACK_STALL_TIME:
+        g_value_set_int64(value, c->ack_stall_time);
+        break;
+    case PROP_TOTAL_WRITE_BYTES:
+        g_value_set_uint64(value, c->total_write_bytes);
+        break;
+    case PROP_MESSAGES_READ:
+        g_value_set_uint64(value, c->msgs_read);
+        break;
+    case PROP_MESSAGES_WRITTEN:
+        g_value_set_uint64(value, c->msgs_written);
+        break;
+    case PROP_QUEUE_SIZE:
+        g_value_set_uint64(value, spice_channel_get_queue_size(channel));
+        break;
+    case PROP_RECONNECTS:
+        g_value_set_uint(value, c->connects > 0 ? c->connects - 1 : 0);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
         break;
@@ -349,6 +384,141 @@ static void spice_channel_class_init(SpiceChannelClass *klass)
                              G_PARAM_READABLE |
                              G_PARAM_STATIC_STRINGS));
 
+    /**
+     * SpiceChannel:tls-offload:
+     *
+     * Whether the kernel handles the TLS records of the connection
+     * (kTLS), in at least one direction. Offload is attempted on Linux
+     * for plain TCP connections, unless SPICE_DISABLE_KTLS is set in
+     * the environment.
+     *
+     * Since: 0.35
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_TLS_OFFLOAD,
+         g_param_spec_boolean("tls-offload",
+                              "TLS offload",
+                              "Whether kernel TLS is in use",
+                              FALSE,
+                              G_PARAM_READABLE |
+                              G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceChannel:acks-sent:
+     *
+     * Number of flow control acknowledgements sent to the server.
+     *
+     * Since: 0.35
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_ACKS_SENT,
+         g_param_spec_uint64("acks-sent",
+                             "ACKs sent",
+                             "Number of ACK messages sent",
+                             0, G_MAXUINT64, 0,
+                             G_PARAM_READABLE |
+                             G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceChannel:ack-stall-time:
+     *
+     * Estimated time, in microseconds, the server spent unable to send
+     * because its ACK window was used up. The estimate is based on the
+     * round trip time of the TCP connection.
+     *
+     * Since: 0.35
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_ACK_STALL_TIME,
+         g_param_spec_int64("ack-stall-time",
+                            "ACK stall time",
+                            "Time the server waited for ACKs, in us",
+                            0, G_MAXINT64, 0,
+                            G_PARAM_READABLE |
+                            G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceChannel:total-write-bytes:
+     *
+     * Number of bytes of the messages written to the connection.
+     *
+     * Since: 0.35
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_TOTAL_WRITE_BYTES,
+         g_param_spec_uint64("total-write-bytes",
+                             "Total write bytes",
+                             "Total written bytes",
+                             0, G_MAXUINT64, 0,
+                             G_PARAM_READABLE |
+                             G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceChannel:messages-read:
+     *
+     * Number of messages received from the server.
+     *
+     * Since: 0.35
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_MESSAGES_READ,
+         g_param_spec_uint64("messages-read",
+                             "Messages read",
+                             "Number of messages received",
+                             0, G_MAXUINT64, 0,
+                             G_PARAM_READABLE |
+                             G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceChannel:messages-written:
+     *
+     * Number of messages sent to the server.
+     *
+     * Since: 0.35
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_MESSAGES_WRITTEN,
+         g_param_spec_uint64("messages-written",
+                             "Messages written",
+                             "Number of messages sent",
+                             0, G_MAXUINT64, 0,
+                             G_PARAM_READABLE |
+                             G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceChannel:queue-size:
+     *
+     * Number of bytes of the messages waiting to be sent.
+     *
+     * Since: 0.35
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_QUEUE_SIZE,
+         g_param_spec_uint64("queue-size",
+                             "Queue size",
+                             "Bytes waiting in the output queue",
+                             0, G_MAXUINT64, 0,
+                             G_PARAM_READABLE |
+                             G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceChannel:reconnects:
+     *
+     * Number of times the channel opened a new connection after its
+     * first one, for instance when switching to TLS or to a migration
+     * target.
+     *
+     * Since: 0.35
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_RECONNECTS,
+         g_param_spec_uint("reconnects",
+                           "Reconnects",
+                           "Number of reconnections",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READABLE |
+                           G_PARAM_STATIC_STRINGS));
+
     /**
      * SpiceChannel::channel-event:
      * @channel: the channel that emitted the signal
@@ -542,7 +712,7 @@ void spice_msg_in_unref(SpiceMsgIn *in)
     in->refcount--;
     if (in->refcount > 0)
         return;
-    if (in->parsed)
+    if (in->parsed && in->pfree)
         in->pfree(in->parsed);
     if (in->parent) {
         spice_msg_in_unref(in->parent);
@@ -727,17 +897,19 @@ G_GNUC_INTERNAL
 void spice_msg_out_send(SpiceMsgOut *out)
 {
     SpiceChannelPrivate *c;
-    gboolean was_empty;
+    gboolean was_empty, dropped = FALSE;
     guint32 size;
 
     g_return_if_fail(out != NULL);
     g_return_if_fail(out->channel != NULL);
     c = out->channel->priv;
     size = spice_marshaller_get_total_size(out->marshaller);
+    SPICE_TRACE3(msg_out_send, c->channel_type, c->channel_id, size);
 
     g_mutex_lock(&c->xmit_queue_lock);
     if (c->xmit_queue_blocked) {
         g_warning("message queue is blocked, dropping message");
+        dropped = TRUE;
         goto end;
     }
 
@@ -757,15 +929,43 @@ void spice_msg_out_send(SpiceMsgOut *out)
 
 end:
     g_mutex_unlock(&c->xmit_queue_lock);
+    /* outside of the lock, the free callbacks of the data may send */
+    if (dropped)
+        spice_msg_out_unref(out);
 }
 
 /* coroutine context */
 G_GNUC_INTERNAL
 void spice_msg_out_send_internal(SpiceMsgOut *out)
 {
+    SpiceChannel *channel;
+
     g_return_if_fail(out != NULL);
 
-    spice_channel_write_msg(out->channel, out);
+    channel = out->channel;
+    spice_channel_write_msg(channel, out);
+#ifdef HAVE_IO_URING
+    /* it doesn't go through iterate_write(), which submits the queued
+     * data: an ack or a pong would otherwise sit in the ring until the
+     * next message of the xmit queue */
+    if (channel->priv->uring)
+        spice_uring_socket_flush(channel->priv->uring);
+#endif
+}
+
+/* coroutine context */
+static void spice_channel_wait(SpiceChannel *channel, GIOCondition cond)
+{
+    SpiceChannelPrivate *c = channel->priv;
+
+#ifdef HAVE_IO_URING
+    /* both directions complete on the ring */
+    if (c->uring) {
+        g_coroutine_fd_wait(&c->coroutine, spice_uring_socket_get_fd(c->uring), G_IO_IN);
+        return;
+    }
+#endif
+    g_coroutine_socket_wait(&c->coroutine, c->sock, cond);
 }
 
 /*
@@ -787,6 +987,13 @@ static gint spice_channel_flush_wire_nonblocking(SpiceChannel *channel,
     g_assert(cond != NULL);
     *cond = 0;
 
+#ifdef HAVE_IO_URING
+    if (c->uring) {
+        ret = spice_uring_socket_send(c->uring, ptr, len, cond);
+        if (ret < 0 && *cond == 0)
+            CHANNEL_DEBUG(channel, "Send error %s", strerror(errno));
+    } else
+#endif
     if (c->tls) {
         ret = SSL_write(c->ssl, ptr, len);
         if (ret < 0) {
@@ -838,7 +1045,7 @@ static void spice_channel_flush_wire(SpiceChannel *channel,
         if (ret == -1) {
             if (cond != 0) {
                 // TODO: should use g_pollable_input/output_stream_create_source() in 2.28 ?
-                g_coroutine_socket_wait(&c->coroutine, c->sock, cond);
+                spice_channel_wait(channel, cond);
                 continue;
             } else {
                 CHANNEL_DEBUG(channel, "Closing the channel: spice_channel_flush %d", errno);
@@ -851,6 +1058,7 @@ static void spice_channel_flush_wire(SpiceChannel *channel,
             c->has_error = TRUE;
             return;
         }
+        SPICE_TRACE3(socket_write, c->channel_type, c->channel_id, ret);
         offset += ret;
     }
 }
@@ -918,6 +1126,10 @@ static void spice_channel_write_msg(SpiceChannel *channel, SpiceMsgOut *out)
     data = spice_marshaller_linearize(out->marshaller, 0, &len, &free_data);
     /* spice_msg_out_hexdump(out, data, len); */
     spice_channel_write(channel, data, len);
+    channel->priv->total_write_bytes += len;
+    channel->priv->msgs_written++;
+    SPICE_TRACE3(msg_out_write, channel->priv->channel_type,
+                 channel->priv->channel_id, msg_size);
 
     if (free_data)
         g_free(data);
@@ -1012,6 +1224,13 @@ static int spice_channel_read_wire_nonblocking(SpiceChannel *channel,
     g_assert(cond != NULL);
     *cond = 0;
 
+#ifdef HAVE_IO_URING
+    if (c->uring) {
+        ret = spice_uring_socket_recv(c->uring, data, len, cond);
+        if (ret < 0 && *cond == 0)
+            CHANNEL_DEBUG(channel, "Read error %s", strerror(errno));
+    } else
+#endif
     if (c->tls) {
         ret = SSL_read(c->ssl, data, len);
         if (ret < 0) {
@@ -1063,7 +1282,7 @@ static int spice_channel_read_wire(SpiceChannel *channel, void *data, size_t len
         if (ret == -1) {
             if (cond != 0) {
                 // TODO: should use g_pollable_input/output_stream_create_source() ?
-                g_coroutine_socket_wait(&c->coroutine, c->sock, cond);
+                spice_channel_wait(channel, cond);
                 continue;
             } else {
                 c->has_error = TRUE;
@@ -1076,6 +1295,7 @@ static int spice_channel_read_wire(SpiceChannel *channel, void *data, size_t len
             return 0;
         }
 
+        SPICE_TRACE3(socket_read, c->channel_type, c->channel_id, ret);
         return ret;
     }
 }
@@ -1325,12 +1545,14 @@ static void spice_channel_send_link(SpiceChannel *channel)
         c->link_hdr.major_version = 1;
         c->link_hdr.minor_version = 3;
         c->parser = spice_get_server_channel_parser1(c->channel_type, NULL);
+        c->view_parser = NULL;
         c->marshallers = spice_message_marshallers_get1();
         break;
     case SPICE_VERSION_MAJOR: /* protocol 2 == current */
         c->link_hdr.major_version = SPICE_VERSION_MAJOR;
         c->link_hdr.minor_version = SPICE_VERSION_MINOR;
         c->parser = spice_get_server_channel_parser(c->channel_type, NULL);
+        c->view_parser = spice_get_server_channel_view_parser(c->channel_type);
         c->marshallers = spice_message_marshallers_get();
         break;
     default:
@@ -2012,6 +2234,173 @@ gboolean spice_channel_get_read_only(SpiceChannel *channel)
     return spice_session_get_read_only(channel->priv->session);
 }
 
+/*
+ * ACK pacing
+ *
+ * The server stops sending once more than twice its ACK window of
+ * messages are unacknowledged, and each ACK credits exactly one window,
+ * so the client can neither send more ACKs nor enlarge the window. What
+ * it can choose is when a due ACK goes out: on a link with a short
+ * round trip a due ACK is held back while the server has window left,
+ * and written once the socket is drained, so that a burst of messages
+ * costs one write instead of one per window. When the round trip gets
+ * close to the time the server needs to use up its remaining window,
+ * the ACK is sent right away.
+ */
+
+#define ACK_RTT_REFRESH (250 * 1000) /* us */
+#define ACK_MAX_INTERVAL (100 * 1000) /* us, ignore idle gaps */
+
+/* coroutine context */
+static void spice_channel_update_rtt(SpiceChannel *channel, gint64 now)
+{
+    SpiceChannelPrivate *c = channel->priv;
+#if defined(G_OS_UNIX) && defined(TCP_INFO)
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+#endif
+
+    if (c->rtt >= 0 && now - c->rtt_time < ACK_RTT_REFRESH)
+        return;
+    c->rtt_time = now;
+
+    if (c->sock == NULL)
+        return;
+    if (g_socket_get_family(c->sock) == G_SOCKET_FAMILY_UNIX) {
+        c->rtt = 0;
+        return;
+    }
+#if defined(G_OS_UNIX) && defined(TCP_INFO)
+    if (getsockopt(g_socket_get_fd(c->sock), IPPROTO_TCP, TCP_INFO, &info, &len) == 0)
+        c->rtt = info.tcpi_rtt;
+#endif
+}
+
+/* coroutine context */
+static void spice_channel_flush_acks(SpiceChannel *channel)
+{
+    SpiceChannelPrivate *c = channel->priv;
+    gint64 now;
+
+    if (c->message_ack_pending == 0)
+        return;
+
+    now = g_get_monotonic_time();
+    for (; c->message_ack_pending > 0; c->message_ack_pending--) {
+        SpiceMsgOut *out = spice_msg_out_new(channel, SPICE_MSGC_ACK);
+
+        spice_msg_out_send_internal(out);
+        c->message_ack_times[c->message_ack_sent % SPICE_CHANNEL_ACK_HISTORY] = now;
+        c->message_ack_sent++;
+        c->acks_sent++;
+    }
+}
+
+/* number of ACKs the server had received when it sent a message that
+ * arrives at @now */
+static guint64 spice_channel_acks_seen(SpiceChannel *channel, gint64 now)
+{
+    SpiceChannelPrivate *c = channel->priv;
+    guint64 seen = c->message_ack_sent;
+    gint64 rtt = MAX(c->rtt, 0);
+
+    while (seen > 0 && c->message_ack_sent - seen < SPICE_CHANNEL_ACK_HISTORY &&
+           c->message_ack_times[(seen - 1) % SPICE_CHANNEL_ACK_HISTORY] > now - rtt)
+        seen--;
+
+    return seen;
+}
+
+/* coroutine context */
+static void spice_channel_ack_msg(SpiceChannel *channel)
+{
+    SpiceChannelPrivate *c = channel->priv;
+    gint64 now, allowance;
+    guint64 seen;
+
+    if (c->message_ack_window == 0)
+        return;
+
+    now = g_get_monotonic_time();
+
+    /* the server was out of window until the next ACK reached it */
+    if (c->message_ack_blocked) {
+        gint64 end = now;
+
+        if (c->message_ack_sent > c->message_ack_blocked_on &&
+            c->message_ack_sent - c->message_ack_blocked_on <= SPICE_CHANNEL_ACK_HISTORY)
+            end = MIN(end, c->message_ack_times[c->message_ack_blocked_on % SPICE_CHANNEL_ACK_HISTORY] +
+                           MAX(c->rtt, 0));
+        c->ack_stall_time += MAX(end - c->message_ack_blocked, 0);
+        c->message_ack_blocked = 0;
+    }
+
+    if (c->last_message_time)
+        c->message_interval += (MIN(now - c->last_message_time, ACK_MAX_INTERVAL) -
+                                c->message_interval) / 8;
+    c->last_message_time = now;
+    c->message_ack_received++;
+
+    seen = spice_channel_acks_seen(channel, now);
+    if (c->message_ack_received >= (seen + 2) * c->message_ack_window + 1) {
+        c->message_ack_blocked = now;
+        c->message_ack_blocked_on = seen;
+    }
+
+    if (--c->message_ack_count == 0) {
+        c->message_ack_count = c->message_ack_window;
+        c->message_ack_pending++;
+        spice_channel_update_rtt(channel, now);
+    }
+    if (c->message_ack_pending == 0)
+        return;
+
+    /* messages the server can still send once it got the ACKs sent so far */
+    allowance = (c->message_ack_sent + 2) * c->message_ack_window + 1 - c->message_ack_received;
+    if (c->rtt < 0 || c->message_ack_pending > 1 ||
+        allowance * c->message_interval <= c->rtt)
+        spice_channel_flush_acks(channel);
+}
+
+/* coroutine context */
+G_GNUC_INTERNAL
+void spice_channel_set_ack_window(SpiceChannel *channel, int window)
+{
+    SpiceChannelPrivate *c = channel->priv;
+
+    CHANNEL_DEBUG(channel, "ack window %d, %" G_GUINT64_FORMAT " acks sent, "
+                  "%" G_GINT64_FORMAT " ms stalled", window, c->acks_sent,
+                  c->ack_stall_time / 1000);
+
+    /* ACKs of the previous generation are ignored by the server */
+    c->message_ack_window = c->message_ack_count = window;
+    c->message_ack_pending = 0;
+    c->message_ack_sent = 0;
+    c->message_ack_received = 0;
+    c->message_ack_blocked = 0;
+}
+
+/* bulk data messages are parsed into the SpiceMsgIn itself, the others
+ * get an allocated structure */
+static void spice_channel_parse_msg(SpiceChannel *channel, SpiceMsgIn *in, int msg_type)
+{
+    SpiceChannelPrivate *c = channel->priv;
+
+    if (c->view_parser != NULL) {
+        in->parsed = c->view_parser(in->data, in->data + in->dpos, msg_type,
+                                    c->peer_hdr.minor_version,
+                                    (uint8_t *)&in->view, sizeof(in->view));
+        if (in->parsed != NULL) {
+            in->psize = sizeof(in->view);
+            in->pfree = NULL;
+            return;
+        }
+    }
+
+    in->parsed = c->parser(in->data, in->data + in->dpos, msg_type,
+                           c->peer_hdr.minor_version, &in->psize, &in->pfree);
+}
+
 /* coroutine context */
 G_GNUC_INTERNAL
 void spice_channel_recv_msg(SpiceChannel *channel,
@@ -2019,10 +2408,11 @@ void spice_channel_recv_msg(SpiceChannel *channel,
 {
     SpiceChannelPrivate *c = channel->priv;
     SpiceMsgIn *in;
-    int msg_size;
-    int msg_type;
+    int msg_size = 0;
+    int msg_type = 0;
     int sub_list_offset = 0;
 
+    SPICE_TRACE2(recv_msg_begin, c->channel_type, c->channel_id);
     in = spice_msg_in_new(channel);
 
     /* receive message */
@@ -2054,38 +2444,29 @@ void spice_channel_recv_msg(SpiceChannel *channel,
         for (i = 0; i < sub_list->size; i++) {
             sub = (SpiceSubMessage *)(in->data + sub_list->sub_messages[i]);
             sub_in = spice_msg_in_sub_new(channel, in, sub);
-            sub_in->parsed = c->parser(sub_in->data, sub_in->data + sub_in->dpos,
-                                       spice_header_get_msg_type(sub_in->header,
-                                                                 c->use_mini_header),
-                                       c->peer_hdr.minor_version,
-                                       &sub_in->psize, &sub_in->pfree);
+            spice_channel_parse_msg(channel, sub_in,
+                                    spice_header_get_msg_type(sub_in->header,
+                                                              c->use_mini_header));
             if (sub_in->parsed == NULL) {
                 g_critical("failed to parse sub-message: %s type %d",
                            c->name, spice_header_get_msg_type(sub_in->header, c->use_mini_header));
                 goto end;
             }
+            c->msgs_read++;
             msg_handler(channel, sub_in, data);
             spice_msg_in_unref(sub_in);
         }
     }
 
     /* ack message */
-    if (c->message_ack_count) {
-        c->message_ack_count--;
-        if (!c->message_ack_count) {
-            SpiceMsgOut *out = spice_msg_out_new(channel, SPICE_MSGC_ACK);
-            spice_msg_out_send_internal(out);
-            c->message_ack_count = c->message_ack_window;
-        }
-    }
+    spice_channel_ack_msg(channel);
 
     if (msg_type == SPICE_MSG_LIST) {
         goto end;
     }
 
     /* parse message */
-    in->parsed = c->parser(in->data, in->data + msg_size, msg_type,
-                           c->peer_hdr.minor_version, &in->psize, &in->pfree);
+    spice_channel_parse_msg(channel, in, msg_type);
     if (in->parsed == NULL) {
         g_critical("failed to parse message: %s type %d",
                    c->name, msg_type);
@@ -2094,6 +2475,7 @@ void spice_channel_recv_msg(SpiceChannel *channel,
 
     /* process message */
     /* spice_msg_in_hexdump(in); */
+    c->msgs_read++;
     msg_handler(channel, in, data);
 
 end:
@@ -2102,6 +2484,7 @@ end:
     c->last_message_serial = spice_header_get_in_msg_serial(in);
     c->in_serial++;
     spice_msg_in_unref(in);
+    SPICE_TRACE4(recv_msg_end, c->channel_type, c->channel_id, msg_type, msg_size);
 }
 
 static const char *to_string[] = {
@@ -2223,7 +2606,7 @@ SpiceChannel *spice_channel_new(SpiceSession *s, int type, int id)
             SPICE_DEBUG("audio channel is disabled, not creating it");
             return NULL;
         }
-		g_print("\nvanxum-usbredir:audio support");
+		SPICE_LOG_INFO("audio support");
         gtype = type == SPICE_CHANNEL_RECORD ?
             SPICE_TYPE_RECORD_CHANNEL : SPICE_TYPE_PLAYBACK_CHANNEL;
         break;
@@ -2249,7 +2632,7 @@ SpiceChannel *spice_channel_new(SpiceSession *s, int type, int id)
             return NULL;
         }
         gtype = SPICE_TYPE_USBREDIR_CHANNEL;
-		g_print("\nvanxum-usbredir:usb support");
+		SPICE_LOG_INFO("usb support");
         break;
     }
 #endif
@@ -2328,20 +2711,35 @@ static void spice_channel_iterate_write(SpiceChannel *channel)
         }
     } while (out);
 
+#ifdef HAVE_IO_URING
+    if (c->uring)
+        spice_uring_socket_flush(c->uring);
+#endif
     spice_channel_flushed(channel, TRUE);
 }
 
+static gboolean spice_channel_is_readable(SpiceChannel *channel)
+{
+    SpiceChannelPrivate *c = channel->priv;
+
+#ifdef HAVE_IO_URING
+    if (c->uring)
+        return spice_uring_socket_is_readable(c->uring);
+#endif
+    return g_pollable_input_stream_is_readable(G_POLLABLE_INPUT_STREAM(c->in));
+}
+
 /* coroutine context */
 static void spice_channel_iterate_read(SpiceChannel *channel)
 {
     SpiceChannelPrivate *c = channel->priv;
 
-    g_coroutine_socket_wait(&c->coroutine, c->sock, G_IO_IN);
+    spice_channel_wait(channel, G_IO_IN);
 
     /* treat all incoming data (block on message completion) */
     while (!c->has_error &&
            c->state != SPICE_CHANNEL_STATE_MIGRATING &&
-           g_pollable_input_stream_is_readable(G_POLLABLE_INPUT_STREAM(c->in))
+           spice_channel_is_readable(channel)
     ) { do
             spice_channel_recv_msg(channel,
                                    (handler_msg_in)SPICE_CHANNEL_GET_CLASS(channel)->handle_msg, NULL);
@@ -2353,6 +2751,9 @@ static void spice_channel_iterate_read(SpiceChannel *channel)
 #endif
     }
 
+    /* the socket is drained, send the ACKs held back */
+    if (!c->has_error)
+        spice_channel_flush_acks(channel);
 }
 
 static gboolean wait_migration(gpointer data)
@@ -2445,67 +2846,6 @@ static gboolean spice_channel_delayed_unref(gpointer data)
     return FALSE;
 }
 
-static int spice_channel_load_ca(SpiceChannel *channel)
-{
-    SpiceChannelPrivate *c = channel->priv;
-    int i, count = 0;
-    guint8 *ca;
-    guint size;
-    const gchar *ca_file;
-    int rc;
-
-    g_return_val_if_fail(c->ctx != NULL, 0);
-
-    ca_file = spice_session_get_ca_file(c->session);
-    spice_session_get_ca(c->session, &ca, &size);
-
-    CHANNEL_DEBUG(channel, "Load CA, file: %s, data: %p", ca_file, ca);
-
-    if (ca != NULL) {
-        STACK_OF(X509_INFO) *inf;
-        X509_STORE *store;
-        BIO *in;
-
-        store = SSL_CTX_get_cert_store(c->ctx);
-        in = BIO_new_mem_buf(ca, size);
-        inf = PEM_X509_INFO_read_bio(in, NULL, NULL, NULL);
-        BIO_free(in);
-
-        for (i = 0; i < sk_X509_INFO_num(inf); i++) {
-            X509_INFO *itmp;
-            itmp = sk_X509_INFO_value(inf, i);
-            if (itmp->x509) {
-                X509_STORE_add_cert(store, itmp->x509);
-                count++;
-            }
-            if (itmp->crl) {
-                X509_STORE_add_crl(store, itmp->crl);
-                count++;
-            }
-        }
-
-        sk_X509_INFO_pop_free(inf, X509_INFO_free);
-    }
-
-    if (ca_file != NULL) {
-        rc = SSL_CTX_load_verify_locations(c->ctx, ca_file, NULL);
-        if (rc != 1)
-            g_warning("loading ca certs from %s failed", ca_file);
-        else
-            count++;
-    }
-
-    if (count == 0) {
-        rc = SSL_CTX_set_default_verify_paths(c->ctx);
-        if (rc != 1)
-            g_warning("loading ca certs from default location failed");
-        else
-            count++;
-    }
-
-    return count;
-}
-
 /**
  * spice_channel_get_error:
  * @channel: a #SpiceChannel
@@ -2533,9 +2873,6 @@ static void *spice_channel_coroutine(void *data)
     SpiceChannelPrivate *c = channel->priv;
     guint verify;
     int rc, delay_val = 1;
-    /* When some other SSL/TLS version becomes obsolete, add it to this
-     * variable. */
-    long ssl_options = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3;
 
     CHANNEL_DEBUG(channel, "Started background coroutine %p", &c->coroutine);
 
@@ -2575,40 +2912,14 @@ reconnect:
     c->sock = g_object_ref(g_socket_connection_get_socket(c->conn));
 
     if (c->tls) {
-        c->ctx = SSL_CTX_new(SSLv23_method());
+        gint64 handshake_start;
+
+        c->ctx = spice_session_get_ssl_ctx(c->session, &verify);
         if (c->ctx == NULL) {
-            g_critical("SSL_CTX_new failed");
             c->event = SPICE_CHANNEL_ERROR_TLS;
             goto cleanup;
         }
 
-        SSL_CTX_set_options(c->ctx, ssl_options);
-
-        verify = spice_session_get_verify(c->session);
-        if (verify &
-            (SPICE_SESSION_VERIFY_SUBJECT | SPICE_SESSION_VERIFY_HOSTNAME)) {
-            rc = spice_channel_load_ca(channel);
-            if (rc == 0) {
-                g_warning("no cert loaded");
-                if (verify & SPICE_SESSION_VERIFY_PUBKEY) {
-                    g_warning("only pubkey active");
-                    verify = SPICE_SESSION_VERIFY_PUBKEY;
-                } else {
-                    c->event = SPICE_CHANNEL_ERROR_TLS;
-                    goto cleanup;
-                }
-            }
-        }
-
-        {
-            const gchar *ciphers = spice_session_get_ciphers(c->session);
-            if (ciphers != NULL) {
-                rc = SSL_CTX_set_cipher_list(c->ctx, ciphers);
-                if (rc != 1)
-                    g_warning("loading cipher list %s failed", ciphers);
-            }
-        }
-
         c->ssl = SSL_new(c->ctx);
         if (c->ssl == NULL) {
             g_critical("SSL_new failed");
@@ -2617,7 +2928,20 @@ reconnect:
         }
 
 
-        BIO *bio = bio_new_giostream(G_IO_STREAM(c->conn));
+        BIO *bio = NULL;
+#ifdef SSL_OP_ENABLE_KTLS
+        /* kernel TLS needs OpenSSL to talk to the socket itself, which
+         * is only possible for a plain TCP connection. If the kernel or
+         * the negotiated cipher can't do it, OpenSSL falls back to
+         * userspace records on its own */
+        if (G_IS_TCP_CONNECTION(c->conn) && !G_IS_TCP_WRAPPER_CONNECTION(c->conn) &&
+            !g_getenv("SPICE_DISABLE_KTLS")) {
+            SSL_set_options(c->ssl, SSL_OP_ENABLE_KTLS);
+            bio = BIO_new_socket(g_socket_get_fd(c->sock), BIO_NOCLOSE);
+        }
+#endif
+        if (bio == NULL)
+            bio = bio_new_giostream(G_IO_STREAM(c->conn));
         SSL_set_bio(c->ssl, bio, bio);
 
         {
@@ -2631,6 +2955,15 @@ reconnect:
                 spice_session_get_cert_subject(c->session));
         }
 
+        {
+            /* offer the session negotiated by a previous channel, so that
+             * only the first channel pays for a full handshake */
+            SSL_SESSION *ssl_session = spice_session_get_ssl_session(c->session);
+            if (ssl_session != NULL)
+                SSL_set_session(c->ssl, ssl_session);
+        }
+
+        handshake_start = g_get_monotonic_time();
 ssl_reconnect:
         rc = SSL_connect(c->ssl);
         if (rc <= 0) {
@@ -2645,6 +2978,20 @@ ssl_reconnect:
                 goto cleanup;
             }
         }
+
+        c->tls_handshake_time = g_get_monotonic_time() - handshake_start;
+        c->tls_session_reused = SSL_session_reused(c->ssl);
+        CHANNEL_DEBUG(channel, "TLS handshake (%s) took %" G_GINT64_FORMAT " us",
+                      c->tls_session_reused ? "resumed" : "full",
+                      c->tls_handshake_time);
+
+#ifdef SSL_OP_ENABLE_KTLS
+        c->ktls_send = BIO_get_ktls_send(SSL_get_wbio(c->ssl));
+        c->ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(c->ssl));
+#endif
+        CHANNEL_DEBUG(channel, "kernel TLS offload: send %s, receive %s",
+                      c->ktls_send ? "on" : "off", c->ktls_recv ? "on" : "off");
+        g_coroutine_object_notify(G_OBJECT(channel), "tls-offload");
     }
 
 connected:
@@ -2652,6 +2999,17 @@ connected:
     c->in = g_io_stream_get_input_stream(G_IO_STREAM(c->conn));
     c->out = g_io_stream_get_output_stream(G_IO_STREAM(c->conn));
 
+#ifdef HAVE_IO_URING
+    /* TLS reads the socket itself, and unix sockets may carry fds
+     * that a multishot recv would swallow */
+    if (!c->tls && g_socket_get_family(c->sock) != G_SOCKET_FAMILY_UNIX &&
+        !g_getenv("SPICE_DISABLE_IO_URING")) {
+        c->uring = spice_uring_socket_new(g_socket_get_fd(c->sock));
+        CHANNEL_DEBUG(channel, "io_uring socket backend %s",
+                      c->uring ? "enabled" : "unavailable, using GSocket");
+    }
+#endif
+
     rc = setsockopt(g_socket_get_fd(c->sock), IPPROTO_TCP, TCP_NODELAY,
                     (const char*)&delay_val, sizeof(delay_val));
     if ((rc != 0)
@@ -2730,16 +3088,21 @@ static gboolean channel_connect(SpiceChannel *channel, gboolean tls)
     if (spice_session_get_client_provided_socket(c->session)) {
         if (c->fd == -1) {
             CHANNEL_DEBUG(channel, "requesting fd");
-            /* FIXME: no way for client to provide fd atm. */
-            /* It could either chain on parent channel.. */
-            /* or register migration channel on parent session, or ? */
+            /* for a migration session, the application follows
+             * SpiceMainChannel::migration-started to answer this */
             g_signal_emit(channel, signals[SPICE_CHANNEL_OPEN_FD], 0, c->tls);
             return true;
         }
     }
 
+    c->connects++;
     c->xmit_queue_blocked = FALSE;
 
+    /* setting a capability twice is harmless, this runs on every connect
+     * since a channel reset drops them with the others */
+    if (SPICE_CHANNEL_GET_CLASS(channel)->priv->link_capabilities)
+        SPICE_CHANNEL_GET_CLASS(channel)->priv->link_capabilities(channel);
+
     g_return_val_if_fail(c->sock == NULL, FALSE);
     g_object_ref(G_OBJECT(channel)); /* Unref'd when co-routine exits */
 
@@ -2803,6 +3166,20 @@ gboolean spice_channel_open_fd(SpiceChannel *channel, int fd)
     return channel_connect(channel, FALSE);
 }
 
+/* the ACK window and the link timings are those of the connection */
+static void channel_reset_acks(SpiceChannelPrivate *c)
+{
+    c->message_ack_window = c->message_ack_count = 0;
+    c->message_ack_pending = 0;
+    c->message_ack_sent = 0;
+    c->message_ack_received = 0;
+    c->message_ack_blocked = 0;
+    c->last_message_time = 0;
+    c->message_interval = 0;
+    c->rtt = -1;
+    c->rtt_time = 0;
+}
+
 /* system or coroutine context */
 static void channel_reset(SpiceChannel *channel, gboolean migrating)
 {
@@ -2825,6 +3202,11 @@ static void channel_reset(SpiceChannel *channel, gboolean migrating)
     g_clear_pointer(&c->sslverify, spice_openssl_verify_free);
     g_clear_pointer(&c->ssl, SSL_free);
     g_clear_pointer(&c->ctx, SSL_CTX_free);
+    c->ktls_send = c->ktls_recv = FALSE;
+    channel_reset_acks(c);
+#ifdef HAVE_IO_URING
+    g_clear_pointer(&c->uring, spice_uring_socket_free);
+#endif
 
     g_clear_object(&c->conn);
     g_clear_object(&c->sock);
@@ -3035,11 +3417,28 @@ guint64 spice_channel_get_queue_size (SpiceChannel *channel)
     return size;
 }
 
+/* returns the duration in microseconds of the last TLS handshake, or 0
+ * for a plain connection */
+G_GNUC_INTERNAL
+gint64 spice_channel_get_tls_handshake_time(SpiceChannel *channel, gboolean *resumed)
+{
+    SpiceChannelPrivate *c;
+
+    g_return_val_if_fail(SPICE_IS_CHANNEL(channel), 0);
+    c = channel->priv;
+
+    if (resumed != NULL)
+        *resumed = c->tls_session_reused;
+
+    return c->tls ? c->tls_handshake_time : 0;
+}
+
 G_GNUC_INTERNAL
 void spice_channel_swap(SpiceChannel *channel, SpiceChannel *swap, gboolean swap_msgs)
 {
     SpiceChannelPrivate *c = channel->priv;
     SpiceChannelPrivate *s = swap->priv;
+    guint i;
 
     g_return_if_fail(c != NULL);
     g_return_if_fail(s != NULL);
@@ -3063,7 +3462,32 @@ void spice_channel_swap(SpiceChannel *channel, SpiceChannel *swap, gboolean swap
     SWAP(ssl);
     SWAP(sslverify);
     SWAP(tls);
+    SWAP(tls_handshake_time);
+    SWAP(tls_session_reused);
+    SWAP(ktls_send);
+    SWAP(ktls_recv);
+#ifdef HAVE_IO_URING
+    SWAP(uring);
+#endif
     SWAP(use_mini_header);
+    /* the destination may have sent SET_ACK already, on the main
+     * channel handshake of a seamless migration */
+    SWAP(message_ack_window);
+    SWAP(message_ack_count);
+    SWAP(message_ack_pending);
+    SWAP(message_ack_sent);
+    SWAP(message_ack_received);
+    SWAP(message_ack_blocked);
+    SWAP(message_ack_blocked_on);
+    for (i = 0; i < SPICE_CHANNEL_ACK_HISTORY; i++) {
+        gint64 sent = c->message_ack_times[i];
+        c->message_ack_times[i] = s->message_ack_times[i];
+        s->message_ack_times[i] = sent;
+    }
+    SWAP(last_message_time);
+    SWAP(message_interval);
+    SWAP(rtt);
+    SWAP(rtt_time);
     if (swap_msgs) {
         SWAP(xmit_queue);
         SWAP(xmit_queue_blocked);
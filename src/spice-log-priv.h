@@ -0,0 +1,66 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SPICE_LOG_PRIV_H
+#define SPICE_LOG_PRIV_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+    SPICE_LOG_LEVEL_NONE,
+    SPICE_LOG_LEVEL_ERROR,
+    SPICE_LOG_LEVEL_WARNING,
+    SPICE_LOG_LEVEL_INFO,
+    SPICE_LOG_LEVEL_DEBUG,
+} SpiceLogLevel;
+
+/* in memory ring of the last SPICE_LOG_RING_SLOTS messages */
+#define SPICE_LOG_RING_SLOTS 1024
+#define SPICE_LOG_RING_SLOT_SIZE 256
+
+G_GNUC_INTERNAL extern gint spice_log_max_level;
+
+/* a disabled level costs a load and a compare, the arguments are not
+ * evaluated */
+#define SPICE_LOG(level, fmt, ...)                                      \
+    do {                                                                \
+        if (G_UNLIKELY((level) <= spice_log_max_level))                 \
+            spice_log_write(level, G_STRLOC, fmt, ## __VA_ARGS__);      \
+    } while (0)
+
+#define SPICE_LOG_ERROR(fmt, ...) SPICE_LOG(SPICE_LOG_LEVEL_ERROR, fmt, ## __VA_ARGS__)
+#define SPICE_LOG_WARNING(fmt, ...) SPICE_LOG(SPICE_LOG_LEVEL_WARNING, fmt, ## __VA_ARGS__)
+#define SPICE_LOG_INFO(fmt, ...) SPICE_LOG(SPICE_LOG_LEVEL_INFO, fmt, ## __VA_ARGS__)
+#define SPICE_LOG_DEBUG(fmt, ...) SPICE_LOG(SPICE_LOG_LEVEL_DEBUG, fmt, ## __VA_ARGS__)
+
+G_GNUC_INTERNAL
+void spice_log_init(void);
+G_GNUC_INTERNAL
+void spice_log_set_level(SpiceLogLevel level);
+G_GNUC_INTERNAL
+void spice_log_write(SpiceLogLevel level, const gchar *location,
+                     const gchar *fmt, ...) G_GNUC_PRINTF(3, 4);
+G_GNUC_INTERNAL
+void spice_log_dump(int fd);
+G_GNUC_INTERNAL
+void spice_log_clear(void);
+
+G_END_DECLS
+
+#endif /* SPICE_LOG_PRIV_H */
@@ -0,0 +1,197 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#ifdef G_OS_UNIX
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#include "spice-util.h"
+#include "spice-log-priv.h"
+
+/*
+ * Leveled log kept in memory: messages are formatted into the slots of
+ * a ring, and only leave the process when the ring is dumped, so that
+ * logging on the device and channel paths costs no syscall.
+ *
+ * A writer claims a slot by bumping the head, marks it busy, formats
+ * the line, and publishes it with the sequence number it claimed. The
+ * dump skips the slots that are busy, or that got reused while it was
+ * copying them.
+ *
+ * SPICE_LOG_LEVEL selects the levels kept (none, error, warning, info
+ * or debug, info by default). With SPICE_LOG_DUMP set, the ring is
+ * written to stderr on SIGUSR2 and on a crash.
+ */
+
+typedef struct {
+    guint seq; /* claimed index + 1, 0 while being written */
+    gchar line[SPICE_LOG_RING_SLOT_SIZE - sizeof(guint)];
+} LogSlot;
+
+G_STATIC_ASSERT(sizeof(LogSlot) == SPICE_LOG_RING_SLOT_SIZE);
+
+gint spice_log_max_level = SPICE_LOG_LEVEL_INFO;
+
+static LogSlot log_ring[SPICE_LOG_RING_SLOTS];
+static guint log_head;
+
+static const gchar log_level_chars[] = "-EWID";
+
+void spice_log_set_level(SpiceLogLevel level)
+{
+    g_atomic_int_set(&spice_log_max_level, level);
+}
+
+void spice_log_write(SpiceLogLevel level, const gchar *location,
+                     const gchar *fmt, ...)
+{
+    guint idx = g_atomic_int_add((gint *)&log_head, 1);
+    LogSlot *slot = &log_ring[idx % SPICE_LOG_RING_SLOTS];
+    gint64 now = g_get_real_time();
+    va_list args;
+    gint len, n;
+
+    g_atomic_int_set(&slot->seq, 0);
+
+    len = g_snprintf(slot->line, sizeof(slot->line), "%" G_GINT64_FORMAT ".%06u %c %s ",
+                     now / G_USEC_PER_SEC, (guint)(now % G_USEC_PER_SEC),
+                     log_level_chars[level], location);
+    len = MIN(len, (gint)sizeof(slot->line) - 2);
+
+    va_start(args, fmt);
+    n = g_vsnprintf(slot->line + len, sizeof(slot->line) - len, fmt, args);
+    va_end(args);
+    len = MIN(len + n, (gint)sizeof(slot->line) - 2);
+    slot->line[len] = '\n';
+    slot->line[len + 1] = '\0';
+
+    if (G_UNLIKELY(spice_util_get_debug()))
+        g_debug("%.*s", len, slot->line);
+
+    /* full barrier: the line is complete before it is published */
+    g_atomic_int_set(&slot->seq, idx + 1);
+}
+
+/* Writes the kept lines to @fd, oldest first. Only uses write(2), and
+ * can be called from a signal handler */
+void spice_log_dump(int fd)
+{
+    guint head = g_atomic_int_get(&log_head);
+    guint i = head > SPICE_LOG_RING_SLOTS ? head - SPICE_LOG_RING_SLOTS : 0;
+
+    for (; i != head; i++) {
+        LogSlot *slot = &log_ring[i % SPICE_LOG_RING_SLOTS];
+        gchar line[sizeof(slot->line)];
+        gsize len;
+
+        if (g_atomic_int_get(&slot->seq) != i + 1)
+            continue;
+        memcpy(line, slot->line, sizeof(line));
+        if (g_atomic_int_get(&slot->seq) != i + 1)
+            continue;
+
+        line[sizeof(line) - 1] = '\0';
+        len = strlen(line);
+#ifdef G_OS_UNIX
+        if (write(fd, line, len) < 0)
+            return;
+#else
+        fputs(line, stderr);
+#endif
+    }
+}
+
+void spice_log_clear(void)
+{
+    guint i;
+
+    for (i = 0; i < SPICE_LOG_RING_SLOTS; i++)
+        g_atomic_int_set(&log_ring[i].seq, 0);
+}
+
+#ifdef G_OS_UNIX
+static void log_dump_signal(int sig)
+{
+    static const char header[] = "spice-gtk log:\n";
+
+    if (write(STDERR_FILENO, header, sizeof(header) - 1) < 0)
+        return;
+    spice_log_dump(STDERR_FILENO);
+
+    /* crash handlers are reset, let the signal take its course */
+    if (sig != SIGUSR2)
+        raise(sig);
+}
+
+static void log_install_handlers(void)
+{
+    static const int crash_signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+    struct sigaction sa;
+    guint i;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = log_dump_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR2, &sa, NULL);
+
+    sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+    for (i = 0; i < G_N_ELEMENTS(crash_signals); i++)
+        sigaction(crash_signals[i], &sa, NULL);
+}
+#endif
+
+static gpointer log_init(gpointer data)
+{
+    static const GDebugKey levels[] = {
+        { "error", SPICE_LOG_LEVEL_ERROR },
+        { "warning", SPICE_LOG_LEVEL_WARNING },
+        { "info", SPICE_LOG_LEVEL_INFO },
+        { "debug", SPICE_LOG_LEVEL_DEBUG },
+    };
+    const gchar *level = g_getenv("SPICE_LOG_LEVEL");
+    guint i;
+
+    if (level != NULL) {
+        spice_log_set_level(SPICE_LOG_LEVEL_NONE);
+        for (i = 0; i < G_N_ELEMENTS(levels); i++) {
+            if (g_ascii_strcasecmp(level, levels[i].key) == 0)
+                spice_log_set_level(levels[i].value);
+        }
+    }
+
+#ifdef G_OS_UNIX
+    if (g_getenv("SPICE_LOG_DUMP") != NULL)
+        log_install_handlers();
+#endif
+
+    return NULL;
+}
+
+void spice_log_init(void)
+{
+    static GOnce log_once = G_ONCE_INIT;
+
+    g_once(&log_once, log_init, NULL);
+}
@@ -33,6 +33,7 @@ static char *smartcard_db = NULL;
 static char *smartcard_certificates = NULL;
 static char *usbredir_auto_redirect_filter = NULL;
 static char *usbredir_redirect_on_connect = NULL;
+static gint usbredir_reconnect_grace = 0;
 static gboolean smartcard = FALSE;
 static gboolean disable_audio = FALSE;
 static gboolean disable_usbredir = FALSE;
@@ -218,6 +219,8 @@ GOptionGroup* spice_get_option_group(void)
           N_("Filter selecting USB devices to be auto-redirected when plugged in"), N_("<filter-string>") },
         { "spice-usbredir-redirect-on-connect", '\0', 0, G_OPTION_ARG_STRING, &usbredir_redirect_on_connect,
           N_("Filter selecting USB devices to redirect on connect"), N_("<filter-string>") },
+        { "spice-usbredir-reconnect-grace", '\0', 0, G_OPTION_ARG_INT, &usbredir_reconnect_grace,
+          N_("Time a redirected USB device stays reserved after its channel dropped"), N_("<ms>") },
         { "spice-cache-size", '\0', 0, G_OPTION_ARG_INT, &cache_size,
           N_("Image cache size (deprecated)"), N_("<bytes>") },
         { "spice-glz-window-size", '\0', 0, G_OPTION_ARG_INT, &glz_window_size,
@@ -308,6 +311,12 @@ void spice_set_session_option(SpiceSession *session)
             g_object_set(m, "redirect-on-connect",
                          usbredir_redirect_on_connect, NULL);
     }
+    if (usbredir_reconnect_grace > 0) {
+        SpiceUsbDeviceManager *m = spice_usb_device_manager_get(session, NULL);
+        if (m)
+            g_object_set(m, "reconnect-grace",
+                         (guint)usbredir_reconnect_grace, NULL);
+    }
     if (disable_usbredir)
         g_object_set(session, "enable-usbredir", FALSE, NULL);
     if (disable_audio)
@@ -22,6 +22,7 @@
 #include "spice-session-priv.h"
 #include "spice-channel-priv.h"
 #include "spice-util-priv.h"
+#include "spice-audio-priv.h"
 
 #include <pulse/glib-mainloop.h>
 #include <pulse/pulseaudio.h>
@@ -306,6 +307,7 @@ static void stream_underflow_cb(pa_stream *s, void *userdata)
     p = pulse->priv;
     g_return_if_fail(p != NULL);
     p->playback.num_underflow++;
+    SPICE_AUDIO(pulse)->priv->underruns++;
 #ifdef PULSE_ADJUST_LATENCY
     const pa_buffer_attr *buffer_attr;
     pa_buffer_attr new_buffer_attr;
@@ -22,6 +22,7 @@
 
 #include <glib.h>
 #include <gio/gio.h>
+#include <openssl/ssl.h>
 
 #ifdef USE_PHODAV
 #include <libphodav/phodav.h>
@@ -47,6 +48,8 @@ gboolean spice_session_get_client_provided_socket(SpiceSession *session);
 
 GSocketConnection* spice_session_channel_open_host(SpiceSession *session, SpiceChannel *channel,
                                                    gboolean *use_tls, GError **error);
+guint spice_session_count_proxy_tunnels(SpiceSession *session, guint *ready);
+void spice_session_age_proxy_tunnels(SpiceSession *session, guint seconds);
 void spice_session_channel_new(SpiceSession *session, SpiceChannel *channel);
 void spice_session_channel_migrate(SpiceSession *session, SpiceChannel *channel);
 
@@ -69,6 +72,8 @@ const gchar* spice_session_get_cert_subject(SpiceSession *session);
 const gchar* spice_session_get_ciphers(SpiceSession *session);
 const gchar* spice_session_get_ca_file(SpiceSession *session);
 void spice_session_get_ca(SpiceSession *session, guint8 **ca, guint *size);
+SSL_CTX *spice_session_get_ssl_ctx(SpiceSession *session, guint *verify);
+SSL_SESSION *spice_session_get_ssl_session(SpiceSession *session);
 
 void spice_session_set_caches_hints(SpiceSession *session,
                                     uint32_t pci_ram_size,
@@ -89,6 +94,7 @@ void spice_session_sync_playback_latency(SpiceSession *session);
 const gchar* spice_session_get_shared_dir(SpiceSession *session);
 void spice_session_set_shared_dir(SpiceSession *session, const gchar *dir);
 gboolean spice_session_get_audio_enabled(SpiceSession *session);
+SpiceAudio *spice_session_get_audio_manager(SpiceSession *session);
 gboolean spice_session_get_smartcard_enabled(SpiceSession *session);
 gboolean spice_session_get_usbredir_enabled(SpiceSession *session);
 
@@ -22,16 +22,20 @@
 #ifdef G_OS_UNIX
 #include <gio/gunixsocketaddress.h>
 #endif
+#include <openssl/ssl.h>
+#include <openssl/err.h>
 #include "common/ring.h"
 
 #include "spice-client.h"
 #include "spice-common.h"
 #include "spice-channel-priv.h"
 #include "spice-util-priv.h"
+#include "spice-log-priv.h"
 #include "spice-session-priv.h"
 #include "gio-coroutine.h"
 #include "wocky-http-proxy.h"
 #include "spice-uri-priv.h"
+#include "channel-main-priv.h"
 #include "channel-playback-priv.h"
 #include "spice-audio-priv.h"
 
@@ -119,6 +123,21 @@ struct _SpiceSessionPrivate {
     gchar             *name;
     SpiceImageCompression preferred_compression;
 
+    /* TLS context shared by all the channels, and the last negotiated
+     * session, offered to the next channels for resumption */
+    SSL_CTX           *ssl_ctx;
+    guint             ssl_verify;
+    SSL_SESSION       *ssl_session;
+
+    /* addresses of host, resolved once and shared by all the channels */
+    GList             *host_addresses;
+    struct host_lookup *host_lookup; /* weak reference */
+
+    /* address of the proxy, resolved once, and tunnels opened through
+     * the proxy ahead of the channels that will need them */
+    GInetAddress      *proxy_address;
+    GList             *proxy_tunnels;
+
     /* associated objects */
     SpiceAudio        *audio_manager;
     SpiceUsbDeviceManager *usb_manager;
@@ -251,6 +270,10 @@ spice_image_compress_get_type (void)
 static guint signals[SPICE_SESSION_LAST_SIGNAL];
 
 static void spice_session_channel_destroy(SpiceSession *session, SpiceChannel *channel);
+static void session_clear_ssl_cache(SpiceSession *session);
+static void session_clear_address_cache(SpiceSession *session);
+static void session_cancel_host_lookup(SpiceSession *session);
+static void session_clear_proxy_tunnels(SpiceSession *session);
 
 static void update_proxy(SpiceSession *self, const gchar *str)
 {
@@ -258,6 +281,9 @@ static void update_proxy(SpiceSession *self, const gchar *str)
     SpiceURI *proxy = NULL;
     GError *error = NULL;
 
+    g_clear_object(&s->proxy_address);
+    session_clear_proxy_tunnels(self);
+
     if (str == NULL)
         str = g_getenv("SPICE_PROXY");
     if (str == NULL || *str == 0) {
@@ -325,6 +351,8 @@ session_disconnect(SpiceSession *self, gboolean keep_main)
     }
 
     s->connection_id = 0;
+    session_cancel_host_lookup(self);
+    session_clear_proxy_tunnels(self);
 
     g_clear_pointer(&s->name, g_free);
     memset(s->uuid, 0, sizeof(s->uuid));
@@ -350,8 +378,12 @@ spice_session_dispose(GObject *gobject)
     g_clear_object(&s->audio_manager);
     g_clear_object(&s->usb_manager);
     g_clear_object(&s->proxy);
+    g_clear_object(&s->proxy_address);
     g_clear_object(&s->webdav);
 
+    session_clear_ssl_cache(session);
+    session_clear_address_cache(session);
+
     /* Chain up to the parent class */
     if (G_OBJECT_CLASS(spice_session_parent_class)->dispose)
         G_OBJECT_CLASS(spice_session_parent_class)->dispose(gobject);
@@ -720,6 +752,8 @@ static void spice_session_set_property(GObject      *gobject,
     case PROP_HOST:
         g_free(s->host);
         s->host = g_value_dup_string(value);
+        session_clear_ssl_cache(session);
+        session_clear_address_cache(session);
         break;
     case PROP_UNIX_PATH:
         g_free(s->unix_path);
@@ -728,10 +762,12 @@ static void spice_session_set_property(GObject      *gobject,
     case PROP_PORT:
         g_free(s->port);
         s->port = g_value_dup_string(value);
+        session_clear_ssl_cache(session);
         break;
     case PROP_TLS_PORT:
         g_free(s->tls_port);
         s->tls_port = g_value_dup_string(value);
+        session_clear_ssl_cache(session);
         break;
     case PROP_USERNAME:
         g_free(s->username);
@@ -744,10 +780,12 @@ static void spice_session_set_property(GObject      *gobject,
     case PROP_CA_FILE:
         g_free(s->ca_file);
         s->ca_file = g_value_dup_string(value);
+        session_clear_ssl_cache(session);
         break;
     case PROP_CIPHERS:
         g_free(s->ciphers);
         s->ciphers = g_value_dup_string(value);
+        session_clear_ssl_cache(session);
         break;
     case PROP_PROTOCOL:
         s->protocol = g_value_get_int(value);
@@ -768,6 +806,7 @@ static void spice_session_set_property(GObject      *gobject,
             s->verify |= SPICE_SESSION_VERIFY_PUBKEY;
         else
             s->verify &= ~SPICE_SESSION_VERIFY_PUBKEY;
+        session_clear_ssl_cache(session);
 	break;
     case PROP_CERT_SUBJECT:
         g_free(s->cert_subject);
@@ -776,9 +815,11 @@ static void spice_session_set_property(GObject      *gobject,
             s->verify |= SPICE_SESSION_VERIFY_SUBJECT;
         else
             s->verify &= ~SPICE_SESSION_VERIFY_SUBJECT;
+        session_clear_ssl_cache(session);
         break;
     case PROP_VERIFY:
         s->verify = g_value_get_flags(value);
+        session_clear_ssl_cache(session);
         break;
     case PROP_MIGRATION_STATE:
         s->migration_state = g_value_get_enum(value);
@@ -827,6 +868,7 @@ static void spice_session_set_property(GObject      *gobject,
     case PROP_CA:
         g_clear_pointer(&s->ca, g_byte_array_unref);
         s->ca = g_value_dup_boxed(value);
+        session_clear_ssl_cache(session);
         break;
     case PROP_PROXY:
         update_proxy(session, g_value_get_string(value));
@@ -856,6 +898,7 @@ static void spice_session_class_init(SpiceSessionClass *klass)
 
     _wocky_http_proxy_get_type();
     _wocky_https_proxy_get_type();
+    spice_log_init();
 
     gobject_class->dispose      = spice_session_dispose;
     gobject_class->finalize     = spice_session_finalize;
@@ -1508,11 +1551,6 @@ SpiceSession *spice_session_new_from_session(SpiceSession *session)
     SpiceSession *copy;
     SpiceSessionPrivate *c;
 
-    if (s->client_provided_sockets) {
-        g_warning("migration with client provided fd is not supported yet");
-        return NULL;
-    }
-
     copy = SPICE_SESSION(g_object_new(SPICE_TYPE_SESSION,
                                       "host", NULL,
                                       "ca-file", NULL,
@@ -1551,6 +1589,9 @@ SpiceSession *spice_session_new_from_session(SpiceSession *session)
                  "ca", &c->ca,
                  NULL);
 
+    /* with client provided sockets, the destination fds are requested
+     * from the application with #SpiceChannel::open-fd on the channels
+     * of the migration session, see #SpiceMainChannel::migration-started */
     c->client_provided_sockets = s->client_provided_sockets;
     c->protocol = s->protocol;
     c->connection_id = s->connection_id;
@@ -2038,8 +2079,302 @@ struct spice_open_host {
     GError *error;
     GSocketConnection *connection;
     GSocketClient *client;
+
+    /* happy eyeballs state */
+    GList *addresses; /* remaining GInetAddress to try */
+    guint attempts;   /* connection attempts in flight */
+    guint fallback_id;
+};
+
+typedef struct host_lookup host_lookup;
+
+struct host_lookup {
+    SpiceSession *session;
+    GCancellable *cancellable; /* cancelled when the session disconnects */
+    GList *waiters; /* spice_open_host */
+};
+
+/* delay before racing the next address, see RFC 8305 */
+#define CONNECTION_ATTEMPT_DELAY 250
+
+#define SOCKET_TIMEOUT 10
+
+/* tunnels kept open through the proxy, per port */
+#define PROXY_TUNNELS 2
+/* in seconds, older tunnels may have been dropped by the proxy idle
+ * timeout, they are replaced before */
+#define PROXY_TUNNEL_MAX_AGE 30
+/* times in a row an unused tunnel is replaced as it ages out, the pool
+ * then stays empty until the next channel connects through the proxy */
+#define PROXY_TUNNEL_MAX_EXPIRIES 2
+/* in seconds, a tunnel closed by the other end sooner is not replaced
+ * until the next channel connects through the proxy */
+#define PROXY_TUNNEL_MIN_AGE 1
+
+typedef struct proxy_tunnel proxy_tunnel;
+
+struct proxy_tunnel {
+    SpiceSession *session; /* weak, NULL once dropped from the pool */
+    int port;
+    GSocketConnection *connection; /* NULL while connecting */
+    GCancellable *cancellable;
+    gint64 time;
+    guint expiries; /* of the unused tunnels this one replaces */
+    GSource *watch; /* for the other end closing the tunnel */
+    guint timeout_id;
 };
 
+static GSocketAddress *session_proxy_address_new(SpiceSession *session,
+                                                 GInetAddress *proxy_address,
+                                                 int port)
+{
+    SpiceSessionPrivate *s = session->priv;
+
+    return g_proxy_address_new(proxy_address,
+                               spice_uri_get_port(s->proxy),
+                               spice_uri_get_scheme(s->proxy),
+                               s->host, port,
+                               spice_uri_get_user(s->proxy),
+                               spice_uri_get_password(s->proxy));
+}
+
+static void proxy_tunnel_free(proxy_tunnel *tunnel)
+{
+    if (tunnel->watch != NULL) {
+        g_source_destroy(tunnel->watch);
+        g_source_unref(tunnel->watch);
+    }
+    if (tunnel->timeout_id != 0)
+        g_source_remove(tunnel->timeout_id);
+    g_clear_object(&tunnel->connection);
+    g_clear_object(&tunnel->cancellable);
+    g_free(tunnel);
+}
+
+static void proxy_tunnels_fill(SpiceSession *session, int port, guint expiries);
+
+/* main context, closes a ready tunnel, and replaces it if @refill */
+static void proxy_tunnel_retire(proxy_tunnel *tunnel, gboolean refill,
+                                guint expiries)
+{
+    SpiceSession *session = tunnel->session;
+    int port = tunnel->port;
+
+    session->priv->proxy_tunnels = g_list_remove(session->priv->proxy_tunnels, tunnel);
+    proxy_tunnel_free(tunnel);
+    if (refill)
+        proxy_tunnels_fill(session, port, expiries);
+}
+
+/* main context */
+static gboolean proxy_tunnel_expired(gpointer data)
+{
+    proxy_tunnel *tunnel = data;
+    guint expiries = tunnel->expiries + 1;
+
+    SPICE_DEBUG("proxy tunnel to port %d expired", tunnel->port);
+    tunnel->timeout_id = 0;
+    /* nothing used the pool for a while, let it drain */
+    proxy_tunnel_retire(tunnel, expiries <= PROXY_TUNNEL_MAX_EXPIRIES, expiries);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* main context, (re)arms the timeout of a ready tunnel */
+static void proxy_tunnel_schedule_expiry(proxy_tunnel *tunnel)
+{
+    gint64 left = tunnel->time + PROXY_TUNNEL_MAX_AGE * G_USEC_PER_SEC - g_get_monotonic_time();
+
+    if (tunnel->timeout_id != 0)
+        g_source_remove(tunnel->timeout_id);
+    tunnel->timeout_id = g_timeout_add(MAX(left, 0) / G_TIME_SPAN_MILLISECOND,
+                                       proxy_tunnel_expired, tunnel);
+}
+
+/* main context */
+static gboolean proxy_tunnel_closed(GSocket *socket G_GNUC_UNUSED,
+                                    GIOCondition condition G_GNUC_UNUSED,
+                                    gpointer data)
+{
+    proxy_tunnel *tunnel = data;
+    gboolean refill;
+
+    SPICE_DEBUG("proxy tunnel to port %d closed", tunnel->port);
+    /* don't keep reopening tunnels the proxy or the server turn down */
+    refill = g_get_monotonic_time() - tunnel->time >= PROXY_TUNNEL_MIN_AGE * G_USEC_PER_SEC;
+    proxy_tunnel_retire(tunnel, refill, tunnel->expiries);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* main context */
+static void proxy_tunnel_ready(GObject *source_object, GAsyncResult *result,
+                               gpointer data)
+{
+    proxy_tunnel *tunnel = data;
+    GError *error = NULL;
+
+    tunnel->connection = g_socket_client_connect_finish(G_SOCKET_CLIENT(source_object),
+                                                        result, &error);
+    if (tunnel->session == NULL) {
+        /* the pool was cleared meanwhile */
+        g_clear_error(&error);
+        proxy_tunnel_free(tunnel);
+        return;
+    }
+
+    if (tunnel->connection == NULL) {
+        SpiceSessionPrivate *s = tunnel->session->priv;
+
+        SPICE_DEBUG("proxy tunnel to port %d failed: %s", tunnel->port, error->message);
+        s->proxy_tunnels = g_list_remove(s->proxy_tunnels, tunnel);
+        g_clear_error(&error);
+        proxy_tunnel_free(tunnel);
+        return;
+    }
+
+    SPICE_DEBUG("proxy tunnel to port %d ready", tunnel->port);
+    tunnel->time = g_get_monotonic_time();
+    /* the server doesn't send anything before the link message, a
+     * readable tunnel was closed on the other end */
+    tunnel->watch = g_socket_create_source(g_socket_connection_get_socket(tunnel->connection),
+                                           G_IO_IN | G_IO_HUP | G_IO_ERR, NULL);
+    g_source_set_callback(tunnel->watch, (GSourceFunc)proxy_tunnel_closed, tunnel, NULL);
+    g_source_attach(tunnel->watch, NULL);
+    proxy_tunnel_schedule_expiry(tunnel);
+}
+
+/* main context, opens tunnels to @port until PROXY_TUNNELS are ready
+ * or on their way. @expiries is 0 when a channel used the pool */
+static void proxy_tunnels_fill(SpiceSession *session, int port, guint expiries)
+{
+    SpiceSessionPrivate *s = session->priv;
+    GSocketClient *client;
+    GList *it;
+    guint n = 0;
+
+    if (s->proxy == NULL || s->proxy_address == NULL)
+        return;
+
+    for (it = s->proxy_tunnels; it != NULL; it = it->next) {
+        proxy_tunnel *tunnel = it->data;
+
+        if (tunnel->port == port)
+            n++;
+    }
+    if (n >= PROXY_TUNNELS)
+        return;
+
+    client = g_socket_client_new();
+    g_socket_client_set_enable_proxy(client, TRUE);
+    g_socket_client_set_timeout(client, SOCKET_TIMEOUT);
+    for (; n < PROXY_TUNNELS; n++) {
+        proxy_tunnel *tunnel = g_new0(proxy_tunnel, 1);
+        GSocketAddress *address;
+
+        tunnel->session = session;
+        tunnel->port = port;
+        tunnel->expiries = expiries;
+        tunnel->cancellable = g_cancellable_new();
+        s->proxy_tunnels = g_list_prepend(s->proxy_tunnels, tunnel);
+
+        address = session_proxy_address_new(session, s->proxy_address, port);
+        g_socket_client_connect_async(client, G_SOCKET_CONNECTABLE(address),
+                                      tunnel->cancellable,
+                                      proxy_tunnel_ready, tunnel);
+        g_object_unref(address);
+    }
+    g_object_unref(client);
+}
+
+/* main context, returns a ready tunnel to @port, or NULL. Tunnels that
+ * expired or were closed are already gone from the pool, but their
+ * watch may not have run yet */
+static GSocketConnection *proxy_tunnel_take(SpiceSession *session, int port)
+{
+    SpiceSessionPrivate *s = session->priv;
+    GList *it, *next;
+
+    for (it = s->proxy_tunnels; it != NULL; it = next) {
+        proxy_tunnel *tunnel = it->data;
+        GSocketConnection *connection = NULL;
+        GSocket *socket;
+
+        next = it->next;
+        if (tunnel->port != port || tunnel->connection == NULL)
+            continue;
+
+        s->proxy_tunnels = g_list_delete_link(s->proxy_tunnels, it);
+        socket = g_socket_connection_get_socket(tunnel->connection);
+        if (g_socket_condition_check(socket, G_IO_IN | G_IO_HUP | G_IO_ERR) == 0) {
+            connection = tunnel->connection;
+            tunnel->connection = NULL;
+        }
+        proxy_tunnel_free(tunnel);
+        if (connection != NULL)
+            return connection;
+    }
+
+    return NULL;
+}
+
+/* main context, for the tests: the number of tunnels in the pool, and
+ * of those ready to be used in @ready */
+G_GNUC_INTERNAL
+guint spice_session_count_proxy_tunnels(SpiceSession *session, guint *ready)
+{
+    SpiceSessionPrivate *s = session->priv;
+    GList *it;
+
+    *ready = 0;
+    for (it = s->proxy_tunnels; it != NULL; it = it->next) {
+        proxy_tunnel *tunnel = it->data;
+
+        if (tunnel->connection != NULL)
+            (*ready)++;
+    }
+
+    return g_list_length(s->proxy_tunnels);
+}
+
+/* main context, for the tests: makes the ready tunnels @seconds older,
+ * those older than PROXY_TUNNEL_MAX_AGE expire from the main loop */
+G_GNUC_INTERNAL
+void spice_session_age_proxy_tunnels(SpiceSession *session, guint seconds)
+{
+    SpiceSessionPrivate *s = session->priv;
+    GList *it;
+
+    for (it = s->proxy_tunnels; it != NULL; it = it->next) {
+        proxy_tunnel *tunnel = it->data;
+
+        if (tunnel->connection == NULL)
+            continue;
+        tunnel->time -= seconds * G_USEC_PER_SEC;
+        proxy_tunnel_schedule_expiry(tunnel);
+    }
+}
+
+static void session_clear_proxy_tunnels(SpiceSession *session)
+{
+    SpiceSessionPrivate *s = session->priv;
+    GList *it;
+
+    for (it = s->proxy_tunnels; it != NULL; it = it->next) {
+        proxy_tunnel *tunnel = it->data;
+
+        if (tunnel->connection == NULL) {
+            /* freed by proxy_tunnel_ready() */
+            tunnel->session = NULL;
+            g_cancellable_cancel(tunnel->cancellable);
+        } else {
+            proxy_tunnel_free(tunnel);
+        }
+    }
+    g_list_free(s->proxy_tunnels);
+    s->proxy_tunnels = NULL;
+}
+
 static void socket_client_connect_ready(GObject *source_object, GAsyncResult *result,
                                         gpointer data)
 {
@@ -2055,6 +2390,8 @@ static void socket_client_connect_ready(GObject *source_object, GAsyncResult *re
     }
 
     open_host->connection = connection;
+    if (open_host->proxy != NULL)
+        proxy_tunnels_fill(open_host->session, open_host->port, 0);
 
 end:
     coroutine_yieldto(open_host->from, NULL);
@@ -2077,7 +2414,7 @@ static void proxy_lookup_ready(GObject *source_object, GAsyncResult *result,
     spice_open_host *open_host = data;
     SpiceSession *session = open_host->session;
     SpiceSessionPrivate *s = session->priv;
-    GList *addresses = NULL, *it;
+    GList *addresses = NULL;
     GSocketAddress *address;
 
     SPICE_DEBUG("proxy lookup ready");
@@ -2089,22 +2426,273 @@ static void proxy_lookup_ready(GObject *source_object, GAsyncResult *result,
         return;
     }
 
-    for (it = addresses; it != NULL; it = it->next) {
-        address = g_proxy_address_new(G_INET_ADDRESS(it->data),
-                                      spice_uri_get_port(open_host->proxy),
-                                      spice_uri_get_scheme(open_host->proxy),
-                                      s->host, open_host->port,
-                                      spice_uri_get_user(open_host->proxy),
-                                      spice_uri_get_password(open_host->proxy));
-        if (address != NULL)
-            break;
-    }
+    /* unless the proxy changed meanwhile, later channels and tunnels
+     * skip the lookup */
+    if (open_host->proxy == s->proxy && s->proxy_address == NULL)
+        s->proxy_address = g_object_ref(addresses->data);
 
+    address = session_proxy_address_new(session, G_INET_ADDRESS(addresses->data),
+                                        open_host->port);
     open_host_connectable_connect(open_host, G_SOCKET_CONNECTABLE(address));
     g_resolver_free_addresses(addresses);
     g_object_unref(address);
 }
 
+static void open_host_attempt_next(spice_open_host *open_host);
+
+/* main context */
+static void open_host_attempts_done(spice_open_host *open_host)
+{
+    if (open_host->fallback_id != 0) {
+        g_source_remove(open_host->fallback_id);
+        open_host->fallback_id = 0;
+    }
+    g_list_free_full(open_host->addresses, g_object_unref);
+    open_host->addresses = NULL;
+
+    if (open_host->connection != NULL) {
+        g_clear_error(&open_host->error);
+    } else {
+        SpiceSessionPrivate *s = open_host->session->priv;
+
+        /* the host may have moved, the next channel resolves it again */
+        g_resolver_free_addresses(s->host_addresses);
+        s->host_addresses = NULL;
+    }
+
+    coroutine_yieldto(open_host->from, NULL);
+}
+
+/* main context */
+static void open_host_attempt_ready(GObject *source_object, GAsyncResult *result,
+                                    gpointer data)
+{
+    GSocketClient *client = G_SOCKET_CLIENT(source_object);
+    spice_open_host *open_host = data;
+    GSocketConnection *connection;
+    GError *error = NULL;
+
+    open_host->attempts--;
+    connection = g_socket_client_connect_finish(client, result, &error);
+    if (connection != NULL) {
+        if (open_host->connection == NULL) {
+            CHANNEL_DEBUG(open_host->channel, "connect ready");
+            open_host->connection = connection;
+            /* abort the attempts still racing */
+            g_cancellable_cancel(open_host->cancellable);
+        } else {
+            g_object_unref(connection);
+        }
+    } else if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        CHANNEL_DEBUG(open_host->channel, "connection attempt failed: %s", error->message);
+        g_clear_error(&open_host->error);
+        open_host->error = error;
+        error = NULL;
+    }
+    g_clear_error(&error);
+
+    if (open_host->connection == NULL && open_host->addresses != NULL) {
+        /* don't wait for the timer if all the attempts failed */
+        if (open_host->attempts == 0)
+            open_host_attempt_next(open_host);
+        return;
+    }
+
+    /* the stack of the coroutine holds @open_host, wait for all the
+     * callbacks before resuming it */
+    if (open_host->attempts == 0)
+        open_host_attempts_done(open_host);
+}
+
+/* main context */
+static gboolean open_host_fallback_cb(gpointer data)
+{
+    spice_open_host *open_host = data;
+
+    if (open_host->connection != NULL || open_host->addresses == NULL) {
+        open_host->fallback_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    open_host_attempt_next(open_host);
+    return G_SOURCE_CONTINUE;
+}
+
+/* main context */
+static void open_host_attempt_next(spice_open_host *open_host)
+{
+    GInetAddress *inet_address;
+    GSocketAddress *address;
+
+    g_return_if_fail(open_host->addresses != NULL);
+
+    inet_address = open_host->addresses->data;
+    open_host->addresses = g_list_delete_link(open_host->addresses,
+                                              open_host->addresses);
+
+    if (spice_util_get_debug()) {
+        gchar *str = g_inet_address_to_string(inet_address);
+        CHANNEL_DEBUG(open_host->channel, "connecting %s:%d...", str, open_host->port);
+        g_free(str);
+    }
+
+    address = g_inet_socket_address_new(inet_address, open_host->port);
+    open_host->attempts++;
+    g_socket_client_connect_async(open_host->client, G_SOCKET_CONNECTABLE(address),
+                                  open_host->cancellable,
+                                  open_host_attempt_ready, open_host);
+    g_object_unref(address);
+    g_object_unref(inet_address);
+
+    if (open_host->addresses != NULL && open_host->fallback_id == 0)
+        open_host->fallback_id = g_timeout_add(CONNECTION_ATTEMPT_DELAY,
+                                               open_host_fallback_cb, open_host);
+}
+
+/* main context */
+static void open_host_connect_addresses(spice_open_host *open_host, GList *addresses)
+{
+    if (addresses == NULL) {
+        if (open_host->error == NULL)
+            g_set_error(&open_host->error, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
+                        "No address to connect to");
+        coroutine_yieldto(open_host->from, NULL);
+        return;
+    }
+
+    open_host->addresses = g_list_copy_deep(addresses, (GCopyFunc)g_object_ref, NULL);
+    open_host_attempt_next(open_host);
+}
+
+/* Interleave the address families, starting with the family of the
+ * first address returned by the resolver (RFC 8305 section 4).
+ * Takes ownership of @addresses. */
+static GList *happy_eyeballs_sort(GList *addresses)
+{
+    GQueue first = G_QUEUE_INIT, second = G_QUEUE_INIT;
+    GList *it, *sorted = NULL;
+    GSocketFamily family;
+
+    if (addresses == NULL)
+        return NULL;
+
+    family = g_inet_address_get_family(addresses->data);
+    for (it = addresses; it != NULL; it = it->next) {
+        if (g_inet_address_get_family(it->data) == family)
+            g_queue_push_tail(&first, it->data);
+        else
+            g_queue_push_tail(&second, it->data);
+    }
+    g_list_free(addresses);
+
+    while (!g_queue_is_empty(&first) || !g_queue_is_empty(&second)) {
+        if (!g_queue_is_empty(&first))
+            sorted = g_list_prepend(sorted, g_queue_pop_head(&first));
+        if (!g_queue_is_empty(&second))
+            sorted = g_list_prepend(sorted, g_queue_pop_head(&second));
+    }
+
+    return g_list_reverse(sorted);
+}
+
+/* main context */
+static void host_lookup_ready(GObject *source_object, GAsyncResult *result,
+                              gpointer data)
+{
+    host_lookup *lookup = data;
+    SpiceSessionPrivate *s = lookup->session->priv;
+    GList *addresses, *it;
+    GError *error = NULL;
+
+    addresses = g_resolver_lookup_by_name_finish(G_RESOLVER(source_object),
+                                                 result, &error);
+    addresses = happy_eyeballs_sort(addresses);
+    SPICE_DEBUG("host lookup ready, %u addresses", g_list_length(addresses));
+
+    if (g_cancellable_is_cancelled(lookup->cancellable)) {
+        /* the session disconnected, the waiting channels only get the
+         * error to give up on */
+        if (error == NULL)
+            g_set_error_literal(&error, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                "Session disconnected");
+        g_resolver_free_addresses(addresses);
+        addresses = NULL;
+    } else if (s->host_lookup == lookup) {
+        /* otherwise the host changed meanwhile, don't cache the result */
+        s->host_lookup = NULL;
+        if (addresses != NULL)
+            s->host_addresses = g_list_copy_deep(addresses, (GCopyFunc)g_object_ref, NULL);
+    }
+
+    for (it = lookup->waiters; it != NULL; it = it->next) {
+        spice_open_host *open_host = it->data;
+
+        if (error != NULL) {
+            open_host->error = g_error_copy(error);
+            coroutine_yieldto(open_host->from, NULL);
+        } else {
+            open_host_connect_addresses(open_host, addresses);
+        }
+    }
+
+    g_list_free(lookup->waiters);
+    g_resolver_free_addresses(addresses);
+    g_clear_error(&error);
+    g_object_unref(lookup->cancellable);
+    g_object_unref(lookup->session);
+    g_free(lookup);
+}
+
+/* main context */
+static void open_host_lookup(spice_open_host *open_host)
+{
+    SpiceSession *session = open_host->session;
+    SpiceSessionPrivate *s = session->priv;
+
+    if (s->host_addresses != NULL) {
+        SPICE_DEBUG("open host %s:%d (cached)", s->host, open_host->port);
+        open_host_connect_addresses(open_host, s->host_addresses);
+        return;
+    }
+
+    /* channels created together share a single lookup */
+    if (s->host_lookup == NULL) {
+        SPICE_DEBUG("resolving host %s", s->host);
+        s->host_lookup = g_new0(host_lookup, 1);
+        s->host_lookup->session = g_object_ref(session);
+        s->host_lookup->cancellable = g_cancellable_new();
+        g_resolver_lookup_by_name_async(g_resolver_get_default(), s->host,
+                                        s->host_lookup->cancellable,
+                                        host_lookup_ready, s->host_lookup);
+    }
+
+    SPICE_DEBUG("open host %s:%d", s->host, open_host->port);
+    s->host_lookup->waiters = g_list_append(s->host_lookup->waiters, open_host);
+}
+
+static void session_cancel_host_lookup(SpiceSession *session)
+{
+    SpiceSessionPrivate *s = session->priv;
+
+    if (s->host_lookup == NULL)
+        return;
+
+    g_cancellable_cancel(s->host_lookup->cancellable);
+    s->host_lookup = NULL;
+}
+
+static void session_clear_address_cache(SpiceSession *session)
+{
+    SpiceSessionPrivate *s = session->priv;
+
+    g_resolver_free_addresses(s->host_addresses);
+    s->host_addresses = NULL;
+    /* a pending lookup still serves its waiters, but won't be cached */
+    s->host_lookup = NULL;
+    /* the tunnels lead to the previous host */
+    session_clear_proxy_tunnels(session);
+}
+
 /* main context */
 static gboolean open_host_idle_cb(gpointer data)
 {
@@ -2125,10 +2713,27 @@ static gboolean open_host_idle_cb(gpointer data)
     }
 
     if (open_host->proxy) {
-        g_resolver_lookup_by_name_async(g_resolver_get_default(),
-                                        spice_uri_get_hostname(open_host->proxy),
-                                        open_host->cancellable,
-                                        proxy_lookup_ready, open_host);
+        open_host->connection = proxy_tunnel_take(open_host->session, open_host->port);
+        if (open_host->connection != NULL) {
+            CHANNEL_DEBUG(open_host->channel, "using a proxy tunnel opened ahead");
+            proxy_tunnels_fill(open_host->session, open_host->port, 0);
+            coroutine_yieldto(open_host->from, NULL);
+            return FALSE;
+        }
+
+        if (s->proxy_address != NULL) {
+            GSocketAddress *address;
+
+            address = session_proxy_address_new(open_host->session, s->proxy_address,
+                                                open_host->port);
+            open_host_connectable_connect(open_host, G_SOCKET_CONNECTABLE(address));
+            g_object_unref(address);
+        } else {
+            g_resolver_lookup_by_name_async(g_resolver_get_default(),
+                                            spice_uri_get_hostname(open_host->proxy),
+                                            open_host->cancellable,
+                                            proxy_lookup_ready, open_host);
+        }
     } else {
         GSocketConnectable *address = NULL;
 
@@ -2141,8 +2746,8 @@ static gboolean open_host_idle_cb(gpointer data)
                                 "Unix path unsupported on this platform");
 #endif
         } else {
-            SPICE_DEBUG("open host %s:%d", s->host, open_host->port);
-            address = g_network_address_parse(s->host, open_host->port, &open_host->error);
+            open_host_lookup(open_host);
+            return FALSE;
         }
 
         if (address == NULL || open_host->error != NULL) {
@@ -2163,8 +2768,6 @@ static gboolean open_host_idle_cb(gpointer data)
     return FALSE;
 }
 
-#define SOCKET_TIMEOUT 10
-
 /* coroutine context */
 G_GNUC_INTERNAL
 GSocketConnection* spice_session_channel_open_host(SpiceSession *session, SpiceChannel *channel,
@@ -2214,6 +2817,7 @@ GSocketConnection* spice_session_channel_open_host(SpiceSession *session, SpiceC
     }
 
     open_host.client = g_socket_client_new();
+    open_host.cancellable = g_cancellable_new();
     g_socket_client_set_enable_proxy(open_host.client, s->proxy != NULL);
     g_socket_client_set_timeout(open_host.client, SOCKET_TIMEOUT);
 
@@ -2233,6 +2837,7 @@ GSocketConnection* spice_session_channel_open_host(SpiceSession *session, SpiceC
     }
 
     g_clear_object(&open_host.client);
+    g_clear_object(&open_host.cancellable);
     return open_host.connection;
 }
 
@@ -2270,6 +2875,16 @@ void spice_session_channel_new(SpiceSession *session, SpiceChannel *channel)
     }
 
     g_signal_emit(session, signals[SPICE_SESSION_CHANNEL_NEW], 0, channel);
+
+    /* the audio backend is only brought up once a channel needs it, a
+     * session redirecting USB alone never talks to PulseAudio/GStreamer */
+    if (s->audio && s->audio_manager == NULL &&
+        (SPICE_IS_PLAYBACK_CHANNEL(channel) || SPICE_IS_RECORD_CHANNEL(channel))) {
+        spice_audio_get(session, NULL);
+        /* the main channel skipped the volume sync without it */
+        if (s->audio_manager != NULL && s->cmain != NULL)
+            spice_main_channel_sync_audio(SPICE_MAIN_CHANNEL(s->cmain));
+    }
 }
 
 static void spice_session_channel_destroy(SpiceSession *session, SpiceChannel *channel)
@@ -2486,6 +3101,169 @@ const gchar* spice_session_get_ca_file(SpiceSession *session)
     return s->ca_file;
 }
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000
+static int SSL_CTX_up_ref(SSL_CTX *ctx)
+{
+    CRYPTO_add(&ctx->references, 1, CRYPTO_LOCK_SSL_CTX);
+    return 1;
+}
+#endif
+
+static void session_clear_ssl_cache(SpiceSession *session)
+{
+    SpiceSessionPrivate *s = session->priv;
+
+    g_clear_pointer(&s->ssl_session, SSL_SESSION_free);
+    if (s->ssl_ctx != NULL) {
+        /* channels may still hold a reference on the context */
+        SSL_CTX_set_app_data(s->ssl_ctx, NULL);
+        g_clear_pointer(&s->ssl_ctx, SSL_CTX_free);
+    }
+}
+
+static int session_load_ca(SpiceSession *session, SSL_CTX *ctx)
+{
+    SpiceSessionPrivate *s = session->priv;
+    int i, count = 0;
+    int rc;
+
+    SPICE_DEBUG("Load CA, file: %s, data: %p", s->ca_file, s->ca);
+
+    if (s->ca != NULL) {
+        STACK_OF(X509_INFO) *inf;
+        X509_STORE *store;
+        BIO *in;
+
+        store = SSL_CTX_get_cert_store(ctx);
+        in = BIO_new_mem_buf(s->ca->data, s->ca->len);
+        inf = PEM_X509_INFO_read_bio(in, NULL, NULL, NULL);
+        BIO_free(in);
+
+        for (i = 0; i < sk_X509_INFO_num(inf); i++) {
+            X509_INFO *itmp;
+            itmp = sk_X509_INFO_value(inf, i);
+            if (itmp->x509) {
+                X509_STORE_add_cert(store, itmp->x509);
+                count++;
+            }
+            if (itmp->crl) {
+                X509_STORE_add_crl(store, itmp->crl);
+                count++;
+            }
+        }
+
+        sk_X509_INFO_pop_free(inf, X509_INFO_free);
+    }
+
+    if (s->ca_file != NULL) {
+        rc = SSL_CTX_load_verify_locations(ctx, s->ca_file, NULL);
+        if (rc != 1)
+            g_warning("loading ca certs from %s failed", s->ca_file);
+        else
+            count++;
+    }
+
+    if (count == 0) {
+        rc = SSL_CTX_set_default_verify_paths(ctx);
+        if (rc != 1)
+            g_warning("loading ca certs from default location failed");
+        else
+            count++;
+    }
+
+    return count;
+}
+
+/* called by OpenSSL when a channel gets a new session (or a TLS 1.3
+ * ticket), so that the next channels can resume it */
+static int session_ssl_new_session_cb(SSL *ssl, SSL_SESSION *ssl_session)
+{
+    SpiceSession *session = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+
+    if (session == NULL)
+        return 0;
+
+    g_clear_pointer(&session->priv->ssl_session, SSL_SESSION_free);
+    session->priv->ssl_session = ssl_session;
+
+    /* we took ownership of @ssl_session */
+    return 1;
+}
+
+/* Returns a new reference on the TLS context shared by all the channels
+ * of @session, creating it and loading the CA certificates on first use.
+ * @verify is set to the verification flags the channel should use. */
+G_GNUC_INTERNAL
+SSL_CTX *spice_session_get_ssl_ctx(SpiceSession *session, guint *verify)
+{
+    SpiceSessionPrivate *s;
+    SSL_CTX *ctx;
+    /* When some other SSL/TLS version becomes obsolete, add it to this
+     * variable. */
+    long ssl_options = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3;
+    guint ctx_verify;
+    int rc;
+
+    g_return_val_if_fail(SPICE_IS_SESSION(session), NULL);
+    g_return_val_if_fail(verify != NULL, NULL);
+    s = session->priv;
+
+    if (s->ssl_ctx != NULL)
+        goto end;
+
+    ctx = SSL_CTX_new(SSLv23_method());
+    if (ctx == NULL) {
+        g_critical("SSL_CTX_new failed");
+        return NULL;
+    }
+
+    SSL_CTX_set_options(ctx, ssl_options);
+
+    ctx_verify = s->verify;
+    if (ctx_verify &
+        (SPICE_SESSION_VERIFY_SUBJECT | SPICE_SESSION_VERIFY_HOSTNAME)) {
+        rc = session_load_ca(session, ctx);
+        if (rc == 0) {
+            g_warning("no cert loaded");
+            if (ctx_verify & SPICE_SESSION_VERIFY_PUBKEY) {
+                g_warning("only pubkey active");
+                ctx_verify = SPICE_SESSION_VERIFY_PUBKEY;
+            } else {
+                SSL_CTX_free(ctx);
+                return NULL;
+            }
+        }
+    }
+
+    if (s->ciphers != NULL) {
+        rc = SSL_CTX_set_cipher_list(ctx, s->ciphers);
+        if (rc != 1)
+            g_warning("loading cipher list %s failed", s->ciphers);
+    }
+
+    SSL_CTX_set_app_data(ctx, session);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT |
+                                        SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, session_ssl_new_session_cb);
+
+    s->ssl_ctx = ctx;
+    s->ssl_verify = ctx_verify;
+
+end:
+    *verify = s->ssl_verify;
+    SSL_CTX_up_ref(s->ssl_ctx);
+    return s->ssl_ctx;
+}
+
+/* returns the last session negotiated with the server, if any */
+G_GNUC_INTERNAL
+SSL_SESSION *spice_session_get_ssl_session(SpiceSession *session)
+{
+    g_return_val_if_fail(SPICE_IS_SESSION(session), NULL);
+
+    return session->priv->ssl_session;
+}
+
 G_GNUC_INTERNAL
 void spice_session_get_caches(SpiceSession *session,
                               display_cache **images,
@@ -2731,6 +3509,14 @@ gboolean spice_session_get_audio_enabled(SpiceSession *session)
     return session->priv->audio;
 }
 
+G_GNUC_INTERNAL
+SpiceAudio *spice_session_get_audio_manager(SpiceSession *session)
+{
+    g_return_val_if_fail(SPICE_IS_SESSION(session), NULL);
+
+    return session->priv->audio_manager;
+}
+
 G_GNUC_INTERNAL
 gboolean spice_session_get_usbredir_enabled(SpiceSession *session)
 {
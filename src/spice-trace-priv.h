@@ -0,0 +1,63 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SPICE_TRACE_PRIV_H
+#define SPICE_TRACE_PRIV_H
+
+/*
+ * USDT probes of the "spice" provider, built with --enable-usdt.
+ *
+ * A probe is a single nop in the code and a note in the .note.stapsdt
+ * section, a tracer only reads the arguments once attached. Keep them to
+ * values at hand (no function calls), they are evaluated regardless, e.g.:
+ *
+ *   bpftrace -e 'usdt:libspice-client-glib-2.0.so:spice:recv_msg_end
+ *                { @[arg2] = hist(arg3); }'
+ *
+ * Probes and arguments:
+ *   socket_read(channel_type, channel_id, bytes)
+ *   socket_write(channel_type, channel_id, bytes)
+ *   recv_msg_begin(channel_type, channel_id)
+ *   recv_msg_end(channel_type, channel_id, msg_type, msg_size)
+ *   msg_out_send(channel_type, channel_id, msg_size)
+ *   msg_out_write(channel_type, channel_id, msg_size)
+ *   usbredir_parse_begin(channel_id, device_id, bytes)
+ *   usbredir_parse_end(channel_id, device_id, result)
+ *   usbredir_write(channel_id, device_id, bytes)
+ *   usb_events_begin()
+ *   usb_events_end(result)
+ *
+ * device_id is bus number << 8 | device address.
+ */
+
+#ifdef ENABLE_USDT
+#include <sys/sdt.h>
+
+#define SPICE_TRACE(name) DTRACE_PROBE(spice, name)
+#define SPICE_TRACE1(name, a1) DTRACE_PROBE1(spice, name, a1)
+#define SPICE_TRACE2(name, a1, a2) DTRACE_PROBE2(spice, name, a1, a2)
+#define SPICE_TRACE3(name, a1, a2, a3) DTRACE_PROBE3(spice, name, a1, a2, a3)
+#define SPICE_TRACE4(name, a1, a2, a3, a4) DTRACE_PROBE4(spice, name, a1, a2, a3, a4)
+#else
+#define SPICE_TRACE(name) do {} while (0)
+#define SPICE_TRACE1(name, a1) do {} while (0)
+#define SPICE_TRACE2(name, a1, a2) do {} while (0)
+#define SPICE_TRACE3(name, a1, a2, a3) do {} while (0)
+#define SPICE_TRACE4(name, a1, a2, a3, a4) do {} while (0)
+#endif
+
+#endif /* SPICE_TRACE_PRIV_H */
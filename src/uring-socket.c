@@ -0,0 +1,453 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <liburing.h>
+#include <glib-unix.h>
+
+#include "spice-util.h"
+#include "uring-socket.h"
+
+/*
+ * io_uring backend for a channel socket.
+ *
+ * Receiving uses a single multishot recv, which fills buffers taken
+ * from a ring registered with the kernel: one submission keeps
+ * delivering data until the buffers run out, and a burst of packets
+ * costs one wakeup. A buffer goes back to the ring once the channel
+ * consumed it.
+ *
+ * Sending copies the data into slots, and submits all the queued slots
+ * at once as a chain of linked sends, so that the kernel keeps them in
+ * order. A new chain is only submitted when the previous one
+ * completed, two chains in flight could otherwise be reordered.
+ *
+ * The caller polls spice_uring_socket_get_fd(), which becomes readable
+ * when completions are waiting.
+ */
+
+#define URING_ENTRIES 64
+#define URING_BUF_GROUP 0
+#define URING_RECV_BUFS 32 /* must be a power of 2 */
+#define URING_RECV_BUF_SIZE (16 * 1024)
+#define URING_SEND_SLOTS 16
+#define URING_SEND_SLOT_SIZE (16 * 1024)
+
+enum {
+    URING_OP_RECV = 1,
+    URING_OP_SEND,
+    URING_OP_CANCEL,
+};
+
+typedef struct {
+    guint16 bid;
+    guint32 len;
+    guint32 offset;
+} UringChunk;
+
+typedef struct {
+    guint8 *data;
+    guint32 len;
+} UringSlot;
+
+struct _SpiceUringSocket {
+    struct io_uring ring;
+    int fd;
+
+    struct io_uring_buf_ring *buf_ring;
+    guint8 *recv_bufs;
+    UringChunk chunks[URING_RECV_BUFS]; /* received, in order */
+    guint chunk_head;
+    guint chunk_count;
+    gboolean recv_armed;
+    gboolean eof;
+    int error; /* first failure, as -errno */
+
+    UringSlot slots[URING_SEND_SLOTS];
+    guint slot_head; /* oldest slot in flight or queued */
+    guint send_inflight;
+    guint send_queued;
+
+    gboolean cancel_pending;
+};
+
+static gboolean uring_arm_recv(SpiceUringSocket *usock)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = io_uring_get_sqe(&usock->ring);
+    if (sqe == NULL)
+        return FALSE;
+
+    io_uring_prep_recv_multishot(sqe, usock->fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    io_uring_sqe_set_data64(sqe, URING_OP_RECV);
+    usock->recv_armed = TRUE;
+
+    return TRUE;
+}
+
+static void uring_recycle_buffer(SpiceUringSocket *usock, guint16 bid)
+{
+    io_uring_buf_ring_add(usock->buf_ring,
+                          usock->recv_bufs + (gsize)bid * URING_RECV_BUF_SIZE,
+                          URING_RECV_BUF_SIZE, bid,
+                          io_uring_buf_ring_mask(URING_RECV_BUFS), 0);
+    io_uring_buf_ring_advance(usock->buf_ring, 1);
+}
+
+static void uring_submit_sends(SpiceUringSocket *usock)
+{
+    struct io_uring_sqe *sqe, *prev = NULL;
+    guint i;
+
+    if (usock->send_inflight > 0 || usock->send_queued == 0 || usock->error)
+        return;
+
+    for (i = 0; i < usock->send_queued; i++) {
+        UringSlot *slot = &usock->slots[(usock->slot_head + i) % URING_SEND_SLOTS];
+
+        sqe = io_uring_get_sqe(&usock->ring);
+        if (sqe == NULL)
+            break;
+        /* MSG_WAITALL: have the kernel retry short sends, a short send
+         * would break the chain */
+        io_uring_prep_send(sqe, usock->fd, slot->data, slot->len,
+                           MSG_NOSIGNAL | MSG_WAITALL);
+        io_uring_sqe_set_data64(sqe, URING_OP_SEND);
+        if (prev != NULL)
+            prev->flags |= IOSQE_IO_LINK;
+        prev = sqe;
+    }
+    usock->send_inflight = i;
+    usock->send_queued -= i;
+
+    io_uring_submit(&usock->ring);
+}
+
+static void uring_set_error(SpiceUringSocket *usock, int error)
+{
+    if (usock->error == 0) {
+        SPICE_DEBUG("io_uring socket error: %s", strerror(-error));
+        usock->error = error;
+    }
+}
+
+static void uring_reap(SpiceUringSocket *usock)
+{
+    struct io_uring_cqe *cqe;
+    unsigned head, count = 0;
+    gboolean rearm = FALSE;
+
+    io_uring_for_each_cqe(&usock->ring, head, cqe) {
+        count++;
+
+        if (io_uring_cqe_get_data64(cqe) == URING_OP_SEND) {
+            UringSlot *slot = &usock->slots[usock->slot_head];
+
+            if (cqe->res < 0)
+                uring_set_error(usock, cqe->res);
+            else if (cqe->res != slot->len)
+                uring_set_error(usock, -EIO);
+            slot->len = 0;
+            usock->slot_head = (usock->slot_head + 1) % URING_SEND_SLOTS;
+            usock->send_inflight--;
+            continue;
+        }
+
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            usock->recv_armed = FALSE;
+            rearm = TRUE;
+        }
+
+        if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+            UringChunk *chunk;
+
+            g_warn_if_fail(usock->chunk_count < URING_RECV_BUFS);
+            chunk = &usock->chunks[(usock->chunk_head + usock->chunk_count) % URING_RECV_BUFS];
+            chunk->bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            chunk->len = cqe->res;
+            chunk->offset = 0;
+            usock->chunk_count++;
+        } else if (cqe->res == 0) {
+            usock->eof = TRUE;
+        } else if (cqe->res == -ENOBUFS) {
+            /* re-armed once the channel gave a buffer back */
+            rearm = FALSE;
+        } else if (cqe->res < 0) {
+            uring_set_error(usock, cqe->res);
+        }
+    }
+    io_uring_cq_advance(&usock->ring, count);
+
+    if (rearm && !usock->recv_armed && !usock->eof && !usock->error &&
+        uring_arm_recv(usock))
+        io_uring_submit(&usock->ring);
+
+    /* keep the send pipeline going */
+    uring_submit_sends(usock);
+}
+
+SpiceUringSocket* spice_uring_socket_new(int fd)
+{
+    SpiceUringSocket *usock;
+    int ret, i;
+
+    g_return_val_if_fail(fd >= 0, NULL);
+
+    usock = g_new0(SpiceUringSocket, 1);
+    usock->fd = fd;
+
+    ret = io_uring_queue_init(URING_ENTRIES, &usock->ring, 0);
+    if (ret < 0) {
+        SPICE_DEBUG("io_uring unavailable: %s", strerror(-ret));
+        g_free(usock);
+        return NULL;
+    }
+
+    usock->buf_ring = io_uring_setup_buf_ring(&usock->ring, URING_RECV_BUFS,
+                                              URING_BUF_GROUP, 0, &ret);
+    if (usock->buf_ring == NULL) {
+        SPICE_DEBUG("io_uring buffer ring unavailable: %s", strerror(-ret));
+        io_uring_queue_exit(&usock->ring);
+        g_free(usock);
+        return NULL;
+    }
+
+    usock->recv_bufs = g_malloc((gsize)URING_RECV_BUFS * URING_RECV_BUF_SIZE);
+    for (i = 0; i < URING_RECV_BUFS; i++)
+        uring_recycle_buffer(usock, i);
+    for (i = 0; i < URING_SEND_SLOTS; i++)
+        usock->slots[i].data = g_malloc(URING_SEND_SLOT_SIZE);
+
+    uring_arm_recv(usock);
+    ret = io_uring_submit(&usock->ring);
+    if (ret < 0) {
+        SPICE_DEBUG("io_uring submit failed: %s", strerror(-ret));
+        usock->recv_armed = FALSE;
+        spice_uring_socket_free(usock);
+        return NULL;
+    }
+
+    return usock;
+}
+
+/* Reaps the completions of the cancelled requests. Returns TRUE once
+ * the last one is in: until then the kernel may still write to the
+ * receive buffers or read from the send slots. */
+static gboolean uring_reap_cancelled(SpiceUringSocket *usock)
+{
+    struct io_uring_cqe *cqe;
+    unsigned head, count = 0;
+
+    io_uring_for_each_cqe(&usock->ring, head, cqe) {
+        count++;
+        switch (io_uring_cqe_get_data64(cqe)) {
+        case URING_OP_RECV:
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+                usock->recv_armed = FALSE;
+            break;
+        case URING_OP_SEND:
+            usock->send_inflight--;
+            break;
+        case URING_OP_CANCEL:
+            usock->cancel_pending = FALSE;
+            break;
+        }
+    }
+    io_uring_cq_advance(&usock->ring, count);
+
+    return !usock->recv_armed && usock->send_inflight == 0 && !usock->cancel_pending;
+}
+
+/* Cancels the pending recv and sends. Returns TRUE if they are all
+ * done already. IORING_ASYNC_CANCEL_ANY is as old as the buffer rings,
+ * without which the socket would not exist. */
+static gboolean uring_cancel_all(SpiceUringSocket *usock)
+{
+    struct io_uring_sqe *sqe;
+
+    if (!usock->recv_armed && usock->send_inflight == 0)
+        return TRUE;
+
+    sqe = io_uring_get_sqe(&usock->ring);
+    if (sqe == NULL) {
+        io_uring_submit(&usock->ring);
+        sqe = io_uring_get_sqe(&usock->ring);
+    }
+    io_uring_prep_cancel(sqe, NULL, IORING_ASYNC_CANCEL_ANY);
+    io_uring_sqe_set_data64(sqe, URING_OP_CANCEL);
+    usock->cancel_pending = TRUE;
+    io_uring_submit(&usock->ring);
+
+    return uring_reap_cancelled(usock);
+}
+
+static void uring_free(SpiceUringSocket *usock)
+{
+    int i;
+
+    io_uring_free_buf_ring(&usock->ring, usock->buf_ring, URING_RECV_BUFS, URING_BUF_GROUP);
+    g_free(usock->recv_bufs);
+    for (i = 0; i < URING_SEND_SLOTS; i++)
+        g_free(usock->slots[i].data);
+    io_uring_queue_exit(&usock->ring);
+    g_free(usock);
+}
+
+/* main context */
+static gboolean uring_cancel_ready(gint fd G_GNUC_UNUSED, GIOCondition condition G_GNUC_UNUSED,
+                                   gpointer user_data)
+{
+    SpiceUringSocket *usock = user_data;
+
+    if (!uring_reap_cancelled(usock))
+        return G_SOURCE_CONTINUE;
+
+    uring_free(usock);
+    return G_SOURCE_REMOVE;
+}
+
+/* The socket the requests were on can be closed as soon as this returns,
+ * the ring keeps its own reference to it. */
+void spice_uring_socket_free(SpiceUringSocket *usock)
+{
+    if (usock == NULL)
+        return;
+
+    if (uring_cancel_all(usock)) {
+        uring_free(usock);
+        return;
+    }
+
+    /* the ring fd becomes readable as the cancellations complete,
+     * don't hold the caller until then */
+    g_unix_fd_add(usock->ring.ring_fd, G_IO_IN, uring_cancel_ready, usock);
+}
+
+int spice_uring_socket_get_fd(SpiceUringSocket *usock)
+{
+    g_return_val_if_fail(usock != NULL, -1);
+
+    return usock->ring.ring_fd;
+}
+
+gboolean spice_uring_socket_is_readable(SpiceUringSocket *usock)
+{
+    g_return_val_if_fail(usock != NULL, FALSE);
+
+    uring_reap(usock);
+
+    return usock->chunk_count > 0 || usock->eof || usock->error;
+}
+
+/* same contract as g_pollable_input_stream_read_nonblocking(): returns
+ * -1 and sets @cond when the caller should wait on the ring fd */
+gssize spice_uring_socket_recv(SpiceUringSocket *usock, void *data, gsize len,
+                               GIOCondition *cond)
+{
+    UringChunk *chunk;
+
+    g_return_val_if_fail(usock != NULL, -1);
+    *cond = 0;
+
+    if (usock->chunk_count == 0)
+        uring_reap(usock);
+
+    if (usock->chunk_count == 0) {
+        if (usock->eof)
+            return 0;
+        if (usock->error) {
+            errno = -usock->error;
+            return -1;
+        }
+        *cond = G_IO_IN;
+        return -1;
+    }
+
+    chunk = &usock->chunks[usock->chunk_head];
+    len = MIN(len, chunk->len - chunk->offset);
+    memcpy(data, usock->recv_bufs + (gsize)chunk->bid * URING_RECV_BUF_SIZE + chunk->offset, len);
+    chunk->offset += len;
+
+    if (chunk->offset == chunk->len) {
+        uring_recycle_buffer(usock, chunk->bid);
+        usock->chunk_head = (usock->chunk_head + 1) % URING_RECV_BUFS;
+        usock->chunk_count--;
+
+        if (!usock->recv_armed && !usock->eof && !usock->error &&
+            uring_arm_recv(usock))
+            io_uring_submit(&usock->ring);
+    }
+
+    return len;
+}
+
+/* queues up to @len bytes, which are sent on the next
+ * spice_uring_socket_flush() */
+gssize spice_uring_socket_send(SpiceUringSocket *usock, const void *data, gsize len,
+                               GIOCondition *cond)
+{
+    UringSlot *slot;
+    guint used;
+
+    g_return_val_if_fail(usock != NULL, -1);
+    *cond = 0;
+
+    if (usock->error) {
+        errno = -usock->error;
+        return -1;
+    }
+
+    used = usock->send_inflight + usock->send_queued;
+    slot = used > 0 ? &usock->slots[(usock->slot_head + used - 1) % URING_SEND_SLOTS] : NULL;
+
+    /* append to the last queued slot while it has room */
+    if (usock->send_queued == 0 || slot->len == URING_SEND_SLOT_SIZE) {
+        if (used == URING_SEND_SLOTS) {
+            uring_reap(usock);
+            used = usock->send_inflight + usock->send_queued;
+        }
+        if (used == URING_SEND_SLOTS) {
+            /* all slots taken, get them on the wire */
+            uring_submit_sends(usock);
+            *cond = G_IO_IN;
+            return -1;
+        }
+        slot = &usock->slots[(usock->slot_head + used) % URING_SEND_SLOTS];
+        slot->len = 0;
+        usock->send_queued++;
+    }
+
+    len = MIN(len, URING_SEND_SLOT_SIZE - slot->len);
+    memcpy(slot->data + slot->len, data, len);
+    slot->len += len;
+
+    return len;
+}
+
+void spice_uring_socket_flush(SpiceUringSocket *usock)
+{
+    g_return_if_fail(usock != NULL);
+
+    uring_submit_sends(usock);
+}
@@ -0,0 +1,41 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef URING_SOCKET_H_
+# define URING_SOCKET_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _SpiceUringSocket SpiceUringSocket;
+
+SpiceUringSocket* spice_uring_socket_new(int fd);
+void spice_uring_socket_free(SpiceUringSocket *usock);
+
+int spice_uring_socket_get_fd(SpiceUringSocket *usock);
+gboolean spice_uring_socket_is_readable(SpiceUringSocket *usock);
+
+gssize spice_uring_socket_recv(SpiceUringSocket *usock, void *data, gsize len,
+                               GIOCondition *cond);
+gssize spice_uring_socket_send(SpiceUringSocket *usock, const void *data, gsize len,
+                               GIOCondition *cond);
+void spice_uring_socket_flush(SpiceUringSocket *usock);
+
+G_END_DECLS
+
+#endif /* !URING_SOCKET_H_ */
@@ -35,6 +35,8 @@ void spice_usb_device_manager_stop_event_listening(
 #include <libusb.h>
 void spice_usb_device_manager_device_error(
     SpiceUsbDeviceManager *manager, SpiceUsbDevice *device, GError *err);
+void spice_usb_device_manager_park_device(
+    SpiceUsbDeviceManager *manager, SpiceUsbDevice *device, gboolean migrating);
 
 guint8 spice_usb_device_get_busnum(const SpiceUsbDevice *device);
 guint8 spice_usb_device_get_devaddr(const SpiceUsbDevice *device);
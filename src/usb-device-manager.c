@@ -9,8 +9,12 @@
 #include "spice-client.h"
 #include "spice-marshal.h"
 #include "usb-device-manager-priv.h"
+#include "spice-log-priv.h"
+#include "spice-trace-priv.h"
 #include <glib/gi18n-lib.h>
 #define DEV_ID_FMT "at %u.%u"
+/* how long a device stays reserved while its channel migrates, in ms */
+#define MIGRATION_PARK_TIMEOUT 10000
 
 /*Add cJSON related heads*/
 #include <stdio.h>
@@ -49,6 +53,7 @@ enum {
     PROP_AUTO_CONNECT_FILTER,
     PROP_REDIRECT_ON_CONNECT,
     PROP_FREE_CHANNELS,
+    PROP_RECONNECT_GRACE,
 };
 
 enum
@@ -57,18 +62,20 @@ enum
     DEVICE_REMOVED,
     AUTO_CONNECT_FAILED,
     DEVICE_ERROR,
+    DEVICE_CONNECTED,
     LAST_SIGNAL,
 };
 
+typedef struct _SpiceUsbContext SpiceUsbContext;
+
 struct _SpiceUsbDeviceManagerPrivate {
     SpiceSession *session;
     gboolean auto_connect;
     gchar *auto_connect_filter;
     gchar *redirect_on_connect;
+    SpiceUsbContext *usb;
     libusb_context *context;
     int event_listeners;
-    GThread *event_thread;
-    gint event_thread_run;
     struct usbredirfilter_rule *auto_conn_filter_rules;
     struct usbredirfilter_rule *redirect_on_connect_rules;
     int auto_conn_filter_rules_count;
@@ -77,8 +84,36 @@ struct _SpiceUsbDeviceManagerPrivate {
     libusb_hotplug_callback_handle hp_handle;
     GPtrArray *devices;
     GPtrArray *channels;
+    guint reconnect_grace;
+    GPtrArray *parked; /* ParkedDevice waiting for their channel to come back */
 };
 
+typedef struct {
+    SpiceUsbDeviceManager *self;
+    SpiceUsbDevice *device;
+    /* kept open so that the device is handed back to the next channel
+     * without a libusb_open() and ACL helper round trip. Only open:
+     * usbredirhost released the interfaces, and the kernel drivers may
+     * bind them again until the device is re-attached */
+    libusb_device_handle *handle;
+    guint timeout_id;
+} ParkedDevice;
+
+/* The libusb context and its event thread are shared by the managers of
+ * all the sessions of the process: one hotplug monitor, one device list
+ * and one thread however many sessions redirect USB devices. */
+struct _SpiceUsbContext {
+    libusb_context *context;
+    GThread *event_thread;
+    gint event_thread_run;
+    int event_listeners;
+    int refs;
+};
+
+/* protects usb_context and its fields, but for event_thread_run */
+static GMutex usb_context_mutex;
+static SpiceUsbContext *usb_context;
+
 enum {
     SPICE_USB_DEVICE_STATE_NONE = 0, /* this is also DISCONNECTED */
     SPICE_USB_DEVICE_STATE_CONNECTING,
@@ -101,8 +136,14 @@ typedef struct _SpiceUsbDeviceInfo {
 
 static void channel_new(SpiceSession *session, SpiceChannel *channel,gpointer user_data);
 static void channel_destroy(SpiceSession *session, SpiceChannel *channel,gpointer user_data);
+static void migration_state_changed(SpiceSession *session, GParamSpec *pspec, gpointer user_data);
 static int spice_usb_device_manager_hotplug_cb(libusb_context *ctx,libusb_device *device,libusb_hotplug_event  event,void *data);
 static void spice_usb_device_manager_check_redir_on_connect(SpiceUsbDeviceManager *self, SpiceChannel *channel);
+static SpiceUsbContext *spice_usb_context_ref(GError **err);
+static void spice_usb_context_unref(SpiceUsbContext *usb);
+static gboolean spice_usb_device_manager_reattach_parked(SpiceUsbDeviceManager *self, SpiceChannel *channel);
+static void spice_usb_device_manager_unpark_device(SpiceUsbDeviceManager *self, SpiceUsbDevice *device);
+static void parked_device_free(ParkedDevice *parked);
 static SpiceUsbDeviceInfo *spice_usb_device_new(libusb_device *libdev);
 static SpiceUsbDevice *spice_usb_device_ref(SpiceUsbDevice *device);
 static void spice_usb_device_unref(SpiceUsbDevice *device);
@@ -148,6 +189,7 @@ static void spice_usb_device_manager_init(SpiceUsbDeviceManager *self)
     self->priv = priv;
     priv->channels = g_ptr_array_new();
     priv->devices  = g_ptr_array_new_with_free_func((GDestroyNotify)spice_usb_device_unref);
+    priv->parked = g_ptr_array_new_with_free_func((GDestroyNotify)parked_device_free);
 	
 
 }
@@ -159,14 +201,11 @@ static gboolean spice_usb_device_manager_initable_init(GInitable  *initable,GCan
     GList *list;
     GList *it;
     int rc;
-    /* Initialize libusb */
-    rc = libusb_init(&priv->context);
-    if (rc < 0) {
-        const char *desc = spice_usbutil_libusb_strerror(rc);
-        g_warning("Error initializing USB support: %s [%i]", desc, rc);
-        g_set_error(err, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,"Error initializing USB support: %s [%i]", desc, rc);
+    /* Initialize libusb, or share the context of the other sessions */
+    priv->usb = spice_usb_context_ref(err);
+    if (priv->usb == NULL)
         return FALSE;
-    }
+    priv->context = priv->usb->context;
 
     /* Start listening for usb devices plug / unplug */
     rc = libusb_hotplug_register_callback(priv->context,
@@ -185,6 +224,8 @@ static gboolean spice_usb_device_manager_initable_init(GInitable  *initable,GCan
     /* Start listening for usb channels connect/disconnect */
     spice_g_signal_connect_object(priv->session, "channel-new", G_CALLBACK(channel_new), self, G_CONNECT_AFTER);
     g_signal_connect(priv->session, "channel-destroy",G_CALLBACK(channel_destroy), self);
+    spice_g_signal_connect_object(priv->session, "notify::migration-state",
+                                  G_CALLBACK(migration_state_changed), self, 0);
     list = spice_session_get_channels(priv->session);
     for (it = g_list_first(list); it != NULL; it = g_list_next(it)) {
         channel_new(priv->session, it->data, (gpointer*)self);
@@ -199,25 +240,21 @@ static void spice_usb_device_manager_dispose(GObject *gobject)
     SpiceUsbDeviceManagerPrivate *priv = self->priv;
     if (priv->hp_handle) {
         spice_usb_device_manager_stop_event_listening(self);
-        if (g_atomic_int_get(&priv->event_thread_run)) {
-            /* Force termination of the event thread even if there were some
+        if (priv->event_listeners > 0) {
+            /* Drop our hold on the event thread even if there were some
              * mismatched spice_usb_device_manager_{start,stop}_event_listening
              * calls. Otherwise, the usb event thread will be leaked, and will
-             * try to use the libusb context we destroy in finalize(), which would
-             * cause a crash */
+             * try to use the libusb context we release in finalize(), which
+             * would cause a crash */
              g_warn_if_reached();
-             g_atomic_int_set(&priv->event_thread_run, FALSE);
+             priv->event_listeners = 1;
+             spice_usb_device_manager_stop_event_listening(self);
         }
         /* This also wakes up the libusb_handle_events() in the event_thread */
         libusb_hotplug_deregister_callback(priv->context, priv->hp_handle);
         priv->hp_handle = 0;
     }
 
-    if (priv->event_thread) {
-        g_warn_if_fail(g_atomic_int_get(&priv->event_thread_run) == FALSE);
-        g_thread_join(priv->event_thread);
-        priv->event_thread = NULL;
-    }
     /* Chain up to the parent class */
     if (G_OBJECT_CLASS(spice_usb_device_manager_parent_class)->dispose)
         G_OBJECT_CLASS(spice_usb_device_manager_parent_class)->dispose(gobject);
@@ -228,11 +265,11 @@ static void spice_usb_device_manager_finalize(GObject *gobject)
     SpiceUsbDeviceManager *self = SPICE_USB_DEVICE_MANAGER(gobject);
     SpiceUsbDeviceManagerPrivate *priv = self->priv;
     g_ptr_array_unref(priv->channels);
+    g_ptr_array_unref(priv->parked);
     if (priv->devices)
         g_ptr_array_unref(priv->devices);
-    g_return_if_fail(priv->event_thread == NULL);
-    if (priv->context)
-        libusb_exit(priv->context);
+    if (priv->usb)
+        spice_usb_context_unref(priv->usb);
     free(priv->auto_conn_filter_rules);
     free(priv->redirect_on_connect_rules);
     g_free(priv->auto_connect_filter);
@@ -280,6 +317,9 @@ static void spice_usb_device_manager_get_property(GObject     *gobject,
         g_value_set_int(value, free_channels);
         break;
     }
+    case PROP_RECONNECT_GRACE:
+        g_value_set_uint(value, priv->reconnect_grace);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
         break;
@@ -340,6 +380,9 @@ static void spice_usb_device_manager_set_property(GObject  *gobject,
         priv->redirect_on_connect = g_strdup(filter);
         break;
     }
+    case PROP_RECONNECT_GRACE:
+        priv->reconnect_grace = g_value_get_uint(value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
         break;
@@ -439,6 +482,30 @@ static void spice_usb_device_manager_class_init(SpiceUsbDeviceManagerClass *klas
     g_object_class_install_property(gobject_class, PROP_FREE_CHANNELS,
                                     pspec);
 
+    /**
+     * SpiceUsbDeviceManager:reconnect-grace:
+     *
+     * Time in milliseconds during which a device whose USB redirection
+     * channel dropped stays reserved for that channel. If a USB
+     * redirection channel comes back within this window, the device is
+     * redirected again right away, without going through the
+     * auto-connect rules. 0 disables the grace window.
+     *
+     * The device is not kept claimed meanwhile: its interfaces go back to
+     * the host kernel drivers when the channel drops, and the guest sees
+     * the device reset and enumerate again once it is redirected. The
+     * window saves opening the device again, and the ACL helper round
+     * trip where there is one.
+     *
+     * Since: 0.35
+     */
+    pspec = g_param_spec_uint("reconnect-grace", "Reconnect grace",
+               "Time in ms a device stays reserved after its channel dropped",
+               0, G_MAXUINT, 0,
+               G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(gobject_class, PROP_RECONNECT_GRACE,
+                                    pspec);
+
     /**
      * SpiceUsbDeviceManager::device-added:
      * @manager: the #SpiceUsbDeviceManager that emitted the signal
@@ -520,6 +587,28 @@ static void spice_usb_device_manager_class_init(SpiceUsbDeviceManagerClass *klas
                      2,
                      SPICE_TYPE_USB_DEVICE,
                      G_TYPE_ERROR);
+
+    /**
+     * SpiceUsbDeviceManager::device-connected:
+     * @manager: #SpiceUsbDeviceManager that emitted the signal
+     * @device:  #SpiceUsbDevice boxed object corresponding to the device
+     *
+     * The #SpiceUsbDeviceManager::device-connected signal is emitted
+     * whenever a device was redirected to the guest, whether on request
+     * or automatically.
+     *
+     * Since: 0.35
+     **/
+    signals[DEVICE_CONNECTED] =
+        g_signal_new("device-connected",
+                     G_OBJECT_CLASS_TYPE(gobject_class),
+                     G_SIGNAL_RUN_FIRST,
+                     G_STRUCT_OFFSET(SpiceUsbDeviceManagerClass, device_connected),
+                     NULL, NULL,
+                     g_cclosure_marshal_VOID__BOXED,
+                     G_TYPE_NONE,
+                     1,
+                     SPICE_TYPE_USB_DEVICE);
     g_type_class_add_private(klass, sizeof(SpiceUsbDeviceManagerPrivate));
 	
 }
@@ -583,6 +672,33 @@ static gboolean spice_usb_device_manager_get_libdev_vid_pid(libusb_device *libde
 /* ------------------------------------------------------------------ */
 /* callbacks                                                          */
 
+static void channel_event(SpiceChannel *channel, SpiceChannelEvent event, gpointer user_data)
+{
+    SpiceUsbDeviceManager *self = user_data;
+
+    /* the channel object itself may be reconnected (after a host switch
+     * for example), without a new channel-new */
+    if (event == SPICE_CHANNEL_OPENED)
+        spice_usb_device_manager_reattach_parked(self, channel);
+}
+
+static void migration_state_changed(SpiceSession *session, GParamSpec *pspec, gpointer user_data)
+{
+    SpiceUsbDeviceManager *self = user_data;
+    SpiceUsbDeviceManagerPrivate *priv = self->priv;
+    SpiceSessionMigration state;
+    guint i;
+
+    g_object_get(session, "migration-state", &state, NULL);
+    if (state != SPICE_SESSION_MIGRATION_NONE)
+        return;
+
+    /* the usbredir channels were swapped to the destination
+     * connections, without any new channel event */
+    for (i = 0; i < priv->channels->len && priv->parked->len > 0; i++)
+        spice_usb_device_manager_reattach_parked(self, g_ptr_array_index(priv->channels, i));
+}
+
 static void channel_new(SpiceSession *session, SpiceChannel *channel,gpointer user_data)
 {
     SpiceUsbDeviceManager *self = user_data;
@@ -592,7 +708,9 @@ static void channel_new(SpiceSession *session, SpiceChannel *channel,gpointer us
     spice_usbredir_channel_set_context(SPICE_USBREDIR_CHANNEL(channel),self->priv->context);
     spice_channel_connect(channel);
     g_ptr_array_add(self->priv->channels, channel);
-    spice_usb_device_manager_check_redir_on_connect(self, channel);
+    spice_g_signal_connect_object(channel, "channel-event", G_CALLBACK(channel_event), self, 0);
+    if (!spice_usb_device_manager_reattach_parked(self, channel))
+        spice_usb_device_manager_check_redir_on_connect(self, channel);
     /*
      * add a reference to ourself, to make sure the libusb context is
      * alive as long as the channel is.
@@ -660,7 +778,7 @@ static SpiceUsbDevice* spice_usb_device_manager_find_device(SpiceUsbDeviceManage
 */
 static int parse_filter_pvid(char *text,char *desc_pvid)
 {
-	g_print("vanxum-usbredir:Enter function  parse_filter_pvid\n");
+	SPICE_LOG_DEBUG("parse_filter_pvid");
 	
 	cJSON *json=NULL;
 	char *rule;
@@ -669,9 +787,9 @@ static int parse_filter_pvid(char *text,char *desc_pvid)
 	
 	json=cJSON_Parse(text);
 	if (!json) {
-		g_print("vanxum-usbredir:String parameter is not JSON string \n");
+		SPICE_LOG_WARNING("filter is not a JSON string");
 	}else{
-		g_print("vanxum-usbredir:Parse JSON String Success!!\n");
+		SPICE_LOG_DEBUG("filter parsed");
    		rule=cJSON_GetObjectItem(json,"rule")->valuestring;
 		pvid=cJSON_GetObjectItem(json,"pvid");
 		pvid_len=cJSON_GetArraySize(pvid);
@@ -704,7 +822,7 @@ static int parse_filter_pvid(char *text,char *desc_pvid)
 
 static int parse_filter_class(char *text,int desc_class)
 {
-	g_print("vanxum-usbredir:Enter function  parse_filter_class\n");
+	SPICE_LOG_DEBUG("parse_filter_class");
 	//g_print("vanxum-usbredir: desc_class %d\n",desc_class);
 	
 	cJSON *json = NULL;
@@ -714,9 +832,9 @@ static int parse_filter_class(char *text,int desc_class)
 
 	json=cJSON_Parse(text);
 	if (!json) {
-		g_print("vanxum-usbredir:String parameter is not JSON string \n");
+		SPICE_LOG_WARNING("filter is not a JSON string");
 	}else{
-		g_print("vanxum-usbredir:Parse JSON String Success!!\n");
+		SPICE_LOG_DEBUG("filter parsed");
 		
 		rule=cJSON_GetObjectItem(json,"rule")->valuestring;
 		usb_class=cJSON_GetObjectItem(json,"class");
@@ -768,20 +886,20 @@ static void spice_usb_device_manager_add_dev(SpiceUsbDeviceManager  *self,libusb
 	//get usb filter ruler
 	gchar *filter=NULL;
 	g_object_get(priv->session, "filter", &filter, NULL);
-	g_print("\n\nvanxum-usbredir:current usb filter ruler=%s\n",filter);
+	SPICE_LOG_DEBUG("usb filter rule=%s", filter);
 
 	if(filter)
 		{
 			cJSON *json;
 			if(!(strstr(filter,"rule") && strstr(filter,"pvid") && strstr(filter,"class")) ){
 				 filter=NULL;
-				 g_print("vanxum-usbredir:current usb filter ruler is't json all usb device will be unfilter \n");
+				 SPICE_LOG_WARNING("usb filter rule is not JSON, no device will be filtered");
 			}else{
 		   		json=cJSON_Parse(filter);
 				if(!json)
 				{
 					 filter=NULL;
-					 g_print("vanxum-usbredir:current usb filter ruler is't json all usb device will be unfilter \n");
+					 SPICE_LOG_WARNING("usb filter rule is not JSON, no device will be filtered");
 				}
 
 			}
@@ -800,17 +918,17 @@ static void spice_usb_device_manager_add_dev(SpiceUsbDeviceManager  *self,libusb
 	strcpy (desc_pvid,"0x");
 	strcat (desc_pvid,pid);
 	strcat (desc_pvid,vid);
-	g_print("vanxum-usbredir:current usb device's pvid=%s\n",desc_pvid);
+	SPICE_LOG_DEBUG("usb device pvid=%s", desc_pvid);
 
 
 	int pvid_return = -1;
 	if(filter != NULL)
 		pvid_return=parse_filter_pvid(filter,desc_pvid);
 	if(pvid_return == 0){
-			g_print("vanxum-usbredir:This USB device pvid=%s allow excute USB-Redir\n",desc_pvid);
+			SPICE_LOG_INFO("usb device pvid=%s allowed by filter", desc_pvid);
 			goto pvfilter;
     }else if(pvid_return == 1){
-			g_print("vanxum-usbredir:This USB device pvid=%s don't allow excute USB-Redir\n",desc_pvid);
+			SPICE_LOG_INFO("usb device pvid=%s denied by filter", desc_pvid);
 			return ;
 	}
 	
@@ -825,14 +943,14 @@ static void spice_usb_device_manager_add_dev(SpiceUsbDeviceManager  *self,libusb
 	int res;
 	res=libusb_get_active_config_descriptor(libdev, &config);
 	if(res!=0){
-		g_print("vanxum-usbredir:+++++++++++++++++Please plug it again+++++++++++++\n");
+		SPICE_LOG_WARNING("no active config descriptor (%d), plug the device again", res);
 		return;
 	}
 		
 	if(config==NULL){
-		g_print("vanxum-usbredir:active config descriptor is null!!\n");
+		SPICE_LOG_WARNING("active config descriptor is null");
 	}else{
-		g_print("vanxum-usbredir:active config descriptor is not null\n");
+		SPICE_LOG_DEBUG("active config descriptor is not null");
 			
 		num_interfaces = config->bNumInterfaces;
 		int exitflag=0;
@@ -868,18 +986,18 @@ static void spice_usb_device_manager_add_dev(SpiceUsbDeviceManager  *self,libusb
 		}
 	
 		if(returnflag > 0){
-			g_print("vanxum-usbredir:This USB Device class filter don't allow excute USB-Redir\n");
+			SPICE_LOG_INFO("usb device %s denied by class filter", desc_pvid);
 			return;
 		}
 			
 		if((exitflag > 0) && (returnflag==0) ){
-			g_print("vanxum-usbredir:This USB Device class filter allow excute USB-Redir\n");
+			SPICE_LOG_INFO("usb device %s allowed by class filter", desc_pvid);
 		}	
 
 	}
 	
 	pvfilter:
-	g_print("vanxum-usbredir:A new usb device begin to usb redirect!!\n");
+	SPICE_LOG_INFO("redirecting new usb device %04x:%04x", desc.idVendor, desc.idProduct);
 			
     device = (SpiceUsbDevice*)spice_usb_device_new(libdev);
     if (!device)
@@ -897,6 +1015,7 @@ static void spice_usb_device_manager_remove_dev(SpiceUsbDeviceManager *self,guin
         return;
     }
    
+    spice_usb_device_manager_unpark_device(self, device);
     disconnect_device_sync(self, device);
     //spice_usb_device_ref(device);
     g_ptr_array_remove(priv->devices, device);
@@ -946,23 +1065,72 @@ static void spice_usb_device_manager_channel_connect_cb(GObject *gobject, GAsync
     GTask *task = G_TASK(user_data);
     GError *err = NULL;
     spice_usbredir_channel_connect_device_finish(channel, channel_res, &err);
-    if (err)
+    if (err) {
         g_task_return_error(task, err);
-    else
+    } else {
+        g_signal_emit(g_task_get_source_object(task), signals[DEVICE_CONNECTED], 0,
+                      spice_usbredir_channel_get_device(channel));
         g_task_return_boolean(task, TRUE);
+    }
     g_object_unref(task);
 }
 
 /* ------------------------------------------------------------------ */
 /* private api                                                        */
 
+static SpiceUsbContext *spice_usb_context_ref(GError **err)
+{
+    SpiceUsbContext *usb;
+
+    g_mutex_lock(&usb_context_mutex);
+    if (usb_context == NULL) {
+        libusb_context *context;
+        int rc;
+
+        rc = libusb_init(&context);
+        if (rc < 0) {
+            const char *desc = spice_usbutil_libusb_strerror(rc);
+            g_mutex_unlock(&usb_context_mutex);
+            g_warning("Error initializing USB support: %s [%i]", desc, rc);
+            g_set_error(err, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,"Error initializing USB support: %s [%i]", desc, rc);
+            return NULL;
+        }
+        usb_context = g_new0(SpiceUsbContext, 1);
+        usb_context->context = context;
+    }
+    usb = usb_context;
+    usb->refs++;
+    g_mutex_unlock(&usb_context_mutex);
+
+    return usb;
+}
+
+static void spice_usb_context_unref(SpiceUsbContext *usb)
+{
+    g_mutex_lock(&usb_context_mutex);
+    if (--usb->refs > 0) {
+        g_mutex_unlock(&usb_context_mutex);
+        return;
+    }
+    usb_context = NULL;
+    g_mutex_unlock(&usb_context_mutex);
+
+    if (usb->event_thread) {
+        g_warn_if_fail(g_atomic_int_get(&usb->event_thread_run) == FALSE);
+        g_thread_join(usb->event_thread);
+    }
+    libusb_exit(usb->context);
+    g_free(usb);
+}
+
 static gpointer spice_usb_device_manager_usb_ev_thread(gpointer user_data)
 {
-    SpiceUsbDeviceManager *self = SPICE_USB_DEVICE_MANAGER(user_data);
-    SpiceUsbDeviceManagerPrivate *priv = self->priv;
+    SpiceUsbContext *usb = user_data;
     int rc;
-    while (g_atomic_int_get(&priv->event_thread_run)) {
-        rc = libusb_handle_events(priv->context);
+    while (g_atomic_int_get(&usb->event_thread_run)) {
+        SPICE_TRACE(usb_events_begin);
+        rc = libusb_handle_events(usb->context);
+        SPICE_TRACE1(usb_events_end, rc);
         if (rc && rc != LIBUSB_ERROR_INTERRUPTED) {
             const char *desc = spice_usbutil_libusb_strerror(rc);
             g_warning("Error handling USB events: %s [%i]", desc, rc);
@@ -975,26 +1143,39 @@ static gpointer spice_usb_device_manager_usb_ev_thread(gpointer user_data)
 gboolean spice_usb_device_manager_start_event_listening(SpiceUsbDeviceManager *self, GError **err)
 {
     SpiceUsbDeviceManagerPrivate *priv = self->priv;
+    SpiceUsbContext *usb = priv->usb;
+    gboolean ret = TRUE;
     g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
     priv->event_listeners++;
     if (priv->event_listeners > 1)
         return TRUE;
-    if (priv->event_thread) {
-         g_thread_join(priv->event_thread);
-         priv->event_thread = NULL;
+    /* the thread runs as long as one of the sessions listens */
+    g_mutex_lock(&usb_context_mutex);
+    if (usb->event_listeners++ == 0) {
+        if (usb->event_thread) {
+             g_thread_join(usb->event_thread);
+             usb->event_thread = NULL;
+        }
+        g_atomic_int_set(&usb->event_thread_run, TRUE);
+        usb->event_thread = g_thread_new("usb_ev_thread",spice_usb_device_manager_usb_ev_thread,usb);
+        ret = usb->event_thread != NULL;
     }
-    g_atomic_int_set(&priv->event_thread_run, TRUE);
-    priv->event_thread = g_thread_new("usb_ev_thread",spice_usb_device_manager_usb_ev_thread,self);
-    return priv->event_thread != NULL;
+    g_mutex_unlock(&usb_context_mutex);
+    return ret;
 }
 
 void spice_usb_device_manager_stop_event_listening(SpiceUsbDeviceManager *self)
 {
     SpiceUsbDeviceManagerPrivate *priv = self->priv;
+    SpiceUsbContext *usb = priv->usb;
     g_return_if_fail(priv->event_listeners > 0);
     priv->event_listeners--;
-    if (priv->event_listeners == 0)
-        g_atomic_int_set(&priv->event_thread_run, FALSE);
+    if (priv->event_listeners > 0)
+        return;
+    g_mutex_lock(&usb_context_mutex);
+    if (--usb->event_listeners == 0)
+        g_atomic_int_set(&usb->event_thread_run, FALSE);
+    g_mutex_unlock(&usb_context_mutex);
 }
 
 static void spice_usb_device_manager_check_redir_on_connect(SpiceUsbDeviceManager *self, SpiceChannel *channel)
@@ -1023,6 +1204,152 @@ static void spice_usb_device_manager_check_redir_on_connect(SpiceUsbDeviceManage
     }
 }
 
+static void parked_device_free(ParkedDevice *parked)
+{
+    if (parked->timeout_id)
+        g_source_remove(parked->timeout_id);
+    if (parked->handle)
+        libusb_close(parked->handle);
+    spice_usb_device_unref(parked->device);
+    g_free(parked);
+}
+
+static gboolean spice_usb_device_manager_park_expired(gpointer user_data)
+{
+    ParkedDevice *parked = user_data;
+
+    SPICE_DEBUG("reconnect grace expired for device %04x:%04x",
+                spice_usb_device_get_vid(parked->device),
+                spice_usb_device_get_pid(parked->device));
+    parked->timeout_id = 0;
+    g_ptr_array_remove(parked->self->priv->parked, parked);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Keeps @device reserved for @reconnect_grace ms after its channel
+ * dropped, so that it gets redirected again as soon as a channel
+ * comes back, instead of waiting for a hotplug event. The usbredirhost
+ * of the channel and its claim on the device don't survive the drop:
+ * usbredirhost has no way to hand a claimed device to another parser,
+ * and the new connection starts with a new hello. A channel reset
+ * for a semi-seamless migration always parks the device, for at least
+ * MIGRATION_PARK_TIMEOUT ms, as the channel object is reused once the
+ * destination is up. This must be called while the channel still has
+ * the device open. */
+void spice_usb_device_manager_park_device(SpiceUsbDeviceManager *self, SpiceUsbDevice *device,
+                                          gboolean migrating)
+{
+    SpiceUsbDeviceManagerPrivate *priv;
+    ParkedDevice *parked;
+    libusb_device *libdev;
+    guint timeout;
+    guint i;
+    int rc;
+
+    g_return_if_fail(SPICE_IS_USB_DEVICE_MANAGER(self));
+    g_return_if_fail(device != NULL);
+    priv = self->priv;
+
+    timeout = priv->reconnect_grace;
+    if (migrating)
+        timeout = MAX(timeout, MIGRATION_PARK_TIMEOUT);
+    if (timeout == 0)
+        return;
+
+    /* the device may have been unplugged meanwhile */
+    for (i = 0; i < priv->devices->len; i++) {
+        if (g_ptr_array_index(priv->devices, i) == device)
+            break;
+    }
+    if (i == priv->devices->len)
+        return;
+
+    spice_usb_device_manager_unpark_device(self, device);
+    SPICE_DEBUG("parking device %04x:%04x for %u ms",
+                spice_usb_device_get_vid(device), spice_usb_device_get_pid(device),
+                timeout);
+
+    parked = g_new0(ParkedDevice, 1);
+    parked->self = self;
+    parked->device = spice_usb_device_ref(device);
+    libdev = spice_usb_device_manager_device_to_libdev(self, device);
+    if (libdev != NULL) {
+        /* usbredirhost closes the channel handle, take our own while
+         * the device node is still accessible to us */
+        rc = libusb_open(libdev, &parked->handle);
+        if (rc != 0) {
+            SPICE_DEBUG("could not keep parked device open: %s [%i]",
+                        spice_usbutil_libusb_strerror(rc), rc);
+            parked->handle = NULL;
+        }
+        libusb_unref_device(libdev);
+    }
+    parked->timeout_id = g_timeout_add(timeout, spice_usb_device_manager_park_expired, parked);
+    g_ptr_array_add(priv->parked, parked);
+}
+
+static void spice_usb_device_manager_unpark_device(SpiceUsbDeviceManager *self, SpiceUsbDevice *device)
+{
+    GPtrArray *parked = self->priv->parked;
+    guint i;
+
+    for (i = 0; i < parked->len; i++) {
+        if (((ParkedDevice *)g_ptr_array_index(parked, i))->device == device) {
+            g_ptr_array_remove_index(parked, i);
+            return;
+        }
+    }
+}
+
+static gboolean spice_usb_device_manager_reattach_parked(SpiceUsbDeviceManager *self, SpiceChannel *channel)
+{
+    SpiceUsbDeviceManagerPrivate *priv = self->priv;
+    ParkedDevice *parked;
+    SpiceUsbDevice *device;
+    libusb_device_handle *handle;
+    libusb_device *libdev;
+    GTask *task;
+
+    if (spice_usbredir_channel_get_device(SPICE_USBREDIR_CHANNEL(channel)) != NULL)
+        return FALSE;
+
+    /* a parked device may have been redirected through another channel
+     * meanwhile, by the user or by auto-connect */
+    while (priv->parked->len > 0) {
+        parked = g_ptr_array_index(priv->parked, 0);
+        if (!spice_usb_device_manager_is_device_connected(self, parked->device))
+            break;
+        g_ptr_array_remove_index(priv->parked, 0);
+    }
+    if (priv->parked->len == 0)
+        return FALSE;
+
+    device = spice_usb_device_ref(parked->device);
+    handle = parked->handle;
+    parked->handle = NULL;
+    g_ptr_array_remove_index(priv->parked, 0);
+
+    SPICE_DEBUG("re-attaching parked device %04x:%04x",
+                spice_usb_device_get_vid(device), spice_usb_device_get_pid(device));
+    /* Note: re-uses spice_usb_device_manager_connect_device_async's
+       completion handling code! */
+    task = g_task_new(self, NULL, spice_usb_device_manager_auto_connect_cb, device);
+    if (handle != NULL) {
+        spice_usbredir_channel_connect_handle_async(SPICE_USBREDIR_CHANNEL(channel), handle, device,
+                                                    NULL, spice_usb_device_manager_channel_connect_cb,
+                                                    task);
+    } else {
+        libdev = spice_usb_device_manager_device_to_libdev(self, device);
+        spice_usbredir_channel_connect_device_async(SPICE_USBREDIR_CHANNEL(channel), libdev, device,
+                                                    NULL, spice_usb_device_manager_channel_connect_cb,
+                                                    task);
+        libusb_unref_device(libdev);
+    }
+
+    return TRUE; /* We've taken the channel! */
+}
+
 void spice_usb_device_manager_device_error(SpiceUsbDeviceManager *self, SpiceUsbDevice *device, GError *err)
 {
     g_return_if_fail(SPICE_IS_USB_DEVICE_MANAGER(self));
@@ -28,6 +28,7 @@
 
 #ifdef USE_USBREDIR
 #include <stdio.h>
+#include <string.h>
 #ifdef __linux__
 #include <unistd.h>
 #include <sys/sysmacros.h>
@@ -39,24 +40,32 @@
 #include "usbutil.h"
 #include "spice-util-priv.h"
 
-#define VENDOR_NAME_LEN (122 - sizeof(void *))
-#define PRODUCT_NAME_LEN 126
+/*
+ * usb.ids is mapped rather than read, and indexed once: the names stay
+ * in the mapping, the index only has their offsets. Vendors, and the
+ * products of each vendor, are sorted for binary search.
+ */
 
 typedef struct _usb_product_info {
+    guint32 name;       /* offset in the usb.ids mapping */
+    guint16 name_len;
     guint16 product_id;
-    char name[PRODUCT_NAME_LEN];
 } usb_product_info;
 
 typedef struct _usb_vendor_info {
-    usb_product_info *product_info;
-    int product_count;
+    guint32 name;
+    guint16 name_len;
     guint16 vendor_id;
-    char name[VENDOR_NAME_LEN];
+    guint32 first_product;
+    guint32 product_count;
 } usb_vendor_info;
 
 static GMutex usbids_load_mutex;
 static int usbids_vendor_count = 0; /* < 0: failed, 0: empty, > 0: loaded */
 static usb_vendor_info *usbids_vendor_info = NULL;
+static usb_product_info *usbids_product_info = NULL;
+static guint usbids_product_count = 0;
+static GMappedFile *usbids_file = NULL;
 
 G_GNUC_INTERNAL
 const char *spice_usbutil_libusb_strerror(enum libusb_error error_code)
@@ -121,95 +130,111 @@ static gchar *spice_usbutil_get_sysfs_attribute(int bus, int address,
 }
 #endif
 
-static gboolean spice_usbutil_parse_usbids(gchar *path)
+static int usbids_compare_vendor(const void *a, const void *b)
 {
-    gchar *contents, *line, **lines;
-    usb_product_info *product_info;
-    int i, j, id, product_count = 0;
-
-    usbids_vendor_count = 0;
-    if (!g_file_get_contents(path, &contents, NULL, NULL)) {
-        usbids_vendor_count = -1;
-        return FALSE;
-    }
-
-    lines = g_strsplit(contents, "\n", -1);
-
-    for (i = 0; lines[i]; i++) {
-        if (!isxdigit(lines[i][0]) || !isxdigit(lines[i][1]))
-            continue;
+    return (int)((const usb_vendor_info *)a)->vendor_id -
+           (int)((const usb_vendor_info *)b)->vendor_id;
+}
 
-        for (j = 1; lines[i + j] &&
-                   (lines[i + j][0] == '\t' ||
-                    lines[i + j][0] == '#'  ||
-                    lines[i + j][0] == '\0'); j++) {
-            if (lines[i + j][0] == '\t' && isxdigit(lines[i + j][1]))
-                product_count++;
-        }
-        i += j - 1;
+static int usbids_compare_product(const void *a, const void *b)
+{
+    return (int)((const usb_product_info *)a)->product_id -
+           (int)((const usb_product_info *)b)->product_id;
+}
 
-        usbids_vendor_count++;
-    }
+/* parses the hex id at the start of @line, and returns where the name
+ * starts */
+static const gchar *usbids_parse_id(const gchar *line, const gchar *end, guint16 *id)
+{
+    guint value = 0;
 
-    usbids_vendor_info = g_new(usb_vendor_info, usbids_vendor_count);
-    product_info = g_new(usb_product_info, product_count);
+    for (; line < end && g_ascii_isxdigit(*line); line++)
+        value = (value << 4) | g_ascii_xdigit_value(*line);
+    *id = value;
 
-    usbids_vendor_count = 0;
-    for (i = 0; lines[i]; i++) {
-        line = lines[i];
+    while (line < end && (*line == ' ' || *line == '\t'))
+        line++;
 
-        if (!isxdigit(line[0]) || !isxdigit(line[1]))
-            continue;
+    return line;
+}
 
-        id = strtoul(line, &line, 16);
-        while (isspace(line[0]))
-            line++;
+static void usbids_sort_products(GArray *products, usb_vendor_info *vendor)
+{
+    if (vendor != NULL && vendor->product_count > 1)
+        qsort(&g_array_index(products, usb_product_info, vendor->first_product),
+              vendor->product_count, sizeof(usb_product_info),
+              usbids_compare_product);
+}
 
-        usbids_vendor_info[usbids_vendor_count].vendor_id = id;
-        snprintf(usbids_vendor_info[usbids_vendor_count].name,
-                 VENDOR_NAME_LEN, "%s", line);
+static gboolean spice_usbutil_parse_usbids(gchar *path)
+{
+    GMappedFile *file;
+    GArray *vendors, *products;
+    const gchar *data, *end, *line, *next, *name;
+    usb_vendor_info *vendor = NULL;
+    guint16 id;
 
-        product_count = 0;
-        for (j = 1; lines[i + j] &&
-                   (lines[i + j][0] == '\t' ||
-                    lines[i + j][0] == '#'  ||
-                    lines[i + j][0] == '\0'); j++) {
-            line = lines[i + j];
+    usbids_vendor_count = 0;
+    file = g_mapped_file_new(path, FALSE, NULL);
+    if (file == NULL) {
+        usbids_vendor_count = -1;
+        return FALSE;
+    }
 
-            if (line[0] != '\t' || !isxdigit(line[1]))
+    data = g_mapped_file_get_contents(file);
+    end = data + g_mapped_file_get_length(file);
+    vendors = g_array_new(FALSE, FALSE, sizeof(usb_vendor_info));
+    products = g_array_new(FALSE, FALSE, sizeof(usb_product_info));
+
+    for (line = data; line < end; line = next) {
+        const gchar *eol = memchr(line, '\n', end - line);
+
+        next = eol ? eol + 1 : end;
+        eol = eol ? eol : end;
+
+        if (eol - line >= 2 && g_ascii_isxdigit(line[0]) && g_ascii_isxdigit(line[1])) {
+            usb_vendor_info info;
+
+            usbids_sort_products(products, vendor);
+            name = usbids_parse_id(line, eol, &id);
+            info.vendor_id = id;
+            info.name = name - data;
+            info.name_len = MIN(eol - name, G_MAXUINT16);
+            info.first_product = products->len;
+            info.product_count = 0;
+            g_array_append_val(vendors, info);
+            vendor = &g_array_index(vendors, usb_vendor_info, vendors->len - 1);
+        } else if (eol - line >= 2 && line[0] == '\t' && g_ascii_isxdigit(line[1])) {
+            usb_product_info info;
+
+            if (vendor == NULL)
                 continue;
-
-            id = strtoul(line + 1, &line, 16);
-            while (isspace(line[0]))
-                line++;
-            product_info[product_count].product_id = id;
-            snprintf(product_info[product_count].name,
-                     PRODUCT_NAME_LEN, "%s", line);
-
-            product_count++;
+            name = usbids_parse_id(line + 1, eol, &id);
+            info.product_id = id;
+            info.name = name - data;
+            info.name_len = MIN(eol - name, G_MAXUINT16);
+            g_array_append_val(products, info);
+            vendor->product_count++;
+        } else if (line < eol && line[0] != '\t' && line[0] != '#') {
+            /* end of the vendor list, e.g. the device classes */
+            usbids_sort_products(products, vendor);
+            vendor = NULL;
         }
-        i += j - 1;
-
-        usbids_vendor_info[usbids_vendor_count].product_count = product_count;
-        usbids_vendor_info[usbids_vendor_count].product_info  = product_info;
-        product_info += product_count;
-        usbids_vendor_count++;
     }
+    usbids_sort_products(products, vendor);
 
-    g_strfreev(lines);
-    g_free(contents);
-
-#if 0 /* Testing only */
-    for (i = 0; i < usbids_vendor_count; i++) {
-        printf("%04x  %s\n", usbids_vendor_info[i].vendor_id,
-               usbids_vendor_info[i].name);
-        product_info = usbids_vendor_info[i].product_info;
-        for (j = 0; j < usbids_vendor_info[i].product_count; j++) {
-            printf("\t%04x  %s\n", product_info[j].product_id,
-                   product_info[j].name);
-        }
-    }
-#endif
+    qsort(vendors->data, vendors->len, sizeof(usb_vendor_info), usbids_compare_vendor);
+
+    /* an empty file gets parsed again on the next lookup */
+    g_clear_pointer(&usbids_vendor_info, g_free);
+    g_clear_pointer(&usbids_product_info, g_free);
+    g_clear_pointer(&usbids_file, g_mapped_file_unref);
+
+    usbids_vendor_count = vendors->len;
+    usbids_product_count = products->len;
+    usbids_vendor_info = (usb_vendor_info *)g_array_free(vendors, FALSE);
+    usbids_product_info = (usb_product_info *)g_array_free(products, FALSE);
+    usbids_file = file;
 
     return TRUE;
 }
@@ -254,9 +279,6 @@ void spice_usb_util_get_device_strings(int bus, int address,
                                        int vendor_id, int product_id,
                                        gchar **manufacturer, gchar **product)
 {
-    usb_product_info *product_info;
-    int i, j;
-
     g_return_if_fail(manufacturer != NULL);
     g_return_if_fail(product != NULL);
 
@@ -270,25 +292,23 @@ void spice_usb_util_get_device_strings(int bus, int address,
 
     if ((!*manufacturer || !*product) &&
         spice_usbutil_load_usbids()) {
-
-        for (i = 0; i < usbids_vendor_count; i++) {
-            if ((int)usbids_vendor_info[i].vendor_id != vendor_id)
-                continue;
-
-            if (!*manufacturer && usbids_vendor_info[i].name[0])
-                *manufacturer = g_strdup(usbids_vendor_info[i].name);
-
-            product_info = usbids_vendor_info[i].product_info;
-            for (j = 0; j < usbids_vendor_info[i].product_count; j++) {
-                if ((int)product_info[j].product_id != product_id)
-                    continue;
-
-                if (!*product && product_info[j].name[0])
-                    *product = g_strdup(product_info[j].name);
-
-                break;
-            }
-            break;
+        const gchar *names = g_mapped_file_get_contents(usbids_file);
+        usb_vendor_info vendor_key = { .vendor_id = vendor_id };
+        usb_product_info product_key = { .product_id = product_id };
+        usb_vendor_info *vendor;
+        usb_product_info *info;
+
+        vendor = bsearch(&vendor_key, usbids_vendor_info, usbids_vendor_count,
+                         sizeof(usb_vendor_info), usbids_compare_vendor);
+        if (vendor != NULL) {
+            if (!*manufacturer && vendor->name_len)
+                *manufacturer = g_strndup(names + vendor->name, vendor->name_len);
+
+            info = bsearch(&product_key, usbids_product_info + vendor->first_product,
+                           vendor->product_count, sizeof(usb_product_info),
+                           usbids_compare_product);
+            if (info != NULL && !*product && info->name_len)
+                *product = g_strndup(names + info->name, info->name_len);
         }
     }
 
@@ -314,11 +334,42 @@ void spice_usb_util_get_device_strings(int bus, int address,
 #endif
 
 #ifdef USBUTIL_TEST
+/* loads usb.ids and looks up every vendor and product it lists, then
+ * the same number of unknown ids */
 int main()
 {
-    if (spice_usbutil_load_usbids())
-        exit(0);
+    gint64 start, loaded, looked_up;
+    guint i, j, lookups = 0;
+
+    start = g_get_monotonic_time();
+    if (!spice_usbutil_load_usbids())
+        exit(1);
+    loaded = g_get_monotonic_time();
+
+    for (i = 0; i < (guint)usbids_vendor_count; i++) {
+        usb_vendor_info *vendor = &usbids_vendor_info[i];
+
+        for (j = 0; j <= vendor->product_count; j++) {
+            int product_id = j < vendor->product_count ?
+                usbids_product_info[vendor->first_product + j].product_id : 0x10000;
+            gchar *manufacturer, *product;
+
+            spice_usb_util_get_device_strings(0, 0, vendor->vendor_id, product_id,
+                                              &manufacturer, &product);
+            g_free(manufacturer);
+            g_free(product);
+            lookups++;
+        }
+    }
+    looked_up = g_get_monotonic_time();
+
+    printf("%d vendors, index of %" G_GSIZE_FORMAT " bytes, loaded in %" G_GINT64_FORMAT " us\n",
+           usbids_vendor_count,
+           usbids_vendor_count * sizeof(usb_vendor_info) +
+           usbids_product_count * sizeof(usb_product_info),
+           loaded - start);
+    printf("%u lookups in %" G_GINT64_FORMAT " us\n", lookups, looked_up - loaded);
 
-    exit(1);
+    exit(0);
 }
 #endif
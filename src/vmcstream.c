@@ -35,6 +35,9 @@ struct _SpiceVmcInputStream
     gsize count;
     gsize pos;
 
+    /* read_bytes_async(): the result references the message data */
+    gboolean bytes;
+
     gulong cancel_id;
 };
 
@@ -100,6 +103,7 @@ spice_vmc_input_stream_new(void)
 typedef struct _complete_in_idle_cb_data {
     GTask *task;
     gssize pos;
+    GBytes *bytes;
 } complete_in_idle_cb_data;
 
 static gboolean
@@ -107,7 +111,10 @@ complete_in_idle_cb(gpointer user_data)
 {
     complete_in_idle_cb_data *data = user_data;
 
-    g_task_return_int(data->task, data->pos);
+    if (data->bytes != NULL)
+        g_task_return_pointer(data->task, data->bytes, (GDestroyNotify)g_bytes_unref);
+    else
+        g_task_return_int(data->task, data->pos);
 
     g_object_unref (data->task);
     g_free (data);
@@ -120,21 +127,25 @@ complete_in_idle_cb(gpointer user_data)
  * Feed a SpiceVmc stream with new data from a coroutine
  *
  * The other end will be waiting on read_async() until data is fed
- * here.
+ * here. @bytes is usually a reference on the message data, that
+ * read_bytes_async() hands over without copying it.
  */
 G_GNUC_INTERNAL void
-spice_vmc_input_stream_co_data(SpiceVmcInputStream *self,
-                               const gpointer d, gsize size)
+spice_vmc_input_stream_co_data(SpiceVmcInputStream *self, GBytes *bytes)
 {
-    guint8 *data = d;
+    const guint8 *data;
+    gsize size, offset = 0;
 
     g_return_if_fail(SPICE_IS_VMC_INPUT_STREAM(self));
     g_return_if_fail(self->coroutine == NULL);
 
     self->coroutine = coroutine_self();
+    data = g_bytes_get_data(bytes, &size);
 
-    while (size > 0) {
+    while (offset < size) {
         complete_in_idle_cb_data *cb_data;
+        GBytes *result = NULL;
+        gsize min;
 
         SPICE_DEBUG("spicevmc co_data %p", self->task);
         if (!self->task)
@@ -142,17 +153,20 @@ spice_vmc_input_stream_co_data(SpiceVmcInputStream *self,
 
         g_return_if_fail(self->task != NULL);
 
-        gsize min = MIN(self->count, size);
-        memcpy(self->buffer, data, min);
+        min = MIN(self->count - self->pos, size - offset);
+        if (self->bytes) {
+            result = g_bytes_new_from_bytes(bytes, offset, min);
+        } else {
+            memcpy(self->buffer, data + offset, min);
+            self->buffer += min;
+        }
 
-        size -= min;
-        data += min;
+        offset += min;
 
         SPICE_DEBUG("spicevmc co_data complete: %" G_GSIZE_FORMAT
                     "/%" G_GSIZE_FORMAT, min, self->count);
 
         self->pos += min;
-        self->buffer += min;
 
         if (self->all && min > 0 && self->pos != self->count)
             continue;
@@ -163,6 +177,7 @@ spice_vmc_input_stream_co_data(SpiceVmcInputStream *self,
         cb_data = g_new(complete_in_idle_cb_data , 1);
         cb_data->task = g_object_ref(self->task);
         cb_data->pos = self->pos;
+        cb_data->bytes = result;
         g_idle_add(complete_in_idle_cb, cb_data);
 
         g_clear_object(&self->task);
@@ -203,6 +218,7 @@ spice_vmc_input_stream_read_all_async(GInputStream        *stream,
     /* no concurrent read permitted by ginputstream */
     g_return_if_fail(self->task == NULL);
     self->all = TRUE;
+    self->bytes = FALSE;
     self->buffer = buffer;
     self->count = count;
     self->pos = 0;
@@ -237,6 +253,57 @@ spice_vmc_input_stream_read_all_finish(GInputStream *stream,
     return g_task_propagate_int(task, error);
 }
 
+/*
+ * Reads up to @count bytes, like read_async(), but without a buffer to
+ * copy them to: the result references the data of the current message.
+ */
+G_GNUC_INTERNAL void
+spice_vmc_input_stream_read_bytes_async(GInputStream        *stream,
+                                        gsize                count,
+                                        int                  io_priority,
+                                        GCancellable        *cancellable,
+                                        GAsyncReadyCallback  callback,
+                                        gpointer             user_data)
+{
+    SpiceVmcInputStream *self = SPICE_VMC_INPUT_STREAM(stream);
+    GTask *task;
+
+    /* no concurrent read permitted by ginputstream */
+    g_return_if_fail(self->task == NULL);
+    g_return_if_fail(count > 0);
+    self->all = FALSE;
+    self->bytes = TRUE;
+    self->buffer = NULL;
+    self->count = count;
+    self->pos = 0;
+    task = g_task_new(self, cancellable, callback, user_data);
+    self->task = task;
+    if (cancellable)
+        self->cancel_id =
+            g_cancellable_connect(cancellable, G_CALLBACK(read_cancelled), self, NULL);
+
+    if (self->coroutine)
+        coroutine_yieldto(self->coroutine, NULL);
+}
+
+G_GNUC_INTERNAL GBytes *
+spice_vmc_input_stream_read_bytes_finish(GInputStream *stream,
+                                         GAsyncResult *result,
+                                         GError **error)
+{
+    GTask *task = G_TASK(result);
+    SpiceVmcInputStream *self = SPICE_VMC_INPUT_STREAM(stream);
+    GCancellable *cancel;
+
+    g_return_val_if_fail(g_task_is_valid(task, self), NULL);
+    cancel = g_task_get_cancellable(task);
+    if (!g_cancellable_is_cancelled(cancel)) {
+         g_cancellable_disconnect(cancel, self->cancel_id);
+         self->cancel_id = 0;
+    }
+    return g_task_propagate_pointer(task, error);
+}
+
 static void
 spice_vmc_input_stream_read_async(GInputStream        *stream,
                                   void                *buffer,
@@ -252,6 +319,7 @@ spice_vmc_input_stream_read_async(GInputStream        *stream,
     /* no concurrent read permitted by ginputstream */
     g_return_if_fail(self->task == NULL);
     self->all = FALSE;
+    self->bytes = FALSE;
     self->buffer = buffer;
     self->count = count;
     self->pos = 0;
@@ -36,8 +36,7 @@ typedef struct _SpiceVmcInputStream          SpiceVmcInputStream;
 
 GType          spice_vmc_input_stream_get_type   (void) G_GNUC_CONST;
 void           spice_vmc_input_stream_co_data    (SpiceVmcInputStream *input,
-                                                  const gpointer data,
-                                                  gsize size);
+                                                  GBytes *bytes);
 
 void           spice_vmc_input_stream_read_all_async(GInputStream        *stream,
                                                      void                *buffer,
@@ -49,6 +48,15 @@ void           spice_vmc_input_stream_read_all_async(GInputStream        *stream
 gssize         spice_vmc_input_stream_read_all_finish(GInputStream       *stream,
                                                       GAsyncResult       *result,
                                                       GError            **error);
+void           spice_vmc_input_stream_read_bytes_async(GInputStream        *stream,
+                                                       gsize                count,
+                                                       int                  io_priority,
+                                                       GCancellable        *cancellable,
+                                                       GAsyncReadyCallback  callback,
+                                                       gpointer             user_data);
+GBytes *       spice_vmc_input_stream_read_bytes_finish(GInputStream       *stream,
+                                                        GAsyncResult       *result,
+                                                        GError            **error);
 
 
 #define SPICE_TYPE_VMC_OUTPUT_STREAM         (spice_vmc_output_stream_get_type ())
@@ -0,0 +1,242 @@
+#include <glib.h>
+#include <string.h>
+#include <spice/vd_agent.h>
+
+#include "spice-client.h"
+#include "spice-channel-priv.h"
+#include "channel-main-priv.h"
+
+/* Stand-in for a guest agent: messages of the usual sizes written back to
+ * back, and cut by the server into SPICE_MSG_MAIN_AGENT_DATA messages of
+ * at most VD_AGENT_MAX_DATA_SIZE without regard for message boundaries.
+ * They are clipboard data, for the main channel to hand them out. */
+static const gsize corpus[] = {
+    sizeof(VDAgentMouseState),
+    sizeof(VDAgentReply),
+    64,         /* clipboard grab */
+    1500,       /* file transfer status */
+    3000,       /* small clipboard */
+    256 * 1024, /* big clipboard */
+};
+
+#define ROUNDS 200
+
+typedef struct _FakeAgent {
+    SpiceSession *session;
+    SpiceChannel *channel;
+    GPtrArray *chunks; /* SpiceMsgIn */
+    guint messages;
+    guint64 payload_bytes;
+    guint64 split_bytes; /* payload of messages spread over several chunks */
+    /* what the channel made of them */
+    guint received;
+    gboolean check;
+} FakeAgent;
+
+static guint8 payload_byte(guint message, gsize pos)
+{
+    return (message * 31 + pos) & 0xff;
+}
+
+static SpiceMsgIn *chunk_new(SpiceChannel *channel, const guint8 *data, gsize size)
+{
+    SpiceMsgIn *in = spice_msg_in_new(channel);
+
+    in->data = g_malloc(size);
+    memcpy(in->data, data, size);
+    in->dpos = size;
+
+    return in;
+}
+
+static void clipboard_selection(SpiceMainChannel *main G_GNUC_UNUSED, guint selection,
+                                guint type, const guchar *data, guint size, FakeAgent *agent)
+{
+    guint message = agent->received++;
+    guint8 header[sizeof(guint32)];
+    guint32 header_type;
+    gsize i;
+
+    if (!agent->check)
+        return;
+
+    /* the VDAgentClipboard header takes the first bytes */
+    g_assert_cmpuint(selection, ==, VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD);
+    g_assert_cmpuint(size + sizeof(header), ==, corpus[message % G_N_ELEMENTS(corpus)]);
+    for (i = 0; i < sizeof(header); i++)
+        header[i] = payload_byte(message, i);
+    memcpy(&header_type, header, sizeof(header));
+    g_assert_cmpuint(type, ==, header_type);
+    for (i = 0; i < size; i++)
+        g_assert_cmpuint(data[i], ==, payload_byte(message, sizeof(header) + i));
+}
+
+static void fake_agent_init(FakeAgent *agent)
+{
+    GByteArray *stream = g_byte_array_new();
+    guint round, i, message = 0;
+    gsize pos, start;
+
+    memset(agent, 0, sizeof(*agent));
+    agent->session = spice_session_new();
+    agent->channel = spice_channel_new(agent->session, SPICE_CHANNEL_MAIN, 0);
+    g_signal_connect(agent->channel, "main-clipboard-selection",
+                     G_CALLBACK(clipboard_selection), agent);
+
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < G_N_ELEMENTS(corpus); i++, message++) {
+            VDAgentMessage header = {
+                .protocol = VD_AGENT_PROTOCOL,
+                .type = VD_AGENT_CLIPBOARD,
+                .opaque = message,
+                .size = corpus[i],
+            };
+
+            g_byte_array_append(stream, (guint8 *)&header, sizeof(header));
+            start = stream->len;
+            g_byte_array_set_size(stream, start + corpus[i]);
+            for (pos = 0; pos < corpus[i]; pos++)
+                stream->data[start + pos] = payload_byte(message, pos);
+
+            agent->payload_bytes += corpus[i];
+            if (start / VD_AGENT_MAX_DATA_SIZE !=
+                (start + corpus[i] - 1) / VD_AGENT_MAX_DATA_SIZE)
+                agent->split_bytes += corpus[i];
+        }
+    }
+    agent->messages = message;
+
+    agent->chunks = g_ptr_array_new_with_free_func((GDestroyNotify)spice_msg_in_unref);
+    for (pos = 0; pos < stream->len; pos += VD_AGENT_MAX_DATA_SIZE)
+        g_ptr_array_add(agent->chunks,
+                        chunk_new(agent->channel, stream->data + pos,
+                                  MIN(VD_AGENT_MAX_DATA_SIZE, stream->len - pos)));
+    g_byte_array_unref(stream);
+}
+
+static void fake_agent_clear(FakeAgent *agent)
+{
+    g_ptr_array_unref(agent->chunks);
+    g_object_unref(agent->session);
+}
+
+/* the way main_handle_agent_data() goes through a chunk */
+static void channel_feed(SpiceChannel *channel, SpiceMsgIn *in)
+{
+    guchar *data;
+    int len;
+
+    data = spice_msg_in_raw(in, &len);
+    while (len > 0)
+        spice_main_channel_handle_agent_data_msg(channel, in, &len, &data);
+}
+
+static gint64 run_agent(FakeAgent *agent, gboolean check)
+{
+    gint64 start = g_get_monotonic_time();
+    guint i;
+
+    agent->check = check;
+    agent->received = 0;
+    for (i = 0; i < agent->chunks->len; i++) {
+        SpiceMsgIn *in = g_ptr_array_index(agent->chunks, i);
+
+        channel_feed(agent->channel, in);
+        /* a message left incomplete is copied, not held */
+        g_assert_cmpint(in->refcount, ==, 1);
+    }
+    g_assert_cmpuint(agent->received, ==, agent->messages);
+
+    return g_get_monotonic_time() - start;
+}
+
+static void test_agent_msg_channel(void)
+{
+    FakeAgent agent;
+    SpiceMainChannel *main;
+
+    fake_agent_init(&agent);
+    main = SPICE_MAIN_CHANNEL(agent.channel);
+
+    run_agent(&agent, TRUE);
+    /* only the messages straddling chunks are copied, once */
+    g_assert_cmpuint(spice_main_channel_get_agent_msg_copied(main), ==, agent.split_bytes);
+
+    fake_agent_clear(&agent);
+}
+
+/* fragments the reassembly holds a reference on */
+static guint held_fragments;
+
+static void fragment_release(gpointer data)
+{
+    held_fragments--;
+}
+
+static void test_agent_msg_reassembly(void)
+{
+    SpiceAgentMsgReassembly *reassembly = spice_agent_msg_reassembly_new(fragment_release);
+    guint8 data[] = "spice-agent";
+
+    /* a whole payload is kept by reference */
+    held_fragments++;
+    spice_agent_msg_reassembly_add(reassembly, data, sizeof(data), sizeof(data), data);
+    g_assert_true(spice_agent_msg_reassembly_finish(reassembly) == data);
+    g_assert_cmpuint(held_fragments, ==, 1);
+    spice_agent_msg_reassembly_clear(reassembly);
+    g_assert_cmpuint(held_fragments, ==, 0);
+    g_assert_cmpuint(spice_agent_msg_reassembly_get_copied(reassembly), ==, 0);
+
+    /* pieces of it are copied, and let go of at once */
+    held_fragments++;
+    spice_agent_msg_reassembly_add(reassembly, data, 6, sizeof(data), data);
+    g_assert_cmpuint(held_fragments, ==, 0);
+    held_fragments++;
+    spice_agent_msg_reassembly_add(reassembly, data + 6, sizeof(data) - 6, sizeof(data), data);
+    g_assert_cmpuint(held_fragments, ==, 0);
+    g_assert_cmpstr((gchar *)spice_agent_msg_reassembly_finish(reassembly), ==, "spice-agent");
+    g_assert_cmpuint(spice_agent_msg_reassembly_get_copied(reassembly), ==, sizeof(data));
+
+    /* a message cut short by an agent reset */
+    spice_agent_msg_reassembly_clear(reassembly);
+    held_fragments++;
+    spice_agent_msg_reassembly_add(reassembly, data, 5, sizeof(data), data);
+    spice_agent_msg_reassembly_clear(reassembly);
+    g_assert_null(spice_agent_msg_reassembly_finish(reassembly));
+    g_assert_cmpuint(held_fragments, ==, 0);
+
+    spice_agent_msg_reassembly_free(reassembly);
+}
+
+static void test_agent_msg_channel_bench(void)
+{
+    FakeAgent agent;
+    gint64 elapsed;
+    guint64 copied;
+
+    if (!g_test_perf())
+        return;
+
+    fake_agent_init(&agent);
+
+    elapsed = run_agent(&agent, FALSE);
+    copied = spice_main_channel_get_agent_msg_copied(SPICE_MAIN_CHANNEL(agent.channel));
+    g_test_message("%u agent messages, %.0f/s, %.0f MB/s, %" G_GUINT64_FORMAT
+                   " of %" G_GUINT64_FORMAT " payload bytes copied (%.0f per message)",
+                   agent.messages, agent.messages * (gdouble)G_USEC_PER_SEC / elapsed,
+                   (gdouble)agent.payload_bytes / elapsed, copied, agent.payload_bytes,
+                   (gdouble)copied / agent.messages);
+
+    fake_agent_clear(&agent);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/agent-msg/channel", test_agent_msg_channel);
+    g_test_add_func("/agent-msg/reassembly", test_agent_msg_reassembly);
+    g_test_add_func("/agent-msg/channel/bench", test_agent_msg_channel_bench);
+
+    return g_test_run();
+}
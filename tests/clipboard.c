@@ -0,0 +1,498 @@
+#include <gio/gio.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <spice/protocol.h>
+#include <spice/vd_agent.h>
+
+#include "spice-client.h"
+
+/* Clipboard transfers with an agent, against a stand-in for a spice
+ * server on a local socket, with the agent behind it. */
+#define BIG (300 * 1024)
+
+typedef struct _Server {
+    GSocketService *service;
+    guint16 port;
+    EVP_PKEY *ticket_key; /* the link reply key, for the spice ticket */
+    GMutex lock;          /* of the writes, from the server and the test */
+    GOutputStream *out;
+    guint64 serial;
+    GAsyncQueue *agent_msgs; /* GBytes of the agent messages of the client */
+    gint done; /* atomic, TRUE once the connection is over */
+} Server;
+
+typedef struct _Fixture {
+    Server server;
+    SpiceSession *session;
+    SpiceMainChannel *main;
+    guint timeout;
+    /* what the client got */
+    guint selections;
+    guint32 type;
+    GByteArray *data;
+    gboolean streamed;
+    GAsyncResult *result;
+} Fixture;
+
+static guint8 pattern[BIG];
+
+static gboolean server_read(GInputStream *in, gpointer data, gsize size)
+{
+    gsize bytes_read;
+
+    return g_input_stream_read_all(in, data, size, &bytes_read, NULL, NULL) &&
+           bytes_read == size;
+}
+
+static gboolean server_write(GOutputStream *out, gconstpointer data, gsize size)
+{
+    return g_output_stream_write_all(out, data, size, NULL, NULL, NULL);
+}
+
+static gboolean server_send(Server *server, guint16 type, gconstpointer data, gsize size)
+{
+    SpiceDataHeader header = { 0, };
+    gboolean ok;
+
+    g_mutex_lock(&server->lock);
+    header.serial = GUINT64_TO_LE(++server->serial);
+    header.type = GUINT16_TO_LE(type);
+    header.size = GUINT32_TO_LE(size);
+    ok = server_write(server->out, &header, sizeof(header)) &&
+         server_write(server->out, data, size);
+    g_mutex_unlock(&server->lock);
+
+    return ok;
+}
+
+/* an agent message, cut the way the server does */
+static void server_send_agent(Server *server, guint32 type,
+                              gconstpointer data1, gsize size1,
+                              gconstpointer data2, gsize size2)
+{
+    GByteArray *msg = g_byte_array_new();
+    VDAgentMessage header = {
+        .protocol = VD_AGENT_PROTOCOL,
+        .type = type,
+        .size = size1 + size2,
+    };
+    gsize pos;
+
+    g_byte_array_append(msg, (guint8 *)&header, sizeof(header));
+    g_byte_array_append(msg, data1, size1);
+    g_byte_array_append(msg, data2, size2);
+    for (pos = 0; pos < msg->len; pos += VD_AGENT_MAX_DATA_SIZE)
+        g_assert_true(server_send(server, SPICE_MSG_MAIN_AGENT_DATA, msg->data + pos,
+                                  MIN(VD_AGENT_MAX_DATA_SIZE, msg->len - pos)));
+    g_byte_array_unref(msg);
+}
+
+static gboolean server_link(Server *server, GInputStream *in, GOutputStream *out)
+{
+    SpiceLinkHeader header;
+    SpiceLinkReply reply = { 0, };
+    guint8 *mess, *der = reply.pub_key;
+    guint8 ticket[128];
+    guint32 result = GUINT32_TO_LE(SPICE_LINK_ERR_OK);
+    gboolean ok;
+
+    if (!server_read(in, &header, sizeof(header)))
+        return FALSE;
+    g_assert_cmpuint(header.magic, ==, SPICE_MAGIC);
+    mess = g_malloc(GUINT32_FROM_LE(header.size));
+    ok = server_read(in, mess, GUINT32_FROM_LE(header.size));
+    g_free(mess);
+    if (!ok)
+        return FALSE;
+
+    /* no common caps: full data headers, plain spice ticket */
+    header.magic = SPICE_MAGIC;
+    header.major_version = GUINT32_TO_LE(SPICE_VERSION_MAJOR);
+    header.minor_version = GUINT32_TO_LE(SPICE_VERSION_MINOR);
+    header.size = GUINT32_TO_LE(sizeof(reply));
+    reply.error = GUINT32_TO_LE(SPICE_LINK_ERR_OK);
+    g_assert_cmpint(i2d_PUBKEY(server->ticket_key, &der), ==, SPICE_TICKET_PUBKEY_BYTES);
+    reply.caps_offset = GUINT32_TO_LE(sizeof(reply));
+    if (!server_write(out, &header, sizeof(header)) ||
+        !server_write(out, &reply, sizeof(reply)) ||
+        !server_read(in, ticket, sizeof(ticket)))
+        return FALSE;
+
+    return server_write(out, &result, sizeof(result));
+}
+
+static gboolean server_run(GThreadedSocketService *service G_GNUC_UNUSED,
+                           GSocketConnection *connection,
+                           GObject *source_object G_GNUC_UNUSED,
+                           gpointer user_data)
+{
+    Server *server = user_data;
+    GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+    GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    GByteArray *agent = g_byte_array_new();
+    guint32 init[] = {
+        GUINT32_TO_LE(1),                      /* session_id */
+        0,                                     /* display_channels_hint */
+        GUINT32_TO_LE(SPICE_MOUSE_MODE_SERVER), /* supported_mouse_modes */
+        GUINT32_TO_LE(SPICE_MOUSE_MODE_SERVER), /* current_mouse_mode */
+        GUINT32_TO_LE(1),                      /* agent_connected */
+        GUINT32_TO_LE(10000),                  /* agent_tokens */
+        0,                                     /* multi_media_time */
+        0,                                     /* ram_hint */
+    };
+
+    if (!server_link(server, in, out))
+        goto end;
+
+    g_mutex_lock(&server->lock);
+    server->out = out;
+    g_mutex_unlock(&server->lock);
+    if (!server_send(server, SPICE_MSG_MAIN_INIT, init, sizeof(init)))
+        goto end;
+
+    /* the agent messages of the client, until it disconnects */
+    for (;;) {
+        SpiceDataHeader header;
+        gsize size;
+        VDAgentMessage *msg;
+
+        if (!server_read(in, &header, sizeof(header)))
+            break;
+        size = GUINT32_FROM_LE(header.size);
+        g_byte_array_set_size(agent, agent->len + size);
+        if (size > 0 && !server_read(in, agent->data + agent->len - size, size))
+            break;
+        if (GUINT16_FROM_LE(header.type) != SPICE_MSGC_MAIN_AGENT_DATA) {
+            g_byte_array_set_size(agent, agent->len - size);
+            continue;
+        }
+
+        msg = (VDAgentMessage *)agent->data;
+        while (agent->len >= sizeof(VDAgentMessage) &&
+               agent->len >= sizeof(VDAgentMessage) + msg->size) {
+            /* the array is shifted in place */
+            size = sizeof(VDAgentMessage) + msg->size;
+            g_async_queue_push(server->agent_msgs, g_bytes_new(agent->data, size));
+            g_byte_array_remove_range(agent, 0, size);
+        }
+    }
+
+end:
+    g_mutex_lock(&server->lock);
+    server->out = NULL;
+    g_mutex_unlock(&server->lock);
+    g_byte_array_unref(agent);
+    g_atomic_int_set(&server->done, TRUE);
+
+    return TRUE;
+}
+
+static void server_start(Server *server)
+{
+    EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+    GError *error = NULL;
+
+    memset(server, 0, sizeof(*server));
+    g_mutex_init(&server->lock);
+    server->agent_msgs = g_async_queue_new_full((GDestroyNotify)g_bytes_unref);
+    g_assert_cmpint(EVP_PKEY_keygen_init(kctx), ==, 1);
+    g_assert_cmpint(EVP_PKEY_CTX_set_rsa_keygen_bits(kctx, SPICE_TICKET_KEY_PAIR_LENGTH), ==, 1);
+    g_assert_cmpint(EVP_PKEY_keygen(kctx, &server->ticket_key), ==, 1);
+    EVP_PKEY_CTX_free(kctx);
+
+    server->service = g_threaded_socket_service_new(1);
+    server->port = g_socket_listener_add_any_inet_port(G_SOCKET_LISTENER(server->service),
+                                                       NULL, &error);
+    g_assert_no_error(error);
+    g_signal_connect(server->service, "run", G_CALLBACK(server_run), server);
+    g_socket_service_start(server->service);
+}
+
+static void server_stop(Server *server)
+{
+    g_socket_service_stop(server->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(server->service));
+    g_object_unref(server->service);
+    EVP_PKEY_free(server->ticket_key);
+    g_async_queue_unref(server->agent_msgs);
+    g_mutex_clear(&server->lock);
+}
+
+/* the next agent message of @type from the client, the others are skipped */
+static GBytes *server_pop_agent(Server *server, guint32 type)
+{
+    for (;;) {
+        GBytes *bytes = g_async_queue_timeout_pop(server->agent_msgs, 1000);
+        const VDAgentMessage *msg;
+
+        if (bytes == NULL) {
+            g_main_context_iteration(NULL, FALSE);
+            continue;
+        }
+        msg = g_bytes_get_data(bytes, NULL);
+        if (msg->type == type)
+            return bytes;
+        g_bytes_unref(bytes);
+    }
+}
+
+static void check_clipboard(GBytes *bytes, guint32 type, const guint8 *data, gsize size)
+{
+    gsize msg_size;
+    const VDAgentMessage *msg = g_bytes_get_data(bytes, &msg_size);
+    const VDAgentClipboard *cb = (const VDAgentClipboard *)msg->data;
+
+    g_assert_cmpuint(msg->size, ==, sizeof(VDAgentClipboard) + size);
+    g_assert_cmpuint(msg_size, ==, sizeof(VDAgentMessage) + msg->size);
+    g_assert_cmpuint(cb->type, ==, type);
+    g_assert_true(memcmp(cb->data, data, size) == 0);
+}
+
+static gboolean timeout_cb(gpointer user_data)
+{
+    g_assert_not_reached();
+    return G_SOURCE_REMOVE;
+}
+
+static void f_setup(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    VDAgentAnnounceCapabilities *caps;
+    gsize caps_size = sizeof(VDAgentAnnounceCapabilities) + VD_AGENT_CAPS_BYTES;
+    gchar *port;
+    gsize i;
+
+    for (i = 0; i < BIG; i++)
+        pattern[i] = i & 0xff;
+    memset(f, 0, sizeof(*f));
+    f->data = g_byte_array_new();
+    server_start(&f->server);
+    f->timeout = g_timeout_add_seconds(30, timeout_cb, NULL);
+
+    port = g_strdup_printf("%u", f->server.port);
+    f->session = spice_session_new();
+    g_object_set(f->session, "host", "127.0.0.1", "port", port, NULL);
+    g_free(port);
+    f->main = SPICE_MAIN_CHANNEL(spice_channel_new(f->session, SPICE_CHANNEL_MAIN, 0));
+    g_assert_true(spice_channel_connect(SPICE_CHANNEL(f->main)));
+
+    /* the client announces itself once the agent is connected, the agent
+     * only takes clipboard data on demand */
+    g_bytes_unref(server_pop_agent(&f->server, VD_AGENT_ANNOUNCE_CAPABILITIES));
+    caps = g_malloc0(caps_size);
+    VD_AGENT_SET_CAPABILITY(caps->caps, VD_AGENT_CAP_CLIPBOARD_BY_DEMAND);
+    server_send_agent(&f->server, VD_AGENT_ANNOUNCE_CAPABILITIES, caps, caps_size, NULL, 0);
+    g_free(caps);
+    while (!spice_main_agent_test_capability(f->main, VD_AGENT_CAP_CLIPBOARD_BY_DEMAND))
+        g_main_context_iteration(NULL, TRUE);
+}
+
+static void f_teardown(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    spice_session_disconnect(f->session);
+    g_object_unref(f->session);
+    /* the server thread is done with the fixture */
+    while (!g_atomic_int_get(&f->server.done))
+        g_main_context_iteration(NULL, FALSE);
+    g_source_remove(f->timeout);
+    server_stop(&f->server);
+    g_byte_array_unref(f->data);
+    g_clear_object(&f->result);
+}
+
+static void clipboard_selection(SpiceMainChannel *main G_GNUC_UNUSED, guint selection,
+                                guint type, const guchar *data, guint size, Fixture *f)
+{
+    g_assert_cmpuint(selection, ==, VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD);
+
+    f->selections++;
+    f->type = type;
+    g_byte_array_set_size(f->data, 0);
+    g_byte_array_append(f->data, data, size);
+}
+
+static void clipboard_selection_data(SpiceMainChannel *main G_GNUC_UNUSED, guint selection,
+                                     guint type, const guchar *data, guint size,
+                                     guint offset, guint total, Fixture *f)
+{
+    g_assert_cmpuint(selection, ==, VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD);
+    g_assert_cmpuint(offset, ==, f->data->len);
+    g_assert_cmpuint(offset + size, <=, total);
+
+    f->type = type;
+    g_byte_array_append(f->data, data, size);
+    f->streamed = offset + size == total;
+}
+
+/* the agent sends @size bytes of the pattern, and the client gets... */
+static void agent_clipboard(Fixture *f, guint32 type, gsize size)
+{
+    VDAgentClipboard cb = { .type = type };
+    guint selections = f->selections;
+
+    server_send_agent(&f->server, VD_AGENT_CLIPBOARD, &cb, sizeof(cb), pattern, size);
+    while (f->selections == selections)
+        g_main_context_iteration(NULL, TRUE);
+    g_assert_cmpuint(f->type, ==, type);
+}
+
+static void test_clipboard_receive_discard(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    g_signal_connect(f->main, "main-clipboard-selection",
+                     G_CALLBACK(clipboard_selection), f);
+    g_object_set(f->main, "max-clipboard", 8000, NULL);
+
+    /* over the limit, the request is answered with nothing */
+    g_test_expect_message("GSpice", G_LOG_LEVEL_WARNING, "discarding 10000 bytes*");
+    agent_clipboard(f, VD_AGENT_CLIPBOARD_UTF8_TEXT, 10000);
+    g_test_assert_expected_messages();
+    g_assert_cmpuint(f->data->len, ==, 0);
+
+    /* what follows is still read right, in several pieces or not */
+    agent_clipboard(f, VD_AGENT_CLIPBOARD_IMAGE_PNG, 7000);
+    g_assert_cmpuint(f->data->len, ==, 7000);
+    g_assert_true(memcmp(f->data->data, pattern, 7000) == 0);
+    agent_clipboard(f, VD_AGENT_CLIPBOARD_UTF8_TEXT, 100);
+    g_assert_cmpuint(f->data->len, ==, 100);
+    g_assert_true(memcmp(f->data->data, pattern, 100) == 0);
+}
+
+static void test_clipboard_receive_stream(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    const VDAgentMessage *msg;
+    GBytes *bytes;
+    VDAgentClipboard cb = { .type = VD_AGENT_CLIPBOARD_UTF8_TEXT };
+
+    g_signal_connect(f->main, "main-clipboard-selection",
+                     G_CALLBACK(clipboard_selection), f);
+    g_signal_connect(f->main, "main-clipboard-selection-data",
+                     G_CALLBACK(clipboard_selection_data), f);
+    g_object_set(f->main, "max-clipboard", 8000, NULL);
+
+    spice_main_clipboard_selection_request_stream(f->main, VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD,
+                                                  VD_AGENT_CLIPBOARD_UTF8_TEXT);
+    bytes = server_pop_agent(&f->server, VD_AGENT_CLIPBOARD_REQUEST);
+    msg = g_bytes_get_data(bytes, NULL);
+    g_assert_cmpuint(((VDAgentClipboardRequest *)msg->data)->type, ==,
+                     VD_AGENT_CLIPBOARD_UTF8_TEXT);
+    g_bytes_unref(bytes);
+
+    /* max-clipboard doesn't apply */
+    server_send_agent(&f->server, VD_AGENT_CLIPBOARD, &cb, sizeof(cb), pattern, BIG);
+    while (!f->streamed)
+        g_main_context_iteration(NULL, TRUE);
+    g_assert_cmpuint(f->selections, ==, 0);
+    g_assert_cmpuint(f->data->len, ==, BIG);
+    g_assert_true(memcmp(f->data->data, pattern, BIG) == 0);
+
+    /* only the reply to that request was streamed */
+    f->streamed = FALSE;
+    agent_clipboard(f, VD_AGENT_CLIPBOARD_UTF8_TEXT, 5000);
+    g_assert_false(f->streamed);
+    g_assert_cmpuint(f->data->len, ==, 5000);
+}
+
+static void notify_done(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    Fixture *f = user_data;
+
+    f->result = g_object_ref(result);
+}
+
+/* the result of spice_main_clipboard_selection_notify_async() */
+static gboolean notify_finish(Fixture *f, GError **error)
+{
+    gboolean ok;
+
+    while (f->result == NULL)
+        g_main_context_iteration(NULL, TRUE);
+    ok = spice_main_clipboard_selection_notify_finish(f->main, f->result, error);
+    g_clear_object(&f->result);
+
+    return ok;
+}
+
+static void test_clipboard_send_stream(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    GInputStream *stream = g_memory_input_stream_new_from_data(pattern, BIG, NULL);
+    GError *error = NULL;
+    GBytes *bytes;
+
+    spice_main_clipboard_selection_notify_async(f->main, VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD,
+                                                VD_AGENT_CLIPBOARD_UTF8_TEXT, stream, BIG,
+                                                NULL, notify_done, f);
+    g_assert_true(notify_finish(f, &error));
+    g_assert_no_error(error);
+
+    bytes = server_pop_agent(&f->server, VD_AGENT_CLIPBOARD);
+    check_clipboard(bytes, VD_AGENT_CLIPBOARD_UTF8_TEXT, pattern, BIG);
+    g_bytes_unref(bytes);
+    g_object_unref(stream);
+}
+
+static void test_clipboard_send_cancel(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    GInputStream *stream = g_memory_input_stream_new_from_data(pattern, BIG, NULL);
+    GCancellable *cancellable = g_cancellable_new();
+    guint8 *zeroes = g_malloc0(BIG);
+    guint8 *truncated = g_malloc0(BIG);
+    GError *error = NULL;
+    GBytes *bytes;
+
+    /* cancelled before the first block is read */
+    g_cancellable_cancel(cancellable);
+    spice_main_clipboard_selection_notify_async(f->main, VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD,
+                                                VD_AGENT_CLIPBOARD_UTF8_TEXT, stream, BIG,
+                                                cancellable, notify_done, f);
+    g_assert_false(notify_finish(f, &error));
+    g_assert_error(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+    g_clear_error(&error);
+    g_object_unref(stream);
+
+    /* the size was announced, the agent gets zeroes instead */
+    bytes = server_pop_agent(&f->server, VD_AGENT_CLIPBOARD);
+    check_clipboard(bytes, VD_AGENT_CLIPBOARD_UTF8_TEXT, zeroes, BIG);
+    g_bytes_unref(bytes);
+
+    /* the same for data shorter than announced */
+    stream = g_memory_input_stream_new_from_data(pattern, BIG / 2, NULL);
+    spice_main_clipboard_selection_notify_async(f->main, VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD,
+                                                VD_AGENT_CLIPBOARD_UTF8_TEXT, stream, BIG,
+                                                NULL, notify_done, f);
+    g_assert_false(notify_finish(f, &error));
+    g_assert_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT);
+    g_clear_error(&error);
+
+    memcpy(truncated, pattern, BIG / 2);
+    bytes = server_pop_agent(&f->server, VD_AGENT_CLIPBOARD);
+    check_clipboard(bytes, VD_AGENT_CLIPBOARD_UTF8_TEXT, truncated, BIG);
+    g_bytes_unref(bytes);
+
+    /* the next transfer isn't affected */
+    spice_main_clipboard_selection_notify(f->main, VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD,
+                                          VD_AGENT_CLIPBOARD_UTF8_TEXT, pattern, 100);
+    bytes = server_pop_agent(&f->server, VD_AGENT_CLIPBOARD);
+    check_clipboard(bytes, VD_AGENT_CLIPBOARD_UTF8_TEXT, pattern, 100);
+    g_bytes_unref(bytes);
+
+    g_free(truncated);
+    g_free(zeroes);
+    g_object_unref(stream);
+    g_object_unref(cancellable);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/clipboard/receive/discard", Fixture, NULL,
+               f_setup, test_clipboard_receive_discard, f_teardown);
+    g_test_add("/clipboard/receive/stream", Fixture, NULL,
+               f_setup, test_clipboard_receive_stream, f_teardown);
+    g_test_add("/clipboard/send/stream", Fixture, NULL,
+               f_setup, test_clipboard_send_stream, f_teardown);
+    g_test_add("/clipboard/send/cancel", Fixture, NULL,
+               f_setup, test_clipboard_send_cancel, f_teardown);
+
+    return g_test_run();
+}
@@ -1,7 +1,11 @@
 #include <glib.h>
+#include <fenv.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#if defined(__x86_64__)
+#include <xmmintrin.h>
+#endif
 
 #include "coroutine.h"
 
@@ -120,6 +124,292 @@ static void test_coroutine_yield(void)
     g_test_assert_expected_messages();
 }
 
+static gpointer co_entry_finish(gpointer data)
+{
+    coroutine_yield(NULL);
+
+    return data;
+}
+
+static gpointer co_entry_resume(gpointer data)
+{
+    struct coroutine *self = coroutine_self();
+    struct coroutine *co = data;
+
+    /* co was started from the main coroutine, it finishes back here */
+    g_assert(coroutine_yieldto(co, NULL) == co);
+    g_assert(co->exited);
+    g_assert(self == coroutine_self());
+
+    return GINT_TO_POINTER(0x42);
+}
+
+static void test_coroutine_resumer(void)
+{
+    struct coroutine *self = coroutine_self();
+    struct coroutine finish = {
+        .stack_size = 16 << 20,
+        .entry = co_entry_finish,
+    };
+    struct coroutine resume = {
+        .stack_size = 16 << 20,
+        .entry = co_entry_resume,
+    };
+
+    coroutine_init(&finish);
+    g_assert_null(coroutine_yieldto(&finish, &finish));
+
+    coroutine_init(&resume);
+    g_assert_cmpint(GPOINTER_TO_INT(coroutine_yieldto(&resume, &finish)), ==, 0x42);
+    g_assert(resume.exited);
+    g_assert(self == coroutine_self());
+}
+
+#if (defined(__x86_64__) || defined(__aarch64__)) && defined(__ELF__)
+#define CHECK_CALLEE_SAVED 1
+/*
+ * Loads the callee-saved registers with seed + 1, seed + 2, ..., calls
+ * fn(arg), and returns whether they came back changed.
+ */
+guint switch_check(gpointer (*fn)(gpointer), gpointer arg, guint64 seed)
+    G_GNUC_INTERNAL;
+
+#if defined(__x86_64__)
+__asm__(
+	".pushsection .text\n"
+	".globl switch_check\n"
+	".hidden switch_check\n"
+	".type switch_check, @function\n"
+	"switch_check:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	pushq %rdx\n"
+	"	leaq 1(%rdx), %rbx\n"
+	"	leaq 2(%rdx), %rbp\n"
+	"	leaq 3(%rdx), %r12\n"
+	"	leaq 4(%rdx), %r13\n"
+	"	leaq 5(%rdx), %r14\n"
+	"	leaq 6(%rdx), %r15\n"
+	"	movq %rdi, %rax\n"
+	"	movq %rsi, %rdi\n"
+	"	call *%rax\n"
+	"	popq %rdx\n"
+	"	movl $1, %eax\n"
+	"	subq %rdx, %rbx\n"
+	"	cmpq $1, %rbx\n"
+	"	jne 1f\n"
+	"	subq %rdx, %rbp\n"
+	"	cmpq $2, %rbp\n"
+	"	jne 1f\n"
+	"	subq %rdx, %r12\n"
+	"	cmpq $3, %r12\n"
+	"	jne 1f\n"
+	"	subq %rdx, %r13\n"
+	"	cmpq $4, %r13\n"
+	"	jne 1f\n"
+	"	subq %rdx, %r14\n"
+	"	cmpq $5, %r14\n"
+	"	jne 1f\n"
+	"	subq %rdx, %r15\n"
+	"	cmpq $6, %r15\n"
+	"	jne 1f\n"
+	"	xorl %eax, %eax\n"
+	"1:\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size switch_check, .-switch_check\n"
+	".popsection\n"
+);
+#else
+__asm__(
+	".pushsection .text\n"
+	".globl switch_check\n"
+	".hidden switch_check\n"
+	".type switch_check, %function\n"
+	"switch_check:\n"
+	"	stp x29, x30, [sp, #-112]!\n"
+	"	mov x29, sp\n"
+	"	stp x19, x20, [sp, #16]\n"
+	"	stp x21, x22, [sp, #32]\n"
+	"	stp x23, x24, [sp, #48]\n"
+	"	stp x25, x26, [sp, #64]\n"
+	"	stp x27, x28, [sp, #80]\n"
+	"	str x2, [sp, #96]\n"
+	"	add x19, x2, #1\n"
+	"	add x20, x2, #2\n"
+	"	add x21, x2, #3\n"
+	"	add x22, x2, #4\n"
+	"	add x23, x2, #5\n"
+	"	add x24, x2, #6\n"
+	"	add x25, x2, #7\n"
+	"	add x26, x2, #8\n"
+	"	add x27, x2, #9\n"
+	"	add x28, x2, #10\n"
+	"	mov x3, x0\n"
+	"	mov x0, x1\n"
+	"	blr x3\n"
+	"	ldr x2, [sp, #96]\n"
+	"	mov x0, #1\n"
+	"	sub x3, x19, x2\n"
+	"	cmp x3, #1\n"
+	"	b.ne 1f\n"
+	"	sub x3, x20, x2\n"
+	"	cmp x3, #2\n"
+	"	b.ne 1f\n"
+	"	sub x3, x21, x2\n"
+	"	cmp x3, #3\n"
+	"	b.ne 1f\n"
+	"	sub x3, x22, x2\n"
+	"	cmp x3, #4\n"
+	"	b.ne 1f\n"
+	"	sub x3, x23, x2\n"
+	"	cmp x3, #5\n"
+	"	b.ne 1f\n"
+	"	sub x3, x24, x2\n"
+	"	cmp x3, #6\n"
+	"	b.ne 1f\n"
+	"	sub x3, x25, x2\n"
+	"	cmp x3, #7\n"
+	"	b.ne 1f\n"
+	"	sub x3, x26, x2\n"
+	"	cmp x3, #8\n"
+	"	b.ne 1f\n"
+	"	sub x3, x27, x2\n"
+	"	cmp x3, #9\n"
+	"	b.ne 1f\n"
+	"	sub x3, x28, x2\n"
+	"	cmp x3, #10\n"
+	"	b.ne 1f\n"
+	"	mov x0, #0\n"
+	"1:\n"
+	"	ldp x19, x20, [sp, #16]\n"
+	"	ldp x21, x22, [sp, #32]\n"
+	"	ldp x23, x24, [sp, #48]\n"
+	"	ldp x25, x26, [sp, #64]\n"
+	"	ldp x27, x28, [sp, #80]\n"
+	"	ldp x29, x30, [sp], #112\n"
+	"	ret\n"
+	".size switch_check, .-switch_check\n"
+	".popsection\n"
+);
+#endif
+
+static gpointer yield_cb(gpointer arg)
+{
+    return coroutine_yield(arg);
+}
+
+static gpointer yieldto_cb(gpointer co)
+{
+    return coroutine_yieldto(co, NULL);
+}
+#endif
+
+/* only the asm switch keeps the floating-point control words per
+ * coroutine, _setjmp() doesn't save them */
+static void set_rounding(int mode G_GNUC_UNUSED)
+{
+#if WITH_ASM_SWITCH
+    g_assert_cmpint(fesetround(mode), ==, 0);
+#endif
+}
+
+/* the rounding mode lives in mxcsr and the x87 control word on x86-64 */
+static void check_rounding(int mode G_GNUC_UNUSED, guint mxcsr G_GNUC_UNUSED)
+{
+#if WITH_ASM_SWITCH
+    g_assert_cmpint(fegetround(), ==, mode);
+#if defined(__x86_64__)
+    g_assert_cmphex(_mm_getcsr() & 0x6000, ==, mxcsr);
+#endif
+#endif
+}
+
+static gpointer co_entry_context(gpointer data)
+{
+    /* a context of its own on this side of the switch */
+    set_rounding(FE_TOWARDZERO);
+#ifdef CHECK_CALLEE_SAVED
+    g_assert_cmpuint(switch_check(yield_cb, data, 0xc0de0000), ==, 0);
+#else
+    coroutine_yield(data);
+#endif
+    check_rounding(FE_TOWARDZERO, 0x6000);
+
+    set_rounding(FE_TONEAREST);
+    return NULL;
+}
+
+static void test_coroutine_context(void)
+{
+    struct coroutine co = {
+        .stack_size = 16 << 20,
+        .entry = co_entry_context,
+    };
+
+    coroutine_init(&co);
+    set_rounding(FE_UPWARD);
+#ifdef CHECK_CALLEE_SAVED
+    g_assert_cmpuint(switch_check(yieldto_cb, &co, 0x5eed0000), ==, 0);
+#else
+    coroutine_yieldto(&co, NULL);
+#endif
+    check_rounding(FE_UPWARD, 0x4000);
+
+    coroutine_yieldto(&co, NULL);
+    g_assert(co.exited);
+    check_rounding(FE_UPWARD, 0x4000);
+    set_rounding(FE_TONEAREST);
+}
+
+#define SWITCH_ROUNDS 1000000
+
+static gpointer co_entry_ping(gpointer data)
+{
+    /* until told to stop with NULL */
+    while (data != NULL)
+        data = coroutine_yield(data);
+
+    return NULL;
+}
+
+static void test_coroutine_switch_bench(void)
+{
+    struct coroutine co = {
+        .stack_size = 16 << 20,
+        .entry = co_entry_ping,
+    };
+    gint64 start, elapsed;
+    guint i;
+
+    if (!g_test_perf())
+        return;
+
+    coroutine_init(&co);
+    start = g_get_monotonic_time();
+    for (i = 1; i <= SWITCH_ROUNDS; i++)
+        g_assert(coroutine_yieldto(&co, GUINT_TO_POINTER(i)) == GUINT_TO_POINTER(i));
+    elapsed = g_get_monotonic_time() - start;
+
+    /* a yieldto and the yield back are two switches */
+    g_test_message("%u coroutine switches: %.1f M/s, %.0f ns each",
+                   2 * SWITCH_ROUNDS, 2.0 * SWITCH_ROUNDS / elapsed,
+                   elapsed * 1000.0 / (2 * SWITCH_ROUNDS));
+
+    /* let it finish, which releases its stack */
+    coroutine_yieldto(&co, NULL);
+    g_assert(co.exited);
+}
+
 int main(int argc, char* argv[])
 {
     g_test_init(&argc, &argv, NULL);
@@ -127,6 +417,9 @@ int main(int argc, char* argv[])
     g_test_add_func("/coroutine/simple", test_coroutine_simple);
     g_test_add_func("/coroutine/two", test_coroutine_two);
     g_test_add_func("/coroutine/yield", test_coroutine_yield);
+    g_test_add_func("/coroutine/resumer", test_coroutine_resumer);
+    g_test_add_func("/coroutine/context", test_coroutine_context);
+    g_test_add_func("/coroutine/switch/bench", test_coroutine_switch_bench);
 
     return g_test_run ();
 }
@@ -0,0 +1,196 @@
+#include <glib.h>
+#include <string.h>
+
+#include "common/messages.h"
+#include "common/client_demarshallers.h"
+
+/*
+ * Corpus of server messages, either loaded from the file given on the
+ * command line, or made up with the sizes seen on a playback + usbredir
+ * session. The file is a sequence of records:
+ *   uint32 channel type, uint16 message type, uint32 size (little endian)
+ *   followed by the message body
+ */
+
+typedef struct {
+    guint32 channel;
+    guint16 type;
+    guint32 size;
+    guint8 *data;
+} CorpusMsg;
+
+typedef union {
+    SpiceMsgPlaybackPacket packet;
+    SpiceMsgCompressedData compressed;
+} MsgView;
+
+static GArray *corpus;
+
+static void corpus_add(guint32 channel, guint16 type, const guint8 *data, guint32 size)
+{
+    CorpusMsg msg = { channel, type, size, g_memdup(data, size) };
+
+    g_array_append_val(corpus, msg);
+}
+
+static gboolean corpus_load(const gchar *filename)
+{
+    gchar *contents;
+    gsize len, pos = 0;
+
+    if (!g_file_get_contents(filename, &contents, &len, NULL))
+        return FALSE;
+
+    while (pos + 10 <= len) {
+        guint32 channel, size;
+        guint16 type;
+
+        memcpy(&channel, contents + pos, 4);
+        memcpy(&type, contents + pos + 4, 2);
+        memcpy(&size, contents + pos + 6, 4);
+        channel = GUINT32_FROM_LE(channel);
+        type = GUINT16_FROM_LE(type);
+        size = GUINT32_FROM_LE(size);
+
+        pos += 10;
+        if (size > len - pos)
+            break;
+        corpus_add(channel, type, (guint8 *)contents + pos, size);
+        pos += size;
+    }
+    g_free(contents);
+
+    return corpus->len > 0;
+}
+
+static void corpus_make_up(void)
+{
+    guint8 buf[16 * 1024];
+    guint i;
+
+    for (i = 0; i < sizeof(buf); i++)
+        buf[i] = i * 31;
+
+    for (i = 0; i < 1000; i++) {
+        /* 10ms of opus */
+        buf[0] = i;
+        corpus_add(SPICE_CHANNEL_PLAYBACK, SPICE_MSG_PLAYBACK_DATA, buf, 4 + 160);
+        /* bulk usbredir data, compressed or not */
+        buf[0] = SPICE_DATA_COMPRESSION_TYPE_LZ4;
+        corpus_add(SPICE_CHANNEL_USBREDIR, SPICE_MSG_SPICEVMC_COMPRESSED_DATA, buf, 1 + 4 + 4000);
+        buf[0] = SPICE_DATA_COMPRESSION_TYPE_NONE;
+        corpus_add(SPICE_CHANNEL_USBREDIR, SPICE_MSG_SPICEVMC_COMPRESSED_DATA, buf, 1 + 512);
+        corpus_add(SPICE_CHANNEL_USBREDIR, SPICE_MSG_SPICEVMC_DATA, buf, sizeof(buf));
+    }
+}
+
+static void test_view_same(void)
+{
+    guint i, viewed = 0;
+
+    for (i = 0; i < corpus->len; i++) {
+        CorpusMsg *msg = &g_array_index(corpus, CorpusMsg, i);
+        spice_parse_channel_func_t parser = spice_get_server_channel_parser(msg->channel, NULL);
+        spice_parse_channel_view_func_t view_parser = spice_get_server_channel_view_parser(msg->channel);
+        MsgView view;
+        message_destructor_t free_message;
+        uint8_t *parsed, *viewed_msg;
+        size_t size;
+
+        g_assert(parser != NULL);
+        parsed = parser(msg->data, msg->data + msg->size, msg->type,
+                        SPICE_VERSION_MINOR, &size, &free_message);
+        g_assert(parsed != NULL);
+
+        viewed_msg = view_parser == NULL ? NULL :
+            view_parser(msg->data, msg->data + msg->size, msg->type,
+                        SPICE_VERSION_MINOR, (uint8_t *)&view, sizeof(view));
+        if (viewed_msg != NULL) {
+            g_assert(viewed_msg == (uint8_t *)&view);
+            viewed++;
+        }
+
+        if (viewed_msg != NULL && msg->type == SPICE_MSG_PLAYBACK_DATA) {
+            SpiceMsgPlaybackPacket *a = (SpiceMsgPlaybackPacket *)parsed;
+
+            g_assert_cmpuint(a->time, ==, view.packet.time);
+            g_assert(a->data == view.packet.data);
+            g_assert_cmpuint(a->data_size, ==, view.packet.data_size);
+        } else if (viewed_msg != NULL && msg->type == SPICE_MSG_SPICEVMC_COMPRESSED_DATA) {
+            SpiceMsgCompressedData *a = (SpiceMsgCompressedData *)parsed;
+
+            g_assert_cmpuint(a->type, ==, view.compressed.type);
+            if (a->type != SPICE_DATA_COMPRESSION_TYPE_NONE)
+                g_assert_cmpuint(a->uncompressed_size, ==, view.compressed.uncompressed_size);
+            g_assert(a->compressed_data == view.compressed.compressed_data);
+            g_assert_cmpuint(a->compressed_size, ==, view.compressed.compressed_size);
+        }
+        free_message(parsed);
+    }
+
+    g_assert_cmpuint(viewed, >, 0);
+}
+
+static gdouble bench_parse(gboolean use_view, guint rounds)
+{
+    MsgView view;
+    gint64 start = g_get_monotonic_time();
+    guint i, r;
+
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < corpus->len; i++) {
+            CorpusMsg *msg = &g_array_index(corpus, CorpusMsg, i);
+            message_destructor_t free_message;
+            uint8_t *parsed = NULL;
+            size_t size;
+
+            if (use_view) {
+                spice_parse_channel_view_func_t view_parser =
+                    spice_get_server_channel_view_parser(msg->channel);
+
+                if (view_parser != NULL)
+                    parsed = view_parser(msg->data, msg->data + msg->size, msg->type,
+                                         SPICE_VERSION_MINOR, (uint8_t *)&view, sizeof(view));
+                if (parsed != NULL)
+                    continue;
+            }
+            parsed = spice_get_server_channel_parser(msg->channel, NULL)(
+                msg->data, msg->data + msg->size, msg->type,
+                SPICE_VERSION_MINOR, &size, &free_message);
+            free_message(parsed);
+        }
+    }
+
+    return (gdouble)rounds * corpus->len * G_USEC_PER_SEC / (g_get_monotonic_time() - start);
+}
+
+/* run with -m perf */
+static void test_view_bench(void)
+{
+    const guint rounds = 2000;
+    gdouble before, after;
+
+    if (!g_test_perf())
+        return;
+
+    before = bench_parse(FALSE, rounds);
+    after = bench_parse(TRUE, rounds);
+
+    g_test_message("%u messages: %.0f msg/s allocated, %.0f msg/s with views",
+                   corpus->len, before, after);
+    g_test_maximized_result(after, "view parsers %.0f msg/s", after);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    corpus = g_array_new(FALSE, FALSE, sizeof(CorpusMsg));
+    if (argc < 2 || !corpus_load(argv[1]))
+        corpus_make_up();
+
+    g_test_add_func("/demarshal/view-same", test_view_same);
+    g_test_add_func("/demarshal/view-bench", test_view_bench);
+
+    return g_test_run();
+}
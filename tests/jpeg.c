@@ -0,0 +1,231 @@
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <jpeglib.h>
+
+#include "decode.h"
+
+/* Stand-ins for the JPEG images found in draw commands: flat UI areas
+ * with sharp edges, and photo-like content */
+typedef struct _Image {
+    const gchar *name;
+    int width;
+    int height;
+    gboolean photo;
+} Image;
+
+static const Image corpus[] = {
+    { "icon", 48, 48, FALSE },
+    { "toolbar", 640, 32, FALSE },
+    { "window", 800, 600, FALSE },
+    { "thumbnail", 160, 120, TRUE },
+    { "photo", 1024, 768, TRUE },
+};
+
+#define BENCH_ROUNDS 10
+
+typedef struct _Encoded {
+    guint8 *data;
+    gulong size;
+    int width;
+    int height;
+} Encoded;
+
+static guint8 *image_pixels(const Image *image)
+{
+    guint8 *rgb = g_malloc(image->width * image->height * 3);
+    GRand *rand = g_rand_new_with_seed(image->width * image->height);
+    int x, y;
+
+    for (y = 0; y < image->height; y++) {
+        for (x = 0; x < image->width; x++) {
+            guint8 *p = rgb + (y * image->width + x) * 3;
+
+            if (image->photo) {
+                p[0] = (x * 255 / image->width + g_rand_int_range(rand, 0, 24)) & 0xff;
+                p[1] = (y * 255 / image->height + g_rand_int_range(rand, 0, 24)) & 0xff;
+                p[2] = ((x + y) / 2 + g_rand_int_range(rand, 0, 24)) & 0xff;
+            } else {
+                gboolean text = (y % 16) < 10 && (x / 3 + y) % 5 == 0;
+
+                p[0] = text ? 0x20 : 0xee;
+                p[1] = text ? 0x20 : (y < 24 ? 0x90 : 0xee);
+                p[2] = text ? 0x20 : (y < 24 ? 0xd0 : 0xee);
+            }
+        }
+    }
+    g_rand_free(rand);
+
+    return rgb;
+}
+
+static void encode(const Image *image, Encoded *encoded)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    guint8 *rgb = image_pixels(image);
+    unsigned char *data = NULL;
+    unsigned long size = 0;
+    JSAMPROW row;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &data, &size);
+    cinfo.image_width = image->width;
+    cinfo.image_height = image->height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 85, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        row = rgb + cinfo.next_scanline * image->width * 3;
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    g_free(rgb);
+
+    encoded->data = g_malloc(size);
+    memcpy(encoded->data, data, size);
+    encoded->size = size;
+    encoded->width = image->width;
+    encoded->height = image->height;
+    free(data);
+}
+
+/* what the decoder used to produce, one RGB row at a time */
+static guint8 *reference_decode(const Encoded *encoded)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    guint8 *rgb = g_malloc(encoded->width * encoded->height * 3);
+    JSAMPROW row;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, encoded->data, encoded->size);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        row = rgb + cinfo.output_scanline * encoded->width * 3;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    return rgb;
+}
+
+static guint8 *decode(SpiceJpegDecoder *decoder, const Encoded *encoded,
+                      int format, int bpp, int *stride)
+{
+    guint8 *dest;
+    int width, height;
+
+    decoder->ops->begin_decode(decoder, encoded->data, encoded->size, &width, &height);
+    g_assert_cmpint(width, ==, encoded->width);
+    g_assert_cmpint(height, ==, encoded->height);
+
+    /* canvas strides are padded, don't let the decoder assume packed rows */
+    *stride = (width * bpp + 7) & ~3;
+    dest = g_malloc0(*stride * height);
+    decoder->ops->decode(decoder, dest, *stride, format);
+
+    return dest;
+}
+
+static void check_decode(int format, int bpp)
+{
+    SpiceJpegDecoder *decoder = jpeg_decoder_new();
+    guint i;
+    int x, y, stride;
+
+    for (i = 0; i < G_N_ELEMENTS(corpus); i++) {
+        Encoded encoded;
+        guint8 *rgb, *dest;
+
+        encode(&corpus[i], &encoded);
+        rgb = reference_decode(&encoded);
+        dest = decode(decoder, &encoded, format, bpp, &stride);
+
+        for (y = 0; y < encoded.height; y++) {
+            for (x = 0; x < encoded.width; x++) {
+                const guint8 *s = rgb + (y * encoded.width + x) * 3;
+                const guint8 *d = dest + y * stride + x * bpp;
+
+                g_assert_cmpuint(d[0], ==, s[2]);
+                g_assert_cmpuint(d[1], ==, s[1]);
+                g_assert_cmpuint(d[2], ==, s[0]);
+            }
+        }
+        g_free(dest);
+        g_free(rgb);
+        g_free(encoded.data);
+    }
+    jpeg_decoder_destroy(decoder);
+}
+
+static void test_jpeg_decode_bgrx(void)
+{
+    check_decode(SPICE_BITMAP_FMT_32BIT, 4);
+}
+
+static void test_jpeg_decode_bgr(void)
+{
+    check_decode(SPICE_BITMAP_FMT_24BIT, 3);
+}
+
+static gdouble bench_decode(Encoded *encoded, guint n)
+{
+    SpiceJpegDecoder *decoder = jpeg_decoder_new();
+    gint64 start = g_get_monotonic_time();
+    gint64 pixels = 0;
+    guint i, round;
+    int stride;
+
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        for (i = 0; i < n; i++) {
+            g_free(decode(decoder, &encoded[i], SPICE_BITMAP_FMT_32BIT, 4, &stride));
+            pixels += encoded[i].width * encoded[i].height;
+        }
+    }
+    jpeg_decoder_destroy(decoder);
+
+    return pixels / (gdouble)(g_get_monotonic_time() - start);
+}
+
+static void test_jpeg_decode_bench(void)
+{
+    Encoded encoded[G_N_ELEMENTS(corpus)];
+    guint i;
+
+    if (!g_test_perf())
+        return;
+
+    for (i = 0; i < G_N_ELEMENTS(corpus); i++)
+        encode(&corpus[i], &encoded[i]);
+
+    g_unsetenv("SPICE_JPEG_FAST_DECODE");
+    g_test_message("corpus decode to BGRX: %.1f Mpixel/s",
+                   bench_decode(encoded, G_N_ELEMENTS(corpus)));
+    g_setenv("SPICE_JPEG_FAST_DECODE", "1", TRUE);
+    g_test_message("corpus decode to BGRX, fast: %.1f Mpixel/s",
+                   bench_decode(encoded, G_N_ELEMENTS(corpus)));
+    g_unsetenv("SPICE_JPEG_FAST_DECODE");
+
+    for (i = 0; i < G_N_ELEMENTS(corpus); i++)
+        g_free(encoded[i].data);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/jpeg/decode/bgrx", test_jpeg_decode_bgrx);
+    g_test_add_func("/jpeg/decode/bgr", test_jpeg_decode_bgr);
+    g_test_add_func("/jpeg/decode/bench", test_jpeg_decode_bench);
+
+    return g_test_run();
+}
@@ -0,0 +1,164 @@
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "spice-log-priv.h"
+
+#define N_THREADS 4
+
+static gchar **log_dump_lines(void)
+{
+    gchar *filename, *contents;
+    gchar **lines;
+    int fd;
+
+    fd = g_file_open_tmp("spice-log-XXXXXX", &filename, NULL);
+    g_assert_cmpint(fd, >=, 0);
+    spice_log_dump(fd);
+    close(fd);
+
+    g_assert(g_file_get_contents(filename, &contents, NULL, NULL));
+    g_unlink(filename);
+    g_free(filename);
+
+    /* every line ends with a newline, drop the last empty string */
+    lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+    g_assert(lines[g_strv_length(lines) - 1][0] == '\0');
+    g_free(lines[g_strv_length(lines) - 1]);
+    lines[g_strv_length(lines) - 1] = NULL;
+
+    return lines;
+}
+
+static void test_log_levels(void)
+{
+    gchar **lines;
+
+    spice_log_clear();
+    spice_log_set_level(SPICE_LOG_LEVEL_WARNING);
+    SPICE_LOG_INFO("dropped %d", 1);
+    SPICE_LOG_WARNING("kept %d", 2);
+    SPICE_LOG_ERROR("kept %d", 3);
+
+    lines = log_dump_lines();
+    g_assert_cmpuint(g_strv_length(lines), ==, 2);
+    g_assert(g_str_has_suffix(lines[0], "kept 2"));
+    g_assert(strstr(lines[0], " W ") != NULL);
+    g_assert(g_str_has_suffix(lines[1], "kept 3"));
+    g_assert(strstr(lines[1], " E ") != NULL);
+    g_strfreev(lines);
+}
+
+static void test_log_wrap(void)
+{
+    gchar **lines;
+    gchar *last;
+    guint i;
+
+    spice_log_clear();
+    spice_log_set_level(SPICE_LOG_LEVEL_DEBUG);
+    for (i = 0; i < SPICE_LOG_RING_SLOTS * 2 + 10; i++)
+        SPICE_LOG(SPICE_LOG_LEVEL_DEBUG, "message %u", i);
+
+    /* only the last ring full is kept, oldest first */
+    lines = log_dump_lines();
+    g_assert_cmpuint(g_strv_length(lines), ==, SPICE_LOG_RING_SLOTS);
+    last = g_strdup_printf("message %u", i - 1);
+    g_assert(g_str_has_suffix(lines[SPICE_LOG_RING_SLOTS - 1], last));
+    g_free(last);
+    last = g_strdup_printf("message %u", i - SPICE_LOG_RING_SLOTS);
+    g_assert(g_str_has_suffix(lines[0], last));
+    g_free(last);
+    g_strfreev(lines);
+}
+
+static void test_log_truncate(void)
+{
+    gchar *long_msg = g_strnfill(SPICE_LOG_RING_SLOT_SIZE * 2, 'x');
+    gchar **lines;
+
+    spice_log_clear();
+    spice_log_set_level(SPICE_LOG_LEVEL_INFO);
+    SPICE_LOG_INFO("%s", long_msg);
+
+    lines = log_dump_lines();
+    g_assert_cmpuint(g_strv_length(lines), ==, 1);
+    g_assert_cmpuint(strlen(lines[0]), <, SPICE_LOG_RING_SLOT_SIZE);
+    g_strfreev(lines);
+    g_free(long_msg);
+}
+
+static gpointer log_writer(gpointer user_data)
+{
+    guint id = GPOINTER_TO_UINT(user_data);
+    guint i;
+
+    for (i = 0; i < SPICE_LOG_RING_SLOTS / N_THREADS; i++)
+        SPICE_LOG_INFO("thread %u message %u", id, i);
+
+    return NULL;
+}
+
+static void test_log_threads(void)
+{
+    GThread *threads[N_THREADS];
+    gchar **lines;
+    guint i;
+
+    spice_log_clear();
+    spice_log_set_level(SPICE_LOG_LEVEL_INFO);
+    for (i = 0; i < N_THREADS; i++)
+        threads[i] = g_thread_new("log-writer", log_writer, GUINT_TO_POINTER(i));
+    for (i = 0; i < N_THREADS; i++)
+        g_thread_join(threads[i]);
+
+    /* exactly one ring full, nothing lost or torn */
+    lines = log_dump_lines();
+    g_assert_cmpuint(g_strv_length(lines), ==, SPICE_LOG_RING_SLOTS);
+    for (i = 0; lines[i] != NULL; i++)
+        g_assert(strstr(lines[i], " I ") != NULL && strstr(lines[i], "thread ") != NULL);
+    g_strfreev(lines);
+}
+
+/* run with -m perf */
+static void test_log_bench(void)
+{
+    const guint count = 1000000;
+    gint64 start;
+    gdouble disabled, enabled;
+    guint i;
+
+    if (!g_test_perf())
+        return;
+
+    spice_log_set_level(SPICE_LOG_LEVEL_WARNING);
+    start = g_get_monotonic_time();
+    for (i = 0; i < count; i++)
+        SPICE_LOG_INFO("usb device pvid=%s allowed by filter", "0x12345678");
+    disabled = (gdouble)(g_get_monotonic_time() - start) * 1000 / count;
+
+    spice_log_set_level(SPICE_LOG_LEVEL_INFO);
+    start = g_get_monotonic_time();
+    for (i = 0; i < count; i++)
+        SPICE_LOG_INFO("usb device pvid=%s allowed by filter", "0x12345678");
+    enabled = (gdouble)(g_get_monotonic_time() - start) * 1000 / count;
+
+    g_test_message("disabled: %.1f ns/message, enabled: %.1f ns/message",
+                   disabled, enabled);
+    g_test_minimized_result(enabled, "ring log %.1f ns/message", enabled);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/log/levels", test_log_levels);
+    g_test_add_func("/log/wrap", test_log_wrap);
+    g_test_add_func("/log/truncate", test_log_truncate);
+    g_test_add_func("/log/threads", test_log_threads);
+    g_test_add_func("/log/bench", test_log_bench);
+
+    return g_test_run();
+}
@@ -0,0 +1,456 @@
+#include <gio/gio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <spice/protocol.h>
+
+#include "spice-client.h"
+
+/* Migrations of a session opened with client provided sockets, between
+ * two stand-ins for a spice server on local sockets. The test opens
+ * every connection itself, both to the source and to the migration
+ * destination, and each server greets the port channel with its own
+ * data, which must reach the same channel object across the migration. */
+#define HOST "127.0.0.1"
+
+enum {
+    CONN_MAIN,
+    CONN_PORT,
+    N_CONNS
+};
+
+typedef struct _Server {
+    GSocketService *service;
+    guint16 port;
+    EVP_PKEY *ticket_key; /* the link reply key, for the spice ticket */
+    const gchar *name;    /* what the port channel gets from it */
+    gboolean destination;
+    GMutex lock;          /* of the writes, from the server and the test */
+    GOutputStream *out[N_CONNS];
+    guint64 serial[N_CONNS];
+    gint running; /* atomic, the connections still served */
+} Server;
+
+typedef struct _Fixture {
+    Server source;
+    Server destination;
+    SpiceSession *session;
+    SpicePortChannel *port;
+    GMainLoop *loop;
+    gboolean seamless;
+    gboolean migrating;
+    guint migrations;
+    gboolean from_destination;
+    gint64 start;
+    gint64 blackout;
+} Fixture;
+
+static const guint32 main_init[] = {
+    GUINT32_TO_LE(1),                       /* session_id */
+    0,                                      /* display_channels_hint */
+    GUINT32_TO_LE(SPICE_MOUSE_MODE_SERVER), /* supported_mouse_modes */
+    GUINT32_TO_LE(SPICE_MOUSE_MODE_SERVER), /* current_mouse_mode */
+    0,                                      /* agent_connected */
+    0,                                      /* agent_tokens */
+    0,                                      /* multi_media_time */
+    0,                                      /* ram_hint */
+};
+
+static gboolean server_read(GInputStream *in, gpointer data, gsize size)
+{
+    gsize bytes_read;
+
+    return g_input_stream_read_all(in, data, size, &bytes_read, NULL, NULL) &&
+           bytes_read == size;
+}
+
+static gboolean server_write(GOutputStream *out, gconstpointer data, gsize size)
+{
+    return g_output_stream_write_all(out, data, size, NULL, NULL, NULL);
+}
+
+static gboolean server_send(Server *server, guint conn, guint16 type,
+                            gconstpointer data, gsize size)
+{
+    SpiceDataHeader header = { 0, };
+    gboolean ok = FALSE;
+
+    g_mutex_lock(&server->lock);
+    if (server->out[conn] != NULL) {
+        header.serial = GUINT64_TO_LE(++server->serial[conn]);
+        header.type = GUINT16_TO_LE(type);
+        header.size = GUINT32_TO_LE(size);
+        ok = server_write(server->out[conn], &header, sizeof(header)) &&
+             (size == 0 || server_write(server->out[conn], data, size));
+    }
+    g_mutex_unlock(&server->lock);
+
+    return ok;
+}
+
+/* returns the type of the channel that linked, or 0 */
+static guint8 server_link(Server *server, GInputStream *in, GOutputStream *out)
+{
+    SpiceLinkHeader header;
+    SpiceLinkReply reply = { 0, };
+    guint8 *mess, *der = reply.pub_key;
+    guint8 ticket[128];
+    guint8 type;
+    guint32 caps = 0;
+    guint32 result = GUINT32_TO_LE(SPICE_LINK_ERR_OK);
+    gboolean ok;
+
+    if (!server_read(in, &header, sizeof(header)))
+        return 0;
+    g_assert_cmpuint(header.magic, ==, SPICE_MAGIC);
+    g_assert_cmpuint(GUINT32_FROM_LE(header.size), >=, sizeof(SpiceLinkMess));
+    mess = g_malloc(GUINT32_FROM_LE(header.size));
+    ok = server_read(in, mess, GUINT32_FROM_LE(header.size));
+    type = ((SpiceLinkMess *)mess)->channel_type;
+    g_free(mess);
+    if (!ok)
+        return 0;
+
+    /* no common caps: full data headers, plain spice ticket */
+    if (type == SPICE_CHANNEL_MAIN)
+        caps = GUINT32_TO_LE(1 << SPICE_MAIN_CAP_SEMI_SEAMLESS_MIGRATE |
+                             1 << SPICE_MAIN_CAP_SEAMLESS_MIGRATE);
+    header.magic = SPICE_MAGIC;
+    header.major_version = GUINT32_TO_LE(SPICE_VERSION_MAJOR);
+    header.minor_version = GUINT32_TO_LE(SPICE_VERSION_MINOR);
+    header.size = GUINT32_TO_LE(sizeof(reply) + sizeof(caps));
+    reply.error = GUINT32_TO_LE(SPICE_LINK_ERR_OK);
+    g_assert_cmpint(i2d_PUBKEY(server->ticket_key, &der), ==, SPICE_TICKET_PUBKEY_BYTES);
+    reply.num_channel_caps = GUINT32_TO_LE(1);
+    reply.caps_offset = GUINT32_TO_LE(sizeof(reply));
+    if (!server_write(out, &header, sizeof(header)) ||
+        !server_write(out, &reply, sizeof(reply)) ||
+        !server_write(out, &caps, sizeof(caps)) ||
+        !server_read(in, ticket, sizeof(ticket)) ||
+        !server_write(out, &result, sizeof(result)))
+        return 0;
+
+    return type;
+}
+
+/* the main channel messages that move the client along the migration */
+static void server_handle_main(Server *server, guint16 type)
+{
+    guint32 flags = 0;
+
+    switch (type) {
+    case SPICE_MSGC_MAIN_MIGRATE_CONNECT_ERROR:
+        g_assert_not_reached();
+        break;
+    case SPICE_MSGC_MAIN_MIGRATE_CONNECTED:
+        /* the guest has moved */
+        g_assert_true(server_send(server, CONN_MAIN, SPICE_MSG_MAIN_MIGRATE_END, NULL, 0));
+        break;
+    case SPICE_MSGC_MAIN_MIGRATE_CONNECTED_SEAMLESS:
+        /* the guest has moved, and nothing is left to flush or to carry
+         * over to the destination */
+        g_assert_true(server_send(server, CONN_PORT, SPICE_MSG_MIGRATE,
+                                  &flags, sizeof(flags)));
+        g_assert_true(server_send(server, CONN_MAIN, SPICE_MSG_MIGRATE,
+                                  &flags, sizeof(flags)));
+        break;
+    case SPICE_MSGC_MAIN_MIGRATE_DST_DO_SEAMLESS:
+        g_assert_true(server->destination);
+        g_assert_true(server_send(server, CONN_MAIN, SPICE_MSG_MAIN_MIGRATE_DST_SEAMLESS_ACK,
+                                  NULL, 0));
+        break;
+    case SPICE_MSGC_MAIN_MIGRATE_END:
+        /* a semi-seamless migration starts afresh on the destination */
+        g_assert_true(server->destination);
+        g_assert_true(server_send(server, CONN_MAIN, SPICE_MSG_MAIN_INIT,
+                                  main_init, sizeof(main_init)));
+        break;
+    default:
+        break;
+    }
+}
+
+static gboolean server_run(GThreadedSocketService *service G_GNUC_UNUSED,
+                           GSocketConnection *connection,
+                           GObject *source_object G_GNUC_UNUSED,
+                           gpointer user_data)
+{
+    Server *server = user_data;
+    GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+    GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    SpiceDataHeader header;
+    guint8 *data = NULL;
+    guint8 type;
+    guint conn;
+    gsize size;
+
+    g_atomic_int_inc(&server->running);
+    type = server_link(server, in, out);
+    if (type == 0)
+        goto end;
+    g_assert_true(type == SPICE_CHANNEL_MAIN || type == SPICE_CHANNEL_PORT);
+    conn = type == SPICE_CHANNEL_MAIN ? CONN_MAIN : CONN_PORT;
+
+    g_mutex_lock(&server->lock);
+    g_assert_null(server->out[conn]);
+    server->out[conn] = out;
+    server->serial[conn] = 0;
+    g_mutex_unlock(&server->lock);
+
+    /* the destination of a migration doesn't greet the main channel,
+     * and the port channel only reads it once it's swapped in */
+    if (conn == CONN_MAIN && !server->destination)
+        g_assert_true(server_send(server, conn, SPICE_MSG_MAIN_INIT,
+                                  main_init, sizeof(main_init)));
+    else if (conn == CONN_PORT)
+        g_assert_true(server_send(server, conn, SPICE_MSG_SPICEVMC_DATA,
+                                  server->name, strlen(server->name)));
+
+    /* until the client disconnects */
+    while (server_read(in, &header, sizeof(header))) {
+        size = GUINT32_FROM_LE(header.size);
+        data = g_realloc(data, size);
+        if (size > 0 && !server_read(in, data, size))
+            break;
+        if (conn == CONN_MAIN)
+            server_handle_main(server, GUINT16_FROM_LE(header.type));
+    }
+
+    g_mutex_lock(&server->lock);
+    server->out[conn] = NULL;
+    g_mutex_unlock(&server->lock);
+    g_free(data);
+
+end:
+    g_atomic_int_add(&server->running, -1);
+    return TRUE;
+}
+
+static void server_start(Server *server, const gchar *name, gboolean destination)
+{
+    EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+    GError *error = NULL;
+
+    memset(server, 0, sizeof(*server));
+    server->name = name;
+    server->destination = destination;
+    g_mutex_init(&server->lock);
+    g_assert_cmpint(EVP_PKEY_keygen_init(kctx), ==, 1);
+    g_assert_cmpint(EVP_PKEY_CTX_set_rsa_keygen_bits(kctx, SPICE_TICKET_KEY_PAIR_LENGTH), ==, 1);
+    g_assert_cmpint(EVP_PKEY_keygen(kctx, &server->ticket_key), ==, 1);
+    EVP_PKEY_CTX_free(kctx);
+
+    /* a thread for each channel */
+    server->service = g_threaded_socket_service_new(N_CONNS);
+    server->port = g_socket_listener_add_any_inet_port(G_SOCKET_LISTENER(server->service),
+                                                       NULL, &error);
+    g_assert_no_error(error);
+    g_signal_connect(server->service, "run", G_CALLBACK(server_run), server);
+    g_socket_service_start(server->service);
+}
+
+static void server_stop(Server *server)
+{
+    g_socket_service_stop(server->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(server->service));
+    g_object_unref(server->service);
+    EVP_PKEY_free(server->ticket_key);
+    g_mutex_clear(&server->lock);
+}
+
+/* tells the client where to go, through the main channel of the source */
+static void server_migrate_begin(Server *source, Server *destination, gboolean seamless)
+{
+    GByteArray *msg = g_byte_array_new();
+    guint16 ports[] = { GUINT16_TO_LE(destination->port), 0 };
+    guint32 host_size = GUINT32_TO_LE(sizeof(HOST));
+    guint32 host_data;
+    guint32 no_cert_subject[2] = { 0, 0 }; /* size, data */
+    guint32 src_mig_version = 0;
+
+    /* the host follows the destination info, and the source version
+     * of a seamless migration */
+    host_data = GUINT32_TO_LE(sizeof(ports) + sizeof(host_size) + sizeof(host_data) +
+                              sizeof(no_cert_subject) +
+                              (seamless ? sizeof(src_mig_version) : 0));
+    g_byte_array_append(msg, (guint8 *)ports, sizeof(ports));
+    g_byte_array_append(msg, (guint8 *)&host_size, sizeof(host_size));
+    g_byte_array_append(msg, (guint8 *)&host_data, sizeof(host_data));
+    g_byte_array_append(msg, (guint8 *)no_cert_subject, sizeof(no_cert_subject));
+    if (seamless)
+        g_byte_array_append(msg, (guint8 *)&src_mig_version, sizeof(src_mig_version));
+    g_byte_array_append(msg, (guint8 *)HOST, sizeof(HOST));
+
+    g_assert_true(server_send(source, CONN_MAIN,
+                              seamless ? SPICE_MSG_MAIN_MIGRATE_BEGIN_SEAMLESS :
+                                         SPICE_MSG_MAIN_MIGRATE_BEGIN,
+                              msg->data, msg->len));
+    g_byte_array_unref(msg);
+}
+
+static void channel_new(SpiceSession *session, SpiceChannel *channel, Fixture *f);
+
+/* the channels connect to the host and port of their own session, the
+ * ones of the migration session to the destination */
+static void open_fd(SpiceChannel *channel, gint with_tls, Fixture *f)
+{
+    SpiceSession *session;
+    GSocketClient *client;
+    GSocketConnection *conn;
+    GError *error = NULL;
+    gchar *host, *port;
+
+    g_assert_false(with_tls);
+    g_object_get(channel, "spice-session", &session, NULL);
+    g_object_get(session, "host", &host, "port", &port, NULL);
+    g_object_unref(session);
+
+    client = g_socket_client_new();
+    conn = g_socket_client_connect_to_host(client, host, atoi(port), NULL, &error);
+    g_assert_no_error(error);
+    g_object_unref(client);
+
+    spice_channel_open_fd(channel,
+                          dup(g_socket_get_fd(g_socket_connection_get_socket(conn))));
+    g_object_unref(conn);
+    g_free(host);
+    g_free(port);
+}
+
+static void migration_started(SpiceMainChannel *main G_GNUC_UNUSED,
+                              SpiceSession *mig, Fixture *f)
+{
+    g_signal_connect(mig, "channel-new", G_CALLBACK(channel_new), f);
+}
+
+static void check_done(Fixture *f)
+{
+    if (f->migrations == 1 && f->from_destination)
+        g_main_loop_quit(f->loop);
+}
+
+static void migration_state(SpiceSession *session, GParamSpec *pspec G_GNUC_UNUSED,
+                            Fixture *f)
+{
+    SpiceSessionMigration state;
+
+    g_object_get(session, "migration-state", &state, NULL);
+    switch (state) {
+    case SPICE_SESSION_MIGRATION_MIGRATING:
+        f->migrating = TRUE;
+        break;
+    case SPICE_SESSION_MIGRATION_NONE:
+        if (!f->migrating)
+            break;
+        f->migrating = FALSE;
+        f->migrations++;
+        check_done(f);
+        break;
+    case SPICE_SESSION_MIGRATION_SWITCHING:
+        g_assert_not_reached();
+        break;
+    default:
+        break;
+    }
+}
+
+static void port_data(SpicePortChannel *port G_GNUC_UNUSED,
+                      gpointer data, gint size, Fixture *f)
+{
+    if ((gsize)size == strlen(f->source.name) &&
+        memcmp(data, f->source.name, size) == 0) {
+        g_assert_cmpuint(f->migrations, ==, 0);
+        f->start = g_get_monotonic_time();
+        server_migrate_begin(&f->source, &f->destination, f->seamless);
+    } else {
+        g_assert_cmpint(size, ==, strlen(f->destination.name));
+        g_assert_cmpint(memcmp(data, f->destination.name, size), ==, 0);
+        g_assert_false(f->from_destination);
+        f->blackout = g_get_monotonic_time() - f->start;
+        f->from_destination = TRUE;
+        check_done(f);
+    }
+}
+
+static void main_channel_event(SpiceChannel *channel, SpiceChannelEvent event, Fixture *f)
+{
+    SpiceSession *session = spice_channel_get_session(channel);
+
+    if (event != SPICE_CHANNEL_OPENED || f->port != NULL)
+        return;
+
+    f->port = SPICE_PORT_CHANNEL(spice_channel_new(session, SPICE_CHANNEL_PORT, 0));
+    g_signal_connect(f->port, "port-data", G_CALLBACK(port_data), f);
+    g_assert_true(spice_channel_connect(SPICE_CHANNEL(f->port)));
+}
+
+static void channel_new(SpiceSession *session, SpiceChannel *channel, Fixture *f)
+{
+    g_signal_connect(channel, "open-fd", G_CALLBACK(open_fd), f);
+
+    /* the channels of the migration session are swapped into the
+     * original ones, which keep their handlers */
+    if (session != f->session || !SPICE_IS_MAIN_CHANNEL(channel))
+        return;
+
+    g_signal_connect(channel, "migration-started", G_CALLBACK(migration_started), f);
+    g_signal_connect(channel, "channel-event", G_CALLBACK(main_channel_event), f);
+}
+
+static gboolean timeout_cb(gpointer user_data)
+{
+    g_assert_not_reached();
+    return G_SOURCE_REMOVE;
+}
+
+static void test_migration(gconstpointer user_data)
+{
+    Fixture f = { 0, };
+    gchar *port;
+    guint timeout;
+
+    f.seamless = GPOINTER_TO_UINT(user_data);
+    server_start(&f.source, "source", FALSE);
+    server_start(&f.destination, "destination", TRUE);
+    port = g_strdup_printf("%u", f.source.port);
+    f.loop = g_main_loop_new(NULL, FALSE);
+    f.session = spice_session_new();
+    g_object_set(f.session,
+                 "host", HOST,
+                 "port", port,
+                 "client-sockets", TRUE,
+                 NULL);
+    g_signal_connect(f.session, "channel-new", G_CALLBACK(channel_new), &f);
+    g_signal_connect(f.session, "notify::migration-state",
+                     G_CALLBACK(migration_state), &f);
+    timeout = g_timeout_add_seconds(30, timeout_cb, NULL);
+
+    g_assert_true(spice_session_open_fd(f.session, -1));
+    g_main_loop_run(f.loop);
+    g_test_message("%s migration: port channel blackout %" G_GINT64_FORMAT " us",
+                   f.seamless ? "seamless" : "semi-seamless", f.blackout);
+
+    spice_session_disconnect(f.session);
+    g_object_unref(f.session);
+    /* the server threads are done with the fixture */
+    while (g_atomic_int_get(&f.source.running) != 0 ||
+           g_atomic_int_get(&f.destination.running) != 0)
+        g_main_context_iteration(NULL, FALSE);
+    g_source_remove(timeout);
+    g_main_loop_unref(f.loop);
+    g_free(port);
+    server_stop(&f.source);
+    server_stop(&f.destination);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_data_func("/migration/semi-seamless", GUINT_TO_POINTER(FALSE), test_migration);
+    g_test_add_data_func("/migration/seamless", GUINT_TO_POINTER(TRUE), test_migration);
+
+    return g_test_run();
+}
@@ -0,0 +1,276 @@
+#include <gio/gio.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <spice/protocol.h>
+
+#include "spice-client.h"
+
+/* Bulk data through a port channel, both ways, against a stand-in for
+ * a spice server on a local socket. The data is a byte pattern of its
+ * position in the stream, however it is cut into messages. */
+#define CHUNK (64 * 1024)
+#define WINDOW 8 /* writes in flight */
+
+typedef struct _Server {
+    GSocketService *service;
+    guint16 port;
+    EVP_PKEY *ticket_key; /* the link reply key, for the spice ticket */
+    gsize total;
+    gint received; /* atomic, TRUE once the client data is all in */
+} Server;
+
+typedef struct _Client {
+    SpicePortChannel *port;
+    gsize total;
+    gsize read;
+    gsize written;
+    guint in_flight;
+    GMainLoop *loop;
+} Client;
+
+static guint8 pattern[CHUNK];
+
+static gboolean server_read(GInputStream *in, gpointer data, gsize size)
+{
+    gsize bytes_read;
+
+    return g_input_stream_read_all(in, data, size, &bytes_read, NULL, NULL) &&
+           bytes_read == size;
+}
+
+static gboolean server_write(GOutputStream *out, gconstpointer data, gsize size)
+{
+    return g_output_stream_write_all(out, data, size, NULL, NULL, NULL);
+}
+
+static gboolean server_link(Server *server, GInputStream *in, GOutputStream *out)
+{
+    SpiceLinkHeader header;
+    SpiceLinkReply reply = { 0, };
+    guint8 *mess, *der = reply.pub_key;
+    guint8 ticket[128];
+    guint32 result = GUINT32_TO_LE(SPICE_LINK_ERR_OK);
+    gboolean ok;
+
+    if (!server_read(in, &header, sizeof(header)))
+        return FALSE;
+    g_assert_cmpuint(header.magic, ==, SPICE_MAGIC);
+    mess = g_malloc(GUINT32_FROM_LE(header.size));
+    ok = server_read(in, mess, GUINT32_FROM_LE(header.size));
+    g_free(mess);
+    if (!ok)
+        return FALSE;
+
+    /* no common caps: full data headers, plain spice ticket */
+    header.magic = SPICE_MAGIC;
+    header.major_version = GUINT32_TO_LE(SPICE_VERSION_MAJOR);
+    header.minor_version = GUINT32_TO_LE(SPICE_VERSION_MINOR);
+    header.size = GUINT32_TO_LE(sizeof(reply));
+    reply.error = GUINT32_TO_LE(SPICE_LINK_ERR_OK);
+    g_assert_cmpint(i2d_PUBKEY(server->ticket_key, &der), ==, SPICE_TICKET_PUBKEY_BYTES);
+    reply.caps_offset = GUINT32_TO_LE(sizeof(reply));
+    if (!server_write(out, &header, sizeof(header)) ||
+        !server_write(out, &reply, sizeof(reply)) ||
+        !server_read(in, ticket, sizeof(ticket)))
+        return FALSE;
+
+    return server_write(out, &result, sizeof(result));
+}
+
+static gboolean server_send_data(Server *server, GOutputStream *out)
+{
+    SpiceDataHeader header = { 0, };
+    gsize pos;
+
+    header.type = GUINT16_TO_LE(SPICE_MSG_SPICEVMC_DATA);
+    header.size = GUINT32_TO_LE(CHUNK);
+    for (pos = 0; pos < server->total; pos += CHUNK) {
+        header.serial = GUINT64_TO_LE(GUINT64_FROM_LE(header.serial) + 1);
+        if (!server_write(out, &header, sizeof(header)) ||
+            !server_write(out, pattern, CHUNK))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean server_receive_data(Server *server, GInputStream *in)
+{
+    guint8 *data = g_malloc(CHUNK);
+    gsize pos = 0;
+    gboolean ok = TRUE;
+
+    while (ok && pos < server->total) {
+        SpiceDataHeader header;
+        gsize size, i;
+
+        if (!server_read(in, &header, sizeof(header))) {
+            ok = FALSE;
+            break;
+        }
+        size = GUINT32_FROM_LE(header.size);
+        g_assert_cmpuint(size, <=, CHUNK);
+        if (size > 0 && !server_read(in, data, size)) {
+            ok = FALSE;
+            break;
+        }
+        if (GUINT16_FROM_LE(header.type) != SPICE_MSGC_SPICEVMC_DATA)
+            continue;
+        for (i = 0; i < size; i++, pos++)
+            g_assert_cmpuint(data[i], ==, pos & 0xff);
+    }
+    g_free(data);
+
+    return ok;
+}
+
+static gboolean server_run(GThreadedSocketService *service G_GNUC_UNUSED,
+                           GSocketConnection *connection,
+                           GObject *source_object G_GNUC_UNUSED,
+                           gpointer user_data)
+{
+    Server *server = user_data;
+    GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+    GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    guint8 byte;
+
+    if (server_link(server, in, out) &&
+        server_send_data(server, out) &&
+        server_receive_data(server, in)) {
+        g_atomic_int_set(&server->received, TRUE);
+        /* until the client disconnects */
+        while (server_read(in, &byte, 1))
+            ;
+    }
+
+    return TRUE;
+}
+
+static void server_start(Server *server, gsize total)
+{
+    EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+    GError *error = NULL;
+
+    memset(server, 0, sizeof(*server));
+    server->total = total;
+    g_assert_cmpint(EVP_PKEY_keygen_init(kctx), ==, 1);
+    g_assert_cmpint(EVP_PKEY_CTX_set_rsa_keygen_bits(kctx, SPICE_TICKET_KEY_PAIR_LENGTH), ==, 1);
+    g_assert_cmpint(EVP_PKEY_keygen(kctx, &server->ticket_key), ==, 1);
+    EVP_PKEY_CTX_free(kctx);
+
+    server->service = g_threaded_socket_service_new(1);
+    server->port = g_socket_listener_add_any_inet_port(G_SOCKET_LISTENER(server->service),
+                                                       NULL, &error);
+    g_assert_no_error(error);
+    g_signal_connect(server->service, "run", G_CALLBACK(server_run), server);
+    g_socket_service_start(server->service);
+}
+
+static void server_stop(Server *server)
+{
+    g_socket_service_stop(server->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(server->service));
+    g_object_unref(server->service);
+    EVP_PKEY_free(server->ticket_key);
+}
+
+static void port_data(SpicePortChannel *port G_GNUC_UNUSED,
+                      gpointer data, gint size, Client *client)
+{
+    const guint8 *bytes = data;
+    gint i;
+
+    for (i = 0; i < size; i++, client->read++)
+        g_assert_cmpuint(bytes[i], ==, client->read & 0xff);
+    if (client->read == client->total)
+        g_main_loop_quit(client->loop);
+}
+
+static void client_write(Client *client);
+
+static void write_done(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    Client *client = user_data;
+    GError *error = NULL;
+
+    g_assert_cmpint(spice_port_write_finish(SPICE_PORT_CHANNEL(source_object), result, &error),
+                    ==, CHUNK);
+    g_assert_no_error(error);
+    client->in_flight--;
+    client_write(client);
+}
+
+static void client_write(Client *client)
+{
+    while (client->in_flight < WINDOW && client->written < client->total) {
+        spice_port_write_async(client->port, pattern, CHUNK, NULL, write_done, client);
+        client->written += CHUNK;
+        client->in_flight++;
+    }
+}
+
+static gboolean timeout_cb(gpointer user_data)
+{
+    g_assert_not_reached();
+    return G_SOURCE_REMOVE;
+}
+
+static void test_port_loopback(void)
+{
+    Server server;
+    Client client = { 0, };
+    SpiceSession *session;
+    gchar *port;
+    gsize i;
+    guint timeout;
+    gint64 start, elapsed;
+
+    for (i = 0; i < CHUNK; i++)
+        pattern[i] = i & 0xff;
+    client.total = g_test_perf() ? 1024 * CHUNK : 64 * CHUNK;
+    server_start(&server, client.total);
+    port = g_strdup_printf("%u", server.port);
+    session = spice_session_new();
+    g_object_set(session, "host", "127.0.0.1", "port", port, NULL);
+
+    client.loop = g_main_loop_new(NULL, FALSE);
+    client.port = SPICE_PORT_CHANNEL(spice_channel_new(session, SPICE_CHANNEL_PORT, 0));
+    g_signal_connect(client.port, "port-data", G_CALLBACK(port_data), &client);
+    timeout = g_timeout_add_seconds(60, timeout_cb, NULL);
+
+    /* from the server, the first data opens the port */
+    start = g_get_monotonic_time();
+    g_assert_true(spice_channel_connect(SPICE_CHANNEL(client.port)));
+    g_main_loop_run(client.loop);
+    elapsed = g_get_monotonic_time() - start;
+    g_test_message("port data from the server: %.0f MB/s",
+                   (gdouble)client.total / elapsed);
+
+    /* to the server */
+    start = g_get_monotonic_time();
+    client_write(&client);
+    while (!g_atomic_int_get(&server.received))
+        g_main_context_iteration(NULL, FALSE);
+    elapsed = g_get_monotonic_time() - start;
+    g_test_message("port writes to the server: %.0f MB/s",
+                   (gdouble)client.total / elapsed);
+    while (client.in_flight > 0)
+        g_main_context_iteration(NULL, TRUE);
+
+    g_source_remove(timeout);
+    spice_session_disconnect(session);
+    g_object_unref(session);
+    g_main_loop_unref(client.loop);
+    g_free(port);
+    server_stop(&server);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/port/loopback", test_port_loopback);
+
+    return g_test_run();
+}
@@ -0,0 +1,237 @@
+#include <gio/gio.h>
+#include <string.h>
+
+#include "spice-client.h"
+#include "spice-session-priv.h"
+#include "coroutine.h"
+
+/* stand-in for an HTTP proxy, answers CONNECT and keeps the tunnels
+ * open, without anything on the other end */
+typedef struct _Proxy {
+    GSocketService *service;
+    guint16 port;
+    GMutex lock;
+    guint connects;
+    GList *tunnels;
+} Proxy;
+
+typedef struct _OpenHost {
+    SpiceSession *session;
+    SpiceChannel *channel;
+    GSocketConnection *connection;
+    gint64 elapsed;
+} OpenHost;
+
+static gboolean proxy_run(GThreadedSocketService *service G_GNUC_UNUSED,
+                          GSocketConnection *connection,
+                          GObject *source_object G_GNUC_UNUSED,
+                          gpointer user_data)
+{
+    static const gchar reply[] = "HTTP/1.0 200 Connection established\r\n\r\n";
+    Proxy *proxy = user_data;
+    GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+    GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    gchar request[1024];
+    gsize len = 0;
+
+    while (g_strstr_len(request, len, "\r\n\r\n") == NULL) {
+        gssize ret;
+
+        g_assert_cmpuint(len, <, sizeof(request));
+        ret = g_input_stream_read(in, request + len, sizeof(request) - len, NULL, NULL);
+        if (ret <= 0)
+            return TRUE;
+        len += ret;
+    }
+    g_assert(g_str_has_prefix(request, "CONNECT spice.test:5900 "));
+
+    g_mutex_lock(&proxy->lock);
+    proxy->connects++;
+    proxy->tunnels = g_list_prepend(proxy->tunnels, g_object_ref(connection));
+    g_mutex_unlock(&proxy->lock);
+
+    g_output_stream_write_all(out, reply, strlen(reply), NULL, NULL, NULL);
+    return TRUE;
+}
+
+static guint proxy_get_connects(Proxy *proxy)
+{
+    guint connects;
+
+    g_mutex_lock(&proxy->lock);
+    connects = proxy->connects;
+    g_mutex_unlock(&proxy->lock);
+
+    return connects;
+}
+
+static void proxy_close_tunnels(Proxy *proxy)
+{
+    GList *it;
+
+    g_mutex_lock(&proxy->lock);
+    for (it = proxy->tunnels; it != NULL; it = it->next)
+        g_io_stream_close(it->data, NULL, NULL);
+    g_list_free_full(proxy->tunnels, g_object_unref);
+    proxy->tunnels = NULL;
+    g_mutex_unlock(&proxy->lock);
+}
+
+static void proxy_start(Proxy *proxy)
+{
+    GError *error = NULL;
+
+    memset(proxy, 0, sizeof(*proxy));
+    g_mutex_init(&proxy->lock);
+    proxy->service = g_threaded_socket_service_new(10);
+    proxy->port = g_socket_listener_add_any_inet_port(G_SOCKET_LISTENER(proxy->service),
+                                                      NULL, &error);
+    g_assert_no_error(error);
+    g_signal_connect(proxy->service, "run", G_CALLBACK(proxy_run), proxy);
+    g_socket_service_start(proxy->service);
+}
+
+static void proxy_stop(Proxy *proxy)
+{
+    g_socket_service_stop(proxy->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(proxy->service));
+    proxy_close_tunnels(proxy);
+    g_object_unref(proxy->service);
+    g_mutex_clear(&proxy->lock);
+}
+
+/* waits for the proxy to have answered @connects CONNECT in total, and
+ * for the pool of @session to hold @tunnels ready tunnels and nothing
+ * else. The client reads the last reply after the proxy counted it */
+static void wait_pool(Proxy *proxy, SpiceSession *session,
+                      guint connects, guint tunnels)
+{
+    guint ready;
+
+    while (proxy_get_connects(proxy) != connects ||
+           spice_session_count_proxy_tunnels(session, &ready) != tunnels ||
+           ready != tunnels)
+        g_main_context_iteration(NULL, TRUE);
+}
+
+static gboolean timeout_cb(gpointer user_data)
+{
+    g_assert_not_reached();
+    return G_SOURCE_REMOVE;
+}
+
+static gpointer open_host_entry(gpointer data)
+{
+    OpenHost *open_host = data;
+    gboolean use_tls = FALSE;
+    GError *error = NULL;
+    gint64 start = g_get_monotonic_time();
+
+    open_host->connection = spice_session_channel_open_host(open_host->session,
+                                                            open_host->channel,
+                                                            &use_tls, &error);
+    open_host->elapsed = g_get_monotonic_time() - start;
+    g_assert_no_error(error);
+
+    return NULL;
+}
+
+/* runs spice_session_channel_open_host() like a channel coroutine would */
+static GSocketConnection *open_host(SpiceSession *session, SpiceChannel *channel,
+                                    gint64 *elapsed)
+{
+    OpenHost data = { session, channel, NULL, 0 };
+    struct coroutine co = {
+        .stack_size = 16 << 20,
+        .entry = open_host_entry,
+    };
+
+    coroutine_init(&co);
+    coroutine_yieldto(&co, &data);
+    while (!co.exited)
+        g_main_context_iteration(NULL, TRUE);
+
+    *elapsed = data.elapsed;
+    return data.connection;
+}
+
+static void test_proxy_tunnels(void)
+{
+    Proxy proxy;
+    SpiceSession *session;
+    SpiceChannel *channel;
+    GSocketConnection *connection;
+    gchar *uri;
+    gint64 cold, warm;
+    guint timeout;
+
+    proxy_start(&proxy);
+    uri = g_strdup_printf("http://127.0.0.1:%u", proxy.port);
+    session = spice_session_new();
+    g_object_set(session, "host", "spice.test", "port", "5900", "proxy", uri, NULL);
+    channel = spice_channel_new(session, SPICE_CHANNEL_MAIN, 0);
+    timeout = g_timeout_add_seconds(10, timeout_cb, NULL);
+
+    /* the first channel resolves the proxy, then the pool is filled */
+    connection = open_host(session, channel, &cold);
+    g_assert_nonnull(connection);
+    g_object_unref(connection);
+    wait_pool(&proxy, session, 3, 2);
+
+    /* the next one gets a tunnel from the pool, then a replacement is opened */
+    connection = open_host(session, channel, &warm);
+    g_assert_nonnull(connection);
+    g_object_unref(connection);
+    wait_pool(&proxy, session, 4, 2);
+
+    g_test_message("channel connect through the proxy: %" G_GINT64_FORMAT " us cold, "
+                   "%" G_GINT64_FORMAT " us with a tunnel opened ahead", cold, warm);
+
+    /* tunnels closed by the proxy are replaced, once they lasted long
+     * enough (PROXY_TUNNEL_MIN_AGE) */
+    spice_session_age_proxy_tunnels(session, 1);
+    proxy_close_tunnels(&proxy);
+    wait_pool(&proxy, session, 6, 2);
+    connection = open_host(session, channel, &warm);
+    g_assert_nonnull(connection);
+    g_object_unref(connection);
+    wait_pool(&proxy, session, 7, 2);
+
+    /* tunnels closed right away are not, the next channel connects cold
+     * and fills the pool again */
+    proxy_close_tunnels(&proxy);
+    wait_pool(&proxy, session, 7, 0);
+    connection = open_host(session, channel, &warm);
+    g_assert_nonnull(connection);
+    g_object_unref(connection);
+    wait_pool(&proxy, session, 10, 2);
+
+    /* unused tunnels are replaced as they age out
+     * (PROXY_TUNNEL_MAX_AGE), PROXY_TUNNEL_MAX_EXPIRIES times in a row */
+    spice_session_age_proxy_tunnels(session, 30);
+    wait_pool(&proxy, session, 12, 2);
+    spice_session_age_proxy_tunnels(session, 30);
+    wait_pool(&proxy, session, 14, 2);
+    spice_session_age_proxy_tunnels(session, 30);
+    wait_pool(&proxy, session, 14, 0);
+
+    /* then the pool stays empty until a channel connects */
+    connection = open_host(session, channel, &warm);
+    g_assert_nonnull(connection);
+    g_object_unref(connection);
+    wait_pool(&proxy, session, 17, 2);
+
+    g_source_remove(timeout);
+    g_object_unref(session);
+    g_free(uri);
+    proxy_stop(&proxy);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/session/proxy-tunnels", test_proxy_tunnels);
+
+    return g_test_run();
+}
@@ -0,0 +1,426 @@
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <spice/protocol.h>
+#if defined(USE_SMARTCARD) && !defined(USE_SMARTCARD_012)
+#include <libcacard.h>
+#endif
+
+#include "spice-client.h"
+
+#if defined(USE_SMARTCARD) && !defined(USE_SMARTCARD_012)
+/* Virtual readers with a card each, attached through a smartcard channel
+ * to a stand-in for a spice server on a local socket. The channel sends
+ * the reader and card events one at a time, each waiting for the server
+ * answer, but answers the APDUs of the server right away. */
+#define READERS 4
+#define MESSAGES 200
+
+/* a card with a single applet, echoing the data of TEST_INS_ECHO */
+#define TEST_INS_ECHO 0x01
+static unsigned char test_aid[] = { 0xf0, 's', 'p', 'i', 'c', 'e' };
+
+typedef struct _Server {
+    GSocketService *service;
+    guint16 port;
+    EVP_PKEY *ticket_key; /* the link reply key, for the spice ticket */
+    guint64 serial;
+    guint32 next_reader_id;
+    gboolean has_card[READERS];
+    guint events; /* reader and card events from the client */
+    guint probes; /* APDUs answered while an event waited for the server */
+    gint64 elapsed; /* for the echo APDUs */
+    GMainLoop *loop;
+    gint done; /* atomic, TRUE once the server thread is done */
+} Server;
+
+/* a VSC message, from the client or to it */
+typedef struct _Message {
+    guint32 type;
+    guint32 reader_id;
+    guint32 length;
+    guint8 data[270];
+} Message;
+
+static gboolean server_read(GInputStream *in, gpointer data, gsize size)
+{
+    gsize bytes_read;
+
+    return g_input_stream_read_all(in, data, size, &bytes_read, NULL, NULL) &&
+           bytes_read == size;
+}
+
+static gboolean server_write(GOutputStream *out, gconstpointer data, gsize size)
+{
+    return g_output_stream_write_all(out, data, size, NULL, NULL, NULL);
+}
+
+static gboolean server_link(Server *server, GInputStream *in, GOutputStream *out)
+{
+    SpiceLinkHeader header;
+    SpiceLinkReply reply = { 0, };
+    guint8 *mess, *der = reply.pub_key;
+    guint8 ticket[128];
+    guint32 result = GUINT32_TO_LE(SPICE_LINK_ERR_OK);
+    gboolean ok;
+
+    if (!server_read(in, &header, sizeof(header)))
+        return FALSE;
+    g_assert_cmpuint(header.magic, ==, SPICE_MAGIC);
+    mess = g_malloc(GUINT32_FROM_LE(header.size));
+    ok = server_read(in, mess, GUINT32_FROM_LE(header.size));
+    g_free(mess);
+    if (!ok)
+        return FALSE;
+
+    /* no common caps: full data headers, plain spice ticket */
+    header.magic = SPICE_MAGIC;
+    header.major_version = GUINT32_TO_LE(SPICE_VERSION_MAJOR);
+    header.minor_version = GUINT32_TO_LE(SPICE_VERSION_MINOR);
+    header.size = GUINT32_TO_LE(sizeof(reply));
+    reply.error = GUINT32_TO_LE(SPICE_LINK_ERR_OK);
+    g_assert_cmpint(i2d_PUBKEY(server->ticket_key, &der), ==, SPICE_TICKET_PUBKEY_BYTES);
+    reply.caps_offset = GUINT32_TO_LE(sizeof(reply));
+    if (!server_write(out, &header, sizeof(header)) ||
+        !server_write(out, &reply, sizeof(reply)) ||
+        !server_read(in, ticket, sizeof(ticket)))
+        return FALSE;
+
+    return server_write(out, &result, sizeof(result));
+}
+
+static gboolean server_send(Server *server, GOutputStream *out, guint32 type,
+                            guint32 reader_id, gconstpointer data, gsize size)
+{
+    SpiceDataHeader header = { 0, };
+    VSCMsgHeader vsc;
+
+    header.serial = GUINT64_TO_LE(++server->serial);
+    header.type = GUINT16_TO_LE(SPICE_MSG_SMARTCARD_DATA);
+    header.size = GUINT32_TO_LE(sizeof(vsc) + size);
+    vsc.type = GUINT32_TO_LE(type);
+    vsc.reader_id = GUINT32_TO_LE(reader_id);
+    vsc.length = GUINT32_TO_LE(size);
+
+    return server_write(out, &header, sizeof(header)) &&
+           server_write(out, &vsc, sizeof(vsc)) &&
+           (size == 0 || server_write(out, data, size));
+}
+
+/* the next smartcard message of the client */
+static gboolean server_receive(GInputStream *in, Message *message)
+{
+    for (;;) {
+        SpiceDataHeader header;
+        VSCMsgHeader vsc;
+        gsize size;
+
+        if (!server_read(in, &header, sizeof(header)))
+            return FALSE;
+        size = GUINT32_FROM_LE(header.size);
+        if (GUINT16_FROM_LE(header.type) != SPICE_MSGC_SMARTCARD_DATA) {
+            guint8 *data = g_malloc(size);
+            gboolean ok = server_read(in, data, size);
+
+            g_free(data);
+            if (!ok)
+                return FALSE;
+            continue;
+        }
+
+        g_assert_cmpuint(size, >=, sizeof(vsc));
+        if (!server_read(in, &vsc, sizeof(vsc)))
+            return FALSE;
+        message->type = GUINT32_FROM_LE(vsc.type);
+        message->reader_id = GUINT32_FROM_LE(vsc.reader_id);
+        message->length = GUINT32_FROM_LE(vsc.length);
+        g_assert_cmpuint(message->length, ==, size - sizeof(vsc));
+        g_assert_cmpuint(message->length, <=, sizeof(message->data));
+
+        return server_read(in, message->data, message->length);
+    }
+}
+
+static gboolean server_send_apdu(Server *server, GOutputStream *out, guint32 reader_id,
+                                 guint8 ins, guint8 p1, const guint8 *data, gsize size)
+{
+    guint8 apdu[5 + 255 + 1] = { 0x00, ins, p1, 0x00, size, };
+
+    g_assert_cmpuint(size, <=, 255);
+    memcpy(apdu + 5, data, size);
+    apdu[5 + size] = 0x00; /* Le */
+
+    return server_send(server, out, VSC_APDU, reader_id, apdu, 5 + size + 1);
+}
+
+/* the answer of the card in @reader_id to the APDU sent last, returns
+ * its status word, or 0 if the connection is gone */
+static guint16 server_receive_apdu(GInputStream *in, guint32 reader_id, Message *answer)
+{
+    if (!server_receive(in, answer))
+        return 0;
+    g_assert_cmpuint(answer->type, ==, VSC_APDU);
+    g_assert_cmpuint(answer->reader_id, ==, reader_id);
+    g_assert_cmpuint(answer->length, >=, 2);
+    answer->length -= 2;
+
+    return answer->data[answer->length] << 8 | answer->data[answer->length + 1];
+}
+
+/* a SELECT of the test applet */
+static gboolean server_select(Server *server, GInputStream *in, GOutputStream *out,
+                              guint32 reader_id)
+{
+    Message answer;
+    guint16 sw;
+
+    if (!server_send_apdu(server, out, reader_id, 0xa4, 0x04, test_aid, sizeof(test_aid)))
+        return FALSE;
+    sw = server_receive_apdu(in, reader_id, &answer);
+    if (sw == 0)
+        return FALSE;
+    g_assert_true(sw == 0x9000 || sw >> 8 == 0x61);
+
+    return TRUE;
+}
+
+/* answers the reader additions and the card insertions of the client,
+ * until all the readers have their card */
+static gboolean server_attach(Server *server, GInputStream *in, GOutputStream *out)
+{
+    while (server->events < 2 * READERS) {
+        Message message;
+        guint32 reader_id = 0, r;
+        guint32 code = GUINT32_TO_LE(VSC_SUCCESS);
+
+        if (!server_receive(in, &message))
+            return FALSE;
+        server->events++;
+        switch (message.type) {
+        case VSC_ReaderAdd:
+            g_assert_cmpuint(message.reader_id, ==, VSCARD_UNDEFINED_READER_ID);
+            g_assert_cmpuint(server->next_reader_id, <, READERS);
+            reader_id = server->next_reader_id++;
+            break;
+        case VSC_ATR:
+            g_assert_cmpuint(message.reader_id, <, server->next_reader_id);
+            reader_id = message.reader_id;
+            break;
+        default:
+            g_assert_not_reached();
+        }
+
+        /* while the event waits for its answer, nothing else is queued
+         * behind it, but a card still answers right away */
+        for (r = 0; r < READERS; r++) {
+            if (!server->has_card[r])
+                continue;
+            if (!server_select(server, in, out, r))
+                return FALSE;
+            server->probes++;
+            break;
+        }
+
+        if (!server_send(server, out, VSC_Error, reader_id, &code, sizeof(code)))
+            return FALSE;
+        if (message.type == VSC_ATR)
+            server->has_card[reader_id] = TRUE;
+    }
+
+    return TRUE;
+}
+
+/* MESSAGES echo APDUs to each card, with one in flight per card */
+static gboolean server_echo(Server *server, GInputStream *in, GOutputStream *out)
+{
+    gint64 start;
+    guint i, r;
+
+    for (r = 0; r < READERS; r++) {
+        if (!server_select(server, in, out, r))
+            return FALSE;
+    }
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < MESSAGES; i++) {
+        for (r = 0; r < READERS; r++) {
+            guint8 data[2] = { r, i };
+
+            if (!server_send_apdu(server, out, r, TEST_INS_ECHO, 0x00, data, sizeof(data)))
+                return FALSE;
+        }
+        for (r = 0; r < READERS; r++) {
+            guint8 data[2] = { r, i };
+            Message answer;
+
+            g_assert_cmphex(server_receive_apdu(in, r, &answer), ==, 0x9000);
+            g_assert_cmpuint(answer.length, ==, sizeof(data));
+            g_assert_cmpint(memcmp(answer.data, data, sizeof(data)), ==, 0);
+        }
+    }
+    server->elapsed = g_get_monotonic_time() - start;
+
+    return TRUE;
+}
+
+static gboolean server_finished(gpointer user_data)
+{
+    Server *server = user_data;
+
+    g_main_loop_quit(server->loop);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean server_run(GThreadedSocketService *service G_GNUC_UNUSED,
+                           GSocketConnection *connection,
+                           GObject *source_object G_GNUC_UNUSED,
+                           gpointer user_data)
+{
+    Server *server = user_data;
+    GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+    GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    guint8 byte;
+
+    if (server_link(server, in, out) &&
+        server_attach(server, in, out) &&
+        server_echo(server, in, out)) {
+        g_idle_add(server_finished, server);
+        /* until the client disconnects */
+        while (server_read(in, &byte, 1))
+            ;
+    }
+    g_atomic_int_set(&server->done, TRUE);
+
+    return TRUE;
+}
+
+static void server_start(Server *server)
+{
+    EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+    GError *error = NULL;
+
+    memset(server, 0, sizeof(*server));
+    g_assert_cmpint(EVP_PKEY_keygen_init(kctx), ==, 1);
+    g_assert_cmpint(EVP_PKEY_CTX_set_rsa_keygen_bits(kctx, SPICE_TICKET_KEY_PAIR_LENGTH), ==, 1);
+    g_assert_cmpint(EVP_PKEY_keygen(kctx, &server->ticket_key), ==, 1);
+    EVP_PKEY_CTX_free(kctx);
+    server->loop = g_main_loop_new(NULL, FALSE);
+
+    server->service = g_threaded_socket_service_new(1);
+    server->port = g_socket_listener_add_any_inet_port(G_SOCKET_LISTENER(server->service),
+                                                       NULL, &error);
+    g_assert_no_error(error);
+    g_signal_connect(server->service, "run", G_CALLBACK(server_run), server);
+    g_socket_service_start(server->service);
+}
+
+static void server_stop(Server *server)
+{
+    g_socket_service_stop(server->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(server->service));
+    g_object_unref(server->service);
+    g_main_loop_unref(server->loop);
+    EVP_PKEY_free(server->ticket_key);
+}
+
+static VCardStatus test_applet_process_apdu(VCard *card, VCardAPDU *apdu,
+                                            VCardResponse **response)
+{
+    if (apdu->a_ins != TEST_INS_ECHO)
+        return VCARD_NEXT;
+
+    *response = vcard_response_new(card, apdu->a_body, apdu->a_Lc, apdu->a_Le,
+                                   VCARD7816_STATUS_SUCCESS);
+    return VCARD_DONE;
+}
+
+static VCardStatus test_applet_reset(VCard *card G_GNUC_UNUSED, int channel G_GNUC_UNUSED)
+{
+    return VCARD_DONE;
+}
+
+static VReader *test_reader_new(guint r)
+{
+    gchar *name = g_strdup_printf("test reader %u", r);
+    VReader *reader = vreader_new(name, NULL, NULL);
+    VCard *card = vcard_new(NULL, NULL);
+
+    vcard_add_applet(card, vcard_new_applet(test_applet_process_apdu, test_applet_reset,
+                                            test_aid, sizeof(test_aid)));
+    g_assert_cmpint(vreader_insert_card(reader, card), ==, VREADER_OK);
+    vcard_free(card);
+    g_free(name);
+
+    return reader;
+}
+
+static gboolean timeout_cb(gpointer user_data)
+{
+    g_assert_not_reached();
+    return G_SOURCE_REMOVE;
+}
+
+static void test_smartcard_channel(void)
+{
+    Server server;
+    SpiceSession *session;
+    SpiceChannel *channel;
+    VReader *readers[READERS];
+    VEvent *event;
+    gchar *port;
+    guint timeout, r;
+
+    /* no hardware and no software card, the initialization of the
+     * channel then finds libcacard ready */
+    vcard_emul_init(vcard_emul_options("use_hw=no"));
+    for (r = 0; r < READERS; r++) {
+        readers[r] = test_reader_new(r);
+        g_assert_cmpint(vreader_add_reader(readers[r]), ==, VREADER_OK);
+    }
+    /* the channel lists the readers once it is up, their events would
+     * only repeat the card insertions */
+    while ((event = vevent_get_next_vevent()) != NULL)
+        vevent_delete(event);
+
+    server_start(&server);
+    port = g_strdup_printf("%u", server.port);
+    session = spice_session_new();
+    g_object_set(session, "host", "127.0.0.1", "port", port, NULL);
+    g_free(port);
+    channel = spice_channel_new(session, SPICE_CHANNEL_SMARTCARD, 0);
+    timeout = g_timeout_add_seconds(30, timeout_cb, NULL);
+
+    g_assert_true(spice_channel_connect(channel));
+    g_main_loop_run(server.loop);
+
+    g_assert_cmpuint(server.events, ==, 2 * READERS);
+    g_assert_cmpuint(server.probes, >, 0);
+    g_test_message("%u APDUs on %u readers through the channel: %.0f/s",
+                   READERS * MESSAGES, READERS,
+                   READERS * MESSAGES * (double)G_USEC_PER_SEC / server.elapsed);
+
+    spice_session_disconnect(session);
+    g_object_unref(session);
+    /* the server thread is done with @server */
+    while (!g_atomic_int_get(&server.done))
+        g_main_context_iteration(NULL, FALSE);
+    g_source_remove(timeout);
+    server_stop(&server);
+    for (r = 0; r < READERS; r++)
+        vreader_free(readers[r]);
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+#if defined(USE_SMARTCARD) && !defined(USE_SMARTCARD_012)
+    g_test_add_func("/smartcard/channel", test_smartcard_channel);
+#endif
+
+    return g_test_run();
+}
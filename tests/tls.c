@@ -0,0 +1,259 @@
+#include <gio/gio.h>
+#include <string.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <spice/protocol.h>
+
+#include "spice-client.h"
+#include "spice-channel-priv.h"
+
+/* stand-in for a spice server TLS port: completes the TLS handshake and
+ * the link, then waits for the client to go away */
+typedef struct _Server {
+    GSocketService *service;
+    guint16 port;
+    SSL_CTX *ctx;
+    EVP_PKEY *ticket_key; /* the link reply key, for the spice ticket */
+    GByteArray *pubkey;   /* of the certificate, for the client to check */
+} Server;
+
+typedef struct _Client {
+    GMainLoop *loop;
+    gboolean opened;
+    gboolean resumed;
+    gboolean offload;
+} Client;
+
+static EVP_PKEY *key_new(int type, int bits_or_curve)
+{
+    EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(type, NULL);
+    EVP_PKEY *key = NULL;
+
+    g_assert_nonnull(kctx);
+    g_assert_cmpint(EVP_PKEY_keygen_init(kctx), ==, 1);
+    if (type == EVP_PKEY_RSA)
+        g_assert_cmpint(EVP_PKEY_CTX_set_rsa_keygen_bits(kctx, bits_or_curve), ==, 1);
+    else
+        g_assert_cmpint(EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, bits_or_curve), ==, 1);
+    g_assert_cmpint(EVP_PKEY_keygen(kctx, &key), ==, 1);
+    EVP_PKEY_CTX_free(kctx);
+
+    return key;
+}
+
+static X509 *certificate_new(EVP_PKEY *key)
+{
+    X509 *cert = X509_new();
+    X509_NAME *name;
+
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_get_notBefore(cert), 0);
+    X509_gmtime_adj(X509_get_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (guchar *)"127.0.0.1", -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    g_assert_cmpint(X509_sign(cert, key, EVP_sha256()), >, 0);
+
+    return cert;
+}
+
+static gboolean server_read(SSL *ssl, gpointer data, gsize size)
+{
+    guint8 *p = data;
+
+    while (size > 0) {
+        int ret = SSL_read(ssl, p, size);
+
+        if (ret <= 0)
+            return FALSE;
+        p += ret;
+        size -= ret;
+    }
+    return TRUE;
+}
+
+static gboolean server_link(Server *server, SSL *ssl)
+{
+    SpiceLinkHeader header;
+    SpiceLinkReply reply = { 0, };
+    guint8 *mess, *der = reply.pub_key;
+    guint8 ticket[128];
+    guint32 result = GUINT32_TO_LE(SPICE_LINK_ERR_OK);
+    gboolean ok;
+
+    if (!server_read(ssl, &header, sizeof(header)))
+        return FALSE;
+    g_assert_cmpuint(header.magic, ==, SPICE_MAGIC);
+    mess = g_malloc(GUINT32_FROM_LE(header.size));
+    ok = server_read(ssl, mess, GUINT32_FROM_LE(header.size));
+    g_free(mess);
+    if (!ok)
+        return FALSE;
+
+    /* no common caps: the client sends a plain spice ticket */
+    header.magic = SPICE_MAGIC;
+    header.major_version = GUINT32_TO_LE(SPICE_VERSION_MAJOR);
+    header.minor_version = GUINT32_TO_LE(SPICE_VERSION_MINOR);
+    header.size = GUINT32_TO_LE(sizeof(reply));
+    reply.error = GUINT32_TO_LE(SPICE_LINK_ERR_OK);
+    g_assert_cmpint(i2d_PUBKEY(server->ticket_key, &der), ==, SPICE_TICKET_PUBKEY_BYTES);
+    reply.caps_offset = GUINT32_TO_LE(sizeof(reply));
+    if (SSL_write(ssl, &header, sizeof(header)) != sizeof(header) ||
+        SSL_write(ssl, &reply, sizeof(reply)) != sizeof(reply))
+        return FALSE;
+
+    if (!server_read(ssl, ticket, sizeof(ticket)))
+        return FALSE;
+
+    return SSL_write(ssl, &result, sizeof(result)) == sizeof(result);
+}
+
+static gboolean server_run(GThreadedSocketService *service G_GNUC_UNUSED,
+                           GSocketConnection *connection,
+                           GObject *source_object G_GNUC_UNUSED,
+                           gpointer user_data)
+{
+    Server *server = user_data;
+    GSocket *socket = g_socket_connection_get_socket(connection);
+    SSL *ssl = SSL_new(server->ctx);
+    guint8 byte;
+
+    g_socket_set_blocking(socket, TRUE);
+    SSL_set_fd(ssl, g_socket_get_fd(socket));
+    if (SSL_accept(ssl) == 1 && server_link(server, ssl)) {
+        /* until the client disconnects */
+        while (SSL_read(ssl, &byte, 1) > 0)
+            ;
+    }
+    SSL_free(ssl);
+
+    return TRUE;
+}
+
+static void server_start(Server *server)
+{
+    EVP_PKEY *key;
+    X509 *cert;
+    guint8 *der;
+    int len;
+    GError *error = NULL;
+
+    memset(server, 0, sizeof(*server));
+    key = key_new(EVP_PKEY_EC, NID_X9_62_prime256v1);
+    cert = certificate_new(key);
+    server->ticket_key = key_new(EVP_PKEY_RSA, SPICE_TICKET_KEY_PAIR_LENGTH);
+
+    server->ctx = SSL_CTX_new(SSLv23_server_method());
+    g_assert_nonnull(server->ctx);
+    g_assert_cmpint(SSL_CTX_use_certificate(server->ctx, cert), ==, 1);
+    g_assert_cmpint(SSL_CTX_use_PrivateKey(server->ctx, key), ==, 1);
+    SSL_CTX_set_session_id_context(server->ctx, (guchar *)"spice", 5);
+
+    len = i2d_PUBKEY(key, NULL);
+    server->pubkey = g_byte_array_sized_new(len);
+    g_byte_array_set_size(server->pubkey, len);
+    der = server->pubkey->data;
+    i2d_PUBKEY(key, &der);
+    X509_free(cert);
+    EVP_PKEY_free(key);
+
+    server->service = g_threaded_socket_service_new(10);
+    server->port = g_socket_listener_add_any_inet_port(G_SOCKET_LISTENER(server->service),
+                                                       NULL, &error);
+    g_assert_no_error(error);
+    g_signal_connect(server->service, "run", G_CALLBACK(server_run), server);
+    g_socket_service_start(server->service);
+}
+
+static void server_stop(Server *server)
+{
+    g_socket_service_stop(server->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(server->service));
+    g_object_unref(server->service);
+    SSL_CTX_free(server->ctx);
+    EVP_PKEY_free(server->ticket_key);
+    g_byte_array_unref(server->pubkey);
+}
+
+static void channel_event(SpiceChannel *channel, SpiceChannelEvent event, Client *client)
+{
+    g_assert_cmpint(event, ==, SPICE_CHANNEL_OPENED);
+
+    client->opened = TRUE;
+    spice_channel_get_tls_handshake_time(channel, &client->resumed);
+    g_object_get(channel, "tls-offload", &client->offload, NULL);
+    g_main_loop_quit(client->loop);
+}
+
+static gboolean timeout_cb(gpointer user_data)
+{
+    g_assert_not_reached();
+    return G_SOURCE_REMOVE;
+}
+
+/* links a channel over TLS, returns whether its session was resumed */
+static gboolean channel_link(SpiceSession *session, gint id, gboolean *offload)
+{
+    Client client = { 0, };
+    SpiceChannel *channel;
+    guint timeout;
+
+    client.loop = g_main_loop_new(NULL, FALSE);
+    channel = spice_channel_new(session, SPICE_CHANNEL_CURSOR, id);
+    g_signal_connect(channel, "channel-event", G_CALLBACK(channel_event), &client);
+    timeout = g_timeout_add_seconds(10, timeout_cb, NULL);
+
+    g_assert_true(spice_channel_connect(channel));
+    g_main_loop_run(client.loop);
+    g_assert_true(client.opened);
+
+    g_source_remove(timeout);
+    g_signal_handlers_disconnect_by_func(channel, channel_event, &client);
+    spice_channel_disconnect(channel, SPICE_CHANNEL_NONE);
+    g_main_loop_unref(client.loop);
+
+    if (offload != NULL)
+        *offload = client.offload;
+    return client.resumed;
+}
+
+static void test_tls_resume(void)
+{
+    Server server;
+    SpiceSession *session;
+    gchar *port;
+    gboolean offload;
+
+    server_start(&server);
+    port = g_strdup_printf("%u", server.port);
+    session = spice_session_new();
+    g_object_set(session,
+                 "host", "127.0.0.1",
+                 "tls-port", port,
+                 "pubkey", server.pubkey,
+                 "verify", SPICE_SESSION_VERIFY_PUBKEY,
+                 NULL);
+
+    /* the first channel does a full handshake, the next ones resume
+     * the session it negotiated */
+    g_assert_false(channel_link(session, 0, &offload));
+    g_assert_true(channel_link(session, 1, NULL));
+    g_assert_true(channel_link(session, 2, NULL));
+    g_test_message("kernel TLS offload %s", offload ? "on" : "off");
+
+    spice_session_disconnect(session);
+    g_object_unref(session);
+    g_free(port);
+    server_stop(&server);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/tls/resume", test_tls_resume);
+
+    return g_test_run();
+}
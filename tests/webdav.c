@@ -0,0 +1,185 @@
+#include <glib.h>
+#include <string.h>
+
+#include "channel-webdav-priv.h"
+
+/* frames of the webdav mux, as the guest interleaves its clients */
+static const struct {
+    gint64 client;
+    guint16 size;
+} frames[] = {
+    { 1, 5 },
+    { 2, 0 },   /* end of a client */
+    { 1, 300 },
+    { -1, 1 },
+    { 3, 1000 },
+    { 1, 0 },
+    { G_MAXINT64, 17 },
+};
+
+typedef struct _Fixture {
+    SpiceWebdavDemux *demux;
+    GByteArray *stream;
+    /* what the demuxer reported */
+    GString *log;
+    GHashTable *payloads; /* client -> GByteArray */
+    const guint8 *data;
+    gsize size;
+} Fixture;
+
+static guint8 payload_byte(guint frame, gsize pos)
+{
+    return (frame * 7 + pos) & 0xff;
+}
+
+static void demux_frame(gint64 client, guint16 size, gpointer user_data)
+{
+    Fixture *f = user_data;
+
+    g_string_append_printf(f->log, "%" G_GINT64_FORMAT ":%u;", client, size);
+}
+
+static void demux_payload(gint64 client, GBytes *payload, gpointer user_data)
+{
+    Fixture *f = user_data;
+    GByteArray *array = g_hash_table_lookup(f->payloads, &client);
+    gsize size;
+    const guint8 *data = g_bytes_get_data(payload, &size);
+
+    /* a slice of the data fed in, not a copy */
+    g_assert_cmpuint(size, >, 0);
+    g_assert_true(data >= f->data && data + size <= f->data + f->size);
+
+    if (array == NULL) {
+        gint64 *key = g_new(gint64, 1);
+
+        *key = client;
+        array = g_byte_array_new();
+        g_hash_table_insert(f->payloads, key, array);
+    }
+    g_byte_array_append(array, data, size);
+}
+
+static void f_setup(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    guint i;
+    gsize pos;
+
+    f->demux = spice_webdav_demux_new(demux_frame, demux_payload, f);
+    f->log = g_string_new(NULL);
+    f->payloads = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free,
+                                        (GDestroyNotify)g_byte_array_unref);
+
+    f->stream = g_byte_array_new();
+    for (i = 0; i < G_N_ELEMENTS(frames); i++) {
+        gint64 client = GINT64_TO_LE(frames[i].client);
+        guint16 size = GUINT16_TO_LE(frames[i].size);
+
+        g_byte_array_append(f->stream, (guint8 *)&client, sizeof(client));
+        g_byte_array_append(f->stream, (guint8 *)&size, sizeof(size));
+        for (pos = 0; pos < frames[i].size; pos++) {
+            guint8 byte = payload_byte(i, pos);
+
+            g_byte_array_append(f->stream, &byte, 1);
+        }
+    }
+    g_assert_cmpuint(f->stream->len, >, MUX_HEADER_SIZE);
+}
+
+static void f_teardown(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    spice_webdav_demux_free(f->demux);
+    g_string_free(f->log, TRUE);
+    g_hash_table_unref(f->payloads);
+    g_byte_array_unref(f->stream);
+}
+
+static void feed(Fixture *f, gsize offset, gsize size)
+{
+    GBytes *bytes = g_bytes_new_static(f->stream->data + offset, size);
+
+    f->data = f->stream->data + offset;
+    f->size = size;
+    spice_webdav_demux_data(f->demux, bytes);
+    g_bytes_unref(bytes);
+}
+
+/* checks what the demuxer reported against the frames, and clears it */
+static void check_frames(Fixture *f)
+{
+    GString *log = g_string_new(NULL);
+    GHashTableIter iter;
+    gpointer key, value;
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(frames); i++)
+        g_string_append_printf(log, "%" G_GINT64_FORMAT ":%u;", frames[i].client, frames[i].size);
+    g_assert_cmpstr(f->log->str, ==, log->str);
+    g_string_free(log, TRUE);
+    g_string_truncate(f->log, 0);
+
+    /* the payloads of each client, in order */
+    g_hash_table_iter_init(&iter, f->payloads);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        GByteArray *array = value;
+        gsize pos = 0, j;
+
+        for (i = 0; i < G_N_ELEMENTS(frames); i++) {
+            if (frames[i].client != *(gint64 *)key)
+                continue;
+            for (j = 0; j < frames[i].size; j++, pos++) {
+                g_assert_cmpuint(pos, <, array->len);
+                g_assert_cmpuint(array->data[pos], ==, payload_byte(i, j));
+            }
+        }
+        g_assert_cmpuint(pos, ==, array->len);
+    }
+    g_hash_table_remove_all(f->payloads);
+}
+
+static void test_webdav_demux_split(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    gsize split;
+
+    /* in two messages, cut anywhere in a header or a payload */
+    for (split = 0; split <= f->stream->len; split++) {
+        feed(f, 0, split);
+        feed(f, split, f->stream->len - split);
+        check_frames(f);
+    }
+}
+
+static void test_webdav_demux_bytes(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    gsize pos;
+
+    for (pos = 0; pos < f->stream->len; pos++)
+        feed(f, pos, 1);
+    check_frames(f);
+}
+
+static void test_webdav_demux_reset(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    /* a port closed in the middle of a header, the next frames are
+     * parsed from their start */
+    feed(f, 0, MUX_HEADER_SIZE - 1);
+    spice_webdav_demux_reset(f->demux);
+    g_assert_cmpuint(f->log->len, ==, 0);
+
+    feed(f, 0, f->stream->len);
+    check_frames(f);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/webdav/demux/split", Fixture, NULL,
+               f_setup, test_webdav_demux_split, f_teardown);
+    g_test_add("/webdav/demux/bytes", Fixture, NULL,
+               f_setup, test_webdav_demux_bytes, f_teardown);
+    g_test_add("/webdav/demux/reset", Fixture, NULL,
+               f_setup, test_webdav_demux_reset, f_teardown);
+
+    return g_test_run();
+}
@@ -0,0 +1,152 @@
+#include <glib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "decode.h"
+
+/* ZLIB_GLZ_RGB images carry a GLZ stream deflated once more, stand-ins
+ * for those: literal runs with back references of various lengths */
+typedef struct _Image {
+    const gchar *name;
+    gsize size;
+    guint literal_percent;
+} Image;
+
+static const Image corpus[] = {
+    { "widget", 4 * 1024, 60 },
+    { "text", 64 * 1024, 30 },
+    { "window", 1024 * 1024, 20 },
+    { "photo", 2 * 1024 * 1024, 80 },
+};
+
+#define BENCH_ROUNDS 20
+
+typedef struct _Compressed {
+    guint8 *raw;
+    gsize raw_size;
+    guint8 *data;
+    gsize size;
+} Compressed;
+
+static guint8 *glz_stream(const Image *image)
+{
+    guint8 *glz = g_malloc(image->size);
+    GRand *rand = g_rand_new_with_seed(image->size);
+    gsize pos = 0;
+
+    while (pos < image->size) {
+        gsize len = MIN((gsize)g_rand_int_range(rand, 4, 64), image->size - pos);
+
+        if (pos < 256 || (guint)g_rand_int_range(rand, 0, 100) < image->literal_percent) {
+            gsize i;
+
+            for (i = 0; i < len; i++)
+                glz[pos + i] = g_rand_int_range(rand, 0, 256);
+        } else {
+            memmove(glz + pos, glz + pos - g_rand_int_range(rand, 1, MIN(pos, 4096)), len);
+        }
+        pos += len;
+    }
+    g_rand_free(rand);
+
+    return glz;
+}
+
+static void compress_image(const Image *image, Compressed *compressed)
+{
+    uLongf size = compressBound(image->size);
+
+    compressed->raw = glz_stream(image);
+    compressed->raw_size = image->size;
+    compressed->data = g_malloc(size);
+    g_assert_cmpint(compress2(compressed->data, &size, compressed->raw, image->size,
+                              Z_DEFAULT_COMPRESSION), ==, Z_OK);
+    compressed->size = size;
+}
+
+static void compressed_clear(Compressed *compressed)
+{
+    g_free(compressed->raw);
+    g_free(compressed->data);
+}
+
+static void test_zlib_decode(void)
+{
+    SpiceZlibDecoder *decoder = zlib_decoder_new();
+    guint i;
+
+    g_assert_nonnull(decoder);
+    for (i = 0; i < G_N_ELEMENTS(corpus); i++) {
+        Compressed compressed;
+        guint8 *dest;
+
+        compress_image(&corpus[i], &compressed);
+        dest = g_malloc0(compressed.raw_size);
+        decoder->ops->decode(decoder, compressed.data, compressed.size,
+                             dest, compressed.raw_size);
+        g_assert(memcmp(dest, compressed.raw, compressed.raw_size) == 0);
+
+        g_free(dest);
+        compressed_clear(&compressed);
+    }
+    zlib_decoder_destroy(decoder);
+}
+
+static void test_zlib_decode_bench(void)
+{
+    Compressed compressed[G_N_ELEMENTS(corpus)];
+    SpiceZlibDecoder *decoder;
+    gint64 start, decoder_time, inflate_time;
+    gsize bytes = 0, max_size = 0;
+    guint i, round;
+    guint8 *dest;
+
+    if (!g_test_perf())
+        return;
+
+    decoder = zlib_decoder_new();
+    for (i = 0; i < G_N_ELEMENTS(corpus); i++) {
+        compress_image(&corpus[i], &compressed[i]);
+        bytes += compressed[i].raw_size;
+        max_size = MAX(max_size, compressed[i].raw_size);
+    }
+    dest = g_malloc(max_size);
+
+    start = g_get_monotonic_time();
+    for (round = 0; round < BENCH_ROUNDS; round++)
+        for (i = 0; i < G_N_ELEMENTS(corpus); i++)
+            decoder->ops->decode(decoder, compressed[i].data, compressed[i].size,
+                                 dest, compressed[i].raw_size);
+    decoder_time = g_get_monotonic_time() - start;
+
+    /* what the decoder does without a faster backend */
+    start = g_get_monotonic_time();
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        for (i = 0; i < G_N_ELEMENTS(corpus); i++) {
+            uLongf size = compressed[i].raw_size;
+
+            g_assert_cmpint(uncompress(dest, &size, compressed[i].data, compressed[i].size),
+                            ==, Z_OK);
+        }
+    }
+    inflate_time = g_get_monotonic_time() - start;
+
+    g_test_message("corpus inflate: decoder %.0f MB/s, stock zlib %.0f MB/s",
+                   (gdouble)bytes * BENCH_ROUNDS / decoder_time,
+                   (gdouble)bytes * BENCH_ROUNDS / inflate_time);
+
+    g_free(dest);
+    for (i = 0; i < G_N_ELEMENTS(corpus); i++)
+        compressed_clear(&compressed[i]);
+    zlib_decoder_destroy(decoder);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/zlib/decode", test_zlib_decode);
+    g_test_add_func("/zlib/decode/bench", test_zlib_decode_bench);
+
+    return g_test_run();
+}
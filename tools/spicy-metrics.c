@@ -0,0 +1,496 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include <gio/gunixsocketaddress.h>
+
+#include "spicy-metrics.h"
+
+/*
+ * Serves the counters of the sessions in the Prometheus text format on a
+ * unix socket. Each connection gets one HTTP/1.0 answer, e.g.:
+ *
+ *   curl --unix-socket /run/spicy.sock http://localhost/metrics
+ */
+
+/* the request is read, but not parsed */
+#define REQUEST_SIZE 4096
+/* see SpiceUsbredirChannel:queue-delay-histogram */
+#define QUEUE_DELAY_BUCKETS 16
+
+struct _SpicyMetrics {
+    gchar *path;
+    GSocketService *service;
+    GPtrArray *sessions;
+    guint next_id;
+};
+
+typedef struct {
+    SpiceSession *session;
+    guint id;
+} MetricsSession;
+
+typedef struct {
+    SpiceChannel *channel;
+    gchar *labels;
+} MetricsChannel;
+
+typedef struct {
+    GSocketConnection *conn;
+    gchar request[REQUEST_SIZE];
+    gchar *response;
+    gsize length;
+    gsize written;
+} MetricsClient;
+
+typedef struct {
+    const gchar *name;
+    const gchar *type;
+    const gchar *help;
+    const gchar *property;
+} ChannelMetric;
+
+static const ChannelMetric channel_metrics[] = {
+    { "spice_channel_read_bytes_total", "counter",
+      "Bytes received on the channel", "total-read-bytes" },
+    { "spice_channel_write_bytes_total", "counter",
+      "Bytes sent on the channel", "total-write-bytes" },
+    { "spice_channel_read_messages_total", "counter",
+      "Messages received on the channel", "messages-read" },
+    { "spice_channel_write_messages_total", "counter",
+      "Messages sent on the channel", "messages-written" },
+    { "spice_channel_queue_bytes", "gauge",
+      "Bytes waiting in the channel output queue", "queue-size" },
+    { "spice_channel_reconnects_total", "counter",
+      "Connections opened by the channel after its first one", "reconnects" },
+};
+
+static void metrics_session_free(gpointer data)
+{
+    MetricsSession *s = data;
+
+    g_object_unref(s->session);
+    g_free(s);
+}
+
+static void metrics_channel_free(gpointer data)
+{
+    MetricsChannel *c = data;
+
+    g_object_unref(c->channel);
+    g_free(c->labels);
+    g_free(c);
+}
+
+/* reads a numeric property, 0 if the object doesn't have it */
+static guint64 get_uint64(gpointer object, const gchar *property)
+{
+    GParamSpec *pspec;
+    GValue value = G_VALUE_INIT;
+    GValue result = G_VALUE_INIT;
+    guint64 ret = 0;
+
+    pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(object), property);
+    if (pspec == NULL)
+        return 0;
+
+    g_value_init(&value, pspec->value_type);
+    g_value_init(&result, G_TYPE_UINT64);
+    g_object_get_property(object, property, &value);
+    if (g_value_transform(&value, &result))
+        ret = g_value_get_uint64(&result);
+    g_value_unset(&value);
+    g_value_unset(&result);
+
+    return ret;
+}
+
+static void append_header(GString *out, const gchar *name,
+                          const gchar *type, const gchar *help)
+{
+    g_string_append_printf(out, "# HELP %s %s.\n# TYPE %s %s\n",
+                           name, help, name, type);
+}
+
+static void append_double(GString *out, gdouble value)
+{
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    g_string_append(out, g_ascii_formatd(buf, sizeof(buf), "%g", value));
+}
+
+static GPtrArray *collect_channels(SpicyMetrics *metrics)
+{
+    GPtrArray *channels = g_ptr_array_new_with_free_func(metrics_channel_free);
+    guint i;
+
+    for (i = 0; i < metrics->sessions->len; i++) {
+        MetricsSession *s = g_ptr_array_index(metrics->sessions, i);
+        GList *list, *l;
+
+        list = spice_session_get_channels(s->session);
+        for (l = list; l != NULL; l = l->next) {
+            MetricsChannel *c = g_new0(MetricsChannel, 1);
+            gint type, id;
+
+            c->channel = g_object_ref(l->data);
+            g_object_get(c->channel, "channel-type", &type, "channel-id", &id, NULL);
+            c->labels = g_strdup_printf("session=\"%u\",channel=\"%s\",id=\"%d\"",
+                                        s->id, spice_channel_type_to_string(type), id);
+            g_ptr_array_add(channels, c);
+        }
+        g_list_free(list);
+    }
+
+    return channels;
+}
+
+static void append_queue_delay(GString *out, GPtrArray *channels)
+{
+    const gchar *name = "spice_usbredir_queue_delay_seconds";
+    guint i, b;
+
+    append_header(out, name, "histogram",
+                  "Time the device data spent in the channel output queue");
+    for (i = 0; i < channels->len; i++) {
+        MetricsChannel *c = g_ptr_array_index(channels, i);
+        GArray *hist = NULL;
+        guint64 count = 0;
+
+        if (!SPICE_IS_USBREDIR_CHANNEL(c->channel))
+            continue;
+
+        g_object_get(c->channel, "queue-delay-histogram", &hist, NULL);
+        if (hist == NULL)
+            continue;
+        for (b = 0; b < hist->len && b < QUEUE_DELAY_BUCKETS; b++) {
+            count += g_array_index(hist, guint64, b);
+            g_string_append_printf(out, "%s_bucket{%s,le=\"", name, c->labels);
+            if (b == QUEUE_DELAY_BUCKETS - 1)
+                g_string_append(out, "+Inf");
+            else
+                append_double(out, (125 << b) / 1e6);
+            g_string_append_printf(out, "\"} %" G_GUINT64_FORMAT "\n", count);
+        }
+        g_array_unref(hist);
+
+        g_string_append_printf(out, "%s_sum{%s} ", name, c->labels);
+        append_double(out, get_uint64(c->channel, "queue-delay-sum") / 1e6);
+        g_string_append_printf(out, "\n%s_count{%s} %" G_GUINT64_FORMAT "\n",
+                               name, c->labels, count);
+    }
+}
+
+static void append_lz4(GString *out, GPtrArray *channels)
+{
+    static const struct {
+        const gchar *name;
+        const gchar *help;
+    } counters[] = {
+        { "spice_usbredir_lz4_uncompressed_bytes_total",
+          "Size of the LZ4 compressed device data before compression" },
+        { "spice_usbredir_lz4_compressed_bytes_total",
+          "Size of the LZ4 compressed device data" },
+    };
+    /* both counters of a channel are read once, so that the ratio agrees
+     * with the totals of the same scrape */
+    guint64 *values = g_new0(guint64, 2 * channels->len);
+    guint i, j;
+
+    for (i = 0; i < channels->len; i++) {
+        MetricsChannel *c = g_ptr_array_index(channels, i);
+
+        if (!SPICE_IS_USBREDIR_CHANNEL(c->channel))
+            continue;
+        values[2 * i] = get_uint64(c->channel, "lz4-uncompressed-bytes");
+        values[2 * i + 1] = get_uint64(c->channel, "lz4-compressed-bytes");
+    }
+
+    for (j = 0; j < G_N_ELEMENTS(counters); j++) {
+        append_header(out, counters[j].name, "counter", counters[j].help);
+        for (i = 0; i < channels->len; i++) {
+            MetricsChannel *c = g_ptr_array_index(channels, i);
+
+            if (!SPICE_IS_USBREDIR_CHANNEL(c->channel))
+                continue;
+            g_string_append_printf(out, "%s{%s} %" G_GUINT64_FORMAT "\n",
+                                   counters[j].name, c->labels, values[2 * i + j]);
+        }
+    }
+
+    append_header(out, "spice_usbredir_lz4_ratio", "gauge",
+                  "Ratio of the LZ4 compressed device data size before and after compression");
+    for (i = 0; i < channels->len; i++) {
+        MetricsChannel *c = g_ptr_array_index(channels, i);
+
+        if (!SPICE_IS_USBREDIR_CHANNEL(c->channel) || values[2 * i + 1] == 0)
+            continue;
+        g_string_append_printf(out, "spice_usbredir_lz4_ratio{%s} ", c->labels);
+        append_double(out, (gdouble)values[2 * i] / values[2 * i + 1]);
+        g_string_append_c(out, '\n');
+    }
+    g_free(values);
+}
+
+/* spice_audio_get() would bring up an audio backend on the first scrape,
+ * only ask for it once the session has a channel that uses one */
+static gboolean session_has_audio(SpiceSession *session)
+{
+    GList *channels = spice_session_get_channels(session);
+    GList *l;
+    gboolean ret = FALSE;
+
+    for (l = channels; l != NULL && !ret; l = l->next)
+        ret = SPICE_IS_PLAYBACK_CHANNEL(l->data) || SPICE_IS_RECORD_CHANNEL(l->data);
+    g_list_free(channels);
+
+    return ret;
+}
+
+static void append_audio(GString *out, SpicyMetrics *metrics)
+{
+    guint i;
+
+    append_header(out, "spice_audio_underruns_total", "counter",
+                  "Times the audio playback ran out of data");
+    for (i = 0; i < metrics->sessions->len; i++) {
+        MetricsSession *s = g_ptr_array_index(metrics->sessions, i);
+        SpiceAudio *audio;
+
+        if (!session_has_audio(s->session))
+            continue;
+        audio = spice_audio_get(s->session, NULL);
+        if (audio == NULL)
+            continue;
+        g_string_append_printf(out, "spice_audio_underruns_total{session=\"%u\"} %"
+                               G_GUINT64_FORMAT "\n",
+                               s->id, get_uint64(audio, "underruns"));
+    }
+}
+
+/**
+ * spicy_metrics_format:
+ *
+ * Returns: the current values of the metrics, in the Prometheus text
+ * exposition format.
+ */
+gchar *spicy_metrics_format(SpicyMetrics *metrics)
+{
+    GString *out = g_string_new(NULL);
+    GPtrArray *channels;
+    guint i, j;
+
+    g_return_val_if_fail(metrics != NULL, NULL);
+
+    channels = collect_channels(metrics);
+    for (j = 0; j < G_N_ELEMENTS(channel_metrics); j++) {
+        const ChannelMetric *m = &channel_metrics[j];
+
+        append_header(out, m->name, m->type, m->help);
+        for (i = 0; i < channels->len; i++) {
+            MetricsChannel *c = g_ptr_array_index(channels, i);
+
+            g_string_append_printf(out, "%s{%s} %" G_GUINT64_FORMAT "\n",
+                                   m->name, c->labels,
+                                   get_uint64(c->channel, m->property));
+        }
+    }
+    append_queue_delay(out, channels);
+    append_lz4(out, channels);
+    append_audio(out, metrics);
+    g_ptr_array_unref(channels);
+
+    return g_string_free(out, FALSE);
+}
+
+static void metrics_client_free(MetricsClient *client)
+{
+    g_io_stream_close(G_IO_STREAM(client->conn), NULL, NULL);
+    g_object_unref(client->conn);
+    g_free(client->response);
+    g_free(client);
+}
+
+static void metrics_client_write(MetricsClient *client);
+
+static void metrics_client_written(GObject *source, GAsyncResult *res,
+                                   gpointer user_data)
+{
+    MetricsClient *client = user_data;
+    gssize ret;
+
+    ret = g_output_stream_write_finish(G_OUTPUT_STREAM(source), res, NULL);
+    if (ret <= 0) {
+        metrics_client_free(client);
+        return;
+    }
+
+    client->written += ret;
+    metrics_client_write(client);
+}
+
+static void metrics_client_write(MetricsClient *client)
+{
+    GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(client->conn));
+
+    if (client->written == client->length) {
+        metrics_client_free(client);
+        return;
+    }
+
+    g_output_stream_write_async(out, client->response + client->written,
+                                client->length - client->written,
+                                G_PRIORITY_DEFAULT, NULL,
+                                metrics_client_written, client);
+}
+
+static void metrics_client_read(GObject *source, GAsyncResult *res,
+                                gpointer user_data)
+{
+    MetricsClient *client = user_data;
+
+    /* answer whatever was asked */
+    g_input_stream_read_finish(G_INPUT_STREAM(source), res, NULL);
+    metrics_client_write(client);
+}
+
+static gboolean metrics_incoming(GSocketService *service,
+                                 GSocketConnection *conn,
+                                 GObject *source_object,
+                                 gpointer user_data)
+{
+    SpicyMetrics *metrics = user_data;
+    MetricsClient *client;
+    GInputStream *in;
+    gchar *body;
+
+    client = g_new0(MetricsClient, 1);
+    client->conn = g_object_ref(conn);
+
+    /* take the values now, the client may outlive @metrics */
+    body = spicy_metrics_format(metrics);
+    client->response = g_strdup_printf("HTTP/1.0 200 OK\r\n"
+                                       "Content-Type: text/plain; version=0.0.4\r\n"
+                                       "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+                                       "\r\n%s", strlen(body), body);
+    client->length = strlen(client->response);
+    g_free(body);
+
+    in = g_io_stream_get_input_stream(G_IO_STREAM(conn));
+    g_input_stream_read_async(in, client->request, sizeof(client->request),
+                              G_PRIORITY_DEFAULT, NULL,
+                              metrics_client_read, client);
+
+    return TRUE;
+}
+
+/**
+ * spicy_metrics_new:
+ * @path: the unix socket to listen on
+ * @error: a return location for #GError, or %NULL.
+ *
+ * Starts serving the metrics on @path. The socket is only accessible
+ * by the current user. A socket left at @path by a previous run is
+ * replaced.
+ *
+ * Returns: a new #SpicyMetrics, or %NULL on error
+ */
+SpicyMetrics *spicy_metrics_new(const gchar *path, GError **error)
+{
+    SpicyMetrics *metrics;
+    GSocketAddress *address;
+    GStatBuf st;
+    mode_t mask;
+    gboolean ok;
+
+    g_return_val_if_fail(path != NULL, NULL);
+
+    if (g_lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        g_unlink(path);
+
+    metrics = g_new0(SpicyMetrics, 1);
+    metrics->sessions = g_ptr_array_new_with_free_func(metrics_session_free);
+    metrics->service = g_socket_service_new();
+
+    /* bind() creates the socket with the umask applied, make it 0600
+     * from the start rather than chmod() it once it's reachable */
+    address = g_unix_socket_address_new(path);
+    mask = umask(S_IRWXG | S_IRWXO | S_IXUSR);
+    ok = g_socket_listener_add_address(G_SOCKET_LISTENER(metrics->service),
+                                       address, G_SOCKET_TYPE_STREAM,
+                                       G_SOCKET_PROTOCOL_DEFAULT,
+                                       NULL, NULL, error);
+    umask(mask);
+    g_object_unref(address);
+    if (!ok) {
+        spicy_metrics_free(metrics);
+        return NULL;
+    }
+    metrics->path = g_strdup(path);
+
+    g_signal_connect(metrics->service, "incoming",
+                     G_CALLBACK(metrics_incoming), metrics);
+    g_socket_service_start(metrics->service);
+
+    return metrics;
+}
+
+void spicy_metrics_free(SpicyMetrics *metrics)
+{
+    g_return_if_fail(metrics != NULL);
+
+    g_socket_service_stop(metrics->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(metrics->service));
+    g_object_unref(metrics->service);
+    if (metrics->path != NULL)
+        g_unlink(metrics->path);
+    g_free(metrics->path);
+    g_ptr_array_unref(metrics->sessions);
+    g_free(metrics);
+}
+
+void spicy_metrics_add_session(SpicyMetrics *metrics, SpiceSession *session)
+{
+    MetricsSession *s;
+
+    g_return_if_fail(metrics != NULL);
+    g_return_if_fail(SPICE_IS_SESSION(session));
+
+    s = g_new0(MetricsSession, 1);
+    s->session = g_object_ref(session);
+    s->id = metrics->next_id++;
+    g_ptr_array_add(metrics->sessions, s);
+}
+
+void spicy_metrics_remove_session(SpicyMetrics *metrics, SpiceSession *session)
+{
+    guint i;
+
+    g_return_if_fail(metrics != NULL);
+
+    for (i = 0; i < metrics->sessions->len; i++) {
+        MetricsSession *s = g_ptr_array_index(metrics->sessions, i);
+
+        if (s->session == session) {
+            g_ptr_array_remove_index(metrics->sessions, i);
+            return;
+        }
+    }
+}
@@ -0,0 +1,35 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SPICY_METRICS_H_
+# define SPICY_METRICS_H_
+
+#include "spice-client.h"
+
+G_BEGIN_DECLS
+
+typedef struct _SpicyMetrics SpicyMetrics;
+
+SpicyMetrics *spicy_metrics_new(const gchar *path, GError **error);
+void spicy_metrics_free(SpicyMetrics *metrics);
+void spicy_metrics_add_session(SpicyMetrics *metrics, SpiceSession *session);
+void spicy_metrics_remove_session(SpicyMetrics *metrics, SpiceSession *session);
+gchar *spicy_metrics_format(SpicyMetrics *metrics);
+
+G_END_DECLS
+
+#endif // SPICY_METRICS_H_
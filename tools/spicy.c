@@ -1,8 +1,12 @@
 #include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include "spice-client.h"
 #include "spice-common.h"
 #include "spice-cmdline.h"
+#include "spicy-metrics.h"
 
 
 typedef struct spice_connection spice_connection;
@@ -11,6 +15,10 @@ struct spice_connection {
     SpiceMainChannel *main;
     int              channels;
     int              disconnecting;
+    gint64           connect_time;
+    gboolean         usbredir_opened;
+    gboolean         usb_redirected;
+    SpiceUsbDeviceManager *usb_manager;
 };
 
 static spice_connection *connection_new(void);
@@ -19,14 +27,50 @@ static void connection_disconnect(spice_connection *conn);
 static void connection_destroy(spice_connection *conn);
 static GMainLoop     *mainloop = NULL;
 static int           connections = 0;
+static SpicyMetrics  *metrics = NULL;
+static gchar         *metrics_socket = NULL;
+static gchar         *sessions_file = NULL;
+static gboolean      startup_report = FALSE;
+static gint64        start_time;
+
+static GOptionEntry spicy_entries[] = {
+    { "metrics-socket", '\0', 0, G_OPTION_ARG_FILENAME, &metrics_socket,
+      "Serve Prometheus metrics on this unix socket", "<path>" },
+    { "sessions", '\0', 0, G_OPTION_ARG_FILENAME, &sessions_file,
+      "Run the sessions listed in this key file", "<file>" },
+    { "startup-report", '\0', 0, G_OPTION_ARG_NONE, &startup_report,
+      "Print the time and memory taken to bring the first channels up", NULL },
+    { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+/* time since spicy started and resident memory when @milestone is reached */
+static void startup_report_print(const gchar *milestone)
+{
+    gchar *statm = NULL;
+    gulong pages = 0;
+
+    if (!startup_report)
+        return;
+    if (g_file_get_contents("/proc/self/statm", &statm, NULL, NULL))
+        sscanf(statm, "%*lu %lu", &pages);
+    g_free(statm);
+    g_print("startup: %s after %" G_GINT64_FORMAT " ms, rss %lu KiB\n", milestone,
+            (g_get_monotonic_time() - start_time) / 1000,
+            pages * (gulong)sysconf(_SC_PAGESIZE) / 1024);
+}
 
 static void main_channel_event(SpiceChannel *channel, SpiceChannelEvent event,gpointer data)
 {
+    static gboolean reported = FALSE;
     const GError *error = NULL;
     spice_connection *conn = data;
     switch (event) {
     case SPICE_CHANNEL_OPENED:
         g_print("vanxum-usbredir:main channel: opened");
+        if (!reported) {
+            reported = TRUE;
+            startup_report_print("main channel opened");
+        }
         break;
     case SPICE_CHANNEL_SWITCHING:
         g_print("main channel: switching host");
@@ -58,6 +102,34 @@ static void main_channel_event(SpiceChannel *channel, SpiceChannelEvent event,gp
     }
 }
 
+static void usbredir_channel_event(SpiceChannel *channel, SpiceChannelEvent event,gpointer data)
+{
+    static gboolean reported = FALSE;
+    spice_connection *conn = data;
+    if (event != SPICE_CHANNEL_OPENED || conn->usbredir_opened)
+        return;
+    conn->usbredir_opened = true;
+    g_print("usbredir channel opened after %" G_GINT64_FORMAT " ms\n",
+            (g_get_monotonic_time() - conn->connect_time) / 1000);
+    if (!reported) {
+        reported = TRUE;
+        startup_report_print("usbredir channel opened");
+    }
+}
+
+/* devices are mostly redirected once their channel is up, by the
+ * auto-connect filter or on request */
+static void usb_device_connected(SpiceUsbDeviceManager *manager, SpiceUsbDevice *device,
+                                 gpointer data)
+{
+    spice_connection *conn = data;
+    if (conn->usb_redirected)
+        return;
+    conn->usb_redirected = true;
+    g_print("first USB device redirected after %" G_GINT64_FORMAT " ms\n",
+            (g_get_monotonic_time() - conn->connect_time) / 1000);
+}
+
 static void channel_new(SpiceSession *s, SpiceChannel *channel, gpointer data)
 {
     spice_connection *conn = data;
@@ -68,6 +140,15 @@ static void channel_new(SpiceSession *s, SpiceChannel *channel, gpointer data)
         conn->main = SPICE_MAIN_CHANNEL(channel);
         g_signal_connect(channel, "channel-event",G_CALLBACK(main_channel_event), conn);
     }
+    if (SPICE_IS_USBREDIR_CHANNEL(channel)) {
+        g_signal_connect(channel, "channel-event",G_CALLBACK(usbredir_channel_event), conn);
+        if (conn->usb_manager == NULL) {
+            conn->usb_manager = spice_usb_device_manager_get(conn->session, NULL);
+            if (conn->usb_manager != NULL)
+                g_signal_connect(conn->usb_manager, "device-connected",
+                                 G_CALLBACK(usb_device_connected), conn);
+        }
+    }
 }
 
 static void channel_destroy(SpiceSession *s, SpiceChannel *channel, gpointer data)
@@ -99,6 +180,9 @@ static spice_connection *connection_new(void)
 static void connection_connect(spice_connection *conn)
 {
     conn->disconnecting = false;
+    conn->connect_time = g_get_monotonic_time();
+    conn->usbredir_opened = false;
+    conn->usb_redirected = false;
     spice_session_connect(conn->session);
 }
 
@@ -112,6 +196,10 @@ static void connection_disconnect(spice_connection *conn)
 
 static void connection_destroy(spice_connection *conn)
 {
+    if (metrics)
+        spicy_metrics_remove_session(metrics, conn->session);
+    if (conn->usb_manager != NULL)
+        g_signal_handlers_disconnect_by_data(conn->usb_manager, conn);
     g_object_unref(conn->session);
     free(conn);
     connections--;
@@ -121,17 +209,127 @@ static void connection_destroy(spice_connection *conn)
     g_main_loop_quit(mainloop);
 }
 
+/* sets the property @name of @object from @key of @group */
+static gboolean set_property_from_key(GObject *object, const gchar *name,
+                                      GKeyFile *keyfile, const gchar *group,
+                                      const gchar *key, GError **error)
+{
+    GParamSpec *pspec;
+    GError *err = NULL;
+
+    pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(object), name);
+    if (pspec == NULL || !(pspec->flags & G_PARAM_WRITABLE)) {
+        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND,
+                    "[%s] unknown setting %s", group, key);
+        return FALSE;
+    }
+
+    switch (G_PARAM_SPEC_VALUE_TYPE(pspec)) {
+    case G_TYPE_STRING: {
+        gchar *value = g_key_file_get_string(keyfile, group, key, &err);
+        if (value)
+            g_object_set(object, name, value, NULL);
+        g_free(value);
+        break;
+    }
+    case G_TYPE_BOOLEAN: {
+        gboolean value = g_key_file_get_boolean(keyfile, group, key, &err);
+        if (!err)
+            g_object_set(object, name, value, NULL);
+        break;
+    }
+    case G_TYPE_INT:
+    case G_TYPE_UINT: {
+        gint value = g_key_file_get_integer(keyfile, group, key, &err);
+        if (!err)
+            g_object_set(object, name, value, NULL);
+        break;
+    }
+    default:
+        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                    "[%s] setting %s can't be set from a file", group, key);
+        return FALSE;
+    }
+
+    if (err) {
+        g_propagate_error(error, err);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * One group per session. The keys are #SpiceSession properties, those
+ * prefixed with "usb-" are #SpiceUsbDeviceManager properties of the
+ * session, so that each session redirects its own devices, e.g.:
+ *
+ *   [vm1]
+ *   uri=spice://host1:5900
+ *   usb-auto-connect-filter=-1,0x1234,-1,-1,1|-1,-1,-1,-1,0
+ *
+ * All the sessions share one libusb context and USB event thread.
+ */
+static gboolean sessions_setup(const gchar *filename, GError **error)
+{
+    GKeyFile *keyfile = g_key_file_new();
+    gchar **groups = NULL;
+    gboolean ret = FALSE;
+    guint i, j;
+
+    if (!g_key_file_load_from_file(keyfile, filename, G_KEY_FILE_NONE, error))
+        goto end;
+
+    groups = g_key_file_get_groups(keyfile, NULL);
+    for (i = 0; groups[i] != NULL; i++) {
+        spice_connection *conn = connection_new();
+        gchar **keys = g_key_file_get_keys(keyfile, groups[i], NULL, NULL);
+
+        gboolean ok = TRUE;
+
+        spice_cmdline_session_setup(conn->session);
+        for (j = 0; ok && keys != NULL && keys[j] != NULL; j++) {
+            GObject *object = G_OBJECT(conn->session);
+            const gchar *name = keys[j];
+
+            if (g_str_has_prefix(name, "usb-")) {
+                object = G_OBJECT(spice_usb_device_manager_get(conn->session, error));
+                if (object == NULL) {
+                    ok = FALSE;
+                    break;
+                }
+                name += strlen("usb-");
+            }
+            ok = set_property_from_key(object, name, keyfile, groups[i], keys[j], error);
+        }
+        g_strfreev(keys);
+        if (!ok)
+            goto end;
+
+        if (metrics)
+            spicy_metrics_add_session(metrics, conn->session);
+        connection_connect(conn);
+    }
+    ret = TRUE;
+
+end:
+    g_strfreev(groups);
+    g_key_file_free(keyfile);
+    return ret;
+}
+
 int main(int argc, char *argv[])
 {
 
     GError *error = NULL;
     GOptionContext *context;
     spice_connection *conn;
-	
+
+    start_time = g_get_monotonic_time();
     context = g_option_context_new("-VANXUM test application");
     g_option_context_set_summary(context, "VANXUM client to connect to Spice servers.");
     g_option_context_set_description(context, "Report bugs to VANXUM.");
     g_option_context_set_main_group(context, spice_cmdline_get_option_group());
+    g_option_context_add_main_entries(context, spicy_entries, NULL);
     if (!g_option_context_parse (context, &argc, &argv, &error)) {
         g_print("option parsing failed: %s\n", error->message);
         exit(1);
@@ -139,11 +337,29 @@ int main(int argc, char *argv[])
     g_option_context_free(context);
 	
     mainloop = g_main_loop_new(NULL, false);
-    conn = connection_new();
-    spice_cmdline_session_setup(conn->session);
-    connection_connect(conn);
+    if (metrics_socket) {
+        metrics = spicy_metrics_new(metrics_socket, &error);
+        if (!metrics) {
+            g_print("metrics socket failed: %s\n", error->message);
+            exit(1);
+        }
+    }
+    if (sessions_file) {
+        if (!sessions_setup(sessions_file, &error)) {
+            g_print("sessions setup failed: %s\n", error->message);
+            exit(1);
+        }
+    } else {
+        conn = connection_new();
+        spice_cmdline_session_setup(conn->session);
+        if (metrics)
+            spicy_metrics_add_session(metrics, conn->session);
+        connection_connect(conn);
+    }
+    startup_report_print("sessions set up");
     if (connections > 0)
         g_main_loop_run(mainloop);
+    g_clear_pointer(&metrics, spicy_metrics_free);
     g_main_loop_unref(mainloop); 
     return 0;
 }